@@ -0,0 +1,163 @@
+// Copyright 2019-2022 bito project contributors.
+// bito is free software under the GPLv3; see LICENSE file for details.
+//
+// Compare the block-packed Bitset against the std::vector<bool> backend it replaced,
+// on the operations that dominate SubsplitDAG construction and BitsetSizeMap lookups:
+// construction, bitwise ops, comparison, hashing, counting and clade extraction.
+//
+// Usage: bitset_benchmark [taxon_count ...]
+
+#include <random>
+
+#include "bitset.hpp"
+#include "stopwatch.hpp"
+
+// The previous Bitset backend, reduced to the operations being benchmarked.
+class VectorBoolBitset {
+ public:
+  explicit VectorBoolBitset(const std::string &str) : value_(str.size()) {
+    for (size_t i = 0; i < str.size(); i++) {
+      value_[i] = (str[i] == '1');
+    }
+  }
+  explicit VectorBoolBitset(std::vector<bool> value) : value_(std::move(value)) {}
+
+  VectorBoolBitset operator&(const VectorBoolBitset &other) const {
+    std::vector<bool> r(value_.size());
+    for (size_t i = 0; i < value_.size(); i++) {
+      r[i] = value_[i] && other.value_[i];
+    }
+    return VectorBoolBitset(std::move(r));
+  }
+  VectorBoolBitset operator|(const VectorBoolBitset &other) const {
+    std::vector<bool> r(value_.size());
+    for (size_t i = 0; i < value_.size(); i++) {
+      r[i] = value_[i] || other.value_[i];
+    }
+    return VectorBoolBitset(std::move(r));
+  }
+  static int Compare(const VectorBoolBitset &a, const VectorBoolBitset &b) {
+    for (size_t i = 0; i < a.value_.size(); i++) {
+      if (a.value_[i] != b.value_[i]) {
+        return static_cast<int>(a.value_[i]) - static_cast<int>(b.value_[i]);
+      }
+    }
+    return 0;
+  }
+  bool operator==(const VectorBoolBitset &other) const {
+    return value_ == other.value_;
+  }
+  size_t Hash() const { return std::hash<std::vector<bool>>{}(value_); }
+  size_t Count() const { return std::count(value_.begin(), value_.end(), true); }
+  VectorBoolBitset MultiCladeGetClade(size_t i, size_t clade_count) const {
+    using diff_t = std::vector<bool>::difference_type;
+    size_t clade_size = value_.size() / clade_count;
+    return VectorBoolBitset(std::vector<bool>(
+        value_.begin() + static_cast<diff_t>(i * clade_size),
+        value_.begin() + static_cast<diff_t>((i + 1) * clade_size)));
+  }
+
+ private:
+  std::vector<bool> value_;
+};
+
+// Run each operation over all pairs of a fixed set of bitsets, returning the
+// milliseconds taken per operation type. The checksum keeps the work from being
+// optimized away.
+template <typename TBitset>
+std::vector<double> TimeOperations(const StringVector &strings, size_t &checksum) {
+  std::vector<double> times;
+  Stopwatch timer(false, Stopwatch::TimeScale::MillisecondScale);
+  auto time = [&times, &timer](auto &&f) {
+    timer.Start();
+    f();
+    times.push_back(timer.Stop());
+  };
+  std::vector<TBitset> bitsets;
+  time([&]() {
+    for (const auto &str : strings) {
+      bitsets.emplace_back(str);
+    }
+  });
+  const size_t n = bitsets.size();
+  time([&]() {
+    for (size_t i = 0; i < n; i++) {
+      for (size_t j = 0; j < n; j++) {
+        checksum += (bitsets[i] & bitsets[j]).Count();
+      }
+    }
+  });
+  time([&]() {
+    for (size_t i = 0; i < n; i++) {
+      for (size_t j = 0; j < n; j++) {
+        checksum += (bitsets[i] | bitsets[j]).Count();
+      }
+    }
+  });
+  time([&]() {
+    for (size_t i = 0; i < n; i++) {
+      for (size_t j = 0; j < n; j++) {
+        checksum += static_cast<size_t>(TBitset::Compare(bitsets[i], bitsets[j]) + 1);
+        checksum += static_cast<size_t>(bitsets[i] == bitsets[j]);
+      }
+    }
+  });
+  time([&]() {
+    for (size_t rep = 0; rep < n; rep++) {
+      for (const auto &bitset : bitsets) {
+        checksum += bitset.Hash();
+      }
+    }
+  });
+  time([&]() {
+    for (size_t rep = 0; rep < n; rep++) {
+      for (const auto &bitset : bitsets) {
+        for (size_t clade = 0; clade < 3; clade++) {
+          checksum += bitset.MultiCladeGetClade(clade, 3).Count();
+        }
+      }
+    }
+  });
+  return times;
+}
+
+int main(int argc, char *argv[]) {
+  SizeVector taxon_counts = {64, 500, 1000, 2000};
+  if (argc > 1) {
+    taxon_counts.clear();
+    for (int arg_index = 1; arg_index < argc; arg_index++) {
+      taxon_counts.push_back(std::stoul(argv[arg_index]));
+    }
+  }
+  const size_t bitset_count = 300;
+  const StringVector operation_names = {"construct", "and",  "or",
+                                        "compare",   "hash", "get_clade"};
+  std::mt19937 generator(42);
+  std::bernoulli_distribution coin(0.5);
+
+  std::cout << "taxa\toperation\tvector_bool_ms\tpacked_ms\tspeedup" << std::endl;
+  for (const auto taxon_count : taxon_counts) {
+    // PCSP-sized bitsets: three clades of taxon_count bits.
+    StringVector strings;
+    for (size_t i = 0; i < bitset_count; i++) {
+      std::string str(3 * taxon_count, '0');
+      for (auto &c : str) {
+        c = coin(generator) ? '1' : '0';
+      }
+      strings.push_back(str);
+    }
+    size_t vector_bool_checksum = 0;
+    size_t packed_checksum = 0;
+    const auto vector_bool_times =
+        TimeOperations<VectorBoolBitset>(strings, vector_bool_checksum);
+    const auto packed_times = TimeOperations<Bitset>(strings, packed_checksum);
+    for (size_t op = 0; op < operation_names.size(); op++) {
+      std::cout << taxon_count << "\t" << operation_names[op] << "\t"
+                << vector_bool_times[op] << "\t" << packed_times[op] << "\t"
+                << vector_bool_times[op] / packed_times[op] << std::endl;
+    }
+    // Printed so that the work isn't optimized away.
+    std::cout << "# checksums: " << vector_bool_checksum << " " << packed_checksum
+              << std::endl;
+  }
+}
@@ -0,0 +1,98 @@
+// Copyright 2019-2022 bito project contributors.
+// bito is free software under the GPLv3; see LICENSE file for details.
+//
+// Measure how the pattern-chunked PLV kernels scale from 1 thread up to the given
+// number of threads, on random PLVs with many site patterns. For each thread count we
+// report microseconds per call of each kernel and the speedup of the whole set of
+// kernels over a single thread.
+//
+// Usage: pattern_chunks_benchmark [max_thread_count] [pattern_count] [repeat_count]
+
+#include <random>
+
+#include "mmapped_plv.hpp"
+#include "plv_kernels.hpp"
+#include "stopwatch.hpp"
+
+// Microseconds per call of f, cycling through the PLVs repeat_count times.
+template <typename TFunction>
+double MicrosecondsPerCall(size_t repeat_count, size_t plv_count, TFunction f) {
+  Stopwatch timer(false, Stopwatch::TimeScale::NanosecondScale);
+  timer.Start();
+  for (size_t rep = 0; rep < repeat_count; rep++) {
+    for (size_t plv_idx = 0; plv_idx + 2 < plv_count; plv_idx++) {
+      f(plv_idx);
+    }
+  }
+  return timer.Stop() / 1000. / static_cast<double>(repeat_count * (plv_count - 2));
+}
+
+int main(int argc, char *argv[]) {
+  const size_t max_thread_count =
+      (argc > 1) ? std::stoul(argv[1])
+                 : std::max(1u, std::thread::hardware_concurrency());
+  const size_t pattern_count = (argc > 2) ? std::stoul(argv[2]) : 50000;
+  const size_t repeat_count = (argc > 3) ? std::stoul(argv[3]) : 20;
+  // Enough PLVs that they don't all fit in cache.
+  const size_t plv_count = 16;
+
+  std::mt19937 generator(42);
+  std::uniform_real_distribution<double> distribution(0.1, 1.);
+  std::vector<NucleotidePLV> plvs(plv_count, NucleotidePLV(4, pattern_count));
+  for (auto &plv : plvs) {
+    for (Eigen::Index i = 0; i < plv.size(); i++) {
+      plv.data()[i] = distribution(generator);
+    }
+  }
+  std::vector<NucleotidePLV> dests(plv_count, NucleotidePLV::Zero(4, pattern_count));
+  Eigen::Matrix4d matrix;
+  for (Eigen::Index i = 0; i < matrix.size(); i++) {
+    matrix.data()[i] = distribution(generator);
+  }
+  const EigenVectorXd weights = EigenVectorXd::Ones(pattern_count);
+  EigenVectorXd likelihoods(pattern_count);
+  // Accumulated into so that the work isn't optimized away.
+  double checksum = 0.;
+
+  std::cout << "patterns: " << pattern_count << " (" << PLVKernels::pattern_chunk_size
+            << " per chunk)" << std::endl;
+  std::cout << "threads\tincrement_us\tmultiply_us\tlikelihood_us\tweighted_sum_us"
+               "\tspeedup"
+            << std::endl;
+  auto time = [repeat_count, plv_count](auto f) {
+    return MicrosecondsPerCall(repeat_count, plv_count, f);
+  };
+  double single_thread_total = 0.;
+  for (size_t thread_count = 1; thread_count <= max_thread_count; thread_count *= 2) {
+    ThreadPool *thread_pool =
+        (thread_count == 1) ? nullptr : &ThreadPool::Shared(thread_count);
+    const double increment = time([&](size_t i) {
+      PLVKernels::IncrementWithWeightedEvolved(thread_pool, dests[i].data(),
+                                               matrix.data(), plvs[i + 1].data(), 0.5,
+                                               pattern_count);
+    });
+    const double multiply = time([&](size_t i) {
+      const auto extrema = PLVKernels::Multiply(thread_pool, dests[i].data(),
+                                                plvs[i + 1].data(), plvs[i + 2].data(),
+                                                pattern_count);
+      checksum += extrema.min_ + extrema.max_;
+    });
+    const double likelihood = time([&](size_t i) {
+      PLVKernels::PerPatternLikelihoods(thread_pool, likelihoods.data(), plvs[i].data(),
+                                        matrix.data(), plvs[i + 1].data(),
+                                        pattern_count);
+    });
+    const double weighted_sum = time([&](size_t) {
+      checksum += PLVKernels::WeightedSum(thread_pool, likelihoods.data(),
+                                          weights.data(), pattern_count);
+    });
+    const double total = increment + multiply + likelihood + weighted_sum;
+    if (thread_count == 1) {
+      single_thread_total = total;
+    }
+    std::cout << thread_count << "\t" << increment << "\t" << multiply << "\t"
+              << likelihood << "\t" << weighted_sum << "\t"
+              << single_thread_total / total << std::endl;
+  }
+  std::cout << "# checksum: " << checksum << std::endl;
+}
@@ -0,0 +1,117 @@
+// Copyright 2019-2022 bito project contributors.
+// bito is free software under the GPLv3; see LICENSE file for details.
+//
+// Report GFLOP/s for each PLV kernel at each available ISA level, along with the
+// Eigen expressions that GPEngine used before the kernels, on PLVs with as many
+// patterns as DS1.
+//
+// Run from a directory containing `data`.
+// Usage: plv_kernels_benchmark [repeat_count]
+
+#include <random>
+
+#include "driver.hpp"
+#include "mmapped_plv.hpp"
+#include "plv_kernels.hpp"
+#include "site_pattern.hpp"
+#include "stopwatch.hpp"
+
+// Floating point operations per pattern, counting fused multiply-adds as two.
+constexpr double increment_flops = 4. * 7. + 4.;  // Evolve, then weight and add.
+constexpr double multiply_flops = 4.;
+constexpr double likelihood_flops = 4. * 7. + 4. + 3.;  // Evolve, then dot product.
+
+// Run f repeat_count times on each of the PLVs in turn, returning GFLOP/s.
+template <typename TFunction>
+double GigaflopsPerSecond(size_t repeat_count, size_t plv_count, size_t pattern_count,
+                          double flops_per_pattern, TFunction f) {
+  Stopwatch timer(false, Stopwatch::TimeScale::NanosecondScale);
+  timer.Start();
+  for (size_t rep = 0; rep < repeat_count; rep++) {
+    for (size_t plv_idx = 0; plv_idx + 2 < plv_count; plv_idx++) {
+      f(plv_idx);
+    }
+  }
+  const double nanoseconds = timer.Stop();
+  return flops_per_pattern * static_cast<double>(pattern_count) *
+         static_cast<double>(repeat_count * (plv_count - 2)) / nanoseconds;
+}
+
+int main(int argc, char *argv[]) {
+  const size_t repeat_count = (argc > 1) ? std::stoul(argv[1]) : 2000;
+  // Enough PLVs to cycle through that we aren't just measuring L1 cache.
+  const size_t plv_count = 64;
+
+  Driver driver;
+  auto tree_collection = driver.ParseNewickFile("data/DS1.100_topologies.nwk");
+  SitePattern site_pattern(Alignment::ReadFasta("data/DS1.fasta"),
+                           tree_collection.TagTaxonMap());
+  const size_t pattern_count = site_pattern.PatternCount();
+
+  std::mt19937 generator(42);
+  std::uniform_real_distribution<double> distribution(0.1, 1.);
+  std::vector<NucleotidePLV> plvs(plv_count, NucleotidePLV(4, pattern_count));
+  for (auto &plv : plvs) {
+    for (Eigen::Index i = 0; i < plv.size(); i++) {
+      plv.data()[i] = distribution(generator);
+    }
+  }
+  // Results go to separate PLVs so that the inputs don't drift to zero or infinity.
+  std::vector<NucleotidePLV> dests(plv_count, NucleotidePLV::Zero(4, pattern_count));
+  Eigen::Matrix4d matrix;
+  for (Eigen::Index i = 0; i < matrix.size(); i++) {
+    matrix.data()[i] = distribution(generator);
+  }
+  EigenVectorXd likelihoods(pattern_count);
+  // Accumulated into so that the work isn't optimized away.
+  double checksum = 0.;
+
+  std::cout << "patterns: " << pattern_count << std::endl;
+  std::cout << "isa\tincrement_gflops\tmultiply_gflops\tlikelihood_gflops" << std::endl;
+  {
+    const double increment = GigaflopsPerSecond(
+        repeat_count, plv_count, pattern_count, increment_flops, [&](size_t i) {
+          dests[i] += 0.5 * matrix * plvs[i + 1];
+        });
+    const double multiply = GigaflopsPerSecond(
+        repeat_count, plv_count, pattern_count, multiply_flops, [&](size_t i) {
+          dests[i].array() = plvs[i + 1].array() * plvs[i + 2].array();
+          checksum += dests[i].minCoeff() + dests[i].maxCoeff();
+        });
+    const double likelihood = GigaflopsPerSecond(
+        repeat_count, plv_count, pattern_count, likelihood_flops, [&](size_t i) {
+          likelihoods = (plvs[i].transpose() * matrix * plvs[i + 1]).diagonal();
+          checksum += likelihoods[0];
+        });
+    std::cout << "eigen\t" << increment << "\t" << multiply << "\t" << likelihood
+              << std::endl;
+  }
+  for (const auto isa : PLVKernels::AvailableIsas()) {
+    PLVKernels::SetIsa(isa);
+    const double increment = GigaflopsPerSecond(
+        repeat_count, plv_count, pattern_count, increment_flops, [&](size_t i) {
+          PLVKernels::IncrementWithWeightedEvolved(dests[i].data(), matrix.data(),
+                                                   plvs[i + 1].data(), 0.5,
+                                                   pattern_count);
+        });
+    const double multiply = GigaflopsPerSecond(
+        repeat_count, plv_count, pattern_count, multiply_flops, [&](size_t i) {
+          const auto extrema = PLVKernels::Multiply(dests[i].data(), plvs[i + 1].data(),
+                                                    plvs[i + 2].data(), pattern_count);
+          checksum += extrema.min_ + extrema.max_;
+        });
+    const double likelihood = GigaflopsPerSecond(
+        repeat_count, plv_count, pattern_count, likelihood_flops, [&](size_t i) {
+          PLVKernels::PerPatternLikelihoods(likelihoods.data(), plvs[i].data(),
+                                            matrix.data(), plvs[i + 1].data(),
+                                            pattern_count);
+          checksum += likelihoods[0];
+        });
+    std::cout << PLVKernels::IsaName(isa) << "\t" << increment << "\t" << multiply
+              << "\t" << likelihood << std::endl;
+  }
+  for (const auto &dest : dests) {
+    checksum += dest.sum();
+  }
+  std::cout << "# checksum: " << checksum << std::endl;
+}
@@ -0,0 +1,113 @@
+// Copyright 2019-2022 bito project contributors.
+// bito is free software under the GPLv3; see LICENSE file for details.
+//
+// Report how much storing PLVs as floats changes GP results. For each of a few of
+// the bundled data sets, we compute the log marginal likelihood at fixed branch
+// lengths, optimize branch lengths, then compute it again. The results are written to
+// _ignore/plv_precision_<double|float>.csv depending on PLVScalar.
+//
+// To compare, build and run this once as usual, then again after configuring with
+// -DPLV_SINGLE_PRECISION=ON. The float run reads the double CSV if it exists and
+// prints the largest absolute and relative differences for each data set.
+//
+// Run from a directory containing `data`.
+// Usage: plv_precision_report [max_iter]
+
+#include <filesystem>
+
+#include "csv.hpp"
+#include "gp_instance.hpp"
+
+struct DataSet {
+  std::string name_;
+  std::string fasta_path_;
+  std::string newick_path_;
+};
+
+// Append the results for data_set to results, with keys of the form
+// "<data set>/<quantity>".
+void RunDataSet(const DataSet &data_set, const size_t max_iter,
+                StringDoubleVector &results) {
+  GPInstance inst("_ignore/plv_precision.data");
+  inst.ReadFastaFile(data_set.fasta_path_);
+  inst.ReadNewickFile(data_set.newick_path_);
+  inst.MakeDAG();
+  inst.MakeGPEngine();
+  inst.GetGPEngine().SetBranchLengthsToConstant(0.1);
+  inst.PopulatePLVs();
+  inst.ComputeMarginalLikelihood();
+  results.push_back({data_set.name_ + "/initial_log_marginal",
+                     inst.GetGPEngine().GetLogMarginalLikelihood()});
+  inst.EstimateBranchLengths(1e-6, max_iter, true);
+  inst.PopulatePLVs();
+  inst.ComputeMarginalLikelihood();
+  results.push_back({data_set.name_ + "/optimized_log_marginal",
+                     inst.GetGPEngine().GetLogMarginalLikelihood()});
+  const EigenVectorXd branch_lengths = inst.GetBranchLengths();
+  for (Eigen::Index i = 0; i < branch_lengths.size(); i++) {
+    results.push_back(
+        {data_set.name_ + "/branch_length_" + std::to_string(i), branch_lengths(i)});
+  }
+}
+
+// The data set part of a "<data set>/<quantity>" key.
+std::string DataSetOfKey(const std::string &key) { return key.substr(0, key.find('/')); }
+
+void CompareWithReference(const StringDoubleVector &results,
+                          const std::string &reference_path) {
+  const auto reference = CSV::StringDoubleMapOfCSV(reference_path);
+  // Maximum absolute and relative differences for each data set.
+  std::map<std::string, std::pair<double, double>> differences;
+  for (const auto &[key, value] : results) {
+    const auto search = reference.find(key);
+    if (search == reference.end()) {
+      std::cout << "No reference value for " << key << std::endl;
+      continue;
+    }
+    const double absolute = fabs(value - search->second);
+    const double relative =
+        (search->second == 0.) ? absolute : absolute / fabs(search->second);
+    auto &[max_absolute, max_relative] = differences[DataSetOfKey(key)];
+    max_absolute = std::max(max_absolute, absolute);
+    max_relative = std::max(max_relative, relative);
+  }
+  std::cout << "data set\tmax abs diff\tmax rel diff" << std::endl;
+  for (const auto &[name, difference] : differences) {
+    std::cout << name << "\t" << difference.first << "\t" << difference.second
+              << std::endl;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  const size_t max_iter = (argc > 1) ? std::stoul(argv[1]) : 10;
+  const std::vector<DataSet> data_sets = {
+      {"hello", "data/hello.fasta", "data/hello_rooted.nwk"},
+      {"five_taxon", "data/five_taxon.fasta", "data/five_taxon_rooted.nwk"},
+      {"ds1_reduced_5", "data/ds1-reduced-5.fasta", "data/ds1-reduced-5.nwk"},
+      {"fluA", "data/fluA.fa", "data/fluA.tree"},
+      {"seven_taxon", "data/7-taxon-slice-of-ds1.fasta",
+       "data/simplest-hybrid-marginal-all-trees.nwk"},
+  };
+  const bool is_single_precision = std::is_same_v<PLVScalar, float>;
+  std::cout << "PLVs stored as " << (is_single_precision ? "float" : "double")
+            << std::endl;
+
+  StringDoubleVector results;
+  for (const auto &data_set : data_sets) {
+    RunDataSet(data_set, max_iter, results);
+  }
+  const std::string double_path = "_ignore/plv_precision_double.csv";
+  const std::string out_path =
+      is_single_precision ? "_ignore/plv_precision_float.csv" : double_path;
+  CSV::StringDoubleVectorToCSV(results, out_path);
+  std::cout << "Wrote " << out_path << std::endl;
+
+  if (is_single_precision) {
+    if (std::filesystem::exists(double_path)) {
+      CompareWithReference(results, double_path);
+    } else {
+      std::cout << "Run a double precision build first to compare against "
+                << double_path << "." << std::endl;
+    }
+  }
+}
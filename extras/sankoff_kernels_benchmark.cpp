@@ -0,0 +1,142 @@
+// Copyright 2019-2022 bito project contributors.
+// bito is free software under the GPLv3; see LICENSE file for details.
+//
+// Report nanoseconds per pattern for the leafward Sankoff step, Q = E(P_left +
+// P_right) + E(Q_parent), on PSVs with as many patterns as DS1. We time it a pattern at
+// a time through SankoffHandler::ParentPartial, as the handlers used to, and with the
+// Sankoff kernels for unit and general costs at each available ISA level. For
+// comparison, we also time the Fitch kernel, which is for unit costs only, at each ISA
+// level, and the corresponding likelihood kernel.
+//
+// Run from a directory containing `data`.
+// Usage: sankoff_kernels_benchmark [repeat_count]
+
+#include <random>
+
+#include "driver.hpp"
+#include "fitch_kernels.hpp"
+#include "plv_kernels.hpp"
+#include "sankoff_handler.hpp"
+#include "sankoff_kernels.hpp"
+#include "stopwatch.hpp"
+
+// Run f repeat_count times on each of the PSVs in turn, returning nanoseconds per
+// pattern.
+template <typename TFunction>
+double NanosecondsPerPattern(size_t repeat_count, size_t psv_count,
+                             size_t pattern_count, TFunction f) {
+  Stopwatch timer(false, Stopwatch::TimeScale::NanosecondScale);
+  timer.Start();
+  for (size_t rep = 0; rep < repeat_count; rep++) {
+    for (size_t psv_idx = 0; psv_idx + 2 < psv_count; psv_idx++) {
+      f(psv_idx);
+    }
+  }
+  const double nanoseconds = timer.Stop();
+  return nanoseconds /
+         (static_cast<double>(pattern_count) *
+          static_cast<double>(repeat_count * (psv_count - 2)));
+}
+
+int main(int argc, char *argv[]) {
+  const size_t repeat_count = (argc > 1) ? std::stoul(argv[1]) : 500;
+  // Enough PSVs to cycle through that we aren't just measuring L1 cache.
+  const size_t psv_count = 64;
+
+  Driver driver;
+  auto tree_collection = driver.ParseNewickFile("data/DS1.100_topologies.nwk");
+  SitePattern site_pattern(Alignment::ReadFasta("data/DS1.fasta"),
+                           tree_collection.TagTaxonMap());
+  const size_t pattern_count = site_pattern.PatternCount();
+
+  std::mt19937 generator(42);
+  std::uniform_int_distribution<int> distribution(0, 20);
+  std::vector<SankoffPartial> psvs(psv_count, SankoffPartial(4, pattern_count));
+  for (auto &psv : psvs) {
+    for (Eigen::Index i = 0; i < psv.size(); i++) {
+      psv.data()[i] = static_cast<double>(distribution(generator));
+    }
+  }
+  std::vector<SankoffPartial> dests(psv_count, SankoffPartial::Zero(4, pattern_count));
+  CostMatrix costs;
+  costs << 0., 2.5, 1., 2.5, 2.5, 0., 2.5, 1., 1., 2.5, 0., 2.5, 2.5, 1., 2.5, 0.;
+  const SankoffMatrix unit_costs;
+  // Accumulated into so that the work isn't optimized away.
+  double checksum = 0.;
+
+  std::cout << "patterns: " << pattern_count << std::endl;
+  std::cout << "method\tunit_cost_ns\tgeneral_cost_ns" << std::endl;
+  {
+    auto time_parent_partial = [&](const SankoffMatrix &sankoff_matrix) {
+      SankoffHandler handler(sankoff_matrix, site_pattern,
+                             "_ignore/sankoff_kernels_benchmark.data");
+      return NanosecondsPerPattern(
+          repeat_count, psv_count, pattern_count, [&](size_t i) {
+            for (size_t pattern = 0; pattern < pattern_count; pattern++) {
+              const EigenVectorXd child =
+                  psvs[i].col(pattern) + psvs[i + 1].col(pattern);
+              dests[i].col(pattern) = handler.ParentPartial(child) +
+                                      handler.ParentPartial(psvs[i + 2].col(pattern));
+            }
+          });
+    };
+    std::cout << "parent_partial\t" << time_parent_partial(unit_costs) << "\t"
+              << time_parent_partial(SankoffMatrix(costs)) << std::endl;
+  }
+  for (const auto isa : PLVKernels::AvailableIsas()) {
+    PLVKernels::SetIsa(isa);
+    auto time_kernel = [&](const CostMatrix &cost_matrix) {
+      return NanosecondsPerPattern(
+          repeat_count, psv_count, pattern_count, [&](size_t i) {
+            SankoffKernels::EvolveSum(dests[i].data(), cost_matrix.data(),
+                                      psvs[i].data(), psvs[i + 1].data(),
+                                      psvs[i + 2].data(), pattern_count);
+          });
+    };
+    std::cout << PLVKernels::IsaName(isa) << "\t"
+              << time_kernel(unit_costs.GetMatrix()) << "\t" << time_kernel(costs)
+              << std::endl;
+  }
+  {
+    const FitchKernels fitch(site_pattern.GetWeights());
+    const size_t fitch_size = FitchKernels::state_count_ * fitch.ColumnCount();
+    std::vector<std::vector<uint64_t>> fitch_pvs(psv_count,
+                                                 std::vector<uint64_t>(fitch_size));
+    const auto &tip_states = site_pattern.GetTipStates();
+    for (size_t psv_idx = 0; psv_idx < psv_count; psv_idx++) {
+      fitch.SetTip(fitch_pvs[psv_idx].data(),
+                   tip_states.Codes(psv_idx % site_pattern.TaxonCount()));
+    }
+    std::vector<std::vector<uint64_t>> fitch_dests = fitch_pvs;
+    for (const auto isa : PLVKernels::AvailableIsas()) {
+      PLVKernels::SetIsa(isa);
+      const double fitch_ns = NanosecondsPerPattern(
+          repeat_count, psv_count, pattern_count, [&](size_t i) {
+            fitch.CombineSum(fitch_dests[i].data(), fitch_pvs[i].data(),
+                             fitch_pvs[i + 1].data(), fitch_pvs[i + 2].data());
+          });
+      for (const auto &fitch_dest : fitch_dests) {
+        checksum += fitch.WeightedCost(fitch_dest.data());
+      }
+      std::cout << "fitch_" << PLVKernels::IsaName(isa) << "\t" << fitch_ns << "\tNA"
+                << std::endl;
+    }
+  }
+  {
+    // The likelihood counterpart of the Sankoff step evolves two PLVs.
+    const double likelihood = NanosecondsPerPattern(
+        repeat_count, psv_count, pattern_count, [&](size_t i) {
+          for (const size_t src_idx : {i + 1, i + 2}) {
+            PLVKernels::IncrementWithWeightedEvolved(dests[i].data(), costs.data(),
+                                                     psvs[src_idx].data(), 0.5,
+                                                     pattern_count);
+          }
+        });
+    std::cout << "likelihood_" << PLVKernels::IsaName(PLVKernels::GetIsa()) << "\t"
+              << likelihood << "\t" << likelihood << std::endl;
+  }
+  for (const auto &dest : dests) {
+    checksum += dest.sum();
+  }
+  std::cout << "# checksum: " << checksum << std::endl;
+}
@@ -0,0 +1,65 @@
+// Copyright 2019-2022 bito project contributors.
+// bito is free software under the GPLv3; see LICENSE file for details.
+//
+// Time the VIMCO topology gradient for K trees sampled from an SBN trained on DS1,
+// comparing the sum of GradientOfLogQ over the trees (the previous TopologyGradients)
+// against SBNGradientEngine on one and on thread_count threads. The indexer
+// representations are made once up front, so that we only time the gradients.
+//
+// Run from a directory containing `data`.
+// Usage: sbn_gradient_benchmark [K] [repeat_count] [thread_count]
+
+#include "stopwatch.hpp"
+#include "unrooted_sbn_instance.hpp"
+
+int main(int argc, char *argv[]) {
+  const size_t tree_count = (argc > 1) ? std::stoul(argv[1]) : 100;
+  const size_t repeat_count = (argc > 2) ? std::stoul(argv[2]) : 100;
+  const size_t thread_count = (argc > 3) ? std::stoul(argv[3]) : 4;
+
+  UnrootedSBNInstance inst("gradient_benchmark");
+  inst.ReadNewickFile("data/DS1.100_topologies.nwk");
+  inst.ProcessLoadedTrees();
+  inst.TrainExpectationMaximization(0.5, 10);
+  inst.SampleTrees(tree_count);
+  const auto indexer_representations = inst.MakeIndexerRepresentations();
+  EigenVectorXd log_f(tree_count);
+  for (size_t tree_idx = 0; tree_idx < tree_count; tree_idx++) {
+    log_f[tree_idx] = -7000. - static_cast<double>(tree_idx % 13);
+  }
+  std::cout << "# " << inst.SBNSupport().GPCSPCount() << " GPCSPs, K = " << tree_count
+            << std::endl;
+
+  auto milliseconds_per_gradient = [repeat_count](auto f) {
+    Stopwatch timer(false, Stopwatch::TimeScale::MillisecondScale);
+    timer.Start();
+    double checksum = 0.;
+    for (size_t repeat = 0; repeat < repeat_count; repeat++) {
+      checksum += f().sum();
+    }
+    const double milliseconds = timer.Stop() / static_cast<double>(repeat_count);
+    std::cout << milliseconds << "\t" << checksum / repeat_count << std::endl;
+  };
+
+  std::cout << "path\tms_per_gradient\tchecksum" << std::endl;
+  std::cout << "per_tree\t";
+  milliseconds_per_gradient([&]() {
+    const EigenVectorXd multiplicative_factors =
+        inst.CalculateVIMCOMultiplicativeFactors(log_f);
+    EigenVectorXd normalized_sbn_parameters_in_log =
+        EigenVectorXd::Constant(inst.sbn_parameters_.size(), DOUBLE_NAN);
+    EigenVectorXd gradient = EigenVectorXd::Zero(inst.sbn_parameters_.size());
+    for (size_t tree_idx = 0; tree_idx < tree_count; tree_idx++) {
+      gradient += multiplicative_factors[tree_idx] *
+                  inst.GradientOfLogQ(normalized_sbn_parameters_in_log,
+                                      indexer_representations[tree_idx]);
+    }
+    return gradient;
+  });
+  for (const size_t threads : {size_t(1), thread_count}) {
+    std::cout << "engine_" << threads << "\t";
+    milliseconds_per_gradient([&]() {
+      return inst.TopologyGradients(indexer_representations, log_f, true, threads);
+    });
+  }
+}
@@ -0,0 +1,85 @@
+// Copyright 2019-2022 bito project contributors.
+// bito is free software under the GPLv3; see LICENSE file for details.
+//
+// Report topologies sampled per second from an SBN trained on DS1, comparing the
+// existing path, which builds a Node tree per sample (and then its rooted indexer
+// representation, when that is what we need), against the alias-table SBNSampler on
+// one and on thread_count threads. We also time building the alias tables, and getting
+// the unrooted indexer representations of the samples (all of their rootings), either
+// from a Node tree per sample or derived from the sampled rows.
+//
+// Run from a directory containing `data`.
+// Usage: sbn_sampler_benchmark [sample_count] [thread_count]
+
+#include "stopwatch.hpp"
+#include "unrooted_sbn_instance.hpp"
+
+// Samples per second of f, which draws sample_count samples.
+template <typename TFunction>
+double SamplesPerSecond(size_t sample_count, TFunction f) {
+  Stopwatch timer(false, Stopwatch::TimeScale::SecondScale);
+  timer.Start();
+  f();
+  return static_cast<double>(sample_count) / timer.Stop();
+}
+
+int main(int argc, char *argv[]) {
+  const size_t sample_count = (argc > 1) ? std::stoul(argv[1]) : 100'000;
+  const size_t thread_count = (argc > 2) ? std::stoul(argv[2]) : 4;
+
+  UnrootedSBNInstance inst("sampler_benchmark");
+  inst.ReadNewickFile("data/DS1.100_topologies.nwk");
+  inst.ProcessLoadedTrees();
+  inst.TrainExpectationMaximization(0.5, 10);
+  size_t checksum = 0;
+
+  std::cout << "path\tsamples_per_second" << std::endl;
+  std::cout << "node\t" << SamplesPerSecond(sample_count, [&]() {
+    for (size_t i = 0; i < sample_count; i++) {
+      checksum += inst.SampleTopology()->Id();
+    }
+  }) << std::endl;
+  std::cout << "node_representation\t" << SamplesPerSecond(sample_count, [&]() {
+    for (size_t i = 0; i < sample_count; i++) {
+      checksum += RootedSBNMaps::IndexerRepresentationOf(
+                      inst.SBNSupport().Indexer(), inst.SampleTopology(true),
+                      inst.SBNSupport().GPCSPCount())
+                      .front();
+    }
+  }) << std::endl;
+  std::cout << "node_unrooted_representation\t"
+            << SamplesPerSecond(sample_count, [&]() {
+                 for (size_t i = 0; i < sample_count; i++) {
+                   checksum += inst.SBNSupport()
+                                   .IndexerRepresentationOf(inst.SampleTopology())
+                                   .front()
+                                   .front();
+                 }
+               })
+            << std::endl;
+
+  Stopwatch build_timer(false, Stopwatch::TimeScale::MillisecondScale);
+  build_timer.Start();
+  const SBNSampler &sampler = inst.GetSBNSampler();
+  std::cout << "# alias tables built in " << build_timer.Stop() << " ms" << std::endl;
+  SizeVector representations(sample_count * sampler.RepresentationLength());
+  for (const size_t threads : {size_t(1), thread_count}) {
+    std::cout << "alias_" << threads << "\t" << SamplesPerSecond(sample_count, [&]() {
+      inst.SampleRootedIndexerRepresentations(representations.data(), sample_count,
+                                              threads);
+    }) << std::endl;
+    checksum += representations.back();
+  }
+  for (const size_t threads : {size_t(1), thread_count}) {
+    std::cout << "alias_unrooted_" << threads << "\t"
+              << SamplesPerSecond(sample_count, [&]() {
+                   const auto unrooted_representations =
+                       inst.UnrootedIndexerRepresentationsOf(
+                           inst.SampleIndexerRepresentations(sample_count, threads),
+                           threads);
+                   checksum += unrooted_representations.back().back().back();
+                 })
+              << std::endl;
+  }
+  std::cout << "# checksum: " << checksum << std::endl;
+}
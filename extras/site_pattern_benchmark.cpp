@@ -0,0 +1,106 @@
+// Copyright 2019-2022 bito project contributors.
+// bito is free software under the GPLv3; see LICENSE file for details.
+//
+// Compare compressing a large FASTA file into site patterns by way of an Alignment
+// with compressing it straight from a FastaFile, from 1 thread up to the given number
+// of threads. The columns of the alignment are drawn from a pool of random columns, so
+// that there are repeated site patterns to find. We report seconds to read and
+// compress the file and the speedup over going through an Alignment on one thread.
+//
+// Usage: site_pattern_benchmark [max_thread_count] [taxon_count] [site_count]
+
+#include <fstream>
+#include <optional>
+#include <random>
+
+#include "site_pattern.hpp"
+#include "stopwatch.hpp"
+
+// The patterns and their weights, sorted, as the two ways of compressing give the
+// patterns in different orders.
+std::vector<std::pair<SymbolVector, double>> SortedPatterns(
+    const SitePattern &site_pattern) {
+  std::vector<std::pair<SymbolVector, double>> patterns;
+  for (size_t pattern_idx = 0; pattern_idx < site_pattern.PatternCount();
+       pattern_idx++) {
+    SymbolVector pattern;
+    for (size_t taxon_idx = 0; taxon_idx < site_pattern.TaxonCount(); taxon_idx++) {
+      pattern.push_back(site_pattern.GetPatternSymbol(taxon_idx, pattern_idx));
+    }
+    patterns.emplace_back(pattern, site_pattern.GetWeights()[pattern_idx]);
+  }
+  std::sort(patterns.begin(), patterns.end());
+  return patterns;
+}
+
+int main(int argc, char *argv[]) {
+  const size_t max_thread_count =
+      (argc > 1) ? std::stoul(argv[1])
+                 : std::max(1u, std::thread::hardware_concurrency());
+  const size_t taxon_count = (argc > 2) ? std::stoul(argv[2]) : 200;
+  const size_t site_count = (argc > 3) ? std::stoul(argv[3]) : 200000;
+  const size_t distinct_column_count = site_count / 4;
+  const std::string fasta_path = "_ignore/site_pattern_benchmark.fasta";
+
+  TagStringMap tag_taxon_map;
+  {
+    std::mt19937 generator(42);
+    const std::string nucleotides = "ACGT-";
+    std::uniform_int_distribution<size_t> nucleotide_distribution(0, 4);
+    std::vector<std::string> columns(distinct_column_count);
+    for (auto &column : columns) {
+      for (size_t taxon_idx = 0; taxon_idx < taxon_count; taxon_idx++) {
+        column.push_back(nucleotides[nucleotide_distribution(generator)]);
+      }
+    }
+    std::uniform_int_distribution<size_t> column_distribution(
+        0, distinct_column_count - 1);
+    SizeVector site_columns(site_count);
+    for (auto &column_idx : site_columns) {
+      column_idx = column_distribution(generator);
+    }
+    std::ofstream fasta_file(fasta_path);
+    for (size_t taxon_idx = 0; taxon_idx < taxon_count; taxon_idx++) {
+      const std::string taxon = "taxon" + std::to_string(taxon_idx);
+      tag_taxon_map[PackInts(static_cast<uint32_t>(taxon_idx), 1)] = taxon;
+      fasta_file << '>' << taxon << '\n';
+      for (size_t site = 0; site < site_count; site++) {
+        fasta_file << columns[site_columns[site]][taxon_idx];
+        if ((site + 1) % 60 == 0 || site + 1 == site_count) {
+          fasta_file << '\n';
+        }
+      }
+    }
+  }
+
+  std::cout << "taxa: " << taxon_count << ", sites: " << site_count << std::endl;
+  std::cout << "source\tthreads\tseconds\tspeedup" << std::endl;
+  std::optional<std::vector<std::pair<SymbolVector, double>>> expected_patterns;
+  double baseline_seconds = 0.;
+  auto run = [&](bool from_fasta_file, size_t thread_count) {
+    Stopwatch timer(false, Stopwatch::TimeScale::SecondScale);
+    timer.Start();
+    const auto site_pattern =
+        from_fasta_file
+            ? SitePattern(FastaFile(fasta_path), tag_taxon_map, thread_count)
+            : SitePattern(Alignment::ReadFasta(fasta_path), tag_taxon_map,
+                          thread_count);
+    const double seconds = timer.Lap();
+    timer.Stop();
+    if (!expected_patterns.has_value()) {
+      expected_patterns = SortedPatterns(site_pattern);
+      baseline_seconds = seconds;
+    } else {
+      Assert(SortedPatterns(site_pattern) == *expected_patterns,
+             "Compressing on " + std::to_string(thread_count) +
+                 " threads gave different patterns.");
+    }
+    std::cout << (from_fasta_file ? "fasta" : "alignment") << "\t" << thread_count
+              << "\t" << seconds << "\t" << baseline_seconds / seconds << std::endl;
+  };
+  for (const bool from_fasta_file : {false, true}) {
+    for (size_t thread_count = 1; thread_count <= max_thread_count; thread_count *= 2) {
+      run(from_fasta_file, thread_count);
+    }
+  }
+}
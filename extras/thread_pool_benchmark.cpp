@@ -0,0 +1,88 @@
+// Copyright 2019-2022 bito project contributors.
+// bito is free software under the GPLv3; see LICENSE file for details.
+//
+// Measure the per-batch overhead of dispatching trees to threads, comparing a fresh
+// TaskProcessor per batch (how Engine used to work) against the persistent
+// ThreadPool. We time empty tasks, which isolates the dispatch cost, and then full
+// Engine::LogLikelihoods calls on DS1.
+//
+// Run from a directory containing `data`.
+// Usage: thread_pool_benchmark [thread_count]
+
+#include "driver.hpp"
+#include "engine.hpp"
+#include "stopwatch.hpp"
+#include "task_processor.hpp"
+
+// Microseconds per call of f, averaged over enough repeats to total ~2^14 trees.
+template <typename TFunction>
+double MicrosecondsPerBatch(size_t batch_size, TFunction f) {
+  const size_t repeat_count = std::max(size_t(10), size_t(16384) / batch_size);
+  Stopwatch timer(false, Stopwatch::TimeScale::NanosecondScale);
+  timer.Start();
+  for (size_t rep = 0; rep < repeat_count; rep++) {
+    f();
+  }
+  return timer.Stop() / 1000. / static_cast<double>(repeat_count);
+}
+
+int main(int argc, char *argv[]) {
+  const size_t thread_count =
+      (argc > 1) ? std::stoul(argv[1])
+                 : std::max(1u, std::thread::hardware_concurrency());
+  const SizeVector batch_sizes = {1, 8, 64, 1024};
+
+  Driver driver;
+  auto all_trees = UnrootedTreeCollection::OfTreeCollection(
+      driver.ParseNewickFile("data/DS1.100_topologies.nwk"));
+  SitePattern site_pattern(Alignment::ReadFasta("data/DS1.fasta"),
+                           all_trees.TagTaxonMap());
+  PhyloModelSpecification model_specification{"JC69", "constant", "strict"};
+  const std::vector<BeagleFlags> beagle_flag_vector;
+  Engine engine({thread_count, beagle_flag_vector, true}, model_specification,
+                site_pattern);
+
+  std::cout << "threads: " << thread_count << std::endl;
+  std::cout << "batch_size\ttask_processor_us\tthread_pool_us\tengine_us_per_batch"
+            << std::endl;
+  for (const auto batch_size : batch_sizes) {
+    // Empty tasks, one per tree.
+    std::vector<size_t> sink(batch_size);
+    const double task_processor_us = MicrosecondsPerBatch(batch_size, [&]() {
+      std::queue<size_t> executor_queue;
+      for (size_t i = 0; i < thread_count; i++) {
+        executor_queue.push(i);
+      }
+      std::queue<size_t> work_queue;
+      for (size_t i = 0; i < batch_size; i++) {
+        work_queue.push(i);
+      }
+      TaskProcessor<size_t, size_t>(executor_queue, work_queue,
+                                    [&sink](size_t executor, size_t work) {
+                                      sink[work] = executor;
+                                    });
+    });
+    auto &thread_pool = ThreadPool::Shared(thread_count);
+    const double thread_pool_us = MicrosecondsPerBatch(batch_size, [&]() {
+      thread_pool.ParallelFor(
+          batch_size, [](size_t) { return 1.; },
+          [&sink](size_t worker_idx, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+              sink[i] = worker_idx;
+            }
+          });
+    });
+    // Real likelihood evaluations, cycling through the DS1 trees.
+    UnrootedTree::UnrootedTreeVector trees;
+    for (size_t i = 0; i < batch_size; i++) {
+      trees.push_back(all_trees.GetTree(i % all_trees.TreeCount()));
+    }
+    UnrootedTreeCollection batch(trees, all_trees.TagTaxonMap());
+    EigenMatrixXd params(
+        batch_size, engine.GetPhyloModelBlockSpecification().ParameterCount());
+    const double engine_us = MicrosecondsPerBatch(
+        batch_size, [&]() { engine.LogLikelihoods(batch, params, false); });
+    std::cout << batch_size << "\t" << task_processor_us << "\t" << thread_pool_us
+              << "\t" << engine_us << std::endl;
+  }
+}
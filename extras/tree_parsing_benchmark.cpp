@@ -0,0 +1,124 @@
+// Copyright 2019-2022 bito project contributors.
+// bito is free software under the GPLv3; see LICENSE file for details.
+//
+// Measure how parsing a large tree file scales from 1 thread up to the given number of
+// threads. We write a Newick file of random trees with branch lengths, along with a
+// Nexus file holding the same trees with a translate block, and report seconds per
+// parse of each file and the speedup over parsing with Bison alone on a single thread.
+// All of the parses are checked against that one. Last, we time loading the trees
+// from the binary format of TreeCollection::Export, relative to parsing the Newick
+// file with Bison.
+//
+// Usage: tree_parsing_benchmark [max_thread_count] [tree_count] [taxon_count]
+
+#include <fstream>
+#include <random>
+
+#include "driver.hpp"
+#include "stopwatch.hpp"
+
+// A random rooted Newick tree on taxa named with their index plus `prefix`, made by
+// joining random pairs of subtrees.
+std::string RandomNewick(std::mt19937 &generator, size_t taxon_count,
+                         const std::string &prefix) {
+  std::uniform_real_distribution<double> branch_length_distribution(0.001, 0.1);
+  StringVector subtrees;
+  for (size_t taxon_idx = 0; taxon_idx < taxon_count; taxon_idx++) {
+    subtrees.push_back(prefix + std::to_string(taxon_idx));
+  }
+  while (subtrees.size() > 1) {
+    std::uniform_int_distribution<size_t> index_distribution(0, subtrees.size() - 1);
+    std::swap(subtrees[index_distribution(generator)], subtrees.back());
+    std::string right = std::move(subtrees.back());
+    subtrees.pop_back();
+    std::uniform_int_distribution<size_t> other_distribution(0, subtrees.size() - 1);
+    std::string &left = subtrees[other_distribution(generator)];
+    left = "(" + left + ":" + std::to_string(branch_length_distribution(generator)) +
+           "," + right + ":" + std::to_string(branch_length_distribution(generator)) +
+           ")";
+  }
+  return subtrees.front() + ":0;";
+}
+
+int main(int argc, char *argv[]) {
+  const size_t max_thread_count =
+      (argc > 1) ? std::stoul(argv[1])
+                 : std::max(1u, std::thread::hardware_concurrency());
+  const size_t tree_count = (argc > 2) ? std::stoul(argv[2]) : 100000;
+  const size_t taxon_count = (argc > 3) ? std::stoul(argv[3]) : 50;
+  const std::string newick_path = "_ignore/tree_parsing_benchmark.nwk";
+  const std::string nexus_path = "_ignore/tree_parsing_benchmark.nexus";
+
+  {
+    std::mt19937 generator(42);
+    std::ofstream newick_file(newick_path);
+    std::ofstream nexus_file(nexus_path);
+    nexus_file << "#NEXUS\nbegin trees;\n\ttranslate\n";
+    for (size_t taxon_idx = 0; taxon_idx < taxon_count; taxon_idx++) {
+      nexus_file << "\t\t" << taxon_idx << " taxon" << taxon_idx
+                 << ((taxon_idx + 1 < taxon_count) ? ",\n" : ";\n");
+    }
+    for (size_t tree_idx = 0; tree_idx < tree_count; tree_idx++) {
+      newick_file << RandomNewick(generator, taxon_count, "taxon") << "\n";
+    }
+    // The Nexus trees use the short names from the translate block.
+    generator.seed(42);
+    for (size_t tree_idx = 0; tree_idx < tree_count; tree_idx++) {
+      nexus_file << "tree STATE_" << tree_idx << " = "
+                 << RandomNewick(generator, taxon_count, "") << "\n";
+    }
+    nexus_file << "end;\n";
+  }
+
+  std::cout << "trees: " << tree_count << ", taxa: " << taxon_count << std::endl;
+  std::cout << "parser\tthreads\tnewick_s\tnexus_s\tspeedup" << std::endl;
+  std::optional<TreeCollection> bison_newick;
+  std::optional<TreeCollection> bison_nexus;
+  double bison_total = 0.;
+  double bison_newick_seconds = 0.;
+  auto run = [&](bool use_fast_newick_parser, size_t thread_count) {
+    Driver driver;
+    driver.SetUseFastNewickParser(use_fast_newick_parser);
+    driver.SetThreadCount(thread_count);
+    Stopwatch timer(false, Stopwatch::TimeScale::SecondScale);
+    timer.Start();
+    auto newick_collection = driver.ParseNewickFile(newick_path);
+    const double newick_seconds = timer.Lap();
+    auto nexus_collection = driver.ParseNexusFile(nexus_path);
+    const double nexus_seconds = timer.Lap();
+    timer.Stop();
+    const double total = newick_seconds + nexus_seconds;
+    if (!bison_newick.has_value()) {
+      bison_total = total;
+      bison_newick_seconds = newick_seconds;
+      bison_newick = std::move(newick_collection);
+      bison_nexus = std::move(nexus_collection);
+    } else {
+      Assert(newick_collection == *bison_newick && nexus_collection == *bison_nexus,
+             "Parsing on " + std::to_string(thread_count) +
+                 " threads gave different trees.");
+    }
+    std::cout << (use_fast_newick_parser ? "fast" : "bison") << "\t" << thread_count
+              << "\t" << newick_seconds << "\t" << nexus_seconds << "\t"
+              << bison_total / total << std::endl;
+  };
+  run(false, 1);
+  for (size_t thread_count = 1; thread_count <= max_thread_count; thread_count *= 2) {
+    run(true, thread_count);
+  }
+
+  // Loading the Newick trees back from the binary format written by Export.
+  const std::string binary_path = "_ignore/tree_parsing_benchmark.bito";
+  bison_newick->Export(binary_path);
+  std::cout << "\nformat\tthreads\tload_s\tspeedup" << std::endl;
+  for (size_t thread_count = 1; thread_count <= max_thread_count; thread_count *= 2) {
+    Stopwatch timer(false, Stopwatch::TimeScale::SecondScale);
+    timer.Start();
+    auto binary_collection = TreeCollection::Load(binary_path, thread_count);
+    const double load_seconds = timer.Lap();
+    timer.Stop();
+    Assert(binary_collection == *bison_newick, "Loading gave different trees.");
+    std::cout << "binary\t" << thread_count << "\t" << load_seconds << "\t"
+              << bison_newick_seconds / load_seconds << std::endl;
+  }
+}
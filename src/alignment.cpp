@@ -9,6 +9,8 @@
 #include <string>
 #include <unordered_map>
 
+#include "fasta_file.hpp"
+
 size_t Alignment::Length() const {
   Assert(SequenceCount() > 0,
          "Must have sequences in an alignment to ask for a Length.");
@@ -34,42 +36,16 @@ const std::string &Alignment::at(const std::string &taxon) const {
   Failwith("Taxon '" + taxon + "' not found in alignment.");
 }
 
-// An edited version of
-// https://stackoverflow.com/questions/35251635/fasta-reader-written-in-c
-// which seems like it was originally taken from
-// http://rosettacode.org/wiki/FASTA_format#C.2B.2B
 Alignment Alignment::ReadFasta(const std::string &fname) {
+  // FastaFile indexes the sequences in place, so we only copy each one once.
+  const FastaFile fasta_file(fname);
   StringStringMap data;
-  auto insert = [&data](std::string taxon, std::string sequence) {
-    if (!taxon.empty()) {
-      SafeInsert(data, taxon, sequence);
-    }
-  };
-  std::ifstream input(fname);
-  if (!input.good()) {
-    Failwith("Could not open '" + fname + "'");
-  }
-  std::string line, taxon, sequence;
-  while (std::getline(input, line)) {
-    if (line.empty()) {
-      continue;
-    }
-    // else:
-    if (line[0] == '>') {
-      insert(taxon, sequence);
-      taxon = line.substr(1);
-      sequence.clear();
-    } else {
-      sequence += line;
-    }
-  }
-  // Insert the last taxon, sequence pair.
-  insert(taxon, sequence);
-  Alignment alignment(data);
-  if (!alignment.IsValid()) {
-    Failwith("Sequences of the alignment are not all the same length.");
+  for (size_t sequence_idx = 0; sequence_idx < fasta_file.SequenceCount();
+       sequence_idx++) {
+    SafeInsert(data, std::string(fasta_file.Name(sequence_idx)),
+               fasta_file.Sequence(sequence_idx));
   }
-  return alignment;
+  return Alignment(std::move(data));
 }
 
 Alignment Alignment::ExtractSingleColumnAlignment(size_t which_column) const {
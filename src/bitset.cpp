@@ -1,8 +1,5 @@
 // Copyright 2019-2022 bito project contributors.
 // bito is free software under the GPLv3; see LICENSE file for details.
-//
-// Note that the default constructor for std::vector<bool> is filled with false:
-// https://stackoverflow.com/a/22984114/467327
 
 #include "bitset.hpp"
 
@@ -10,17 +7,29 @@
 
 #include "sugar.hpp"
 
-Bitset::Bitset(std::vector<bool> value) : value_(std::move(value)) {}
+Bitset::Bitset(std::vector<bool> value) : Bitset(value.size()) {
+  for (size_t i = 0; i < value.size(); i++) {
+    if (value[i]) {
+      Blocks()[i / BlockBitCount] |= MaskOfBit(i);
+    }
+  }
+}
 
-Bitset::Bitset(const size_t n, const bool initial_value) : value_(n, initial_value) {}
+Bitset::Bitset(const size_t n, const bool initial_value) : bit_count_(n) {
+  if (!IsInline()) {
+    heap_blocks_.resize(BlockCount());
+  }
+  if (initial_value) {
+    std::fill(Blocks(), Blocks() + BlockCount(), ~Block(0));
+    ClearTrailingBits();
+  }
+}
 
 Bitset::Bitset(const std::string str) : Bitset(str.length()) {
-  for (size_t i = 0; i < value_.size(); i++) {
-    if (str[i] == '0') {
-      value_[i] = false;
-    } else if (str[i] == '1') {
-      value_[i] = true;
-    } else {
+  for (size_t i = 0; i < bit_count_; i++) {
+    if (str[i] == '1') {
+      Blocks()[i / BlockBitCount] |= MaskOfBit(i);
+    } else if (str[i] != '0') {
       Failwith("String constructor for Bitset must use only 0s or 1s; found '" +
                std::string(1, str[i]) + "'.");
     }
@@ -30,34 +39,111 @@ Bitset::Bitset(const std::string str) : Bitset(str.length()) {
 Bitset::Bitset(const SizeVector bits_on, const size_t n) : Bitset(n, false) {
   for (auto i : bits_on) {
     Assert(i < n, "Bitset SizeVector constructor has values out of range.");
-    value_[i] = true;
+    Blocks()[i / BlockBitCount] |= MaskOfBit(i);
+  }
+}
+
+// ** Block Helpers
+
+void Bitset::ClearTrailingBits() {
+  const size_t remainder = bit_count_ % BlockBitCount;
+  if (remainder != 0) {
+    Blocks()[BlockCount() - 1] &= MaskOfLeadingBits(remainder);
+  }
+}
+
+Bitset::Block Bitset::ReadBlockAt(const size_t begin) const {
+  const size_t block_idx = begin / BlockBitCount;
+  const size_t shift = begin % BlockBitCount;
+  const size_t block_count = BlockCount();
+  const Block* blocks = Blocks();
+  if (block_idx >= block_count) {
+    return 0;
+  }
+  Block block = blocks[block_idx] << shift;
+  if (shift != 0 && block_idx + 1 < block_count) {
+    block |= blocks[block_idx + 1] >> (BlockBitCount - shift);
+  }
+  return block;
+}
+
+void Bitset::WriteBlockAt(const size_t begin, Block block, const size_t bit_count) {
+  const Block mask = MaskOfLeadingBits(bit_count);
+  const size_t block_idx = begin / BlockBitCount;
+  const size_t shift = begin % BlockBitCount;
+  Block* blocks = Blocks();
+  block &= mask;
+  blocks[block_idx] = (blocks[block_idx] & ~(mask >> shift)) | (block >> shift);
+  if (shift != 0 && shift + bit_count > BlockBitCount) {
+    const size_t back_shift = BlockBitCount - shift;
+    blocks[block_idx + 1] =
+        (blocks[block_idx + 1] & ~(mask << back_shift)) | (block << back_shift);
+  }
+}
+
+size_t Bitset::CountRange(const size_t begin, const size_t end) const {
+  size_t count = 0;
+  for (size_t i = begin; i < end; i += BlockBitCount) {
+    const Block mask = MaskOfLeadingBits(end - i);
+    count += static_cast<size_t>(__builtin_popcountll(ReadBlockAt(i) & mask));
+  }
+  return count;
+}
+
+int Bitset::LexicographicCompare(const Bitset& bitset_a, const Bitset& bitset_b) {
+  const size_t common_size = std::min(bitset_a.size(), bitset_b.size());
+  for (size_t i = 0; i < common_size; i += BlockBitCount) {
+    const Block mask = MaskOfLeadingBits(common_size - i);
+    const Block block_a = bitset_a.ReadBlockAt(i) & mask;
+    const Block block_b = bitset_b.ReadBlockAt(i) & mask;
+    if (block_a != block_b) {
+      return block_a < block_b ? -1 : 1;
+    }
   }
+  if (bitset_a.size() == bitset_b.size()) {
+    return 0;
+  }
+  return bitset_a.size() < bitset_b.size() ? -1 : 1;
 }
 
 // ** std::bitset Interface Methods
 
-bool Bitset::operator[](size_t i) const { return value_[i]; }
+bool Bitset::operator[](size_t i) const {
+  return (Blocks()[i / BlockBitCount] & MaskOfBit(i)) != 0;
+}
 
-size_t Bitset::size() const { return value_.size(); }
+size_t Bitset::size() const { return bit_count_; }
 
 void Bitset::set(size_t i, bool value) {
-  Assert(i < value_.size(), "i out of range in Bitset::set.");
-  value_[i] = value;
+  Assert(i < bit_count_, "i out of range in Bitset::set.");
+  if (value) {
+    Blocks()[i / BlockBitCount] |= MaskOfBit(i);
+  } else {
+    Blocks()[i / BlockBitCount] &= ~MaskOfBit(i);
+  }
 }
 
 void Bitset::reset(size_t i) {
-  Assert(i < value_.size(), "i out of range in Bitset::reset.");
-  value_[i] = false;
+  Assert(i < bit_count_, "i out of range in Bitset::reset.");
+  Blocks()[i / BlockBitCount] &= ~MaskOfBit(i);
 }
 
-void Bitset::flip() { value_.flip(); }
+void Bitset::flip() {
+  Block* blocks = Blocks();
+  for (size_t i = 0; i < BlockCount(); i++) {
+    blocks[i] = ~blocks[i];
+  }
+  ClearTrailingBits();
+}
 
 int Bitset::Compare(const Bitset& bitset_a, const Bitset& bitset_b) {
   Assert(bitset_a.size() == bitset_b.size(),
          "Bitsets must be same size for Bitset::Compare.");
-  for (size_t i = 0; i < bitset_a.size(); i++) {
-    if (bitset_a[i] != bitset_b[i]) {
-      return static_cast<int>(bitset_a[i]) - static_cast<int>(bitset_b[i]);
+  const Block* blocks_a = bitset_a.Blocks();
+  const Block* blocks_b = bitset_b.Blocks();
+  for (size_t i = 0; i < bitset_a.BlockCount(); i++) {
+    if (blocks_a[i] != blocks_b[i]) {
+      return blocks_a[i] < blocks_b[i] ? -1 : 1;
     }
   }
   return 0;
@@ -68,70 +154,79 @@ int Bitset::Compare(const Bitset& that_bitset) const {
   return Compare(this_bitset, that_bitset);
 }
 
-bool Bitset::operator==(const Bitset& other) const { return value_ == other.value_; }
-bool Bitset::operator!=(const Bitset& other) const { return value_ != other.value_; }
-bool Bitset::operator<(const Bitset& other) const { return value_ < other.value_; }
-bool Bitset::operator<=(const Bitset& other) const { return value_ <= other.value_; }
-bool Bitset::operator>(const Bitset& other) const { return value_ > other.value_; }
-bool Bitset::operator>=(const Bitset& other) const { return value_ >= other.value_; }
+bool Bitset::operator==(const Bitset& other) const {
+  return bit_count_ == other.bit_count_ &&
+         std::equal(Blocks(), Blocks() + BlockCount(), other.Blocks());
+}
+bool Bitset::operator!=(const Bitset& other) const { return !(*this == other); }
+bool Bitset::operator<(const Bitset& other) const {
+  return LexicographicCompare(*this, other) < 0;
+}
+bool Bitset::operator<=(const Bitset& other) const {
+  return LexicographicCompare(*this, other) <= 0;
+}
+bool Bitset::operator>(const Bitset& other) const {
+  return LexicographicCompare(*this, other) > 0;
+}
+bool Bitset::operator>=(const Bitset& other) const {
+  return LexicographicCompare(*this, other) >= 0;
+}
+
+// The bitwise operators are simple loops over blocks, which the compiler vectorizes.
 
 Bitset Bitset::operator&(const Bitset& other) const {
-  Assert(value_.size() == other.size(), "Size mismatch in Bitset::operator&.");
-  Bitset r(value_.size());
-  for (size_t i = 0; i < value_.size(); i++) {
-    if (value_[i] && other.value_[i]) {
-      r.set(i);
-    }
-  }
+  Assert(size() == other.size(), "Size mismatch in Bitset::operator&.");
+  Bitset r(*this);
+  r &= other;
   return r;
 }
 
 Bitset Bitset::operator|(const Bitset& other) const {
-  Assert(value_.size() == other.size(), "Size mismatch in Bitset::operator|.");
-  Bitset r(value_.size());
-  for (size_t i = 0; i < value_.size(); i++) {
-    if (value_[i] || other.value_[i]) {
-      r.set(i);
-    }
-  }
+  Assert(size() == other.size(), "Size mismatch in Bitset::operator|.");
+  Bitset r(*this);
+  r |= other;
   return r;
 }
 
 Bitset Bitset::operator^(const Bitset& other) const {
-  Assert(value_.size() == other.size(), "Size mismatch in Bitset::operator^.");
-  Bitset r(value_.size());
-  for (size_t i = 0; i < value_.size(); i++) {
-    if (value_[i] != other.value_[i]) {
-      r.set(i);
-    }
+  Assert(size() == other.size(), "Size mismatch in Bitset::operator^.");
+  Bitset r(*this);
+  Block* blocks = r.Blocks();
+  const Block* other_blocks = other.Blocks();
+  for (size_t i = 0; i < r.BlockCount(); i++) {
+    blocks[i] ^= other_blocks[i];
   }
   return r;
 }
 
 Bitset Bitset::operator~() const {
-  Bitset r(value_);
-  r.value_.flip();
+  Bitset r(*this);
+  r.flip();
   return r;
 }
 
 Bitset Bitset::operator+(const Bitset& other) const {
-  Bitset sum(value_.size() + other.size());
+  Bitset sum(size() + other.size());
   sum.CopyFrom(*this, 0, false);
-  sum.CopyFrom(other, value_.size(), false);
+  sum.CopyFrom(other, size(), false);
   return sum;
 }
 
 void Bitset::operator&=(const Bitset& other) {
-  Assert(value_.size() == other.size(), "Size mismatch in Bitset::operator&=.");
-  for (size_t i = 0; i < value_.size(); i++) {
-    value_[i] = value_[i] && other[i];
+  Assert(size() == other.size(), "Size mismatch in Bitset::operator&=.");
+  Block* blocks = Blocks();
+  const Block* other_blocks = other.Blocks();
+  for (size_t i = 0; i < BlockCount(); i++) {
+    blocks[i] &= other_blocks[i];
   }
 }
 
 void Bitset::operator|=(const Bitset& other) {
-  Assert(value_.size() == other.size(), "Size mismatch in Bitset::operator|=.");
-  for (size_t i = 0; i < value_.size(); i++) {
-    value_[i] = value_[i] || other[i];
+  Assert(size() == other.size(), "Size mismatch in Bitset::operator|=.");
+  Block* blocks = Blocks();
+  const Block* other_blocks = other.Blocks();
+  for (size_t i = 0; i < BlockCount(); i++) {
+    blocks[i] |= other_blocks[i];
   }
 }
 
@@ -142,42 +237,65 @@ std::ostream& operator<<(std::ostream& os, const Bitset& bitset) {
 
 // ** Bitset Methods
 
-void Bitset::Zero() { std::fill(value_.begin(), value_.end(), false); }
-
-std::vector<bool> Bitset::GetData() { return value_; }
+void Bitset::Zero() { std::fill(Blocks(), Blocks() + BlockCount(), Block(0)); }
 
-size_t Bitset::Hash() const { return std::hash<std::vector<bool>>{}(value_); }
+std::vector<bool> Bitset::GetData() {
+  std::vector<bool> data(size());
+  for (size_t i = 0; i < size(); i++) {
+    data[i] = (*this)[i];
+  }
+  return data;
+}
+
+size_t Bitset::Hash() const {
+  // MurmurHash64A over the blocks, seeded with the size.
+  const Block multiplier = 0xc6a4a7935bd1e995ULL;
+  const int shift = 47;
+  Block hash = bit_count_ ^ (BlockCount() * multiplier);
+  const Block* blocks = Blocks();
+  for (size_t i = 0; i < BlockCount(); i++) {
+    Block block = blocks[i] * multiplier;
+    block ^= block >> shift;
+    block *= multiplier;
+    hash ^= block;
+    hash *= multiplier;
+  }
+  hash ^= hash >> shift;
+  hash *= multiplier;
+  hash ^= hash >> shift;
+  return static_cast<size_t>(hash);
+}
 
 std::string Bitset::ToString() const {
-  std::string str;
-  for (auto&& bit : value_) {
-    str += (bit ? '1' : '0');
+  std::string str(size(), '0');
+  for (size_t i = 0; i < size(); i++) {
+    if ((*this)[i]) {
+      str[i] = '1';
+    }
   }
   return str;
 }
 
 std::vector<size_t> Bitset::ToVectorOfSetBits() const {
   std::vector<size_t> vec;
-  for (size_t i = 0; i < size(); i++) {
-    if (value_[i]) {
-      vec.push_back(i);
+  const Block* blocks = Blocks();
+  for (size_t block_idx = 0; block_idx < BlockCount(); block_idx++) {
+    Block block = blocks[block_idx];
+    while (block != 0) {
+      const size_t offset = static_cast<size_t>(__builtin_clzll(block));
+      vec.push_back(block_idx * BlockBitCount + offset);
+      block &= ~(Block(1) << (BlockBitCount - 1 - offset));
     }
   }
   return vec;
 }
 
-bool Bitset::All() const {
-  for (auto&& bit : value_) {
-    if (!bit) {
-      return false;
-    }
-  }
-  return true;
-}
+bool Bitset::All() const { return Count() == size(); }
 
 bool Bitset::Any() const {
-  for (auto&& bit : value_) {
-    if (bit) {
+  const Block* blocks = Blocks();
+  for (size_t i = 0; i < BlockCount(); i++) {
+    if (blocks[i] != 0) {
       return true;
     }
   }
@@ -190,8 +308,10 @@ bool Bitset::IsSingleton() const { return SingletonOption().has_value(); }
 
 bool Bitset::IsDisjoint(const Bitset& other) const {
   Assert(size() == other.size(), "Size mismatch in Bitset::IsDisjoint.");
-  for (size_t i = 0; i < size(); i++) {
-    if (value_[i] && other.value_[i]) {
+  const Block* blocks = Blocks();
+  const Block* other_blocks = other.Blocks();
+  for (size_t i = 0; i < BlockCount(); i++) {
+    if ((blocks[i] & other_blocks[i]) != 0) {
       return false;
     }
   }
@@ -199,53 +319,49 @@ bool Bitset::IsDisjoint(const Bitset& other) const {
 }
 
 void Bitset::Minorize() {
-  Assert(!(value_.empty()), "Can't Bitset::Minorize an empty bitset.");
-  if (value_[0]) {
-    value_.flip();
+  Assert(size() > 0, "Can't Bitset::Minorize an empty bitset.");
+  if ((*this)[0]) {
+    flip();
   }
 }
 
 void Bitset::CopyFrom(const Bitset& other, size_t begin, bool flip) {
   Assert(begin + other.size() <= size(), "Can't fit copy in Bitset::CopyFrom.");
-  if (flip) {
-    for (size_t i = 0; i < other.size(); i++) {
-      value_[i + begin] = !other[i];
-    }
-  } else {
-    for (size_t i = 0; i < other.size(); i++) {
-      value_[i + begin] = other[i];
-    }
+  const Block* other_blocks = other.Blocks();
+  for (size_t i = 0; i < other.BlockCount(); i++) {
+    const size_t bit_count = std::min(BlockBitCount, other.size() - i * BlockBitCount);
+    WriteBlockAt(begin + i * BlockBitCount, flip ? ~other_blocks[i] : other_blocks[i],
+                 bit_count);
   }
 }
 
 std::optional<uint32_t> Bitset::SingletonOption() const {
-  bool found_already = false;
-  uint32_t found_index;
-  for (uint32_t i = 0; i < size(); i++) {
-    if (value_[i]) {
-      if (found_already) {
-        // We previously found an index, so this isn't a singleton.
-        return std::nullopt;
-      }  // else
-      found_already = true;
-      found_index = i;
+  if (Count() != 1) {
+    return std::nullopt;
+  }
+  const Block* blocks = Blocks();
+  for (size_t i = 0; i < BlockCount(); i++) {
+    if (blocks[i] != 0) {
+      return static_cast<uint32_t>(i * BlockBitCount + __builtin_clzll(blocks[i]));
     }
   }
-  if (found_already) {
-    return found_index;
-  }  // else
   return std::nullopt;
 }
 
-size_t Bitset::Count() const { return std::count(value_.begin(), value_.end(), true); }
+size_t Bitset::Count() const {
+  size_t count = 0;
+  const Block* blocks = Blocks();
+  for (size_t i = 0; i < BlockCount(); i++) {
+    count += static_cast<size_t>(__builtin_popcountll(blocks[i]));
+  }
+  return count;
+}
 
 std::string Bitset::ToVectorOfSetBitsAsString() const {
   std::string str;
-  for (size_t i = 0; i < size(); i++) {
-    if (value_[i]) {
-      str += std::to_string(i);
-      str += ",";
-    }
+  for (const auto i : ToVectorOfSetBits()) {
+    str += std::to_string(i);
+    str += ",";
   }
   if (!str.empty()) {
     str.pop_back();
@@ -277,19 +393,21 @@ size_t Bitset::MultiCladeGetCladeSize(const size_t clade_count) const {
 Bitset Bitset::MultiCladeGetClade(const size_t i, const size_t clade_count) const {
   Assert(i < clade_count, "Bitset::MultiCladeGetClade: index is too large.");
   size_t clade_size = MultiCladeGetCladeSize(clade_count);
-  std::vector<bool> new_value(
-      value_.begin() + static_cast<std::vector<bool>::difference_type>(i * clade_size),
-      value_.begin() +
-          static_cast<std::vector<bool>::difference_type>((i + 1) * clade_size));
-  return Bitset(std::move(new_value));
+  Bitset clade(clade_size);
+  Block* clade_blocks = clade.Blocks();
+  for (size_t j = 0; j < clade.BlockCount(); j++) {
+    clade_blocks[j] = ReadBlockAt(i * clade_size + j * BlockBitCount);
+  }
+  clade.ClearTrailingBits();
+  return clade;
 }
 
 std::string Bitset::MultiCladeToString(const size_t clade_count) const {
   size_t clade_size = MultiCladeGetCladeSize(clade_count);
   std::string str;
-  for (size_t i = 0; i < value_.size(); ++i) {
-    str += (value_[i] ? '1' : '0');
-    if ((i + 1) % clade_size == 0 && i + 1 < value_.size()) {
+  for (size_t i = 0; i < size(); ++i) {
+    str += ((*this)[i] ? '1' : '0');
+    if ((i + 1) % clade_size == 0 && i + 1 < size()) {
       // The next item will start a new clade, so add a separator.
       str += '|';
     }
@@ -582,10 +700,8 @@ bool Bitset::PCSPIsParentRootsplit() const {
 SizePair Bitset::PCSPGetChildSubsplitTaxonCounts() const {
   auto clade_size = PCSPGetCladeSize();
   auto total_clade_taxon_count =
-      std::count(value_.begin() + clade_size,
-                 value_.begin() + SubsplitCladeCount * clade_size, true);
-  auto clade0_taxon_count =
-      std::count(value_.begin() + SubsplitCladeCount * clade_size, value_.end(), true);
+      CountRange(clade_size, SubsplitCladeCount * clade_size);
+  auto clade0_taxon_count = CountRange(SubsplitCladeCount * clade_size, size());
   Assert(clade0_taxon_count < total_clade_taxon_count,
          "PCSPGetChildSubsplitTaxonCounts: not a proper PCSP bitset.");
   return {static_cast<size_t>(clade0_taxon_count),
@@ -10,10 +10,19 @@
 // this class goes way beyond what std::bitset offers.
 // Note that we can't use std::bitset because we don't know the size of the
 // bitsets at compile time.
+//
+// Bits are packed into 64-bit blocks, most significant bit first, so that comparing
+// blocks as unsigned integers gives the same ordering as comparing the bitsets as
+// strings. Bitsets that fit in InlineBlockCapacity blocks (up to 256 bits, which covers
+// PCSPs on 85 taxa) are stored inline and never touch the heap. Bits past size() in the
+// last block are always kept zero, so that block-wise equality, hashing and counting
+// need no masking.
 
 #pragma once
 
 #include <algorithm>
+#include <array>
+#include <cstdint>
 #include <functional>
 #include <optional>
 #include <string>
@@ -24,6 +33,10 @@
 class Bitset {
  public:
   using BitsetPair = std::pair<Bitset, Bitset>;
+  using Block = uint64_t;
+  static constexpr size_t BlockBitCount = 64;
+  static constexpr size_t InlineBlockCapacity = 4;
+
   // Builds Bitset from boolean vector.
   explicit Bitset(std::vector<bool> value);
   // Fills entire Bitset of size `n` with `initial_value`.
@@ -348,8 +361,41 @@ class Bitset {
                                     const Bitset &child_pcsp);
 
  protected:
-  // Vector of bits.
-  std::vector<bool> value_;
+  // Number of bits.
+  size_t bit_count_ = 0;
+  // Blocks are stored here if there are at most InlineBlockCapacity of them...
+  std::array<Block, InlineBlockCapacity> inline_blocks_ = {};
+  // ... and here otherwise.
+  std::vector<Block> heap_blocks_;
+
+  static size_t BlockCountOfBitCount(size_t bit_count) {
+    return (bit_count + BlockBitCount - 1) / BlockBitCount;
+  }
+  static Block MaskOfBit(size_t i) {
+    return Block(1) << (BlockBitCount - 1 - (i % BlockBitCount));
+  }
+  // Mask of the top `bit_count` bits of a block.
+  static Block MaskOfLeadingBits(size_t bit_count) {
+    return bit_count >= BlockBitCount ? ~Block(0) : ~(~Block(0) >> bit_count);
+  }
+  size_t BlockCount() const { return BlockCountOfBitCount(bit_count_); }
+  bool IsInline() const { return BlockCount() <= InlineBlockCapacity; }
+  Block *Blocks() { return IsInline() ? inline_blocks_.data() : heap_blocks_.data(); }
+  const Block *Blocks() const {
+    return IsInline() ? inline_blocks_.data() : heap_blocks_.data();
+  }
+  // Zero out the unused bits of the last block.
+  void ClearTrailingBits();
+  // Get the 64 bits starting at bit `begin`, padded with zeros past the end.
+  Block ReadBlockAt(size_t begin) const;
+  // Overwrite the `bit_count` bits starting at bit `begin` with the leading
+  // `bit_count` bits of `block`.
+  void WriteBlockAt(size_t begin, Block block, size_t bit_count);
+  // Count the 1s in the half-open bit range [begin, end).
+  size_t CountRange(size_t begin, size_t end) const;
+  // Lexicographic comparison consistent with that of std::vector<bool>, which also
+  // handles bitsets of different sizes.
+  static int LexicographicCompare(const Bitset &bitset_a, const Bitset &bitset_b);
 };
 
 using Subsplit = Bitset;
@@ -457,6 +503,43 @@ TEST_CASE("Bitset") {
   CHECK_EQ(Bitset("0000").ToVectorOfSetBitsAsString(), "");
 }
 
+TEST_CASE("Bitset: Blocks") {
+  // Sizes on either side of the block boundaries and of the inline capacity.
+  for (const size_t n : {63, 64, 65, 127, 255, 256, 257, 300}) {
+    std::string str(n, '0');
+    for (size_t i = 0; i < n; i += 3) {
+      str[i] = '1';
+    }
+    Bitset bitset(str);
+    CHECK_EQ(bitset.ToString(), str);
+    CHECK_EQ(bitset.Count(), (n + 2) / 3);
+    CHECK_EQ(bitset.GetData(), Bitset(bitset.GetData()).GetData());
+    CHECK_EQ((~bitset).Count(), n - bitset.Count());
+    CHECK_EQ(~~bitset, bitset);
+    CHECK_EQ(bitset & ~bitset, Bitset(n));
+    CHECK_EQ(bitset | ~bitset, Bitset(n, true));
+    CHECK_EQ(bitset ^ bitset, Bitset(n));
+    CHECK_EQ((bitset + ~bitset).SubsplitGetClade(SubsplitClade::Left), bitset);
+    CHECK_EQ((bitset + ~bitset).SubsplitGetClade(SubsplitClade::Right), ~bitset);
+    CHECK_EQ((bitset + bitset + ~bitset).PCSPGetClade(PCSPClade::RightChild),
+             ~bitset);
+    CHECK_EQ(Bitset::Singleton(n, n - 1).SingletonOption(), n - 1);
+    CHECK_EQ(Bitset::Singleton(n, n - 1).ToVectorOfSetBits(), SizeVector({n - 1}));
+    CHECK_EQ(bitset.Hash(), Bitset(str).Hash());
+    CHECK_LT(Bitset::Singleton(n, n - 1), Bitset::Singleton(n, 0));
+    CHECK_LT(Bitset(n), Bitset(n + 1));
+  }
+  // Copy across a block boundary.
+  Bitset wide(130);
+  wide.CopyFrom(Bitset(70, true), 60, false);
+  CHECK_EQ(wide.Count(), 70);
+  CHECK_EQ(wide[59], false);
+  CHECK_EQ(wide[60], true);
+  CHECK_EQ(wide[129], true);
+  wide.CopyFrom(Bitset(10, true), 62, true);
+  CHECK_EQ(wide.Count(), 60);
+}
+
 TEST_CASE("Bitset: Clades, Subsplits, PCSPs") {
   auto p = Bitset("000111");
   // Subsplit: 000|111
@@ -8,13 +8,18 @@
 
 #include <fstream>
 #include <iostream>
+#include <iterator>
 #include <memory>
+#include <numeric>
 #include <regex>
+#include <tuple>
 #include <unordered_map>
 #include <utility>
 
+#include "mmapped_file.hpp"
 #include "parser.hpp"
 #include "taxon_name_munging.hpp"
+#include "thread_pool.hpp"
 #include "zlib_stream.hpp"
 
 Driver::Driver()
@@ -22,7 +27,19 @@ Driver::Driver()
       taxa_complete_(false),
       trace_parsing_(0),
       trace_scanning_(false),
-      latest_tree_(nullptr) {}
+      latest_tree_(nullptr),
+      thread_count_(1),
+      use_fast_newick_parser_(true),
+      fast_parsed_tree_count_(0) {}
+
+void Driver::SetThreadCount(size_t thread_count) {
+  Assert(thread_count > 0, "Driver needs at least one thread.");
+  thread_count_ = thread_count;
+}
+
+void Driver::SetUseFastNewickParser(bool use_fast_newick_parser) {
+  use_fast_newick_parser_ = use_fast_newick_parser;
+}
 
 void Driver::Clear() {
   next_id_ = 0;
@@ -32,32 +49,185 @@ void Driver::Clear() {
   latest_tree_ = nullptr;
   taxa_.clear();
   branch_lengths_.clear();
+  fast_parsed_tree_count_ = 0;
 }
 
 // This parser will allow anything before the first '('.
-TreeCollection Driver::ParseNewick(std::istream &in) {
+TreeCollection Driver::ParseNewick(std::string_view contents) {
+  TreeLineVector tree_lines;
+  unsigned int line_number = 1;
+  while (!contents.empty()) {
+    const auto line_end = contents.find('\n');
+    const auto line = contents.substr(0, line_end);
+    contents.remove_prefix(line_end == std::string_view::npos ? contents.size()
+                                                              : line_end + 1);
+    auto tree_start = line.find_first_of('(');
+    if (tree_start != std::string_view::npos) {
+      // Skip any characters before the first '('.
+      tree_lines.push_back({line_number, line.substr(tree_start)});
+    }
+    line_number++;
+  }
+  Tree::TreeVector trees;
+  ParseTreeLinesInto(tree_lines, trees);
+  return TreeCollection(std::move(trees), this->TagTaxonMap());
+}
+
+void Driver::ParseTreeLinesInto(const TreeLineVector &tree_lines,
+                                Tree::TreeVector &trees) {
+  if (thread_count_ == 1 || tree_lines.size() < 2) {
+    trees.reserve(trees.size() + tree_lines.size());
+    for (auto &tree : ParseTreeLines(tree_lines, 0, tree_lines.size())) {
+      trees.push_back(std::move(tree));
+    }
+    return;
+  }
+  size_t begin = 0;
+  if (!taxa_complete_) {
+    // Parse the first tree here, so that it can set up taxa_.
+    trees.push_back(std::move(ParseTreeLines(tree_lines, 0, 1).front()));
+    begin = 1;
+  }
+  ParseTreeLinesInParallel(tree_lines, begin, trees);
+}
+
+Tree Driver::ParseTreeLine(yy::parser *parser_instance,
+                           std::optional<FastNewickParser> &fast_parser,
+                           const TreeLine &tree_line) {
+  // We can only use the fast parser once the taxa are known.
+  if (use_fast_newick_parser_ && taxa_complete_) {
+    if (!fast_parser.has_value()) {
+      fast_parser.emplace(taxa_);
+    }
+    auto tree = fast_parser->Parse(tree_line.newick_);
+    if (tree.has_value()) {
+      fast_parsed_tree_count_++;
+      return std::move(*tree);
+    }
+  }
+  // Set the Bison location line number properly so we get useful error
+  // messages.
+  location_.initialize(nullptr, tree_line.line_number_);
+  return ParseString(parser_instance, std::string(tree_line.newick_));
+}
+
+Tree::TreeVector Driver::ParseTreeLines(const TreeLineVector &tree_lines, size_t begin,
+                                        size_t end) {
   yy::parser parser_instance(*this);
   parser_instance.set_debug_level(trace_parsing_);
-  std::string line;
-  unsigned int line_number = 1;
+  std::optional<FastNewickParser> fast_parser;
   Tree::TreeVector trees;
-  while (std::getline(in, line)) {
-    // Set the Bison location line number properly so we get useful error
-    // messages.
-    location_.initialize(nullptr, line_number);
+  trees.reserve(end - begin);
+  for (size_t line_idx = begin; line_idx < end; line_idx++) {
+    trees.push_back(ParseTreeLine(&parser_instance, fast_parser, tree_lines[line_idx]));
+  }
+  return trees;
+}
+
+void Driver::ParseTreeLinesInParallel(const TreeLineVector &tree_lines, size_t begin,
+                                      Tree::TreeVector &trees) {
+  Assert(taxa_complete_, "The taxa must be known before parsing in parallel.");
+  // Split the remaining lines into ranges of about the same number of characters.
+  const size_t remaining_count = tree_lines.size() - begin;
+  const auto boundaries = ThreadPool::ChunkBoundaries(
+      remaining_count,
+      [&tree_lines, begin](size_t idx) {
+        return static_cast<double>(tree_lines[begin + idx].newick_.size());
+      },
+      thread_count_ * ThreadPool::chunks_per_worker_);
+  const size_t chunk_count = boundaries.size() - 1;
+  std::vector<Tree::TreeVector> chunk_trees(chunk_count);
+  SizeVector chunk_fast_parsed_tree_counts(chunk_count);
+  ThreadPool::TaskVector tasks;
+  for (size_t chunk_idx = 0; chunk_idx < chunk_count; chunk_idx++) {
+    tasks.push_back([this, &tree_lines, begin, &boundaries, &chunk_trees,
+                     &chunk_fast_parsed_tree_counts, chunk_idx](size_t) {
+      // Each range gets a Driver of its own, with our taxon numbering.
+      Driver chunk_driver;
+      chunk_driver.taxa_ = taxa_;
+      chunk_driver.taxa_complete_ = true;
+      chunk_driver.trace_parsing_ = trace_parsing_;
+      chunk_driver.trace_scanning_ = trace_scanning_;
+      chunk_driver.use_fast_newick_parser_ = use_fast_newick_parser_;
+      chunk_trees[chunk_idx] =
+          chunk_driver.ParseTreeLines(tree_lines, begin + boundaries[chunk_idx],
+                                      begin + boundaries[chunk_idx + 1]);
+      chunk_fast_parsed_tree_counts[chunk_idx] = chunk_driver.fast_parsed_tree_count_;
+    });
+  }
+  ThreadPool::Shared(thread_count_).Run(std::move(tasks));
+  fast_parsed_tree_count_ += std::accumulate(chunk_fast_parsed_tree_counts.begin(),
+                                             chunk_fast_parsed_tree_counts.end(),
+                                             size_t(0));
+  trees.reserve(trees.size() + remaining_count);
+  for (auto &chunk : chunk_trees) {
+    std::move(chunk.begin(), chunk.end(), std::back_inserter(trees));
+  }
+}
+
+// A LineSource reading lines from a stream into `buffer`, starting with what is already
+// in `buffer` if start_with_buffer is set.
+std::function<bool(std::string_view &)> StreamLineSource(std::istream &in,
+                                                         std::string &buffer,
+                                                         bool start_with_buffer) {
+  return [&in, &buffer, start_with_buffer](std::string_view &line) mutable {
+    if (start_with_buffer) {
+      start_with_buffer = false;
+    } else if (!std::getline(in, buffer)) {
+      return false;
+    }
+    line = buffer;
+    return true;
+  };
+}
+
+Tree::TreeVector Driver::ParseNewickLines(const LineSource &next_line) {
+  Tree::TreeVector trees;
+  if (thread_count_ == 1) {
+    StreamNewick(
+        next_line, [&trees](Tree tree) { trees.push_back(std::move(tree)); }, 0, 1);
+    return trees;
+  }
+  // Gather the tree lines in batches, copying them out of the line buffer, and parse
+  // each batch on thread_count_ threads. The offsets of the lines are kept until the
+  // batch is complete, as the batch text moves as it grows.
+  const size_t batch_line_count =
+      thread_count_ * ThreadPool::chunks_per_worker_ * parse_lines_per_chunk_;
+  std::string batch_text;
+  std::vector<std::tuple<unsigned int, size_t, size_t>> batch_lines;
+  TreeLineVector tree_lines;
+  auto parse_batch = [this, &batch_text, &batch_lines, &tree_lines, &trees]() {
+    tree_lines.clear();
+    for (const auto &[line_number, offset, size] : batch_lines) {
+      tree_lines.push_back(
+          {line_number, std::string_view(batch_text).substr(offset, size)});
+    }
+    ParseTreeLinesInto(tree_lines, trees);
+    batch_text.clear();
+    batch_lines.clear();
+  };
+  std::string_view line;
+  unsigned int line_number = 0;
+  while (next_line(line)) {
     line_number++;
-    auto tree_start = line.find_first_of('(');
-    if (!line.empty() && tree_start != std::string::npos) {
-      // Erase any characters before the first '('.
-      line.erase(0, tree_start);
-      trees.push_back(ParseString(&parser_instance, line));
+    // As in ParseNewick, we skip any characters before the first '('.
+    const auto tree_start = line.find_first_of('(');
+    if (tree_start == std::string_view::npos) {
+      continue;
+    }
+    line.remove_prefix(tree_start);
+    batch_lines.emplace_back(line_number, batch_text.size(), line.size());
+    batch_text += line;
+    if (batch_lines.size() == batch_line_count) {
+      parse_batch();
     }
   }
-  return TreeCollection(std::move(trees), this->TagTaxonMap());
+  parse_batch();
+  return trees;
 }
 
-TreeCollection Driver::ParseAndDequoteNewick(std::istream &in) {
-  TreeCollection perhaps_quoted_trees = ParseNewick(in);
+TreeCollection Driver::ParseAndDequoteNewick(std::string_view contents) {
+  TreeCollection perhaps_quoted_trees = ParseNewick(contents);
   return TreeCollection(
       std::move(perhaps_quoted_trees.trees_),
       TaxonNameMunging::DequoteTagStringMap(perhaps_quoted_trees.TagTaxonMap()));
@@ -65,11 +235,9 @@ TreeCollection Driver::ParseAndDequoteNewick(std::istream &in) {
 
 TreeCollection Driver::ParseNewickFile(const std::string &fname) {
   Clear();
-  std::ifstream in(fname.c_str());
-  if (!in) {
-    Failwith("Cannot open the File : " + fname);
-  }
-  return ParseAndDequoteNewick(in);
+  // Scan the file in place.
+  MmappedFile mmapped_file(fname);
+  return ParseAndDequoteNewick(mmapped_file.View());
 }
 
 TreeCollection Driver::ParseNewickFileGZ(const std::string &fname) {
@@ -78,9 +246,15 @@ TreeCollection Driver::ParseNewickFileGZ(const std::string &fname) {
   if (!in_compressed) {
     Failwith("Cannot open the File : " + fname);
   }
-  zlib::ZStringBuf zbuf(in_compressed, 1024, 2048);
+  zlib::ZStringBuf zbuf(in_compressed, zlib::ZStringBuf::default_buf_size_,
+                        zlib::ZStringBuf::default_buf_size_, thread_count_);
   std::istream in(&zbuf);
-  return ParseAndDequoteNewick(in);
+  // Let inflation errors through rather than just setting badbit.
+  in.exceptions(std::ios::badbit);
+  std::string buffer;
+  auto trees = ParseNewickLines(StreamLineSource(in, buffer, false));
+  return TreeCollection(std::move(trees),
+                        TaxonNameMunging::DequoteTagStringMap(TagTaxonMap()));
 }
 
 void GetLineAndConvertToLowerCase(std::istream &in, std::string &line) {
@@ -102,73 +276,184 @@ TreeCollection Driver::ParseNexusFileGZ(const std::string &fname) {
   if (!in_compressed) {
     throw std::runtime_error("Cannot open file.");
   }
-  zlib::ZStringBuf zbuf(in_compressed, 1024, 2048);
+  zlib::ZStringBuf zbuf(in_compressed, zlib::ZStringBuf::default_buf_size_,
+                        zlib::ZStringBuf::default_buf_size_, thread_count_);
   std::istream in(&zbuf);
+  // Let inflation errors through rather than just setting badbit.
+  in.exceptions(std::ios::badbit);
   return ParseNexus(in);
 }
 
 TreeCollection Driver::ParseNexus(std::istream &in) {
   Clear();
   try {
-    std::string line;
-    std::getline(in, line);
-    if (line != "#NEXUS") {
-      throw std::runtime_error("Putative Nexus file doesn't begin with #NEXUS.");
+    std::string buffer;
+    auto long_name_taxon_map = ParseNexusTranslateBlock(in, buffer);
+    auto trees = ParseNewickLines(StreamLineSource(in, buffer, true));
+    // The trees are tagged according to the translate block, so we use its long names
+    // rather than the short names of taxa_.
+    return TreeCollection(std::move(trees),
+                          TaxonNameMunging::DequoteTagStringMap(long_name_taxon_map));
+  } catch (const std::exception &exception) {
+    Failwith(std::string("Problem parsing Nexus file:\n") + exception.what());
+  }
+}
+
+TagStringMap Driver::ParseNexusTranslateBlock(std::istream &in,
+                                              std::string &line) {
+  std::getline(in, line);
+  if (line != "#NEXUS") {
+    throw std::runtime_error("Putative Nexus file doesn't begin with #NEXUS.");
+  }
+  do {
+    if (in.eof()) {
+      throw std::runtime_error("Finished reading and couldn't find 'begin trees;'");
     }
-    do {
-      if (in.eof()) {
-        throw std::runtime_error("Finished reading and couldn't find 'begin trees;'");
-      }
-      GetLineAndConvertToLowerCase(in, line);
-    } while (line != "begin trees;");
     GetLineAndConvertToLowerCase(in, line);
-    std::regex translate_start("^\\s*translate");
-    if (!std::regex_match(line, translate_start)) {
-      throw std::runtime_error("Missing translate block.");
+  } while (line != "begin trees;");
+  GetLineAndConvertToLowerCase(in, line);
+  std::regex translate_start("^\\s*translate");
+  if (!std::regex_match(line, translate_start)) {
+    throw std::runtime_error("Missing translate block.");
+  }
+  std::getline(in, line);
+  std::regex translate_item_regex(R"raw(^\s*(\d+)\s([^,;]*)[,;]?$)raw");
+  std::regex lone_semicolon_regex(R"raw(\s*;$)raw");
+  std::smatch match;
+  TagStringMap long_name_taxon_map;
+  uint32_t leaf_id = 0;
+  // Iterate through the translate table, assigning tags according to the order of
+  // taxa in the block. So, the first taxon name gets leaf number 0, etc.
+  while (std::regex_match(line, match, translate_item_regex)) {
+    const auto short_name = match[1].str();
+    const auto long_name = match[2].str();
+    // We prepare taxa_ so that it can parse the short taxon names.
+    SafeInsert(taxa_, short_name, leaf_id);
+    // However, we keep the long names for the TagTaxonMap.
+    SafeInsert(long_name_taxon_map, PackInts(leaf_id, 1), long_name);
+    leaf_id++;
+    // Semicolon marks the end of the translate block.
+    // It appears at the end of a translation statement line in MrBayes.
+    if (match[3].str() == ";") {
+      break;
     }
     std::getline(in, line);
-    std::regex translate_item_regex(R"raw(^\s*(\d+)\s([^,;]*)[,;]?$)raw");
-    std::regex lone_semicolon_regex(R"raw(\s*;$)raw");
-    std::smatch match;
-    auto previous_position = in.tellg();
-    TagStringMap long_name_taxon_map;
-    uint32_t leaf_id = 0;
-    // Iterate through the translate table, assigning tags according to the order of
-    // taxa in the block. So, the first taxon name gets leaf number 0, etc.
-    while (std::regex_match(line, match, translate_item_regex)) {
-      const auto short_name = match[1].str();
-      const auto long_name = match[2].str();
-      // We prepare taxa_ so that it can parse the short taxon names.
-      SafeInsert(taxa_, short_name, leaf_id);
-      // However, we keep the long names for the TagTaxonMap.
-      SafeInsert(long_name_taxon_map, PackInts(leaf_id, 1), long_name);
-      leaf_id++;
-      // Semicolon marks the end of the translate block.
-      // It appears at the end of a translation statement line in MrBayes.
-      if (match[3].str() == ";") {
-        break;
-      }
-      previous_position = in.tellg();
-      std::getline(in, line);
-      // BEAST has the ending semicolon on a line of its own.
-      if (std::regex_match(line, match, lone_semicolon_regex)) {
-        break;
-      }
-      if (in.eof()) {
-        throw std::runtime_error("Encountered EOF while parsing translate block.");
+    // BEAST has the ending semicolon on a line of its own.
+    if (std::regex_match(line, match, lone_semicolon_regex)) {
+      break;
+    }
+    if (in.eof()) {
+      throw std::runtime_error("Encountered EOF while parsing translate block.");
+    }
+  }
+  Assert(leaf_id > 0, "No taxa found in translate block!");
+  taxa_complete_ = true;
+  // We leave the last line that we read in `line`, as it may hold the first tree.
+  // Compressed streams can't seek back to it.
+  return long_name_taxon_map;
+}
+
+void Driver::StreamNewick(const LineSource &next_line, const TreeVisitor &visitor,
+                          size_t burn_in_count, size_t thinning) {
+  Assert(thinning > 0, "Thinning must be at least 1.");
+  yy::parser parser_instance(*this);
+  parser_instance.set_debug_level(trace_parsing_);
+  std::optional<FastNewickParser> fast_parser;
+  std::string_view line;
+  unsigned int line_number = 0;
+  size_t tree_idx = 0;
+  while (next_line(line)) {
+    line_number++;
+    // As in ParseNewick, we skip any characters before the first '('.
+    const auto tree_start = line.find_first_of('(');
+    if (tree_start == std::string_view::npos) {
+      continue;
+    }
+    const bool keep =
+        tree_idx >= burn_in_count && (tree_idx - burn_in_count) % thinning == 0;
+    if (keep || !taxa_complete_) {
+      auto tree = ParseTreeLine(&parser_instance, fast_parser,
+                                {line_number, line.substr(tree_start)});
+      if (keep) {
+        visitor(std::move(tree));
       }
     }
-    Assert(leaf_id > 0, "No taxa found in translate block!");
-    taxa_complete_ = true;
-    // Back up one line to hit the first tree.
-    in.seekg(previous_position);
-    // Now we make a new TagTaxonMap to replace the one with numbers in place of
-    // taxon names.
-    auto short_name_tree_collection = ParseNewick(in);
-    // We're using the public member directly rather than the const accessor because we
-    // want to move.
-    return TreeCollection(std::move(short_name_tree_collection.trees_),
-                          TaxonNameMunging::DequoteTagStringMap(long_name_taxon_map));
+    tree_idx++;
+  }
+}
+
+TagStringMap Driver::StreamNewickFile(const std::string &fname,
+                                      const TreeVisitor &visitor, size_t burn_in_count,
+                                      size_t thinning) {
+  Clear();
+  MmappedFile mmapped_file(fname);
+  std::string_view contents = mmapped_file.View();
+  StreamNewick(
+      [&contents](std::string_view &line) {
+        if (contents.empty()) {
+          return false;
+        }
+        const auto line_end = contents.find('\n');
+        line = contents.substr(0, line_end);
+        contents.remove_prefix(line_end == std::string_view::npos ? contents.size()
+                                                                  : line_end + 1);
+        return true;
+      },
+      visitor, burn_in_count, thinning);
+  return TaxonNameMunging::DequoteTagStringMap(TagTaxonMap());
+}
+
+TagStringMap Driver::StreamNewickFileGZ(const std::string &fname,
+                                        const TreeVisitor &visitor,
+                                        size_t burn_in_count, size_t thinning) {
+  Clear();
+  std::ifstream in_compressed(fname.c_str());
+  if (!in_compressed) {
+    Failwith("Cannot open the File : " + fname);
+  }
+  zlib::ZStringBuf zbuf(in_compressed, zlib::ZStringBuf::default_buf_size_,
+                        zlib::ZStringBuf::default_buf_size_, thread_count_);
+  std::istream in(&zbuf);
+  // Let inflation errors through rather than just setting badbit.
+  in.exceptions(std::ios::badbit);
+  std::string buffer;
+  StreamNewick(StreamLineSource(in, buffer, false), visitor, burn_in_count, thinning);
+  return TaxonNameMunging::DequoteTagStringMap(TagTaxonMap());
+}
+
+TagStringMap Driver::StreamNexusFile(const std::string &fname,
+                                     const TreeVisitor &visitor, size_t burn_in_count,
+                                     size_t thinning) {
+  std::ifstream in(fname.c_str());
+  if (!in) {
+    throw std::runtime_error("Cannot open file.");
+  }
+  return StreamNexus(in, visitor, burn_in_count, thinning);
+}
+
+TagStringMap Driver::StreamNexusFileGZ(const std::string &fname,
+                                       const TreeVisitor &visitor, size_t burn_in_count,
+                                       size_t thinning) {
+  std::ifstream in_compressed(fname.c_str());
+  if (!in_compressed) {
+    throw std::runtime_error("Cannot open file.");
+  }
+  zlib::ZStringBuf zbuf(in_compressed, zlib::ZStringBuf::default_buf_size_,
+                        zlib::ZStringBuf::default_buf_size_, thread_count_);
+  std::istream in(&zbuf);
+  // Let inflation errors through rather than just setting badbit.
+  in.exceptions(std::ios::badbit);
+  return StreamNexus(in, visitor, burn_in_count, thinning);
+}
+
+TagStringMap Driver::StreamNexus(std::istream &in, const TreeVisitor &visitor,
+                                 size_t burn_in_count, size_t thinning) {
+  Clear();
+  try {
+    std::string buffer;
+    auto long_name_taxon_map = ParseNexusTranslateBlock(in, buffer);
+    StreamNewick(StreamLineSource(in, buffer, true), visitor, burn_in_count, thinning);
+    return TaxonNameMunging::DequoteTagStringMap(long_name_taxon_map);
   } catch (const std::exception &exception) {
     Failwith(std::string("Problem parsing Nexus file:\n") + exception.what());
   }
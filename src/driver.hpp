@@ -5,11 +5,15 @@
 
 #pragma once
 
+#include <functional>
 #include <map>
 #include <memory>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include "fast_newick_parser.hpp"
 #include "parser.hpp"
 #include "sugar.hpp"
 #include "tree_collection.hpp"
@@ -39,7 +43,7 @@ class Driver {
   int trace_parsing_;
   // Whether to generate scanner debug traces.
   bool trace_scanning_;
-  // The most recent tree parsed.
+  // The most recent tree parsed by Bison.
   std::shared_ptr<Tree> latest_tree_;
   // Map from taxon names to their numerical identifiers.
   std::map<std::string, uint32_t> taxa_;
@@ -48,34 +52,108 @@ class Driver {
   // The token's location, used by the scanner to give good debug info.
   yy::location location_;
 
+  // Parse files on this many threads. The tree lines of a file are split into ranges,
+  // each parsed with its own Driver state, and the trees are kept in file order. The
+  // taxon numbering is fixed by the translate block or the first tree, as usual. BGZF
+  // compressed files are also inflated on this many threads.
+  void SetThreadCount(size_t thread_count);
+  size_t GetThreadCount() const { return thread_count_; }
+  // Once the taxa are known, parse tree lines with FastNewickParser where we can,
+  // falling back to Bison for anything it doesn't handle. This is on by default.
+  void SetUseFastNewickParser(bool use_fast_newick_parser);
+  // The number of trees parsed by FastNewickParser since the last Clear().
+  size_t GetFastParsedTreeCount() const { return fast_parsed_tree_count_; }
+
   // These three parsing methods also remove quotes from Newick strings and Nexus files.
   // Make a parser and then parse a string for a one-off parsing.
   TreeCollection ParseString(const std::string& s);
   // Run the parser on a Newick file.
   TreeCollection ParseNewickFile(const std::string& fname);
-  // Run the parser on a gzip-ed Newick file.
+  // Run the parser on a gzip-ed Newick file, parsing trees as they are inflated.
   TreeCollection ParseNewickFileGZ(const std::string& fname);
   // Run the parser on a Nexus file. The Nexus file must have a translate block, and the
   // leaf tags are assigned according to the order of names in the translate block.
   TreeCollection ParseNexusFile(const std::string& fname);
   // Run the parser on a gzip-ed Nexus file. Check ParseNexusFile() for details.
   TreeCollection ParseNexusFileGZ(const std::string& fname);
-  // Clear out stored state.
+
+  // Called by the streaming methods below on each tree that they keep.
+  using TreeVisitor = std::function<void(Tree)>;
+  // These streaming methods parse a tree file one tree at a time, handing each tree to
+  // `visitor` rather than collecting them, so that memory use doesn't grow with the
+  // length of the file. The first burn_in_count trees are dropped, and then every
+  // thinning-th tree is kept. Dropped trees aren't parsed at all, except for the first
+  // tree of a Newick file, which sets up the taxa. They parse on a single thread, and
+  // return the dequoted map from leaf tags to taxon names.
+  TagStringMap StreamNewickFile(const std::string& fname, const TreeVisitor& visitor,
+                                size_t burn_in_count = 0, size_t thinning = 1);
+  TagStringMap StreamNewickFileGZ(const std::string& fname, const TreeVisitor& visitor,
+                                  size_t burn_in_count = 0, size_t thinning = 1);
+  TagStringMap StreamNexusFile(const std::string& fname, const TreeVisitor& visitor,
+                               size_t burn_in_count = 0, size_t thinning = 1);
+  TagStringMap StreamNexusFileGZ(const std::string& fname, const TreeVisitor& visitor,
+                                 size_t burn_in_count = 0, size_t thinning = 1);
+  // Clear out stored state. The thread count and parser choice are kept.
   void Clear();
   // Make the map from the edge tags of the tree to the taxon names from taxa_.
   TagStringMap TagTaxonMap();
 
  private:
+  // A line of a tree file starting at its first '(', along with its line number. The
+  // newick_ views the buffer holding the file.
+  struct TreeLine {
+    unsigned int line_number_;
+    std::string_view newick_;
+  };
+  using TreeLineVector = std::vector<TreeLine>;
+  // Puts the next line of a file into its argument, returning false at the end.
+  using LineSource = std::function<bool(std::string_view&)>;
+
+  size_t thread_count_;
+  bool use_fast_newick_parser_;
+  size_t fast_parsed_tree_count_;
+
+  static inline const size_t parse_lines_per_chunk_ = 64;
+
   // Scan a string with flex.
   void ScanString(const std::string& str);
   // Parse a string with an existing parser object.
   Tree ParseString(yy::parser* parser_instance, const std::string& str);
-  // Run the parser on a Newick stream.
-  TreeCollection ParseNewick(std::istream& in);
+  // Parse a single tree line, with fast_parser if we can. The fast parser is made on
+  // first use once the taxa are known.
+  Tree ParseTreeLine(yy::parser* parser_instance,
+                     std::optional<FastNewickParser>& fast_parser,
+                     const TreeLine& tree_line);
+  // Parse the tree lines in the half-open range [begin, end).
+  Tree::TreeVector ParseTreeLines(const TreeLineVector& tree_lines, size_t begin,
+                                  size_t end);
+  // Parse the tree lines from begin onwards on thread_count_ threads, appending the
+  // trees to `trees` in order.
+  void ParseTreeLinesInParallel(const TreeLineVector& tree_lines, size_t begin,
+                                Tree::TreeVector& trees);
+  // Parse the tree lines on thread_count_ threads, appending the trees to `trees` in
+  // order. If the taxa aren't known yet, the first tree sets them up.
+  void ParseTreeLinesInto(const TreeLineVector& tree_lines, Tree::TreeVector& trees);
+  // Parse the trees of the lines from next_line, so that we never hold the text of the
+  // whole file. With several threads, we parse batches of parse_lines_per_chunk_ lines
+  // per chunk of ThreadPool::ParallelFor.
+  Tree::TreeVector ParseNewickLines(const LineSource& next_line);
+  // Run the parser on the contents of a Newick file.
+  TreeCollection ParseNewick(std::string_view contents);
   // Runs ParseNewick() and dequotes the resulting trees.
-  TreeCollection ParseAndDequoteNewick(std::istream& in);
+  TreeCollection ParseAndDequoteNewick(std::string_view contents);
   // Run the parser on a Nexus stream.
   TreeCollection ParseNexus(std::istream& in);
+  // Read a Nexus stream up to its first tree, setting up taxa_ with the short names of
+  // the translate block. Returns the map from leaf tags to the long names. The last
+  // line read is left in `line`, as it may hold the first tree.
+  TagStringMap ParseNexusTranslateBlock(std::istream& in, std::string& line);
+  // The trees of the lines from next_line, as described for StreamNewickFile.
+  void StreamNewick(const LineSource& next_line, const TreeVisitor& visitor,
+                    size_t burn_in_count, size_t thinning);
+  // Stream the trees of a Nexus stream, as described for StreamNewickFile.
+  TagStringMap StreamNexus(std::istream& in, const TreeVisitor& visitor,
+                           size_t burn_in_count, size_t thinning);
 };
 
 #ifdef DOCTEST_LIBRARY_INCLUDED
@@ -131,5 +209,107 @@ TEST_CASE("Driver") {
   auto beast_nexus_gz =
       driver.ParseNexusFileGZ("data/test_beast_tree_parsing.nexus.gz");
   CHECK_EQ(beast_nexus, beast_nexus_gz);
+  // FastNewickParser gives the same trees as Bison, with the first tree of a Newick
+  // file and any trees with comments left to Bison.
+  for (const auto& [fname, is_nexus, fast_parsed_tree_count] :
+       std::vector<std::tuple<std::string, bool, size_t>>{
+           {"data/DS1.subsampled_10.t.nwk", false, 9},
+           {"data/DS1.subsampled_10.t.reordered", true, 10},
+           {"data/test_beast_tree_parsing.nexus", true, 0},
+           {"data/five_taxon_unrooted.nwk", false, 3}}) {
+    auto parse = [&driver, &fname = fname, is_nexus = is_nexus]() {
+      return is_nexus ? driver.ParseNexusFile(fname) : driver.ParseNewickFile(fname);
+    };
+    driver.SetUseFastNewickParser(false);
+    const auto bison_collection = parse();
+    CHECK_EQ(driver.GetFastParsedTreeCount(), 0);
+    driver.SetUseFastNewickParser(true);
+    CHECK_EQ(parse(), bison_collection);
+    CHECK_EQ(driver.GetFastParsedTreeCount(), fast_parsed_tree_count);
+  }
+  // Parsing on several threads gives the same trees in the same order, whether the
+  // taxa come from the first tree or from a translate block.
+  driver.SetThreadCount(3);
+  CHECK_EQ(driver.ParseNewickFile("data/DS1.subsampled_10.t.nwk"), newick_collection);
+  CHECK_EQ(driver.ParseNewickFileGZ("data/DS1.subsampled_10.t.nwk.gz"),
+           newick_collection);
+  CHECK_EQ(driver.ParseNexusFile("data/DS1.subsampled_10.t.reordered"),
+           nexus_collection);
+  CHECK_EQ(driver.ParseNexusFile("data/test_beast_tree_parsing.nexus"), beast_nexus);
+  // Errors on the worker threads make it back to us.
+  {
+    std::ofstream bad_taxon_file("_ignore/bad_taxon.nwk");
+    bad_taxon_file << "(a:1,b:1,c:1):0;\n(b:1,a:1,c:1):0;\n(a:1,b:1,d:1):0;\n";
+  }
+  CHECK_THROWS(driver.ParseNewickFile("_ignore/bad_taxon.nwk"));
+  // Multi-member gzip and BGZF files, on one thread and on several. Concatenating
+  // many copies makes for more output than fits in the ring of buffers.
+  const size_t copy_count = 300;
+  for (const auto& fname :
+       {"data/DS1.subsampled_10.t.nwk.multi.gz", "data/DS1.subsampled_10.t.nwk.bgz"}) {
+    {
+      std::ifstream in(fname, std::ios::binary);
+      const std::string contents(std::istreambuf_iterator<char>(in), {});
+      std::ofstream copies_file("_ignore/copies.gz", std::ios::binary);
+      for (size_t copy_idx = 0; copy_idx < copy_count; copy_idx++) {
+        copies_file << contents;
+      }
+      std::ofstream truncated_file("_ignore/truncated.gz", std::ios::binary);
+      truncated_file << contents.substr(0, contents.size() / 2);
+    }
+    for (const size_t thread_count : {1, 3}) {
+      driver.SetThreadCount(thread_count);
+      CHECK_EQ(driver.ParseNewickFileGZ(fname), newick_collection);
+      const auto copies = driver.ParseNewickFileGZ("_ignore/copies.gz");
+      CHECK_EQ(copies.TreeCount(), copy_count * newick_collection.TreeCount());
+      CHECK(copies.Trees().back() == newick_collection.Trees().back());
+      CHECK_THROWS(driver.ParseNewickFileGZ("_ignore/truncated.gz"));
+    }
+  }
+  CHECK_EQ(driver.ParseNexusFileGZ("data/test_beast_tree_parsing.nexus.gz"),
+           beast_nexus);
+  // Reading BGZF from every worker of a shared pool, while those workers wait on the
+  // inflation, doesn't deadlock.
+  {
+    const size_t thread_count = 2;
+    std::vector<TreeCollection> collections(thread_count);
+    ThreadPool::TaskVector tasks;
+    for (size_t task_idx = 0; task_idx < thread_count; task_idx++) {
+      tasks.push_back([&collections, task_idx, thread_count](size_t) {
+        Driver task_driver;
+        task_driver.SetThreadCount(thread_count);
+        collections[task_idx] =
+            task_driver.ParseNewickFileGZ("data/DS1.subsampled_10.t.nwk.bgz");
+      });
+    }
+    ThreadPool::Shared(thread_count).Run(std::move(tasks));
+    for (const auto& collection : collections) {
+      CHECK_EQ(collection, newick_collection);
+    }
+  }
+  // Streaming hands over the trees that are left after burn-in and thinning, in order.
+  Tree::TreeVector streamed_trees;
+  auto keep_tree = [&streamed_trees](Tree tree) {
+    streamed_trees.push_back(std::move(tree));
+  };
+  // Collect the trees streamed so far along with their taxa.
+  auto streamed_collection = [&streamed_trees](TagStringMap tag_taxon_map) {
+    return TreeCollection(std::exchange(streamed_trees, {}), std::move(tag_taxon_map));
+  };
+  const auto& ds1_trees = newick_collection.Trees();
+  CHECK_EQ(streamed_collection(driver.StreamNewickFile("data/DS1.subsampled_10.t.nwk",
+                                                       keep_tree, 3, 2)),
+           TreeCollection({ds1_trees[3], ds1_trees[5], ds1_trees[7], ds1_trees[9]},
+                          newick_collection.TagTaxonMap()));
+  CHECK_EQ(streamed_collection(driver.StreamNewickFileGZ(
+               "data/DS1.subsampled_10.t.nwk.gz", keep_tree, 0, 3)),
+           TreeCollection({ds1_trees[0], ds1_trees[3], ds1_trees[6], ds1_trees[9]},
+                          newick_collection.TagTaxonMap()));
+  CHECK_EQ(streamed_collection(driver.StreamNexusFile(
+               "data/DS1.subsampled_10.t.reordered", keep_tree, 10)),
+           TreeCollection({}, nexus_collection.TagTaxonMap()));
+  CHECK_EQ(streamed_collection(driver.StreamNexusFileGZ(
+               "data/test_beast_tree_parsing.nexus.gz", keep_tree)),
+           beast_nexus);
 }
 #endif  // DOCTEST_LIBRARY_INCLUDED
@@ -10,10 +10,15 @@
 Engine::Engine(const EngineSpecification &engine_specification,
                const PhyloModelSpecification &model_specification,
                SitePattern site_pattern)
-    : site_pattern_(std::move(site_pattern)) {
+    : site_pattern_(std::move(site_pattern)),
+      tree_batch_size_(engine_specification.tree_batch_size_) {
   if (engine_specification.thread_count_ == 0) {
     Failwith("Thread count needs to be strictly positive.");
   }  // else
+  if (tree_batch_size_ == 0) {
+    Failwith("Tree batch size needs to be strictly positive.");
+  }  // else
+  thread_pool_ = &ThreadPool::Shared(engine_specification.thread_count_);
   const auto beagle_preference_flags =
       engine_specification.beagle_flag_vector_.empty()
           ? BEAGLE_FLAG_VECTOR_SSE  // Default flags.
@@ -27,7 +32,7 @@ Engine::Engine(const EngineSpecification &engine_specification,
   for (size_t i = 0; i < engine_specification.thread_count_; i++) {
     fat_beagles_.push_back(std::make_unique<FatBeagle>(
         model_specification, site_pattern_, beagle_preference_flags,
-        engine_specification.use_tip_states_));
+        engine_specification.use_tip_states_, tree_batch_size_));
   }
   if (!engine_specification.beagle_flag_vector_.empty()) {
     std::cout << "We asked BEAGLE for: "
@@ -59,9 +64,58 @@ std::vector<double> Engine::LogLikelihoods(
     const UnrootedTreeCollection &tree_collection,
     const EigenMatrixXdRef phylo_model_params, const bool rescaling,
     const std::optional<PhyloFlags> flags) const {
+  if (tree_batch_size_ > 1) {
+    return BatchedLogLikelihoods(tree_collection, phylo_model_params, rescaling);
+  }
   return FatBeagleParallelize<double, UnrootedTree, UnrootedTreeCollection>(
-      FatBeagle::StaticUnrootedLogLikelihood, fat_beagles_, tree_collection,
-      phylo_model_params, rescaling, flags);
+      FatBeagle::StaticUnrootedLogLikelihood, fat_beagles_, *thread_pool_,
+      tree_collection, phylo_model_params, rescaling, flags);
+}
+
+std::vector<double> Engine::BatchedLogLikelihoods(
+    const UnrootedTreeCollection &tree_collection,
+    EigenMatrixXdRef phylo_model_params, const bool rescaling) const {
+  Assert(static_cast<Eigen::Index>(tree_collection.TreeCount()) ==
+             phylo_model_params.rows(),
+         "We phylo_model_params needs as many rows as we have trees.");
+  // A batch is a run of consecutive trees that share model parameters, given as the
+  // boundaries between batches.
+  SizeVector batch_boundaries = {0};
+  for (size_t tree_number = 1; tree_number < tree_collection.TreeCount();
+       tree_number++) {
+    const size_t batch_start = batch_boundaries.back();
+    if (tree_number - batch_start == tree_batch_size_ ||
+        phylo_model_params.row(tree_number) != phylo_model_params.row(batch_start)) {
+      batch_boundaries.push_back(tree_number);
+    }
+  }
+  batch_boundaries.push_back(tree_collection.TreeCount());
+  const size_t batch_count = batch_boundaries.size() - 1;
+
+  std::vector<double> results(tree_collection.TreeCount());
+  thread_pool_->ParallelFor(
+      batch_count,
+      [&batch_boundaries](size_t batch_idx) {
+        return static_cast<double>(batch_boundaries[batch_idx + 1] -
+                                   batch_boundaries[batch_idx]);
+      },
+      [this, &results, &batch_boundaries, &tree_collection, &phylo_model_params,
+       rescaling](size_t worker_idx, size_t begin, size_t end) {
+        FatBeagle *fat_beagle = fat_beagles_[worker_idx].get();
+        fat_beagle->SetRescaling(rescaling);
+        const auto &trees = tree_collection.Trees();
+        for (size_t batch_idx = begin; batch_idx < end; batch_idx++) {
+          const auto batch_start = batch_boundaries[batch_idx];
+          const auto batch_end = batch_boundaries[batch_idx + 1];
+          fat_beagle->SetParameters(phylo_model_params.row(batch_start));
+          const UnrootedTree::UnrootedTreeVector batch(trees.begin() + batch_start,
+                                                       trees.begin() + batch_end);
+          const auto log_likelihoods = fat_beagle->BatchLogLikelihoods(batch);
+          std::copy(log_likelihoods.begin(), log_likelihoods.end(),
+                    results.begin() + batch_start);
+        }
+      });
+  return results;
 }
 
 std::vector<double> Engine::LogLikelihoods(
@@ -69,8 +123,8 @@ std::vector<double> Engine::LogLikelihoods(
     const EigenMatrixXdRef phylo_model_params, const bool rescaling,
     const std::optional<PhyloFlags> flags) const {
   return FatBeagleParallelize<double, RootedTree, RootedTreeCollection>(
-      FatBeagle::StaticRootedLogLikelihood, fat_beagles_, tree_collection,
-      phylo_model_params, rescaling, flags);
+      FatBeagle::StaticRootedLogLikelihood, fat_beagles_, *thread_pool_,
+      tree_collection, phylo_model_params, rescaling, flags);
 }
 
 std::vector<double> Engine::UnrootedLogLikelihoods(
@@ -78,8 +132,8 @@ std::vector<double> Engine::UnrootedLogLikelihoods(
     const EigenMatrixXdRef phylo_model_params, const bool rescaling,
     const std::optional<PhyloFlags> flags) const {
   return FatBeagleParallelize<double, RootedTree, RootedTreeCollection>(
-      FatBeagle::StaticUnrootedLogLikelihoodOfRooted, fat_beagles_, tree_collection,
-      phylo_model_params, rescaling, flags);
+      FatBeagle::StaticUnrootedLogLikelihoodOfRooted, fat_beagles_, *thread_pool_,
+      tree_collection, phylo_model_params, rescaling, flags);
 }
 
 std::vector<double> Engine::LogDetJacobianHeightTransform(
@@ -87,8 +141,8 @@ std::vector<double> Engine::LogDetJacobianHeightTransform(
     const EigenMatrixXdRef phylo_model_params, const bool rescaling,
     const std::optional<PhyloFlags> flags) const {
   return FatBeagleParallelize<double, RootedTree, RootedTreeCollection>(
-      FatBeagle::StaticLogDetJacobianHeightTransform, fat_beagles_, tree_collection,
-      phylo_model_params, rescaling, flags);
+      FatBeagle::StaticLogDetJacobianHeightTransform, fat_beagles_, *thread_pool_,
+      tree_collection, phylo_model_params, rescaling, flags);
 }
 
 std::vector<PhyloGradient> Engine::Gradients(
@@ -96,8 +150,8 @@ std::vector<PhyloGradient> Engine::Gradients(
     const EigenMatrixXdRef phylo_model_params, const bool rescaling,
     const std::optional<PhyloFlags> flags) const {
   return FatBeagleParallelize<PhyloGradient, UnrootedTree, UnrootedTreeCollection>(
-      FatBeagle::StaticUnrootedGradient, fat_beagles_, tree_collection,
-      phylo_model_params, rescaling, flags);
+      FatBeagle::StaticUnrootedGradient, fat_beagles_, *thread_pool_,
+      tree_collection, phylo_model_params, rescaling, flags);
 }
 
 std::vector<PhyloGradient> Engine::Gradients(
@@ -105,8 +159,8 @@ std::vector<PhyloGradient> Engine::Gradients(
     const EigenMatrixXdRef phylo_model_params, const bool rescaling,
     const std::optional<PhyloFlags> flags) const {
   return FatBeagleParallelize<PhyloGradient, RootedTree, RootedTreeCollection>(
-      FatBeagle::StaticRootedGradient, fat_beagles_, tree_collection,
-      phylo_model_params, rescaling, flags);
+      FatBeagle::StaticRootedGradient, fat_beagles_, *thread_pool_,
+      tree_collection, phylo_model_params, rescaling, flags);
 }
 
 std::vector<DoubleVector> Engine::GradientLogDeterminantJacobian(
@@ -114,8 +168,8 @@ std::vector<DoubleVector> Engine::GradientLogDeterminantJacobian(
     const EigenMatrixXdRef phylo_model_params, const bool rescaling,
     const std::optional<PhyloFlags> flags) const {
   return FatBeagleParallelize<DoubleVector, RootedTree, RootedTreeCollection>(
-      FatBeagle::StaticGradientLogDeterminantJacobian, fat_beagles_, tree_collection,
-      phylo_model_params, rescaling, flags);
+      FatBeagle::StaticGradientLogDeterminantJacobian, fat_beagles_, *thread_pool_,
+      tree_collection, phylo_model_params, rescaling, flags);
 }
 
 const FatBeagle *const Engine::GetFirstFatBeagle() const {
@@ -15,12 +15,17 @@
 #include "phylo_model.hpp"
 #include "rooted_tree_collection.hpp"
 #include "site_pattern.hpp"
+#include "thread_pool.hpp"
 #include "unrooted_tree_collection.hpp"
 
 struct EngineSpecification {
   const size_t thread_count_;
   const std::vector<BeagleFlags> &beagle_flag_vector_;
   const bool use_tip_states_;
+  // If greater than 1, LogLikelihoods of unrooted trees evaluates up to this many
+  // trees sharing model parameters with each batch of BEAGLE calls (see
+  // FatBeagle::BatchLogLikelihoods).
+  const size_t tree_batch_size_ = 1;
 };
 
 class Engine {
@@ -64,5 +69,13 @@ class Engine {
 
  private:
   SitePattern site_pattern_;
+  // One FatBeagle per thread of the pool, used by the worker of the same index.
   std::vector<std::unique_ptr<FatBeagle>> fat_beagles_;
+  // The process-wide pool with our thread count.
+  ThreadPool *thread_pool_;
+  size_t tree_batch_size_;
+
+  std::vector<double> BatchedLogLikelihoods(
+      const UnrootedTreeCollection &tree_collection,
+      EigenMatrixXdRef phylo_model_params, const bool rescaling) const;
 };
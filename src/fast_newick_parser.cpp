@@ -0,0 +1,181 @@
+// Copyright 2019-2022 bito project contributors.
+// bito is free software under the GPLv3; see LICENSE file for details.
+
+#include "fast_newick_parser.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdlib>
+
+namespace {
+
+// The characters of a Newick label, following LABEL in scanner.ll: printable
+// non-space characters other than the ones with a meaning of their own.
+bool IsLabelChar(char c) {
+  switch (c) {
+    case '(':
+    case ')':
+    case ';':
+    case ',':
+    case ':':
+    case '\'':
+    case '[':
+    case ']':
+      return false;
+    default:
+      return c > ' ' && c < 127;
+  }
+}
+
+bool IsBlankChar(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+
+// Parse the whole of [begin, end) as a double, as std::stod does for Bison. The
+// character at end must not continue a number.
+std::optional<double> ParseDouble(const char* begin, const char* end) {
+  double value;
+// std::from_chars is much faster than strtod, but not all standard libraries have it
+// for floating point yet.
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+  const auto [from_chars_end, error] = std::from_chars(begin, end, value);
+  if (error != std::errc() || from_chars_end != end) {
+    return std::nullopt;
+  }
+#else
+  char* strtod_end;
+  value = std::strtod(begin, &strtod_end);
+  if (strtod_end != end) {
+    return std::nullopt;
+  }
+#endif
+  return value;
+}
+
+}  // namespace
+
+FastNewickParser::FastNewickParser(const std::map<std::string, uint32_t>& taxa) {
+  taxon_ids_.reserve(taxa.size());
+  size_t taxon_count = 0;
+  for (const auto& [name, id] : taxa) {
+    taxon_ids_.emplace(std::string_view(name), id);
+    taxon_count = std::max(taxon_count, static_cast<size_t>(id) + 1);
+  }
+  taxon_seen_.resize(taxon_count);
+}
+
+std::optional<Tree> FastNewickParser::Parse(std::string_view newick) {
+  node_stack_.clear();
+  open_positions_.clear();
+  branch_lengths_.clear();
+  std::fill(taxon_seen_.begin(), taxon_seen_.end(), false);
+  const char* position = newick.data();
+  const char* const end = newick.data() + newick.size();
+  // The end of the label starting at position.
+  auto label_end = [&position, end]() {
+    const char* label_end = position;
+    while (label_end < end && IsLabelChar(*label_end)) {
+      label_end++;
+    }
+    return label_end;
+  };
+  // We alternate between expecting a node and expecting what comes after a node.
+  bool expecting_node = true;
+  bool has_branch_length = false;
+  while (position < end) {
+    if (expecting_node) {
+      if (*position == '(') {
+        open_positions_.push_back(node_stack_.size());
+        position++;
+        continue;
+      }
+      // else we have a leaf.
+      const char* name_end = label_end();
+      auto search = taxon_ids_.find(
+          std::string_view(position, static_cast<size_t>(name_end - position)));
+      // Bison gives the error message for unknown or repeated taxa.
+      if (search == taxon_ids_.end() || taxon_seen_[search->second]) {
+        return std::nullopt;
+      }
+      taxon_seen_[search->second] = true;
+      node_stack_.push_back(Node::Leaf(search->second));
+      position = name_end;
+      expecting_node = false;
+      has_branch_length = false;
+      continue;
+    }
+    // else we have just finished a node.
+    switch (*position) {
+      case ':': {
+        if (has_branch_length) {
+          return std::nullopt;
+        }
+        position++;
+        const char* number_end = label_end();
+        // The number must be followed by punctuation, which also stops ParseDouble from
+        // reading past the end of the buffer.
+        if (number_end == position || number_end == end ||
+            !(*number_end == ',' || *number_end == ')' || *number_end == ';')) {
+          return std::nullopt;
+        }
+        const auto branch_length = ParseDouble(position, number_end);
+        if (!branch_length.has_value()) {
+          return std::nullopt;
+        }
+        branch_lengths_.emplace_back(node_stack_.back().get(), *branch_length);
+        has_branch_length = true;
+        position = number_end;
+        break;
+      }
+      case ',':
+        if (open_positions_.empty()) {
+          return std::nullopt;
+        }
+        expecting_node = true;
+        position++;
+        break;
+      case ')': {
+        if (open_positions_.empty()) {
+          return std::nullopt;
+        }
+        const auto first_child = node_stack_.begin() + open_positions_.back();
+        open_positions_.pop_back();
+        // A node with a single child would share its tag, which Bison reports.
+        if (node_stack_.end() - first_child < 2) {
+          return std::nullopt;
+        }
+        Node::NodePtrVec children(std::make_move_iterator(first_child),
+                                  std::make_move_iterator(node_stack_.end()));
+        node_stack_.erase(first_child, node_stack_.end());
+        node_stack_.push_back(Node::Join(std::move(children)));
+        has_branch_length = false;
+        position++;
+        break;
+      }
+      case ';': {
+        if (!open_positions_.empty() || node_stack_.size() != 1) {
+          return std::nullopt;
+        }
+        position++;
+        while (position < end && IsBlankChar(*position)) {
+          position++;
+        }
+        if (position != end) {
+          return std::nullopt;
+        }
+        const auto topology = node_stack_.front();
+        node_stack_.clear();
+        // Polish assigns the node ids, which index the branch lengths. We have made
+        // sure that the tags are unique, so we can skip building the tag map.
+        topology->PolishWithoutTagMap();
+        Tree::BranchLengthVector branch_lengths(topology->Id() + 1, 0.);
+        for (const auto& [node, branch_length] : branch_lengths_) {
+          branch_lengths[node->Id()] = branch_length;
+        }
+        return Tree(topology, std::move(branch_lengths));
+      }
+      default:
+        return std::nullopt;
+    }
+  }
+  // We ran out of string before the ';'.
+  return std::nullopt;
+}
@@ -0,0 +1,72 @@
+// Copyright 2019-2022 bito project contributors.
+// bito is free software under the GPLv3; see LICENSE file for details.
+//
+// A hand-written parser for the common case of plain Newick: unquoted taxon names
+// from a known taxon set, optional numeric branch lengths, no comments or whitespace,
+// and no internal node labels. It scans a string_view in place, looks taxon names up
+// without copying them, and writes branch lengths straight into the branch length
+// vector of the Tree, which is many times faster than going through Flex and Bison.
+//
+// Anything else is left to the Bison parser: Parse returns std::nullopt, and the
+// Driver parses the string again the usual way. Bison then either handles the
+// exotic syntax or gives a proper error message. Both parsers build the topology
+// with Node::Leaf and Node::Join, so they give identical trees.
+
+#pragma once
+
+#include <map>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+
+#include "sugar.hpp"
+#include "tree.hpp"
+
+class FastNewickParser {
+ public:
+  // The taxon map is that of the Driver, and must outlive this parser.
+  explicit FastNewickParser(const std::map<std::string, uint32_t>& taxa);
+
+  // Parse a tree starting at its first '(', or return std::nullopt if it isn't plain
+  // Newick as described above. Whitespace after the closing ';' is allowed.
+  std::optional<Tree> Parse(std::string_view newick);
+
+ private:
+  std::unordered_map<std::string_view, uint32_t> taxon_ids_;
+  // Scratch space, kept between calls to save on allocations.
+  // The subtrees that have been parsed but not yet joined.
+  Node::NodePtrVec node_stack_;
+  // The positions in node_stack_ at which each open '(' starts.
+  SizeVector open_positions_;
+  // Which taxa we have seen so far in this tree.
+  std::vector<bool> taxon_seen_;
+  // The branch lengths that we have parsed, for the nodes they belong to.
+  std::vector<std::pair<const Node*, double>> branch_lengths_;
+};
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+TEST_CASE("FastNewickParser") {
+  std::map<std::string, uint32_t> taxa = {{"a", 0}, {"b", 1}, {"c", 2}, {"d", 3}};
+  TagStringMap tag_taxon_map;
+  for (const auto& [name, id] : taxa) {
+    tag_taxon_map[PackInts(id, 1)] = name;
+  }
+  FastNewickParser parser(taxa);
+  auto tree = parser.Parse("((b:2,a:1.5):0.25,(c,d:1e-3):0.5):0;\r\n");
+  REQUIRE(tree.has_value());
+  CHECK_EQ(tree->Newick(tag_taxon_map), "((a:1.5,b:2):0.25,(c:0,d:0.001):0.5):0;");
+  // Multifurcations are fine.
+  CHECK(parser.Parse("(a,b,c,d);").has_value());
+  // These are all left to Bison.
+  for (const auto* newick : {"((a,b),(c,d))", "((a,b),(c,'d'));", "((a,b),(c,d)x);",
+                             "((a, b),(c,d));", "((a,b),(c,d:1[&rate=1]));",
+                             "((a,b),(c,d:1x));", "((a,b),(c,e));", "((a,b),(c,d)));",
+                             "((a,b),(c,d)); x", "((a,b),(c,d:1:2));",
+                             "((a,b),(c,a));", "(((a,b)),(c,d));"}) {
+    CHECK_FALSE(parser.Parse(newick).has_value());
+  }
+  // A parse that fails part way doesn't get in the way of the next one.
+  CHECK_EQ(parser.Parse("(a:1,(b:2,c:3):4,d:5):0;")->Newick(tag_taxon_map),
+           "(a:1,(b:2,c:3):4,d:5):0;");
+}
+#endif  // DOCTEST_LIBRARY_INCLUDED
@@ -0,0 +1,151 @@
+// Copyright 2019-2022 bito project contributors.
+// bito is free software under the GPLv3; see LICENSE file for details.
+
+#include "fasta_file.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+FastaFile::FastaFile(const std::string &path) : path_(path), mmapped_file_(path) {
+  const std::string_view contents = mmapped_file_.View();
+  // The lines of the sequence that we are reading.
+  const char *first_line = nullptr;
+  const char *end_of_lines = nullptr;
+  size_t line_count = 0;
+  size_t last_line_site_count = 0;
+  size_t record_site_count = 0;
+  bool is_regular = true;
+  auto finish_record = [&]() {
+    if (records_.empty()) {
+      return;
+    }
+    auto &record = records_.back();
+    if (records_.size() == 1) {
+      site_count_ = record_site_count;
+    } else if (record_site_count != site_count_) {
+      Failwith("Sequences of the alignment are not all the same length.");
+    }
+    if (line_count > 0 &&
+        (!is_regular || last_line_site_count > record.line_site_count_)) {
+      // Copy the sites out, skipping line ends and blank lines.
+      std::string sequence;
+      sequence.reserve(record_site_count);
+      for (const char *position = first_line; position < end_of_lines;) {
+        const char *line_end = static_cast<const char *>(
+            std::memchr(position, '\n', static_cast<size_t>(end_of_lines - position)));
+        if (line_end == nullptr) {
+          line_end = end_of_lines;
+        }
+        const char *next_line = line_end + (line_end < end_of_lines ? 1 : 0);
+        if (line_end > position && line_end[-1] == '\r') {
+          line_end--;
+        }
+        sequence.append(position, static_cast<size_t>(line_end - position));
+        position = next_line;
+      }
+      record.copy_idx_ = copied_sequences_.size();
+      copied_sequences_.push_back(std::move(sequence));
+    }
+  };
+  size_t position = 0;
+  while (position < contents.size()) {
+    auto line_end = contents.find('\n', position);
+    if (line_end == std::string_view::npos) {
+      line_end = contents.size();
+    }
+    const size_t next_line = std::min(line_end + 1, contents.size());
+    std::string_view line = contents.substr(position, line_end - position);
+    if (!line.empty() && line.back() == '\r') {
+      line.remove_suffix(1);
+    }
+    if (line.empty()) {
+      // Blank lines are skipped.
+    } else if (line[0] == '>') {
+      finish_record();
+      const auto name = line.substr(1);
+      if (!sequence_indices_.insert({name, records_.size()}).second) {
+        Failwith("Sequence '" + std::string(name) + "' appears twice in " + path_ +
+                 ".");
+      }
+      records_.push_back({name, nullptr, 0, 0, std::nullopt});
+      line_count = 0;
+      record_site_count = 0;
+      is_regular = true;
+    } else if (!records_.empty()) {
+      // Anything before the first name is ignored.
+      auto &record = records_.back();
+      if (line_count == 0) {
+        first_line = line.data();
+        record.sites_ = line.data();
+        record.line_site_count_ = line.size();
+        record.line_stride_ = next_line - position;
+      } else {
+        // All lines but the last must be full, and evenly spaced.
+        is_regular = is_regular && last_line_site_count == record.line_site_count_ &&
+                     line.data() == first_line + line_count * record.line_stride_;
+      }
+      last_line_site_count = line.size();
+      end_of_lines = contents.data() + line_end;
+      line_count++;
+      record_site_count += line.size();
+    }
+    position = next_line;
+  }
+  finish_record();
+  if (records_.empty()) {
+    Failwith("No sequences found in " + path_ + ".");
+  }
+}
+
+size_t FastaFile::SequenceIndex(const std::string &name) const {
+  const auto search = sequence_indices_.find(name);
+  if (search == sequence_indices_.end()) {
+    Failwith("Taxon '" + name + "' not found in alignment.");
+  }
+  return search->second;
+}
+
+void FastaFile::CopySites(size_t sequence_idx, size_t begin, size_t end,
+                          char *out) const {
+  Assert(begin <= end && end <= site_count_, "Site range out of range in CopySites.");
+  const auto &record = records_[sequence_idx];
+  if (record.copy_idx_.has_value()) {
+    std::memcpy(out, copied_sequences_[*record.copy_idx_].data() + begin, end - begin);
+    return;
+  }
+  while (begin < end) {
+    const size_t line_idx = begin / record.line_site_count_;
+    const size_t line_offset = begin % record.line_site_count_;
+    const size_t count = std::min(record.line_site_count_ - line_offset, end - begin);
+    std::memcpy(out, record.sites_ + line_idx * record.line_stride_ + line_offset,
+                count);
+    out += count;
+    begin += count;
+  }
+}
+
+std::string_view FastaFile::SitesView(size_t sequence_idx, size_t begin,
+                                      size_t end) const {
+  Assert(begin <= end && end <= site_count_, "Site range out of range in SitesView.");
+  const auto &record = records_[sequence_idx];
+  if (record.copy_idx_.has_value()) {
+    return std::string_view(copied_sequences_[*record.copy_idx_]).substr(begin,
+                                                                        end - begin);
+  }
+  if (begin == end) {
+    return {};
+  }
+  const size_t line_idx = begin / record.line_site_count_;
+  if (line_idx != (end - 1) / record.line_site_count_) {
+    return {};
+  }
+  return {record.sites_ + line_idx * record.line_stride_ +
+              begin % record.line_site_count_,
+          end - begin};
+}
+
+std::string FastaFile::Sequence(size_t sequence_idx) const {
+  std::string sequence(site_count_, ' ');
+  CopySites(sequence_idx, 0, site_count_, sequence.data());
+  return sequence;
+}
@@ -0,0 +1,100 @@
+// Copyright 2019-2022 bito project contributors.
+// bito is free software under the GPLv3; see LICENSE file for details.
+//
+// Read-only access to the sequences of a FASTA file without copying them out. We map
+// the file into memory and index each sequence as samtools faidx does: where its
+// first site is, and how many sites and bytes each of its lines hold, so that any
+// range of sites can be found by arithmetic. Sequences whose lines aren't all the same
+// length (other than the last) can't be indexed this way, so we copy those into
+// strings of their own.
+
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "mmapped_file.hpp"
+#include "sugar.hpp"
+
+class FastaFile {
+ public:
+  explicit FastaFile(const std::string &path);
+
+  size_t SequenceCount() const { return records_.size(); }
+  // The number of sites in each sequence, which must all be the same.
+  size_t SiteCount() const { return site_count_; }
+  // The name of a sequence, without the leading '>'.
+  std::string_view Name(size_t sequence_idx) const {
+    return records_[sequence_idx].name_;
+  }
+  // The index of the sequence with the given name.
+  size_t SequenceIndex(const std::string &name) const;
+  // Copy the sites [begin, end) of a sequence to out.
+  void CopySites(size_t sequence_idx, size_t begin, size_t end, char *out) const;
+  // The sites [begin, end) of a sequence, if they sit together in the file or in a
+  // copied sequence, or an empty view if they span several lines.
+  std::string_view SitesView(size_t sequence_idx, size_t begin, size_t end) const;
+  std::string Sequence(size_t sequence_idx) const;
+
+ private:
+  struct Record {
+    std::string_view name_;
+    // The sites of the sequence, starting at the beginning of its first line.
+    const char *sites_;
+    // The number of sites on each line but the last, and the number of bytes from the
+    // start of one line to the start of the next.
+    size_t line_site_count_;
+    size_t line_stride_;
+    // If the lines don't have a regular layout, the index of our copy of the sequence
+    // in copied_sequences_.
+    std::optional<size_t> copy_idx_;
+  };
+
+  std::string path_;
+  MmappedFile mmapped_file_;
+  std::vector<Record> records_;
+  StringVector copied_sequences_;
+  std::unordered_map<std::string_view, size_t> sequence_indices_;
+  size_t site_count_ = 0;
+};
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+TEST_CASE("FastaFile") {
+  {
+    std::ofstream fasta("_ignore/fasta_file.fasta");
+    fasta << "; a comment\n\n"
+          << ">regular\nACGTA\nCGTAC\nGT\n"
+          << ">single line\r\nTTTTTTTTTTTT\r\n"
+          << ">irregular\nACG\nTACGT\n\nACGT\n";
+  }
+  FastaFile fasta_file("_ignore/fasta_file.fasta");
+  CHECK_EQ(fasta_file.SequenceCount(), 3);
+  CHECK_EQ(fasta_file.SiteCount(), 12);
+  CHECK_EQ(fasta_file.Name(1), "single line");
+  CHECK_EQ(fasta_file.SequenceIndex("irregular"), 2);
+  CHECK_THROWS(fasta_file.SequenceIndex("missing"));
+  for (size_t sequence_idx : {0, 2}) {
+    CHECK_EQ(fasta_file.Sequence(sequence_idx), "ACGTACGTACGT");
+    std::string sites(4, ' ');
+    fasta_file.CopySites(sequence_idx, 3, 7, sites.data());
+    CHECK_EQ(sites, "TACG");
+  }
+  CHECK_EQ(fasta_file.SitesView(0, 5, 10), "CGTAC");
+  CHECK_EQ(fasta_file.SitesView(0, 4, 6), "");
+  CHECK_EQ(fasta_file.SitesView(1, 2, 5), "TTT");
+  CHECK_EQ(fasta_file.SitesView(2, 0, 12), "ACGTACGTACGT");
+  {
+    std::ofstream fasta("_ignore/fasta_file.fasta");
+    fasta << ">a\nACGT\n>b\nACG\n";
+  }
+  CHECK_THROWS(FastaFile("_ignore/fasta_file.fasta"));
+  {
+    std::ofstream fasta("_ignore/fasta_file.fasta");
+    fasta << ">a\nACGT\n>a\nACGT\n";
+  }
+  CHECK_THROWS(FastaFile("_ignore/fasta_file.fasta"));
+}
+#endif  // DOCTEST_LIBRARY_INCLUDED
@@ -12,11 +12,13 @@
 FatBeagle::FatBeagle(const PhyloModelSpecification &specification,
                      const SitePattern &site_pattern,
                      const FatBeagle::PackedBeagleFlags beagle_preference_flags,
-                     bool use_tip_states)
+                     bool use_tip_states, size_t tree_batch_size)
     : phylo_model_(PhyloModel::OfSpecification(specification)),
       rescaling_(false),  // Note: rescaling_ set via the SetRescaling method.
       pattern_count_(static_cast<int>(site_pattern.PatternCount())),
-      use_tip_states_(use_tip_states) {
+      use_tip_states_(use_tip_states),
+      tree_batch_size_(tree_batch_size) {
+  Assert(tree_batch_size_ > 0, "FatBeagle needs a strictly positive batch size.");
   std::tie(beagle_instance_, beagle_flags_) =
       CreateInstance(site_pattern, beagle_preference_flags);
   if (use_tip_states_) {
@@ -42,6 +44,8 @@ const BlockSpecification &FatBeagle::GetPhyloModelBlockSpecification() const {
 void FatBeagle::SetParameters(const EigenVectorXdRef param_vector) {
   phylo_model_->SetParameters(param_vector);
   UpdatePhyloModelInBeagle();
+  // The resident transition matrices were computed with the old parameters.
+  incremental_buffers_valid_ = false;
 }
 
 // This is the "core" of the likelihood calculation, assuming that the tree is
@@ -50,6 +54,7 @@ double FatBeagle::LogLikelihoodInternals(
     const Node::NodePtr topology, const std::vector<double> &branch_lengths) const {
   BeagleAccessories ba(beagle_instance_, rescaling_, topology);
   BeagleOperationVector operations;
+  incremental_buffers_valid_ = false;
   beagleResetScaleFactors(beagle_instance_, 0);
   topology->BinaryIdPostorder(
       [&operations, &ba](int node_id, int child0_id, int child1_id) {
@@ -97,6 +102,298 @@ double FatBeagle::LogLikelihood(const RootedTree &tree,
   return log_likelihood;
 }
 
+// The other trees of a batch use buffers after those used by LogLikelihoodInternals,
+// Gradient and incremental evaluation. Each has a block of scale buffers holding its
+// cumulative scale factors followed by those of its internal nodes, as for position
+// 0.
+int FatBeagle::BatchPartialIndex(const int taxon_count, const size_t batch_idx,
+                                 const int node_id) {
+  if (batch_idx == 0 || node_id < taxon_count) {
+    return node_id;
+  }
+  return 5 * taxon_count - 3 + static_cast<int>(batch_idx - 1) * (taxon_count - 1) +
+         node_id - taxon_count;
+}
+
+int FatBeagle::BatchMatrixIndex(const int taxon_count, const size_t batch_idx,
+                                const int node_id) {
+  if (batch_idx == 0) {
+    return node_id;
+  }
+  return 2 * (2 * taxon_count - 1) +
+         static_cast<int>(batch_idx - 1) * (2 * taxon_count - 2) + node_id;
+}
+
+int FatBeagle::BatchScaleIndex(const int taxon_count, const size_t batch_idx,
+                               const int node_id) {
+  return BatchCumulativeScaleIndex(taxon_count, batch_idx) + node_id - taxon_count + 1;
+}
+
+int FatBeagle::BatchCumulativeScaleIndex(const int taxon_count,
+                                         const size_t batch_idx) {
+  if (batch_idx == 0) {
+    return 0;
+  }
+  return 4 * taxon_count - 2 + static_cast<int>(batch_idx - 1) * taxon_count;
+}
+
+std::vector<double> FatBeagle::BatchLogLikelihoods(
+    const UnrootedTree::UnrootedTreeVector &trees) const {
+  Assert(trees.size() <= tree_batch_size_,
+         "Got more trees than fit in the batch buffers of this FatBeagle.");
+  if (trees.empty()) {
+    return {};
+  }
+  incremental_buffers_valid_ = false;
+  Tree::TreeVector detrifurcated_trees;
+  for (const auto &tree : trees) {
+    detrifurcated_trees.push_back(tree.Detrifurcate());
+  }
+  const BeagleAccessories first_ba(beagle_instance_, rescaling_,
+                                   detrifurcated_trees[0].Topology());
+  const int taxon_count = first_ba.taxon_count_;
+  std::vector<int> matrix_indices;
+  std::vector<double> branch_lengths;
+  BeagleOperationVector operations;
+  std::vector<int> root_buffers;
+  for (size_t batch_idx = 0; batch_idx < trees.size(); batch_idx++) {
+    const auto &tree = detrifurcated_trees[batch_idx];
+    BeagleAccessories ba(beagle_instance_, rescaling_, tree.Topology());
+    for (int node_id = 0; node_id < ba.node_count_ - 1; node_id++) {
+      matrix_indices.push_back(BatchMatrixIndex(taxon_count, batch_idx, node_id));
+      branch_lengths.push_back(tree.BranchLengths()[node_id]);
+    }
+    tree.Topology()->BinaryIdPostorder([&operations, &ba, taxon_count, batch_idx](
+                                           int node_id, int child0_id, int child1_id) {
+      const int destinationScaleWrite =
+          ba.rescaling_ ? BatchScaleIndex(taxon_count, batch_idx, node_id)
+                        : BEAGLE_OP_NONE;
+      operations.push_back({
+          BatchPartialIndex(taxon_count, batch_idx, node_id),  // destinationPartials
+          destinationScaleWrite, ba.destinationScaleRead_,
+          BatchPartialIndex(taxon_count, batch_idx, child0_id),
+          BatchMatrixIndex(taxon_count, batch_idx, child0_id),
+          BatchPartialIndex(taxon_count, batch_idx, child1_id),
+          BatchMatrixIndex(taxon_count, batch_idx, child1_id),
+      });
+    });
+    root_buffers.push_back(BatchPartialIndex(taxon_count, batch_idx, ba.root_id_));
+  }
+  beagleUpdateTransitionMatrices(beagle_instance_, 0, matrix_indices.data(), nullptr,
+                                 nullptr, branch_lengths.data(),
+                                 static_cast<int>(matrix_indices.size()));
+  // BEAGLE accumulates scale factors into a single buffer per call, so we accumulate
+  // each tree's own factors afterwards.
+  beagleUpdatePartials(beagle_instance_, operations.data(),
+                       static_cast<int>(operations.size()), BEAGLE_OP_NONE);
+
+  // Calculating root log likelihoods of several buffers in one BEAGLE call integrates
+  // them as a mixture, so we need a call per tree to get separate values.
+  std::vector<double> log_likelihoods(trees.size());
+  for (size_t batch_idx = 0; batch_idx < trees.size(); batch_idx++) {
+    const int cumulative_scale_index =
+        rescaling_ ? BatchCumulativeScaleIndex(taxon_count, batch_idx) : BEAGLE_OP_NONE;
+    if (rescaling_) {
+      std::vector<int> scale_indices;
+      for (int node_id = taxon_count; node_id < 2 * taxon_count - 1; node_id++) {
+        scale_indices.push_back(BatchScaleIndex(taxon_count, batch_idx, node_id));
+      }
+      beagleResetScaleFactors(beagle_instance_, cumulative_scale_index);
+      beagleAccumulateScaleFactors(beagle_instance_, scale_indices.data(),
+                                   static_cast<int>(scale_indices.size()),
+                                   cumulative_scale_index);
+    }
+    beagleCalculateRootLogLikelihoods(
+        beagle_instance_, &root_buffers[batch_idx],
+        first_ba.category_weight_index_.data(), first_ba.state_frequency_index_.data(),
+        &cumulative_scale_index, first_ba.mysterious_count_,
+        &log_likelihoods[batch_idx]);
+  }
+  return log_likelihoods;
+}
+
+// Slot 0 uses the same buffers as LogLikelihoodInternals. Slot 1 uses the second
+// set of transition matrices, the lower partial buffers after the upper partials,
+// and the scale buffers after those of the upper partials.
+int FatBeagle::IncrementalPartialIndex(const int taxon_count, const int node_id,
+                                       const int slot) {
+  if (slot == 0 || node_id < taxon_count) {
+    return node_id;
+  }
+  return 3 * taxon_count - 2 + node_id;
+}
+
+int FatBeagle::IncrementalMatrixIndex(const int taxon_count, const int node_id,
+                                      const int slot) {
+  return (slot == 0) ? node_id : 2 * taxon_count - 1 + node_id;
+}
+
+int FatBeagle::IncrementalScaleIndex(const int taxon_count, const int node_id,
+                                     const int slot) {
+  return (slot == 0) ? node_id - taxon_count + 1 : 2 * taxon_count - 1 + node_id;
+}
+
+double FatBeagle::IncrementalLogLikelihoodInternals(
+    const Node::NodePtr topology, const std::vector<double> &branch_lengths) {
+  Assert(!proposed_state_.has_value(),
+         "Please commit or revert the pending proposal before making another.");
+  BeagleAccessories ba(beagle_instance_, rescaling_, topology);
+  const int taxon_count = ba.taxon_count_;
+  const auto node_count = static_cast<size_t>(ba.node_count_);
+  if (!incremental_buffers_valid_ || incremental_rescaling_ != rescaling_ ||
+      (committed_state_.has_value() &&
+       committed_state_->children_.size() != node_count)) {
+    committed_state_.reset();
+  }
+  // Without a committed state we compute everything from scratch.
+  const bool full_evaluation = !committed_state_.has_value();
+  IncrementalState proposal;
+  if (full_evaluation) {
+    proposal.children_.assign(node_count, {-1, -1});
+    proposal.partial_slots_.assign(node_count, 0);
+    proposal.matrix_slots_.assign(node_count, 0);
+  } else {
+    proposal = *committed_state_;
+  }
+  proposal.branch_lengths_ = branch_lengths;
+
+  // Recompute the transition matrices of branches whose length changed.
+  std::vector<bool> matrix_updated(node_count, false);
+  std::vector<int> matrix_indices;
+  std::vector<double> matrix_branch_lengths;
+  for (size_t node_id = 0; node_id < node_count - 1; node_id++) {
+    if (full_evaluation ||
+        branch_lengths[node_id] != committed_state_->branch_lengths_[node_id]) {
+      matrix_updated[node_id] = true;
+      proposal.matrix_slots_[node_id] ^= 1;
+      matrix_indices.push_back(IncrementalMatrixIndex(
+          taxon_count, static_cast<int>(node_id), proposal.matrix_slots_[node_id]));
+      matrix_branch_lengths.push_back(branch_lengths[node_id]);
+    }
+  }
+  if (!matrix_indices.empty()) {
+    beagleUpdateTransitionMatrices(beagle_instance_, 0, matrix_indices.data(), nullptr,
+                                   nullptr, matrix_branch_lengths.data(),
+                                   static_cast<int>(matrix_indices.size()));
+  }
+
+  // Recompute the partials of nodes whose children changed, or whose children's
+  // partials or transition matrices changed. The postorder visits children first.
+  std::vector<bool> partial_updated(node_count, false);
+  incremental_updated_node_ids_.clear();
+  BeagleOperationVector operations;
+  topology->BinaryIdPostorder([this, &ba, &proposal, &partial_updated,
+                               &matrix_updated, &operations, full_evaluation,
+                               taxon_count](int node_id, int child0_id, int child1_id) {
+    const std::pair<int, int> children = {child0_id, child1_id};
+    if (!full_evaluation && children == committed_state_->children_[node_id] &&
+        !partial_updated[child0_id] && !partial_updated[child1_id] &&
+        !matrix_updated[child0_id] && !matrix_updated[child1_id]) {
+      return;
+    }
+    partial_updated[node_id] = true;
+    incremental_updated_node_ids_.push_back(node_id);
+    proposal.children_[node_id] = children;
+    const int slot = (proposal.partial_slots_[node_id] ^= 1);
+    const int destinationScaleWrite =
+        ba.rescaling_ ? IncrementalScaleIndex(taxon_count, node_id, slot)
+                      : BEAGLE_OP_NONE;
+    operations.push_back({
+        IncrementalPartialIndex(taxon_count, node_id, slot),  // destinationPartials
+        destinationScaleWrite, ba.destinationScaleRead_,
+        IncrementalPartialIndex(taxon_count, child0_id,
+                                proposal.partial_slots_[child0_id]),
+        IncrementalMatrixIndex(taxon_count, child0_id,
+                               proposal.matrix_slots_[child0_id]),
+        IncrementalPartialIndex(taxon_count, child1_id,
+                                proposal.partial_slots_[child1_id]),
+        IncrementalMatrixIndex(taxon_count, child1_id,
+                               proposal.matrix_slots_[child1_id]),
+    });
+  });
+
+  // The cumulative scale buffer holds the sum of the scale factors of the slots in
+  // use, so we swap out the factors of the slots we are about to replace.
+  if (rescaling_) {
+    if (full_evaluation) {
+      beagleResetScaleFactors(beagle_instance_, ba.cumulative_scale_index_[0]);
+    } else if (!incremental_updated_node_ids_.empty()) {
+      std::vector<int> scale_indices;
+      for (const int node_id : incremental_updated_node_ids_) {
+        scale_indices.push_back(IncrementalScaleIndex(
+            taxon_count, node_id, committed_state_->partial_slots_[node_id]));
+      }
+      beagleRemoveScaleFactors(beagle_instance_, scale_indices.data(),
+                               static_cast<int>(scale_indices.size()),
+                               ba.cumulative_scale_index_[0]);
+    }
+  }
+  if (!operations.empty()) {
+    beagleUpdatePartials(beagle_instance_, operations.data(),
+                         static_cast<int>(operations.size()),
+                         ba.cumulative_scale_index_[0]);
+  }
+  if (full_evaluation || !operations.empty()) {
+    const int root_buffer = IncrementalPartialIndex(
+        taxon_count, ba.root_id_, proposal.partial_slots_[ba.root_id_]);
+    beagleCalculateRootLogLikelihoods(
+        beagle_instance_, &root_buffer, ba.category_weight_index_.data(),
+        ba.state_frequency_index_.data(), ba.cumulative_scale_index_.data(),
+        ba.mysterious_count_, &proposal.log_likelihood_);
+  }
+  incremental_buffers_valid_ = true;
+  incremental_rescaling_ = rescaling_;
+  proposed_state_ = std::move(proposal);
+  return proposed_state_->log_likelihood_;
+}
+
+double FatBeagle::IncrementalLogLikelihood(const UnrootedTree &tree) {
+  auto detrifurcated_tree = tree.Detrifurcate();
+  return IncrementalLogLikelihoodInternals(detrifurcated_tree.Topology(),
+                                           detrifurcated_tree.BranchLengths());
+}
+
+double FatBeagle::IncrementalLogLikelihood(const RootedTree &tree) {
+  std::vector<double> branch_lengths = tree.BranchLengths();
+  const std::vector<double> &rates = tree.GetRates();
+  for (size_t i = 0; i < tree.BranchLengths().size() - 1; i++) {
+    branch_lengths[i] *= rates[i];
+  }
+  return IncrementalLogLikelihoodInternals(tree.Topology(), branch_lengths);
+}
+
+void FatBeagle::CommitIncrementalState() {
+  Assert(proposed_state_.has_value(), "There is no pending proposal to commit.");
+  committed_state_ = std::move(proposed_state_);
+  proposed_state_.reset();
+}
+
+void FatBeagle::RevertIncrementalState() {
+  Assert(proposed_state_.has_value(), "There is no pending proposal to revert.");
+  // Put the scale factors of the committed slots back into the cumulative buffer.
+  if (incremental_buffers_valid_ && incremental_rescaling_ &&
+      committed_state_.has_value() && !incremental_updated_node_ids_.empty()) {
+    const int taxon_count =
+        static_cast<int>(committed_state_->children_.size() + 1) / 2;
+    std::vector<int> proposed_scale_indices;
+    std::vector<int> committed_scale_indices;
+    for (const int node_id : incremental_updated_node_ids_) {
+      proposed_scale_indices.push_back(IncrementalScaleIndex(
+          taxon_count, node_id, proposed_state_->partial_slots_[node_id]));
+      committed_scale_indices.push_back(IncrementalScaleIndex(
+          taxon_count, node_id, committed_state_->partial_slots_[node_id]));
+    }
+    const int cumulative_scale_index = 0;
+    beagleRemoveScaleFactors(beagle_instance_, proposed_scale_indices.data(),
+                             static_cast<int>(proposed_scale_indices.size()),
+                             cumulative_scale_index);
+    beagleAccumulateScaleFactors(beagle_instance_, committed_scale_indices.data(),
+                                 static_cast<int>(committed_scale_indices.size()),
+                                 cumulative_scale_index);
+  }
+  proposed_state_.reset();
+}
+
 // Build differential matrix and scale it.
 EigenMatrixXd BuildDifferentialMatrices(const SubstitutionModel &substitution_model,
                                         const EigenVectorXd &scalers) {
@@ -113,6 +410,7 @@ EigenMatrixXd BuildDifferentialMatrices(const SubstitutionModel &substitution_mo
 std::pair<double, std::vector<double>> FatBeagle::BranchGradientInternals(
     const Node::NodePtr topology, const std::vector<double> &branch_lengths,
     const EigenMatrixXd &dQ) const {
+  incremental_buffers_valid_ = false;
   beagleResetScaleFactors(beagle_instance_, 0);
   BeagleAccessories ba(beagle_instance_, rescaling_, topology);
   UpdateBeagleTransitionMatrices(ba, branch_lengths, nullptr);
@@ -219,10 +517,16 @@ std::pair<FatBeagle::BeagleInstance, FatBeagle::PackedBeagleFlags>
 FatBeagle::CreateInstance(const SitePattern &site_pattern,
                           FatBeagle::PackedBeagleFlags beagle_preference_flags) {
   int taxon_count = static_cast<int>(site_pattern.SequenceCount());
+  // The number of trees in a batch other than the first, which uses the same buffers
+  // as single tree calculations.
+  int other_batch_tree_count = static_cast<int>(tree_batch_size_) - 1;
   // Number of partial buffers to create (input):
   // taxon_count - 1 for lower partials (internal nodes only)
   // 2*taxon_count - 1 for upper partials (every node)
-  int partials_buffer_count = 3 * taxon_count - 2;
+  // taxon_count - 1 for the second slot of lower partials in incremental evaluation
+  // taxon_count - 1 for lower partials of each other tree of a batch
+  int partials_buffer_count =
+      4 * taxon_count - 3 + (taxon_count - 1) * other_batch_tree_count;
   if (!use_tip_states_) {
     partials_buffer_count += taxon_count;
   }
@@ -236,14 +540,17 @@ FatBeagle::CreateInstance(const SitePattern &site_pattern,
   int pattern_count = pattern_count_;
   // Number of eigen-decomposition buffers to allocate (input)
   int eigen_buffer_count = 1;
-  // Number of transition matrix buffers (input) -- two per edge
-  int matrix_buffer_count = 2 * (2 * taxon_count - 1);
+  // Number of transition matrix buffers (input) -- two per edge, the second of which
+  // is used by incremental evaluation, and one per edge of each other tree of a batch
+  int matrix_buffer_count =
+      2 * (2 * taxon_count - 1) + (2 * taxon_count - 2) * other_batch_tree_count;
   // Number of rate categories
   int category_count =
       static_cast<int>(phylo_model_->GetSiteModel()->GetCategoryCount());
   // Number of scaling buffers -- 1 buffer per partial buffer and 1 more
-  // for accumulating scale factors in position 0.
-  int scale_buffer_count = partials_buffer_count + 1;
+  // for accumulating scale factors in position 0, plus 1 more for accumulating
+  // the scale factors of each other tree of a batch.
+  int scale_buffer_count = partials_buffer_count + 1 + other_batch_tree_count;
   // List of potential resources on which this instance is allowed (input,
   // NULL implies no restriction
   int *allowed_resources = nullptr;
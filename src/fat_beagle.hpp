@@ -4,6 +4,7 @@
 #pragma once
 
 #include <memory>
+#include <optional>
 #include <queue>
 #include <utility>
 #include <vector>
@@ -15,17 +16,19 @@
 #include "rooted_tree_collection.hpp"
 #include "site_pattern.hpp"
 #include "stick_breaking_transform.hpp"
-#include "task_processor.hpp"
+#include "thread_pool.hpp"
 #include "unrooted_tree_collection.hpp"
 
 class FatBeagle {
  public:
   using PackedBeagleFlags = long;
 
-  // This constructor makes the beagle_instance_
+  // This constructor makes the beagle_instance_, with room for the partials of
+  // tree_batch_size trees for BatchLogLikelihoods.
   FatBeagle(const PhyloModelSpecification &specification,
             const SitePattern &site_pattern,
-            const PackedBeagleFlags beagle_preference_flags, bool use_tip_states);
+            const PackedBeagleFlags beagle_preference_flags, bool use_tip_states,
+            size_t tree_batch_size = 1);
   ~FatBeagle();
   // Delete (copy + move) x (constructor + assignment) because FatBeagle manages an
   // external resource (a BEAGLE instance).
@@ -36,6 +39,7 @@ class FatBeagle {
 
   const BlockSpecification &GetPhyloModelBlockSpecification() const;
   const PackedBeagleFlags &GetBeagleFlags() const { return beagle_flags_; };
+  size_t TreeBatchSize() const { return tree_batch_size_; }
 
   void SetParameters(const EigenVectorXdRef param_vector);
   void SetRescaling(const bool rescaling) { rescaling_ = rescaling; }
@@ -48,6 +52,13 @@ class FatBeagle {
                                std::optional<PhyloFlags> flags = std::nullopt) const;
   double LogLikelihood(const RootedTree &tree,
                        std::optional<PhyloFlags> flags = std::nullopt) const;
+  // Compute the log likelihoods of up to TreeBatchSize() trees under the current
+  // parameters. The trees' partials are laid out side by side in the BEAGLE
+  // instance, so that all of the transition matrices and all of the partials are
+  // computed with one BEAGLE call each, which matters when trees are small and BEAGLE
+  // call overhead dominates.
+  std::vector<double> BatchLogLikelihoods(
+      const UnrootedTree::UnrootedTreeVector &trees) const;
   // Compute first derivative of the log likelihood with respect to each branch
   // length, as a vector of first derivatives indexed by node id.
   PhyloGradient Gradient(const UnrootedTree &tree,
@@ -55,6 +66,29 @@ class FatBeagle {
   PhyloGradient Gradient(const RootedTree &tree,
                          std::optional<PhyloFlags> flags = std::nullopt) const;
 
+  // ** Incremental evaluation:
+  // An MCMC-style proposal usually perturbs a few branch lengths or moves one
+  // subtree, leaving most partials of the tree unchanged. IncrementalLogLikelihood
+  // keeps the partials and transition matrices of the committed tree resident in
+  // BEAGLE, compares the proposed tree to it node by node (by id), and recomputes
+  // only the transition matrices of branches whose length changed and the partials
+  // on the paths from changed nodes to the root. Each proposal writes to the buffers
+  // that the committed tree isn't using, so it can then be committed to become the
+  // current tree, or reverted without recomputing anything. Only one proposal can be
+  // pending at a time.
+  //
+  // Other calculations (LogLikelihood, Gradient) and SetParameters overwrite the
+  // resident buffers, so the proposal following them is a full evaluation.
+  double IncrementalLogLikelihood(const UnrootedTree &tree);
+  // Like LogLikelihood for rooted trees, without the optional Jacobian term.
+  double IncrementalLogLikelihood(const RootedTree &tree);
+  void CommitIncrementalState();
+  void RevertIncrementalState();
+  // The number of partials recomputed for the last proposal.
+  size_t IncrementalPartialUpdateCount() const {
+    return incremental_updated_node_ids_.size();
+  }
+
   // ** Static Methods:
   // We can pass these static methods to FatBeagleParallelize.
 
@@ -116,6 +150,26 @@ class FatBeagle {
   PackedBeagleFlags beagle_flags_;
   int pattern_count_;
   bool use_tip_states_;
+  size_t tree_batch_size_;
+
+  // A tree whose partials are resident in BEAGLE for incremental evaluation. Every
+  // internal node has two partial buffers (and scale buffers), and every branch two
+  // transition matrices. We record which slot each node is using along with the
+  // children (-1 for leaves) and branch length that its buffers were computed from.
+  struct IncrementalState {
+    std::vector<std::pair<int, int>> children_;
+    std::vector<double> branch_lengths_;
+    std::vector<int> partial_slots_;
+    std::vector<int> matrix_slots_;
+    double log_likelihood_ = 0.;
+  };
+  std::optional<IncrementalState> committed_state_;
+  std::optional<IncrementalState> proposed_state_;
+  std::vector<int> incremental_updated_node_ids_;
+  bool incremental_rescaling_ = false;
+  // Slot 0 of the incremental buffers is shared with the other calculations, which
+  // clear this flag when they overwrite it.
+  mutable bool incremental_buffers_valid_ = false;
 
   std::pair<BeagleInstance, PackedBeagleFlags> CreateInstance(
       const SitePattern &site_pattern, PackedBeagleFlags beagle_preference_flags);
@@ -127,6 +181,8 @@ class FatBeagle {
 
   double LogLikelihoodInternals(const Node::NodePtr topology,
                                 const std::vector<double> &branch_lengths) const;
+  double IncrementalLogLikelihoodInternals(const Node::NodePtr topology,
+                                           const std::vector<double> &branch_lengths);
   std::pair<double, std::vector<double>> BranchGradientInternals(
       const Node::NodePtr topology, const std::vector<double> &branch_lengths,
       const EigenMatrixXd &dQ) const;
@@ -143,41 +199,58 @@ class FatBeagle {
   static inline void AddUpperPartialOperation(BeagleOperationVector &operations,
                                               const BeagleAccessories &ba, int node_id,
                                               int sister_id, int parent_id);
+  // BEAGLE buffer indices for a node of the tree in the given position of a batch.
+  // The tree in position 0 uses the same buffers as LogLikelihoodInternals.
+  static int BatchPartialIndex(int taxon_count, size_t batch_idx, int node_id);
+  static int BatchMatrixIndex(int taxon_count, size_t batch_idx, int node_id);
+  static int BatchScaleIndex(int taxon_count, size_t batch_idx, int node_id);
+  static int BatchCumulativeScaleIndex(int taxon_count, size_t batch_idx);
+  // BEAGLE buffer indices for the given slot of a node in incremental evaluation.
+  static int IncrementalPartialIndex(int taxon_count, int node_id, int slot);
+  static int IncrementalMatrixIndex(int taxon_count, int node_id, int slot);
+  static int IncrementalScaleIndex(int taxon_count, int node_id, int slot);
   static inline std::pair<double, double> ComputeGradientEntry(
       BeagleAccessories &ba, const SizeVectorVector &indices_above, int node_id,
       int sister_id);
 };
 
+// Evaluate f on every tree of the collection using the pool, with the FatBeagle of
+// index i acting as the executor for worker i. Trees are scheduled in chunks of
+// roughly equal total branch count.
 template <typename TOut, typename TTree, typename TTreeCollection>
 std::vector<TOut> FatBeagleParallelize(
     FatBeagle::StaticTreeFunction<TOut, TTree> f,
     const std::vector<std::unique_ptr<FatBeagle>> &fat_beagles,
-    const TTreeCollection &tree_collection, EigenMatrixXdRef param_matrix,
-    const bool rescaling, std::optional<PhyloFlags> flags = std::nullopt) {
+    ThreadPool &thread_pool, const TTreeCollection &tree_collection,
+    EigenMatrixXdRef param_matrix, const bool rescaling,
+    std::optional<PhyloFlags> flags = std::nullopt) {
   if (fat_beagles.empty()) {
     Failwith("Please add some FatBeagles that can be used for computation.");
   }
-  std::vector<TOut> results(tree_collection.TreeCount());
-  std::queue<FatBeagle *> fat_beagle_queue;
+  Assert(fat_beagles.size() >= thread_pool.ThreadCount(),
+         "We need a FatBeagle for every thread of the pool.");
   for (const auto &fat_beagle : fat_beagles) {
     Assert(fat_beagle != nullptr, "Got a fat_beagle nullptr!");
-    fat_beagle_queue.push(fat_beagle.get());
-  }
-  std::queue<size_t> tree_number_queue;
-  for (size_t i = 0; i < tree_collection.TreeCount(); i++) {
-    tree_number_queue.push(i);
   }
   Assert(static_cast<Eigen::Index>(tree_collection.TreeCount()) == param_matrix.rows(),
          "We param_matrix needs as many rows as we have trees.");
+  std::vector<TOut> results(tree_collection.TreeCount());
 
-  TaskProcessor<FatBeagle *, size_t>(
-      std::move(fat_beagle_queue), std::move(tree_number_queue),
-      [&results, &tree_collection, &param_matrix, &rescaling, &f, &flags](
-          FatBeagle *fat_beagle, size_t tree_number) {
-        fat_beagle->SetParameters(param_matrix.row(tree_number));
-        fat_beagle->SetRescaling(rescaling);
-        results[tree_number] =
-            f(fat_beagle, tree_collection.GetTree(tree_number), flags);
+  thread_pool.ParallelFor(
+      tree_collection.TreeCount(),
+      [&tree_collection](size_t tree_number) {
+        return static_cast<double>(
+            tree_collection.GetTree(tree_number).BranchLengths().size());
+      },
+      [&results, &fat_beagles, &tree_collection, &param_matrix, &rescaling, &f,
+       &flags](size_t worker_idx, size_t begin, size_t end) {
+        FatBeagle *fat_beagle = fat_beagles[worker_idx].get();
+        for (size_t tree_number = begin; tree_number < end; tree_number++) {
+          fat_beagle->SetParameters(param_matrix.row(tree_number));
+          fat_beagle->SetRescaling(rescaling);
+          results[tree_number] =
+              f(fat_beagle, tree_collection.GetTree(tree_number), flags);
+        }
       });
 
   return results;
@@ -0,0 +1,271 @@
+// Copyright 2019-2022 bito project contributors.
+// bito is free software under the GPLv3; see LICENSE file for details.
+
+#include "fitch_kernels.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+#include "plv_kernels.hpp"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define BITO_FITCH_KERNELS_X86
+#define POPCNT_TARGET __attribute__((target("popcnt")))
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+// The word loops are inlined into each ISA's entry point, so that they count with its
+// popcount.
+#define FITCH_INLINE inline __attribute__((always_inline))
+#else
+#define FITCH_INLINE inline
+#endif
+
+namespace {
+
+constexpr size_t state_count = FitchKernels::state_count_;
+
+// One Fitch step on a word of patterns: write the state sets of a . b to out, and
+// return the patterns whose state sets don't meet.
+FITCH_INLINE uint64_t FitchStep(const uint64_t *a, const uint64_t *b, uint64_t *out) {
+  uint64_t meet[state_count];
+  uint64_t any_meet = 0;
+  for (size_t state = 0; state < state_count; state++) {
+    meet[state] = a[state] & b[state];
+    any_meet |= meet[state];
+  }
+  const uint64_t disjoint = ~any_meet;
+  for (size_t state = 0; state < state_count; state++) {
+    out[state] = meet[state] | (disjoint & (a[state] | b[state]));
+  }
+  return disjoint;
+}
+
+// The weight planes of FitchKernels.
+struct WeightPlanes {
+  const size_t *starts_;
+  const uint64_t *planes_;
+  const uint8_t *bits_;
+
+  // The sum of the weights of the patterns of a word in mask.
+  FITCH_INLINE uint64_t WeightedCount(const size_t word_idx,
+                                      const uint64_t mask) const {
+    uint64_t count = 0;
+    for (size_t plane = starts_[word_idx]; plane < starts_[word_idx + 1]; plane++) {
+      count += static_cast<uint64_t>(__builtin_popcountll(mask & planes_[plane]))
+               << bits_[plane];
+    }
+    return count;
+  }
+};
+
+FITCH_INLINE uint64_t CombineWords(const WeightPlanes &weights, const size_t word_count,
+                                   uint64_t *dest, const uint64_t *src1,
+                                   const uint64_t *src2) {
+  uint64_t cost = 0;
+  for (size_t word_idx = 0; word_idx < word_count; word_idx++) {
+    const size_t offset = state_count * word_idx;
+    const uint64_t disjoint = FitchStep(src1 + offset, src2 + offset, dest + offset);
+    if (disjoint != 0) {
+      cost += weights.WeightedCount(word_idx, disjoint);
+    }
+  }
+  return cost;
+}
+
+template <bool write_dest>
+FITCH_INLINE uint64_t CombineSumWords(const WeightPlanes &weights,
+                                      const size_t word_count, uint64_t *dest,
+                                      const uint64_t *src1, const uint64_t *src2,
+                                      const uint64_t *src3) {
+  uint64_t cost = 0;
+  for (size_t word_idx = 0; word_idx < word_count; word_idx++) {
+    const size_t offset = state_count * word_idx;
+    uint64_t combined[state_count];
+    uint64_t total[state_count];
+    // A pattern may cost a union at both steps, so we count them separately.
+    uint64_t disjoint = FitchStep(src1 + offset, src2 + offset, combined);
+    if (disjoint != 0) {
+      cost += weights.WeightedCount(word_idx, disjoint);
+    }
+    disjoint = FitchStep(combined, src3 + offset, write_dest ? dest + offset : total);
+    if (disjoint != 0) {
+      cost += weights.WeightedCount(word_idx, disjoint);
+    }
+  }
+  return cost;
+}
+
+uint64_t GenericCombine(const WeightPlanes &weights, const size_t word_count,
+                        uint64_t *dest, const uint64_t *src1, const uint64_t *src2) {
+  return CombineWords(weights, word_count, dest, src1, src2);
+}
+
+template <bool write_dest>
+uint64_t GenericCombineSum(const WeightPlanes &weights, const size_t word_count,
+                           uint64_t *dest, const uint64_t *src1, const uint64_t *src2,
+                           const uint64_t *src3) {
+  return CombineSumWords<write_dest>(weights, word_count, dest, src1, src2, src3);
+}
+
+#ifdef BITO_FITCH_KERNELS_X86
+
+POPCNT_TARGET uint64_t PopcntCombine(const WeightPlanes &weights,
+                                     const size_t word_count, uint64_t *dest,
+                                     const uint64_t *src1, const uint64_t *src2) {
+  return CombineWords(weights, word_count, dest, src1, src2);
+}
+
+template <bool write_dest>
+POPCNT_TARGET uint64_t PopcntCombineSum(const WeightPlanes &weights,
+                                        const size_t word_count, uint64_t *dest,
+                                        const uint64_t *src1, const uint64_t *src2,
+                                        const uint64_t *src3) {
+  return CombineSumWords<write_dest>(weights, word_count, dest, src1, src2, src3);
+}
+
+#endif  // BITO_FITCH_KERNELS_X86
+
+// As for the Sankoff kernels, every CPU that PLVKernels runs at AVX2 has popcnt.
+bool UsePopcnt() {
+#ifdef BITO_FITCH_KERNELS_X86
+  return PLVKernels::GetIsa() != PLVKernels::Isa::Generic;
+#else
+  return false;
+#endif  // BITO_FITCH_KERNELS_X86
+}
+
+// The cost that the Fitch steps of Combine add, on the best ISA.
+uint64_t CombineWordsCost(const WeightPlanes &weights, const size_t word_count,
+                          uint64_t *dest, const uint64_t *src1, const uint64_t *src2) {
+#ifdef BITO_FITCH_KERNELS_X86
+  if (UsePopcnt()) {
+    return PopcntCombine(weights, word_count, dest, src1, src2);
+  }
+#endif  // BITO_FITCH_KERNELS_X86
+  return GenericCombine(weights, word_count, dest, src1, src2);
+}
+
+// The same for CombineSum.
+template <bool write_dest>
+uint64_t CombineSumWordsCost(const WeightPlanes &weights, const size_t word_count,
+                             uint64_t *dest, const uint64_t *src1,
+                             const uint64_t *src2, const uint64_t *src3) {
+#ifdef BITO_FITCH_KERNELS_X86
+  if (UsePopcnt()) {
+    return PopcntCombineSum<write_dest>(weights, word_count, dest, src1, src2, src3);
+  }
+#endif  // BITO_FITCH_KERNELS_X86
+  return GenericCombineSum<write_dest>(weights, word_count, dest, src1, src2, src3);
+}
+
+}  // namespace
+
+FitchKernels::FitchKernels(const std::vector<double> &weights)
+    : pattern_count_(weights.size()),
+      word_count_((weights.size() + word_bit_count_ - 1) / word_bit_count_),
+      pattern_positions_(weights.size()),
+      weight_plane_starts_(word_count_ + 1, 0) {
+  Assert(SupportsWeights(weights),
+         "FitchKernels needs pattern weights that are whole numbers below 2^32.");
+  SizeVector patterns_by_weight(pattern_count_);
+  std::iota(patterns_by_weight.begin(), patterns_by_weight.end(), 0);
+  std::stable_sort(patterns_by_weight.begin(), patterns_by_weight.end(),
+                   [&weights](const size_t lhs, const size_t rhs) {
+                     return weights[lhs] < weights[rhs];
+                   });
+  for (size_t position = 0; position < pattern_count_; position++) {
+    pattern_positions_[patterns_by_weight[position]] = position;
+  }
+  for (size_t word_idx = 0; word_idx < word_count_; word_idx++) {
+    uint64_t planes[32] = {};
+    const size_t end = std::min(pattern_count_, (word_idx + 1) * word_bit_count_);
+    for (size_t position = word_idx * word_bit_count_; position < end; position++) {
+      const auto weight = static_cast<uint64_t>(weights[patterns_by_weight[position]]);
+      const uint64_t pattern_bit = uint64_t(1) << (position % word_bit_count_);
+      for (size_t bit = 0; bit < 32; bit++) {
+        if ((weight >> bit) & 1) {
+          planes[bit] |= pattern_bit;
+        }
+      }
+    }
+    for (size_t bit = 0; bit < 32; bit++) {
+      if (planes[bit] != 0) {
+        weight_planes_.push_back(planes[bit]);
+        weight_plane_bits_.push_back(static_cast<uint8_t>(bit));
+      }
+    }
+    weight_plane_starts_[word_idx + 1] = weight_planes_.size();
+  }
+}
+
+bool FitchKernels::SupportsWeights(const std::vector<double> &weights) {
+  return std::all_of(weights.begin(), weights.end(), [](const double weight) {
+    return weight >= 0. && weight < 4294967296. && std::floor(weight) == weight;
+  });
+}
+
+void FitchKernels::SetTip(uint64_t *dest, const uint8_t *tip_codes) const {
+  SetAnyState(dest);
+  for (size_t pattern_idx = 0; pattern_idx < pattern_count_; pattern_idx++) {
+    const uint8_t code = (tip_codes[pattern_idx / 2] >> (4 * (pattern_idx % 2))) & 0xF;
+    const size_t position = PatternPosition(pattern_idx);
+    const uint64_t pattern_bit = uint64_t(1) << (position % word_bit_count_);
+    uint64_t *word = dest + state_count_ * (position / word_bit_count_);
+    for (size_t state = 0; state < state_count_; state++) {
+      if (((code >> state) & 1) == 0) {
+        word[state] &= ~pattern_bit;
+      }
+    }
+  }
+}
+
+void FitchKernels::SetAnyState(uint64_t *dest) const {
+  std::fill(dest, dest + CostOffset(), ~uint64_t(0));
+  std::fill(dest + CostOffset(), dest + state_count_ * ColumnCount(), 0);
+}
+
+uint8_t FitchKernels::StateSet(const uint64_t *src, const size_t pattern_idx) const {
+  Assert(pattern_idx < pattern_count_, "pattern_idx out of range in StateSet.");
+  const size_t position = PatternPosition(pattern_idx);
+  const uint64_t *word = src + state_count_ * (position / word_bit_count_);
+  uint8_t code = 0;
+  for (size_t state = 0; state < state_count_; state++) {
+    code |= static_cast<uint8_t>(((word[state] >> (position % word_bit_count_)) & 1)
+                                 << state);
+  }
+  return code;
+}
+
+void FitchKernels::Combine(uint64_t *dest, const uint64_t *src1,
+                           const uint64_t *src2) const {
+  const WeightPlanes weights{weight_plane_starts_.data(), weight_planes_.data(),
+                             weight_plane_bits_.data()};
+  const uint64_t cost = src1[CostOffset()] + src2[CostOffset()] +
+                        CombineWordsCost(weights, word_count_, dest, src1, src2);
+  std::fill(dest + CostOffset(), dest + state_count_ * ColumnCount(), 0);
+  dest[CostOffset()] = cost;
+}
+
+template <bool write_dest>
+uint64_t FitchKernels::CombineSumCost(uint64_t *dest, const uint64_t *src1,
+                                      const uint64_t *src2,
+                                      const uint64_t *src3) const {
+  const WeightPlanes weights{weight_plane_starts_.data(), weight_planes_.data(),
+                             weight_plane_bits_.data()};
+  return src1[CostOffset()] + src2[CostOffset()] + src3[CostOffset()] +
+         CombineSumWordsCost<write_dest>(weights, word_count_, dest, src1, src2, src3);
+}
+
+void FitchKernels::CombineSum(uint64_t *dest, const uint64_t *src1,
+                              const uint64_t *src2, const uint64_t *src3) const {
+  const uint64_t cost = CombineSumCost<true>(dest, src1, src2, src3);
+  std::fill(dest + CostOffset(), dest + state_count_ * ColumnCount(), 0);
+  dest[CostOffset()] = cost;
+}
+
+double FitchKernels::ParsimonyScore(const uint64_t *src1, const uint64_t *src2,
+                                    const uint64_t *src3) const {
+  return static_cast<double>(CombineSumCost<false>(nullptr, src1, src2, src3));
+}
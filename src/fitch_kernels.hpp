@@ -0,0 +1,208 @@
+// Copyright 2019-2022 bito project contributors.
+// bito is free software under the GPLv3; see LICENSE file for details.
+//
+// Bit-parallel Fitch parsimony, which is Sankoff parsimony with unit costs.
+//
+// With unit costs, moving a PSV x up a branch gives E(x)[i] = min(x[i], min_j x[j] +
+// 1) (see SankoffKernels), which only depends on the least cost min_j x[j] and the set
+// of states that attain it. So for each pattern we keep that cost and state set, and
+// adding two evolved PSVs is the Fitch step: if their state sets meet, the sum has
+// their intersection at the sum of their costs, and otherwise it has their union at
+// one more than that.
+//
+// A Fitch PV holds the state sets as bit planes: it is a column-major 4 x
+// ColumnCount() matrix of words where bit k of row s of column w is set if pattern
+// 64 * w + k may be in state s. The state sets of patterns past PatternCount() are
+// full, so they never cost anything. As the costs only ever add up, we don't need them
+// per pattern, and the first entry of the last column holds their sum weighted by the
+// pattern weights. Weights must then be whole numbers, which they are for site
+// patterns, and we count weighted pattern sets a bit plane of the weights at a time.
+// Counting is most of the work, so the bits of a word don't follow the pattern order:
+// we place patterns in order of weight (see PatternPosition), which leaves most words
+// with a single weight, and only count the planes that are set for each word. When
+// PLVKernels is at AVX2 or better we count with the popcnt instruction.
+//
+// Writing a . b for the Fitch step, a Fitch PV stands for any PSV with the same least
+// costs and state sets, so the Fitch PVs of a Sankoff engine are:
+//
+// * a tip: its ambiguity codes (see TipStates) at no cost,
+// * a zero PSV: every state at no cost,
+// * E(src1 + src2): src1 . src2, which is Combine,
+// * E(src1 + src2) + E(src3): (src1 . src2) . src3, which is CombineSum,
+// * and the parsimony score of SankoffKernels::ParsimonyScore is the cost of
+//   (src1 . src2) . src3, which is ParsimonyScore.
+//
+// Results are exactly those of the Sankoff kernels with unit costs.
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "sugar.hpp"
+
+class FitchKernels {
+ public:
+  static constexpr size_t state_count_ = 4;
+  static constexpr size_t word_bit_count_ = 64;
+
+  FitchKernels() = default;
+  explicit FitchKernels(const std::vector<double> &weights);
+
+  // Whether we can count patterns with these weights, which must be whole numbers
+  // below 2^32.
+  static bool SupportsWeights(const std::vector<double> &weights);
+
+  size_t PatternCount() const { return pattern_count_; }
+  size_t WordCount() const { return word_count_; }
+  // Columns per Fitch PV: a column per word, and one for the cost.
+  size_t ColumnCount() const { return word_count_ + 1; }
+
+  // Set dest to the Fitch PV of a tip, given its packed codes.
+  void SetTip(uint64_t *dest, const uint8_t *tip_codes) const;
+  // Set dest to the Fitch PV of a zero PSV.
+  void SetAnyState(uint64_t *dest) const;
+  // The bit of the Fitch PVs that holds a pattern, counting along the words.
+  size_t PatternPosition(size_t pattern_idx) const {
+    return pattern_positions_[pattern_idx];
+  }
+  // The state set of a pattern, as a TipStates code.
+  uint8_t StateSet(const uint64_t *src, size_t pattern_idx) const;
+  // The weighted cost of a Fitch PV.
+  double WeightedCost(const uint64_t *src) const {
+    return static_cast<double>(src[CostOffset()]);
+  }
+
+  void Combine(uint64_t *dest, const uint64_t *src1, const uint64_t *src2) const;
+  void CombineSum(uint64_t *dest, const uint64_t *src1, const uint64_t *src2,
+                  const uint64_t *src3) const;
+  double ParsimonyScore(const uint64_t *src1, const uint64_t *src2,
+                        const uint64_t *src3) const;
+
+ private:
+  size_t pattern_count_ = 0;
+  size_t word_count_ = 0;
+  SizeVector pattern_positions_;
+  // The bit planes of the weights that are set for some pattern of a word: plane p
+  // holds bit weight_plane_bits_[p] of the weights of the patterns of its word, and
+  // the planes of word w are those in [weight_plane_starts_[w],
+  // weight_plane_starts_[w + 1]).
+  SizeVector weight_plane_starts_;
+  std::vector<uint64_t> weight_planes_;
+  std::vector<uint8_t> weight_plane_bits_;
+
+  size_t CostOffset() const { return state_count_ * word_count_; }
+  // The cost of (src1 . src2) . src3, writing its state sets to dest if write_dest.
+  template <bool write_dest>
+  uint64_t CombineSumCost(uint64_t *dest, const uint64_t *src1, const uint64_t *src2,
+                          const uint64_t *src3) const;
+};
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+#include "plv_kernels.hpp"
+#include "sankoff_kernels.hpp"
+#include "sankoff_matrix.hpp"
+#include "tip_states.hpp"
+
+TEST_CASE("FitchKernels") {
+  // Enough patterns to run into a second word, which is then part padding.
+  const size_t pattern_count = 70;
+  const double big = 1e9;
+  std::vector<SymbolVector> patterns(3, SymbolVector(pattern_count));
+  std::vector<double> weights(pattern_count);
+  for (size_t pattern_idx = 0; pattern_idx < pattern_count; pattern_idx++) {
+    for (size_t taxon_idx = 0; taxon_idx < patterns.size(); taxon_idx++) {
+      patterns[taxon_idx][pattern_idx] =
+          static_cast<int>((pattern_idx * (taxon_idx + 2) + taxon_idx) % 5);
+    }
+    weights[pattern_idx] = static_cast<double>(1 + pattern_idx % 6);
+  }
+  const TipStates tip_states(patterns);
+  const FitchKernels fitch(weights);
+  CHECK_EQ(fitch.WordCount(), 2);
+  CHECK(FitchKernels::SupportsWeights(weights));
+  CHECK_FALSE(FitchKernels::SupportsWeights({1., 0.5}));
+  CHECK_THROWS(FitchKernels({-1.}));
+
+  // The tree ((t0, t1), t2), with its root on the edge above (t0, t1), as the Sankoff
+  // kernels with unit costs see it: each tip's PLeft PSV holds its leaf partial and
+  // PRight PSV holds zeros.
+  CostMatrix costs;
+  costs.setOnes();
+  costs.diagonal().setZero();
+  using PSV = Eigen::Matrix<double, 4, Eigen::Dynamic>;
+  std::vector<PSV> leaves(3, PSV(4, pattern_count));
+  for (size_t taxon_idx = 0; taxon_idx < leaves.size(); taxon_idx++) {
+    tip_states.Expand(taxon_idx, 0., big, leaves[taxon_idx].data());
+  }
+  const PSV zeros = PSV::Zero(4, pattern_count);
+  PSV p_left(4, pattern_count), p_right(4, pattern_count), q(4, pattern_count);
+  SankoffKernels::Evolve(p_left.data(), costs.data(), leaves[0].data(), zeros.data(),
+                         pattern_count);
+  SankoffKernels::Evolve(p_right.data(), costs.data(), leaves[1].data(), zeros.data(),
+                         pattern_count);
+  SankoffKernels::EvolveSum(q.data(), costs.data(), leaves[2].data(), zeros.data(),
+                            zeros.data(), pattern_count);
+
+  using FitchPV = std::vector<uint64_t>;
+  const size_t fitch_size = FitchKernels::state_count_ * fitch.ColumnCount();
+  std::vector<FitchPV> tips(3, FitchPV(fitch_size));
+  for (size_t taxon_idx = 0; taxon_idx < tips.size(); taxon_idx++) {
+    fitch.SetTip(tips[taxon_idx].data(), tip_states.Codes(taxon_idx));
+  }
+  FitchPV any_state(fitch_size), fitch_p_left(fitch_size), fitch_p_right(fitch_size),
+      fitch_q(fitch_size);
+  fitch.SetAnyState(any_state.data());
+  fitch.Combine(fitch_p_left.data(), tips[0].data(), any_state.data());
+  fitch.Combine(fitch_p_right.data(), tips[1].data(), any_state.data());
+  fitch.CombineSum(fitch_q.data(), tips[2].data(), any_state.data(), any_state.data());
+
+  // Each Fitch PV has the least costs and the states that attain them.
+  auto check_matches = [&](const PSV &psv, const FitchPV &fitch_pv) {
+    double weighted_cost = 0.;
+    for (size_t pattern_idx = 0; pattern_idx < pattern_count; pattern_idx++) {
+      const double least = psv.col(pattern_idx).minCoeff();
+      uint8_t state_set = 0;
+      for (size_t state = 0; state < 4; state++) {
+        state_set |= (psv(state, pattern_idx) == least) << state;
+      }
+      CHECK_EQ(fitch.StateSet(fitch_pv.data(), pattern_idx), state_set);
+      weighted_cost += least * weights[pattern_idx];
+    }
+    CHECK_EQ(fitch.WeightedCost(fitch_pv.data()), weighted_cost);
+  };
+  check_matches(p_left, fitch_p_left);
+  check_matches(p_right, fitch_p_right);
+  check_matches(q, fitch_q);
+  // The cherry (t0, t1) as seen from the root.
+  PSV cherry(4, pattern_count);
+  SankoffKernels::Evolve(cherry.data(), costs.data(), p_left.data(), p_right.data(),
+                         pattern_count);
+  FitchPV fitch_cherry(fitch_size);
+  fitch.Combine(fitch_cherry.data(), fitch_p_left.data(), fitch_p_right.data());
+  CHECK_GT(fitch.WeightedCost(fitch_cherry.data()), 0.);
+  check_matches(cherry, fitch_cherry);
+  const double score = SankoffKernels::ParsimonyScore(
+      costs.data(), p_left.data(), p_right.data(), q.data(), weights.data(),
+      pattern_count);
+  CHECK_GT(score, 0.);
+  CHECK_EQ(fitch.ParsimonyScore(fitch_p_left.data(), fitch_p_right.data(),
+                                fitch_q.data()),
+           score);
+
+  // Each ISA counts the same.
+  const auto original_isa = PLVKernels::GetIsa();
+  for (const auto isa : PLVKernels::AvailableIsas()) {
+    PLVKernels::SetIsa(isa);
+    FitchPV isa_q(fitch_size), isa_cherry(fitch_size);
+    fitch.CombineSum(isa_q.data(), tips[2].data(), any_state.data(), any_state.data());
+    fitch.Combine(isa_cherry.data(), fitch_p_left.data(), fitch_p_right.data());
+    CHECK(isa_q == fitch_q);
+    CHECK(isa_cherry == fitch_cherry);
+    CHECK_EQ(fitch.ParsimonyScore(fitch_p_left.data(), fitch_p_right.data(),
+                                  fitch_q.data()),
+             score);
+  }
+  PLVKernels::SetIsa(original_isa);
+}
+#endif  // DOCTEST_LIBRARY_INCLUDED
@@ -14,12 +14,16 @@
 #include "ProgressBar.hpp"
 #include "alignment.hpp"
 #include "csv.hpp"
+#include "driver.hpp"
 #include "engine.hpp"
+#include "fasta_file.hpp"
 #include "mersenne_twister.hpp"
 #include "numerical_utils.hpp"
 #include "psp_indexer.hpp"
 #include "rooted_sbn_support.hpp"
+#include "sbn_gradient_engine.hpp"
 #include "sbn_probability.hpp"
+#include "sbn_sampler.hpp"
 #include "unrooted_sbn_support.hpp"
 #include "phylo_flags.hpp"
 #include "phylo_model.hpp"
@@ -82,7 +86,7 @@ class GenericSBNInstance {
     } else {
       std::cout << "No trees loaded.\n";
     }
-    std::cout << alignment_.Data().size() << " sequences loaded.\n";
+    std::cout << SequenceCount() << " sequences loaded.\n";
   }
 
   BitsetSizeDict RootsplitCounterOf(const Node::TopologyCounter &topologies) const {
@@ -92,7 +96,12 @@ class GenericSBNInstance {
     return TSBNSupport::PCSPCounterOf(topologies);
   }
   StringVector PrettyIndexer() const { return sbn_support_.PrettyIndexer(); }
+  // The topologies of the loaded trees, or those counted when streaming a tree file
+  // (which leaves no trees loaded).
   Node::TopologyCounter TopologyCounter() const {
+    if (tree_collection_.TreeCount() == 0) {
+      return topology_counter_;
+    }
     return tree_collection_.TopologyCounter();
   }
 
@@ -103,15 +112,41 @@ class GenericSBNInstance {
     sbn_parameters_.resize(sbn_support_.GPCSPCount());
     sbn_parameters_.setOnes();
     psp_indexer_ = sbn_support_.BuildPSPIndexer();
+    sbn_sampler_parameters_.resize(0);
+    sbn_gradient_engine_.reset();
   }
 
   // Use the loaded trees to set up the TopologyCounter, SBNSupport, etc.
   void ProcessLoadedTrees() {
+    if (tree_collection_.TreeCount() == 0 && !topology_counter_.empty()) {
+      Failwith(
+          "There are no loaded trees to process: streaming a tree file already set up "
+          "the SBN support from its trees.");
+    }
     ClearTreeCollectionAssociatedState();
     topology_counter_ = TopologyCounter();
     SetSBNSupport(TSBNSupport(topology_counter_, tree_collection_.TaxonNames()));
   };
 
+  // Set up the TopologyCounter, SBNSupport, etc. from a tree file without loading it.
+  // The trees are parsed one at a time and folded into the TopologyCounter, so memory
+  // use depends on the number of unique topologies rather than the number of trees.
+  // This gives the same SBN support as reading the file and calling ProcessLoadedTrees,
+  // but leaves the tree collection without trees. See Driver::StreamNewickFile for a
+  // description of burn_in_count and thinning.
+  void StreamNewickFile(const std::string &fname, size_t burn_in_count = 0,
+                        size_t thinning = 1) {
+    ProcessTreeStream([&](Driver &driver, const Driver::TreeVisitor &visitor) {
+      return driver.StreamNewickFile(fname, visitor, burn_in_count, thinning);
+    });
+  }
+  void StreamNexusFile(const std::string &fname, size_t burn_in_count = 0,
+                       size_t thinning = 1) {
+    ProcessTreeStream([&](Driver &driver, const Driver::TreeVisitor &visitor) {
+      return driver.StreamNexusFile(fname, visitor, burn_in_count, thinning);
+    });
+  }
+
   // Set the SBN parameters using a "pretty" map of SBNs.
   //
   // Any GPCSP that is not assigned a value by pretty_sbn_parameters will be assigned a
@@ -153,12 +188,12 @@ class GenericSBNInstance {
   }
 
   void CheckTopologyCounter() {
-    if (TopologyCounter().empty()) {
+    if (topology_counter_.empty()) {
       Failwith("Please load some trees into your SBN instance.");
     }
   }
 
-  void CheckSBNSupportNonEmpty() {
+  void CheckSBNSupportNonEmpty() const {
     if (sbn_support_.Empty()) {
       Failwith("Please call ProcessLoadedTrees to prepare your SBN support.");
     }
@@ -209,16 +244,157 @@ class GenericSBNInstance {
   // See the documentation of IndexerRepresentationOf in sbn_maps.hpp for an
   // explanation of what these are. This version uses the length of
   // sbn_parameters_ as a sentinel value for all rootsplits/PCSPs that aren't
-  // present in the indexer.
-  std::vector<TIndexerRepresentation> MakeIndexerRepresentations() const {
-    std::vector<TIndexerRepresentation> representations;
-    representations.reserve(tree_collection_.trees_.size());
-    for (const auto &tree : tree_collection_.trees_) {
-      representations.push_back(sbn_support_.IndexerRepresentationOf(tree.Topology()));
+  // present in the indexer. The trees are split over thread_count threads.
+  std::vector<TIndexerRepresentation> MakeIndexerRepresentations(
+      size_t thread_count = 1) const {
+    const auto &trees = tree_collection_.trees_;
+    std::vector<TIndexerRepresentation> representations(trees.size());
+    auto represent = [this, &trees, &representations](size_t begin, size_t end) {
+      for (size_t tree_idx = begin; tree_idx < end; tree_idx++) {
+        representations[tree_idx] =
+            sbn_support_.IndexerRepresentationOf(trees[tree_idx].Topology());
+      }
+    };
+    if (thread_count < 2) {
+      represent(0, trees.size());
+    } else {
+      ThreadPool::Shared(thread_count)
+          .ParallelFor(
+              trees.size(), [](size_t) { return 1.; },
+              [&represent](size_t, size_t begin, size_t end) {
+                represent(begin, end);
+              });
     }
     return representations;
   }
 
+  // The alias-table sampler for the current SBN parameters. As sbn_parameters_ can be
+  // set directly, we keep a copy of the parameters the sampler was built for, and only
+  // rebuild it if they have changed.
+  const SBNSampler &GetSBNSampler() const {
+    CheckSBNSupportNonEmpty();
+    if (sbn_sampler_parameters_.size() != sbn_parameters_.size() ||
+        sbn_sampler_parameters_ != sbn_parameters_) {
+      sbn_sampler_ = SBNSampler(sbn_support_, NormalizedSBNParameters());
+      sbn_sampler_parameters_ = sbn_parameters_;
+    }
+    return sbn_sampler_;
+  }
+
+  // Sample sample_count rooted topologies from the SBN on thread_count threads, and
+  // write their rooted indexer representations to consecutive rows of representations,
+  // which must have room for sample_count * GetSBNSampler().RepresentationLength()
+  // entries. The seed of the sampler is drawn from our random number generator.
+  void SampleRootedIndexerRepresentations(size_t *representations,
+                                          size_t sample_count,
+                                          size_t thread_count = 1) const {
+    const SBNSampler &sampler = GetSBNSampler();
+    sampler.Sample(representations, sample_count, mersenne_twister_.GetGenerator()(),
+                   thread_count);
+  }
+
+  // Sample sample_count rooted topologies from the SBN as above, returning a matrix
+  // with the rooted indexer representation of each sample as a row. No Node trees are
+  // built; see LoadTreesFromIndexerRepresentations in the derived classes for that.
+  IndexerRepresentationMatrix SampleIndexerRepresentations(
+      size_t sample_count, size_t thread_count = 1) const {
+    IndexerRepresentationMatrix representations(sample_count,
+                                                GetSBNSampler().RepresentationLength());
+    SampleRootedIndexerRepresentations(representations.data(), sample_count,
+                                       thread_count);
+    return representations;
+  }
+
+  // Build the rooted topology with the given rooted indexer representation, the entries
+  // of which may come in any order after the rootsplit.
+  Node::NodePtr RootedTopologyOf(
+      const RootedIndexerRepresentation &rooted_representation) const {
+    Assert(!rooted_representation.empty() &&
+               rooted_representation[0] < sbn_support_.RootsplitCount(),
+           "RootedTopologyOf needs a representation starting with a rootsplit.");
+    // Each range of PCSPs holds exactly one entry of the representation for every
+    // clade with that range, so after sorting we can find it by binary search.
+    SizeVector pcsps(rooted_representation.begin() + 1, rooted_representation.end());
+    std::sort(pcsps.begin(), pcsps.end());
+    std::function<Node::NodePtr(const Bitset &)> topology_below =
+        [this, &pcsps, &topology_below](const Bitset &parent_subsplit) {
+          auto process_subsplit = [this, &pcsps,
+                                   &topology_below](const Bitset &parent) {
+            auto singleton_option =
+                parent.SubsplitGetClade(SubsplitClade::Right).SingletonOption();
+            if (singleton_option) {
+              return Node::Leaf(*singleton_option);
+            }  // else
+            const auto [start, end] = sbn_support_.ParentToRangeAt(parent);
+            const auto child = std::lower_bound(pcsps.begin(), pcsps.end(), start);
+            Assert(child != pcsps.end() && *child < end,
+                   "RootedTopologyOf given a representation missing a PCSP.");
+            return topology_below(sbn_support_.IndexToChildAt(*child));
+          };
+          return Node::Join(process_subsplit(parent_subsplit),
+                            process_subsplit(parent_subsplit.SubsplitRotate()));
+        };
+    auto topology =
+        topology_below(sbn_support_.RootsplitsAt(rooted_representation[0]));
+    topology->Polish();
+    return topology;
+  }
+
+  // The engine for batched topology gradients, which is built for the current support
+  // on first use.
+  const SBNGradientEngine &GetSBNGradientEngine() const {
+    CheckSBNSupportNonEmpty();
+    if (!sbn_gradient_engine_) {
+      sbn_gradient_engine_ = SBNGradientEngine(sbn_support_);
+    }
+    return *sbn_gradient_engine_;
+  }
+
+  // The multiplicative factors of the RWS and VIMCO estimators of the topology
+  // gradient for samples with the given log_f.
+  static EigenVectorXd CalculateMultiplicativeFactors(EigenVectorXdRef log_f) {
+    double tree_count = log_f.size();
+    double log_F = NumericalUtils::LogSum(log_f);
+    double hat_L = log_F - log(tree_count);
+    EigenVectorXd tilde_w = log_f.array() - log_F;
+    tilde_w = tilde_w.array().exp();
+    return hat_L - tilde_w.array();
+  }
+
+  static EigenVectorXd CalculateVIMCOMultiplicativeFactors(EigenVectorXdRef log_f) {
+    // Use the geometric mean as \hat{f}(\tau^{-j}, \theta^{-j}), in eq:f_hat in
+    // the implementation notes.
+    size_t tree_count = log_f.size();
+    double log_tree_count = log(tree_count);
+    double sum_of_log_f = log_f.sum();
+    // This has jth entry \hat{f}_{\bm{\phi},{\bm{\psi}}}(\tau^{-j},\bm{\theta}^{-j}),
+    // i.e. the log of the geometric mean of each item other than j.
+    EigenVectorXd log_geometric_mean =
+        (sum_of_log_f - log_f.array()) / (tree_count - 1);
+    // The parenthetical expression in eq:perSampleLearning is the log of the mean of f
+    // with its jth entry replaced by the geometric mean. We get the log of the sum of
+    // the other entries from log sums of the entries before and after j, which takes
+    // linear rather than quadratic time in the number of trees.
+    EigenVectorXd log_sum_before(tree_count);
+    double log_sum = DOUBLE_NEG_INF;
+    for (size_t j = 0; j < tree_count; j++) {
+      log_sum_before(j) = log_sum;
+      log_sum = NumericalUtils::LogAdd(log_sum, log_f(j));
+    }
+    EigenVectorXd per_sample_signal(tree_count);
+    log_sum = DOUBLE_NEG_INF;
+    for (size_t j = tree_count; j-- > 0;) {
+      per_sample_signal(j) =
+          NumericalUtils::LogAdd(NumericalUtils::LogAdd(log_sum_before(j), log_sum),
+                                 log_geometric_mean(j)) -
+          log_tree_count;
+      log_sum = NumericalUtils::LogAdd(log_sum, log_f(j));
+    }
+    EigenVectorXd multiplicative_factors = CalculateMultiplicativeFactors(log_f);
+    multiplicative_factors -= per_sample_signal;
+    return multiplicative_factors;
+  }
+
   // Calculate SBN probabilities for all currently-loaded trees.
   EigenVectorXd CalculateSBNProbabilities() {
     EigenVectorXd sbn_parameters_copy = sbn_parameters_;
@@ -244,8 +420,13 @@ class GenericSBNInstance {
   // Set whether we use rescaling for phylogenetic likelihood computation.
   void SetRescaling(bool use_rescaling) { rescaling_ = use_rescaling; }
 
+  // The number of sequences loaded, whether from a FASTA file or an Alignment.
+  size_t SequenceCount() const {
+    return fasta_file_ ? fasta_file_->SequenceCount() : alignment_.SequenceCount();
+  }
+
   void CheckSequencesAndTreesLoaded() const {
-    if (alignment_.SequenceCount() == 0) {
+    if (SequenceCount() == 0) {
       Failwith(
           "Load an alignment into your SBNInstance on which you wish to "
           "calculate phylogenetic likelihoods.");
@@ -258,13 +439,21 @@ class GenericSBNInstance {
   }
   // Prepare for phylogenetic likelihood calculation. If we get a nullopt
   // argument, it just uses the number of trees currently in the SBNInstance.
+  // Only unrooted likelihoods are computed in batches, so rooted instances need a
+  // tree_batch_size of 1, rather than paying for buffers that are never used.
   void PrepareForPhyloLikelihood(
       const PhyloModelSpecification &model_specification, size_t thread_count,
       const std::vector<BeagleFlags> &beagle_flag_vector = {},
       bool use_tip_states = true,
-      const std::optional<size_t> &tree_count_option = std::nullopt) {
+      const std::optional<size_t> &tree_count_option = std::nullopt,
+      size_t tree_batch_size = 1) {
+    if (std::is_same<TTreeCollection, RootedTreeCollection>::value &&
+        tree_batch_size > 1) {
+      Failwith(
+          "Rooted trees are evaluated one at a time, so tree_batch_size must be 1.");
+    }
     const EngineSpecification engine_specification{thread_count, beagle_flag_vector,
-                                                   use_tip_states};
+                                                   use_tip_states, tree_batch_size};
     MakeGPEngine(engine_specification, model_specification);
     ResizePhyloModelParams(tree_count_option);
   }
@@ -291,13 +480,22 @@ class GenericSBNInstance {
 
   // ** I/O
 
+  // Index the sequences of a FASTA file in place, rather than copying them into an
+  // Alignment.
   void ReadFastaFile(const std::string &fname) {
-    alignment_ = Alignment::ReadFasta(fname);
+    fasta_file_ = std::make_unique<FastaFile>(fname);
+    alignment_ = Alignment();
   }
 
   // Allow users to pass in alignment directly.
-  void SetAlignment(const Alignment &alignment) { alignment_ = alignment; }
-  void SetAlignment(Alignment &&alignment) { alignment_ = alignment; }
+  void SetAlignment(const Alignment &alignment) {
+    alignment_ = alignment;
+    fasta_file_.reset();
+  }
+  void SetAlignment(Alignment &&alignment) {
+    alignment_ = std::move(alignment);
+    fasta_file_.reset();
+  }
 
   void LoadDuplicatesOfFirstTree(size_t number_of_times) {
     tree_collection_ =
@@ -363,7 +561,9 @@ class GenericSBNInstance {
   std::unique_ptr<PhyloFlags> phylo_flags_ = nullptr;
   // Whether we use likelihood vector rescaling.
   bool rescaling_;
-  // The multiple sequence alignment.
+  // The multiple sequence alignment, either read from a FASTA file, which we index in
+  // place, or set directly. Only one of these is in use.
+  std::unique_ptr<FastaFile> fasta_file_;
   Alignment alignment_;
   // The phylogenetic model parameterization. This has as many rows as there are
   // trees, and holds the parameters before likelihood computation, where they
@@ -375,12 +575,20 @@ class GenericSBNInstance {
 
   MersenneTwister mersenne_twister_;
   inline void SetSeed(uint64_t seed) { mersenne_twister_.SetSeed(seed); }
+  // The sampler of GetSBNSampler, and the parameters it was built for.
+  mutable SBNSampler sbn_sampler_;
+  mutable EigenVectorXd sbn_sampler_parameters_;
+  // The engine of GetSBNGradientEngine.
+  mutable std::optional<SBNGradientEngine> sbn_gradient_engine_;
 
   // Make a likelihood engine with the given specification.
   void MakeGPEngine(const EngineSpecification &engine_specification,
                     const PhyloModelSpecification &model_specification) {
     CheckSequencesAndTreesLoaded();
-    SitePattern site_pattern(alignment_, TagTaxonMap());
+    const size_t thread_count = engine_specification.thread_count_;
+    const SitePattern site_pattern =
+        fasta_file_ ? SitePattern(*fasta_file_, TagTaxonMap(), thread_count)
+                    : SitePattern(alignment_, TagTaxonMap(), thread_count);
     engine_ = std::make_unique<Engine>(engine_specification, model_specification,
                                        site_pattern);
   }
@@ -431,6 +639,28 @@ class GenericSBNInstance {
                       process_subsplit(parent_subsplit.SubsplitRotate()));
   }
 
+  // Run `stream` on a Driver with a visitor that counts topologies, then set up the SBN
+  // support from the counts and keep the taxa of the trees.
+  void ProcessTreeStream(
+      const std::function<TagStringMap(Driver &, const Driver::TreeVisitor &)> &stream) {
+    using TTree = typename std::decay_t<decltype(tree_collection_.Trees())>::value_type;
+    ClearTreeCollectionAssociatedState();
+    tree_collection_ = TTreeCollection();
+    Driver driver;
+    auto tag_taxon_map = stream(driver, [this](Tree tree) {
+      // Making a TTree checks the tree just as reading the file would.
+      const TTree typed_tree(std::move(tree));
+      auto search = topology_counter_.find(typed_tree.Topology());
+      if (search == topology_counter_.end()) {
+        SafeInsert(topology_counter_, typed_tree.Topology(), static_cast<uint32_t>(1));
+      } else {
+        search->second++;
+      }
+    });
+    tree_collection_ = TTreeCollection({}, std::move(tag_taxon_map));
+    SetSBNSupport(TSBNSupport(topology_counter_, tree_collection_.TaxonNames()));
+  }
+
   // Clear all of the state that depends on the current tree collection.
   void ClearTreeCollectionAssociatedState() {
     sbn_parameters_.resize(0);
@@ -460,41 +690,6 @@ class GenericSBNInstance {
     }
     return subsplit_ranges;
   }
-
-  static EigenVectorXd CalculateMultiplicativeFactors(EigenVectorXdRef log_f) {
-    double tree_count = log_f.size();
-    double log_F = NumericalUtils::LogSum(log_f);
-    double hat_L = log_F - log(tree_count);
-    EigenVectorXd tilde_w = log_f.array() - log_F;
-    tilde_w = tilde_w.array().exp();
-    return hat_L - tilde_w.array();
-  }
-
-  static EigenVectorXd CalculateVIMCOMultiplicativeFactors(EigenVectorXdRef log_f) {
-    // Use the geometric mean as \hat{f}(\tau^{-j}, \theta^{-j}), in eq:f_hat in
-    // the implementation notes.
-    size_t tree_count = log_f.size();
-    double log_tree_count = log(tree_count);
-    double sum_of_log_f = log_f.sum();
-    // This has jth entry \hat{f}_{\bm{\phi},{\bm{\psi}}}(\tau^{-j},\bm{\theta}^{-j}),
-    // i.e. the log of the geometric mean of each item other than j.
-    EigenVectorXd log_geometric_mean =
-        (sum_of_log_f - log_f.array()) / (tree_count - 1);
-    EigenVectorXd per_sample_signal(tree_count);
-    // This is a vector of entries that when summed become the parenthetical expression
-    // in eq:perSampleLearning.
-    EigenVectorXd log_f_perturbed = log_f;
-    for (size_t j = 0; j < tree_count; j++) {
-      log_f_perturbed(j) = log_geometric_mean(j);
-      per_sample_signal(j) =
-          log_f_perturbed.redux(NumericalUtils::LogAdd) - log_tree_count;
-      // Reset the value.
-      log_f_perturbed(j) = log_f(j);
-    }
-    EigenVectorXd multiplicative_factors = CalculateMultiplicativeFactors(log_f);
-    multiplicative_factors -= per_sample_signal;
-    return multiplicative_factors;
-  }
 };
 
 #ifdef DOCTEST_LIBRARY_INCLUDED
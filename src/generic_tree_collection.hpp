@@ -4,13 +4,16 @@
 #pragma once
 
 #include <fstream>
+#include <iterator>
 #include <memory>
 #include <string>
 #include <unordered_map>
 #include <utility>
 #include <vector>
 
+#include "thread_pool.hpp"
 #include "tree.hpp"
+#include "tree_collection_file.hpp"
 
 template <typename TTree>
 class GenericTreeCollection {
@@ -177,6 +180,47 @@ class GenericTreeCollection {
     return GenericTreeCollection(tree_vector, tag_taxon_map);
   }
 
+  // Write the collection to a compact binary file that Load can read back without
+  // parsing; see tree_collection_file.hpp. The weights are either empty or give a
+  // weight for each tree.
+  void Export(const std::string &out_path, const DoubleVector &weights = {}) const {
+    TreeCollectionFile::Write(
+        out_path, tag_taxon_map_, TreeCount(),
+        [this](size_t tree_idx) -> const Tree & { return trees_[tree_idx]; }, weights);
+  }
+
+  // Load a collection written by Export, building the trees on thread_count threads.
+  static GenericTreeCollection Load(const std::string &path, size_t thread_count = 1) {
+    const TreeCollectionFile file(path);
+    const auto boundaries = ThreadPool::ChunkBoundaries(
+        file.TreeCount(), [](size_t) { return 1.; },
+        thread_count * ThreadPool::chunks_per_worker_);
+    std::vector<TTreeVector> chunk_trees(boundaries.size() - 1);
+    ThreadPool::TaskVector tasks;
+    for (size_t chunk_idx = 0; chunk_idx < chunk_trees.size(); chunk_idx++) {
+      tasks.push_back([&file, &boundaries, &chunk_trees, chunk_idx](size_t) {
+        auto &trees = chunk_trees[chunk_idx];
+        trees.reserve(boundaries[chunk_idx + 1] - boundaries[chunk_idx]);
+        for (size_t tree_idx = boundaries[chunk_idx];
+             tree_idx < boundaries[chunk_idx + 1]; tree_idx++) {
+          trees.emplace_back(file.TopologyAt(tree_idx), file.BranchLengthsAt(tree_idx));
+        }
+      });
+    }
+    ThreadPool::Shared(thread_count).Run(std::move(tasks));
+    TTreeVector trees;
+    trees.reserve(file.TreeCount());
+    for (auto &chunk : chunk_trees) {
+      std::move(chunk.begin(), chunk.end(), std::back_inserter(trees));
+    }
+    return GenericTreeCollection(std::move(trees), file.TagTaxonMap());
+  }
+
+  // The tree weights of a file written by Export, or an empty vector if there are none.
+  static DoubleVector LoadWeights(const std::string &path) {
+    return TreeCollectionFile(path).Weights();
+  }
+
   auto begin() const { return trees_.begin(); }
   auto end() const { return trees_.end(); }
 
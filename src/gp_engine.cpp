@@ -10,7 +10,8 @@ GPEngine::GPEngine(SitePattern site_pattern, size_t node_count, size_t gpcsp_cou
                    const std::string& mmap_file_path, double rescaling_threshold,
                    EigenVectorXd sbn_prior,
                    EigenVectorXd unconditional_node_probabilities,
-                   EigenVectorXd inverted_sbn_prior, bool use_gradients)
+                   EigenVectorXd inverted_sbn_prior, bool use_gradients,
+                   std::optional<size_t> plv_byte_budget)
     : site_pattern_(std::move(site_pattern)),
       rescaling_threshold_(rescaling_threshold),
       log_rescaling_threshold_(log(rescaling_threshold)),
@@ -32,7 +33,7 @@ GPEngine::GPEngine(SitePattern site_pattern, size_t node_count, size_t gpcsp_cou
   branch_handler_.SetSpareCount(GetSpareGPCSPCount());
   GrowGPCSPs(gpcsp_count, std::nullopt, std::nullopt, true);
   // Initialize PLV temporaries.
-  quartet_root_plv_ = GetPLV(PVId(0));
+  quartet_root_plv_ = DoublePLV(0);
   quartet_root_plv_.setZero();
   quartet_r_s_plv_ = quartet_root_plv_;
   quartet_q_s_plv_ = quartet_root_plv_;
@@ -40,6 +41,11 @@ GPEngine::GPEngine(SitePattern site_pattern, size_t node_count, size_t gpcsp_cou
 
   InitializeBranchLengthHandler();
   UseGradientOptimization(use_gradients);
+  if (plv_byte_budget.has_value()) {
+    plv_cache_.emplace(plv_byte_budget.value(),
+                       static_cast<size_t>(GetPLVs()[0].size()) * sizeof(PLVScalar));
+    plv_cache_->Reset(ReleasablePLVByteCounts());
+  }
 }
 
 void GPEngine::InitializePriors(EigenVectorXd sbn_prior,
@@ -65,6 +71,10 @@ void GPEngine::GrowPLVs(const size_t new_node_count,
                         std::optional<const Reindexer> node_reindexer,
                         std::optional<const size_t> explicit_alloc,
                         const bool on_init) {
+  // The PLV cache doesn't follow PLVs as they move.
+  if (HasPLVByteBudget()) {
+    MakeAllPLVsResident();
+  }
   const size_t old_node_count = GetNodeCount();
   const size_t old_plv_count = GetPLVCount();
   SetNodeCount(new_node_count);
@@ -96,7 +106,9 @@ void GPEngine::GrowPLVs(const size_t new_node_count,
          "Didn't get the right shape of PLVs out of Subdivide.");
   for (PVId pv_id = PVId(old_plv_count); pv_id < GetPaddedPLVCount(); pv_id++) {
     rescaling_counts_[pv_id.value_] = 0;
-    GetPLV(pv_id).setZero();
+    if (!IsTipPLV(pv_id.value_)) {
+      GetPLV(pv_id).setZero();
+    }
   }
   for (NodeId node_id = NodeId(old_node_count); node_id < GetNodeCount(); node_id++) {
     if (!on_init) {
@@ -107,6 +119,9 @@ void GPEngine::GrowPLVs(const size_t new_node_count,
   if (node_reindexer.has_value()) {
     ReindexPLVs(node_reindexer.value(), old_node_count);
   }
+  if (HasPLVByteBudget()) {
+    plv_cache_->Reset(ReleasablePLVByteCounts());
+  }
 }
 
 void GPEngine::GrowGPCSPs(const size_t new_gpcsp_count,
@@ -229,6 +244,12 @@ void GPEngine::operator()(const GPOperations::SetToStationaryDistribution& op) {
 void GPEngine::operator()(const GPOperations::IncrementWithWeightedEvolvedPLV& op) {
   const auto branch_length = branch_handler_(EdgeId(op.gpcsp_));
   SetTransitionMatrixToHaveBranchLength(branch_length);
+  IncrementWithWeightedEvolvedPLV(op, transition_matrix_);
+}
+
+void GPEngine::IncrementWithWeightedEvolvedPLV(
+    const GPOperations::IncrementWithWeightedEvolvedPLV& op,
+    const Eigen::Matrix4d& transition_matrix) {
   // We assume that we've done a PrepForMarginalization operation, and thus the
   // rescaling count for op.dest_ is the minimum of the rescaling counts among the
   // op.src_s. Thus this should be non-negative:
@@ -244,8 +265,22 @@ void GPEngine::operator()(const GPOperations::IncrementWithWeightedEvolvedPLV& o
   // adding together things of radically different rescaling amounts. This appears
   // unavoidable without special-purpose truncation code, which doesn't seem
   // worthwhile.
-  GetPLV(PVId(op.dest_)) +=
-      rescaling_factor * q_(op.gpcsp_) * transition_matrix_ * GetPLV(PVId(op.src_));
+  AssertPLVIsContiguous(op.dest_);
+  auto& dest = GetPLV(PVId(op.dest_));
+  const double weight = rescaling_factor * q_(op.gpcsp_);
+  const auto pattern_count = static_cast<size_t>(dest.cols());
+  if (IsTipPLV(op.src_)) {
+    PLVKernels::IncrementWithWeightedEvolvedTip(
+        PatternThreadPool(), dest.data(), transition_matrix.data(), TipCodes(op.src_),
+        weight, pattern_count);
+    return;
+  }
+  // else
+  AssertPLVIsContiguous(op.src_);
+  PLVKernels::IncrementWithWeightedEvolved(PatternThreadPool(), dest.data(),
+                                           transition_matrix.data(),
+                                           GetPLV(PVId(op.src_)).data(), weight,
+                                           pattern_count);
 }
 
 void GPEngine::operator()(const GPOperations::ResetMarginalLikelihood& op) {  // NOLINT
@@ -262,7 +297,8 @@ void GPEngine::operator()(const GPOperations::IncrementMarginalLikelihood& op) {
   // per-site marginal likelihood. It's an unconditional contribution because our
   // stationary distribution incorporates the prior on rootsplits.
   log_likelihoods_.row(op.rootsplit_) =
-      (GetPLV(PVId(op.stationary_times_prior_)).transpose() * GetPLV(PVId(op.p_)))
+      (GetPLV(PVId(op.stationary_times_prior_)).cast<double>().transpose() *
+       DoublePLV(op.p_))
           .diagonal()
           .array()
           .log() +
@@ -276,18 +312,34 @@ void GPEngine::operator()(const GPOperations::IncrementMarginalLikelihood& op) {
 }
 
 void GPEngine::operator()(const GPOperations::Multiply& op) {
-  GetPLV(PVId(op.dest_)).array() =
-      GetPLV(PVId(op.src1_)).array() * GetPLV(PVId(op.src2_)).array();
+  Assert(!IsTipPLV(op.src1_) && !IsTipPLV(op.src2_),
+         "Multiply can't read the P-PLV of a leaf.");
+  AssertPLVIsContiguous(op.dest_);
+  AssertPLVIsContiguous(op.src1_);
+  AssertPLVIsContiguous(op.src2_);
+  // The kernel gathers the extrema as it goes, saving two passes over dest_.
+  auto& dest = GetPLV(PVId(op.dest_));
+  const auto extrema = PLVKernels::Multiply(
+      PatternThreadPool(), dest.data(), GetPLV(PVId(op.src1_)).data(),
+      GetPLV(PVId(op.src2_)).data(),
+      static_cast<size_t>(dest.cols()));
   rescaling_counts_(op.dest_) =
       rescaling_counts_(op.src1_) + rescaling_counts_(op.src2_);
-  AssertPLVIsFinite(op.dest_, "Multiply dest_ is not finite");
-  RescalePLVIfNeeded(op.dest_);
+  Assert(extrema.is_finite_, "Multiply dest_ is not finite");
+  RescalePLVGivenExtrema(op.dest_, extrema.min_, extrema.max_);
 }
 
 void GPEngine::operator()(const GPOperations::Likelihood& op) {
   SetTransitionMatrixToHaveBranchLength(branch_handler_(EdgeId(op.dest_)));
-  PreparePerPatternLogLikelihoodsForGPCSP(op.parent_, op.child_);
-  log_likelihoods_.row(op.dest_) = per_pattern_log_likelihoods_;
+  SetLikelihood(op, transition_matrix_, per_pattern_log_likelihoods_);
+}
+
+void GPEngine::SetLikelihood(const GPOperations::Likelihood& op,
+                             const Eigen::Matrix4d& transition_matrix,
+                             EigenVectorXd& per_pattern_log_likelihoods) {
+  PrepareRescaledPerPatternLogLikelihoods(per_pattern_log_likelihoods, op.parent_,
+                                          transition_matrix, op.child_);
+  log_likelihoods_.row(op.dest_) = per_pattern_log_likelihoods;
 }
 
 void GPEngine::operator()(const GPOperations::OptimizeBranchLength& op) {
@@ -332,29 +384,194 @@ void GPEngine::operator()(const GPOperations::PrepForMarginalization& op) {
   rescaling_counts_(op.dest_) = min_rescaling_count;
 }
 
+struct GPEngine::ConcurrentOperationVisitor {
+  GPEngine& engine_;
+  Eigen::Matrix4d transition_matrix_;
+  EigenVectorXd per_pattern_log_likelihoods_;
+
+  void SetTransitionMatrixForEdge(size_t gpcsp_idx) {
+    transition_matrix_ = engine_.TransitionMatrixForBranchLength(
+        engine_.branch_handler_(EdgeId(gpcsp_idx)));
+  }
+
+  void operator()(const GPOperations::IncrementWithWeightedEvolvedPLV& op) {
+    SetTransitionMatrixForEdge(op.gpcsp_);
+    engine_.IncrementWithWeightedEvolvedPLV(op, transition_matrix_);
+  }
+  void operator()(const GPOperations::Likelihood& op) {
+    SetTransitionMatrixForEdge(op.dest_);
+    engine_.SetLikelihood(op, transition_matrix_, per_pattern_log_likelihoods_);
+  }
+  // The other non-barrier operations only touch their own PLVs.
+  template <typename TOperation>
+  void operator()(const TOperation& op) {
+    engine_(op);
+  }
+};
+
 void GPEngine::ProcessOperations(GPOperationVector operations) {
   for (const auto& operation : operations) {
-    std::visit(*this, operation);
+    PrecomputeTransitionMatrix(operation);
+  }
+  if (HasPLVByteBudget()) {
+    for (const auto& operation : operations) {
+      ProcessOperationWithinBudget(operation, false);
+    }
+    return;
+  }
+  // else
+  if (thread_count_ == 1) {
+    for (const auto& operation : operations) {
+      std::visit(*this, operation);
+    }
+    return;
+  }
+  // else
+  auto& thread_pool = ThreadPool::Shared(thread_count_);
+  for (const auto& level : GPOperations::DependencyLevels(operations)) {
+    if (level.size() == 1) {
+      // Barriers, which need the engine's own visitor, always end up here.
+      std::visit(*this, operations[level.front()]);
+      continue;
+    }
+    // else
+    // Branch lengths may have been optimized since we precomputed, and the concurrent
+    // operations only look matrices up.
+    for (const auto op_idx : level) {
+      PrecomputeTransitionMatrix(operations[op_idx]);
+    }
+    thread_pool.ParallelFor(
+        level.size(), [](size_t) { return 1.; },
+        [this, &level, &operations](size_t, size_t begin, size_t end) {
+          ConcurrentOperationVisitor visitor{*this, {}, {}};
+          for (size_t idx = begin; idx < end; idx++) {
+            std::visit(visitor, operations[level[idx]]);
+          }
+        });
+  }
+}
+
+void GPEngine::PrecomputeTransitionMatrix(const GPOperation& operation) {
+  if (const auto* op =
+          std::get_if<GPOperations::IncrementWithWeightedEvolvedPLV>(&operation)) {
+    transition_matrix_cache_.Precompute(branch_handler_(EdgeId(op->gpcsp_)));
+  } else if (const auto* op = std::get_if<GPOperations::Likelihood>(&operation)) {
+    transition_matrix_cache_.Precompute(branch_handler_(EdgeId(op->dest_)));
+  }
+}
+
+void GPEngine::ProcessOperationWithinBudget(const GPOperation& operation,
+                                            bool is_recomputation) {
+  const GPOperationPLVs plvs(operation);
+  // Pin everything first, so that recomputing one PLV doesn't evict another.
+  for (const auto plv_idx : plvs.reads_) {
+    plv_cache_->Pin(plv_idx);
+  }
+  if (plvs.dest_.has_value()) {
+    plv_cache_->Pin(plvs.dest_.value());
+  }
+  for (const auto plv_idx : plvs.reads_) {
+    EnsurePLVIsResident(plv_idx);
+  }
+  if (plvs.overwrites_dest_) {
+    plv_cache_->SetResident(plvs.dest_.value());
+  }
+  std::visit(*this, operation);
+  if (!is_recomputation) {
+    plv_cache_->RecordOperation(operation, plvs);
+  }
+  for (const auto plv_idx : plvs.reads_) {
+    plv_cache_->Unpin(plv_idx);
+    plv_cache_->Touch(plv_idx);
+  }
+  if (plvs.dest_.has_value()) {
+    plv_cache_->Unpin(plvs.dest_.value());
+    plv_cache_->Touch(plvs.dest_.value());
+  }
+  EvictPLVsOverBudget();
+}
+
+void GPEngine::EnsurePLVIsResident(size_t plv_idx) {
+  if (!HasPLVByteBudget()) {
+    return;
+  }
+  // else
+  if (plv_cache_->IsResident(plv_idx)) {
+    plv_cache_->CountHit();
+    return;
+  }
+  // else
+  plv_cache_->CountMiss();
+  // Replaying doesn't record operations, so the recipe stays put as we go.
+  plv_cache_->Pin(plv_idx);
+  for (const auto& operation : plv_cache_->GetRecipe(plv_idx)) {
+    plv_cache_->CountRecomputedOperation();
+    ProcessOperationWithinBudget(operation, true);
+  }
+  plv_cache_->Unpin(plv_idx);
+  Assert(plv_cache_->IsResident(plv_idx),
+         "Recipe did not recompute PLV " + std::to_string(plv_idx) + ".");
+}
+
+void GPEngine::MakeAllPLVsResident() {
+  if (!HasPLVByteBudget()) {
+    return;
+  }
+  // else
+  for (size_t plv_idx = 0; plv_idx < plv_cache_->GetPLVCount(); plv_idx++) {
+    EnsurePLVIsResident(plv_idx);
+    // Without a recipe this PLV can't be evicted by later recomputations.
+    plv_cache_->ForgetRecipe(plv_idx);
   }
 }
 
+SizeVector GPEngine::ReleasablePLVByteCounts() const {
+  SizeVector releasable_byte_counts(GetPaddedPLVCount());
+  // The leaf P-PLVs are released for good, so the cache has nothing to evict there.
+  for (size_t plv_idx = 0; plv_idx < releasable_byte_counts.size(); plv_idx++) {
+    releasable_byte_counts[plv_idx] =
+        IsTipPLV(plv_idx) ? 0 : plv_handler_.ReleasablePVByteCount(PVId(plv_idx));
+  }
+  return releasable_byte_counts;
+}
+
+void GPEngine::EvictPLVsOverBudget() {
+  while (const auto plv_idx = plv_cache_->NextEviction()) {
+    plv_handler_.ReleasePVMemory(PVId(plv_idx.value()));
+    plv_cache_->SetEvicted(plv_idx.value());
+  }
+}
+
+StringSizeMap GPEngine::PLVCacheStatistics() const {
+  Assert(HasPLVByteBudget(), "PLV cache statistics need a GPEngine with a budget.");
+  return plv_cache_->Statistics();
+}
+
+void GPEngine::ResetPLVCacheStatistics() {
+  Assert(HasPLVByteBudget(), "PLV cache statistics need a GPEngine with a budget.");
+  plv_cache_->ResetStatistics();
+}
+
+void GPEngine::SetThreadCount(size_t thread_count) {
+  Assert(thread_count > 0, "GPEngine needs a strictly positive thread count.");
+  thread_count_ = thread_count;
+}
+
+Eigen::Matrix4d GPEngine::TransitionMatrixForBranchLength(double branch_length) const {
+  return transition_matrix_cache_.FindTransitionMatrix(branch_length);
+}
+
 void GPEngine::SetTransitionMatrixToHaveBranchLength(double branch_length) {
-  diagonal_matrix_.diagonal() = (branch_length * eigenvalues_).array().exp();
-  transition_matrix_ = eigenmatrix_ * diagonal_matrix_ * inverse_eigenmatrix_;
+  transition_matrix_ = transition_matrix_cache_.GetTransitionMatrix(branch_length);
 }
 
 void GPEngine::SetTransitionAndDerivativeMatricesToHaveBranchLength(
     double branch_length) {
-  diagonal_vector_ = (branch_length * eigenvalues_).array().exp();
-  diagonal_matrix_.diagonal() = diagonal_vector_;
-  transition_matrix_ = eigenmatrix_ * diagonal_matrix_ * inverse_eigenmatrix_;
-  // Now calculating derivative matrix
-  diagonal_matrix_.diagonal() = eigenvalues_.array() * diagonal_vector_.array();
-  derivative_matrix_ = eigenmatrix_ * diagonal_matrix_ * inverse_eigenmatrix_;
-  // Now calculating hessian matrix
-  diagonal_matrix_.diagonal() =
-      eigenvalues_.array() * eigenvalues_.array() * diagonal_vector_.array();
-  hessian_matrix_ = eigenmatrix_ * diagonal_matrix_ * inverse_eigenmatrix_;
+  const auto& matrices =
+      transition_matrix_cache_.GetMatricesWithDerivatives(branch_length);
+  transition_matrix_ = matrices.transition_;
+  derivative_matrix_ = matrices.derivative_;
+  hessian_matrix_ = matrices.hessian_;
 }
 
 void GPEngine::SetTransitionMatrixToHaveBranchLengthAndTranspose(double branch_length) {
@@ -394,7 +611,23 @@ void GPEngine::CopyNodeData(const NodeId src_node_idx, const NodeId dest_node_id
 void GPEngine::CopyPLVData(const size_t src_plv_idx, const size_t dest_plv_idx) {
   Assert((src_plv_idx < GetPaddedPLVCount()) && (dest_plv_idx < GetPaddedPLVCount()),
          "Cannot copy PLV data with src or dest index out-of-range.");
-  GetPLV(PVId(dest_plv_idx)) = GetPLV(PVId(src_plv_idx));
+  if (HasPLVByteBudget()) {
+    EnsurePLVIsResident(src_plv_idx);
+    plv_cache_->SetResident(dest_plv_idx);
+    plv_cache_->ForgetRecipe(dest_plv_idx);
+  }
+  if (IsTipPLV(dest_plv_idx)) {
+    Assert(src_plv_idx == dest_plv_idx, "Cannot overwrite the P-PLV of a leaf.");
+    return;
+  }
+  // else
+  if (IsTipPLV(src_plv_idx)) {
+    AssertPLVIsContiguous(dest_plv_idx);
+    site_pattern_.GetTipStates().Expand(src_plv_idx, PLVScalar(1), PLVScalar(0),
+                                        GetPLV(PVId(dest_plv_idx)).data());
+  } else {
+    GetPLV(PVId(dest_plv_idx)) = GetPLV(PVId(src_plv_idx));
+  }
   rescaling_counts_[dest_plv_idx] = rescaling_counts_[src_plv_idx];
 }
 
@@ -480,7 +713,7 @@ DoublePair GPEngine::LogLikelihoodAndDerivative(const size_t gpcsp,
   // The prior is expressed using the current value of q_.
   // The phylogenetic component of the likelihood is weighted with the number of times
   // we see the site patterns.
-  const double log_likelihood = per_pattern_log_likelihoods_.dot(site_pattern_weights_);
+  const double log_likelihood = SumOverSitePatterns(per_pattern_log_likelihoods_);
 
   // The per-site likelihood derivative is calculated in the same way as the per-site
   // likelihood, but using the derivative matrix instead of the transition matrix.
@@ -488,12 +721,9 @@ DoublePair GPEngine::LogLikelihoodAndDerivative(const size_t gpcsp,
   // rescalings cancel out in the ratio below.
   PrepareUnrescaledPerPatternLikelihoodDerivatives(rootward, leafward);
   PrepareUnrescaledPerPatternLikelihoods(rootward, leafward);
-  // If l_i is the per-site likelihood, the derivative of log(l_i) is the derivative
-  // of l_i divided by l_i.
-  per_pattern_likelihood_derivative_ratios_ =
-      per_pattern_likelihood_derivatives_.array() / per_pattern_likelihoods_.array();
+  PreparePerPatternLikelihoodDerivativeRatios();
   const double log_likelihood_derivative =
-      per_pattern_likelihood_derivative_ratios_.dot(site_pattern_weights_);
+      SumOverSitePatterns(per_pattern_likelihood_derivative_ratios_);
   return {log_likelihood, log_likelihood_derivative};
 }
 
@@ -507,7 +737,7 @@ std::tuple<double, double, double> GPEngine::LogLikelihoodAndFirstTwoDerivatives
   SetTransitionAndDerivativeMatricesToHaveBranchLength(branch_handler_(EdgeId(gpcsp)));
   PreparePerPatternLogLikelihoodsForGPCSP(rootward, leafward);
 
-  const double log_likelihood = per_pattern_log_likelihoods_.dot(site_pattern_weights_);
+  const double log_likelihood = SumOverSitePatterns(per_pattern_log_likelihoods_);
 
   // The per-site likelihood derivative is calculated in the same way as the per-site
   // likelihood, but using the derivative matrix instead of the transition matrix.
@@ -515,27 +745,17 @@ std::tuple<double, double, double> GPEngine::LogLikelihoodAndFirstTwoDerivatives
   // rescalings cancel out in the ratio below.
   PrepareUnrescaledPerPatternLikelihoodDerivatives(rootward, leafward);
   PrepareUnrescaledPerPatternLikelihoods(rootward, leafward);
-  // If l_i is the per-site likelihood, the derivative of log(l_i) is the derivative
-  // of l_i divided by l_i.
-  per_pattern_likelihood_derivative_ratios_ =
-      per_pattern_likelihood_derivatives_.array() / per_pattern_likelihoods_.array();
+  PreparePerPatternLikelihoodDerivativeRatios();
   const double log_likelihood_gradient =
-      per_pattern_likelihood_derivative_ratios_.dot(site_pattern_weights_);
+      SumOverSitePatterns(per_pattern_likelihood_derivative_ratios_);
 
   // Second derivative is calculated the same way, but has an extra term due to
   // the product rule.
 
   PrepareUnrescaledPerPatternLikelihoodSecondDerivatives(rootward, leafward);
-
-  per_pattern_likelihood_second_derivative_ratios_ =
-      (per_pattern_likelihood_second_derivatives_.array() *
-           per_pattern_likelihoods_.array() -
-       per_pattern_likelihood_derivatives_.array() *
-           per_pattern_likelihood_derivatives_.array()) /
-      (per_pattern_likelihoods_.array() * per_pattern_likelihoods_.array());
-
+  PreparePerPatternLikelihoodSecondDerivativeRatios();
   const double log_likelihood_hessian =
-      per_pattern_likelihood_second_derivative_ratios_.dot(site_pattern_weights_);
+      SumOverSitePatterns(per_pattern_likelihood_second_derivative_ratios_);
 
   return std::make_tuple(log_likelihood, log_likelihood_gradient,
                          log_likelihood_hessian);
@@ -545,20 +765,20 @@ void GPEngine::InitializePLVsWithSitePatterns() {
   for (auto& plv : GetPLVs()) {
     plv.setZero();
   }
-  NodeId taxon_idx = 0;
-  for (const auto& pattern : site_pattern_.GetPatterns()) {
-    size_t site_idx = 0;
-    for (const int symbol : pattern) {
-      Assert(symbol >= 0, "Negative symbol!");
-      if (symbol == MmappedNucleotidePLV::base_count_) {  // Gap character.
-        GetPLV(PVId(taxon_idx.value_)).col(site_idx).setConstant(1.);
-      } else if (symbol < MmappedNucleotidePLV::base_count_) {
-        GetPLV(PVId(taxon_idx.value_))(symbol, site_idx) = 1.;
-      }
-      site_idx++;
-    }
-    taxon_idx++;
+  // The leaf P-PLVs come first, one after another. We read the tip codes in their
+  // place (see IsTipPLV), so we give back the pages that they cover.
+  plv_handler_.ReleasePVMemory(PVId(0), site_pattern_.GetTipStates().TaxonCount());
+}
+
+NucleotidePV<double> GPEngine::DoublePLV(size_t plv_idx) const {
+  if (IsTipPLV(plv_idx)) {
+    NucleotidePV<double> plv(MmappedNucleotidePLV::base_count_,
+                             site_pattern_.PatternCount());
+    site_pattern_.GetTipStates().Expand(plv_idx, 1., 0., plv.data());
+    return plv;
   }
+  // else
+  return GetPLV(PVId(plv_idx)).cast<double>();
 }
 
 void GPEngine::RescalePLV(size_t plv_idx, int rescaling_count) {
@@ -567,8 +787,11 @@ void GPEngine::RescalePLV(size_t plv_idx, int rescaling_count) {
   }
   // else
   Assert(rescaling_count >= 0, "Negative rescaling count in RescalePLV.");
-  GetPLV(PVId(plv_idx)) /=
-      pow(rescaling_threshold_, static_cast<double>(rescaling_count));
+  auto& plv = GetPLV(PVId(plv_idx));
+  const double factor =
+      1. / pow(rescaling_threshold_, static_cast<double>(rescaling_count));
+  PLVKernels::Scale(PatternThreadPool(), plv.data(), factor,
+                    static_cast<size_t>(plv.cols()));
   rescaling_counts_(plv_idx) += rescaling_count;
 }
 
@@ -577,11 +800,25 @@ void GPEngine::AssertPLVIsFinite(size_t plv_idx, const std::string& message) con
 }
 
 std::pair<double, double> GPEngine::PLVMinMax(size_t plv_idx) const {
-  return {GetPLV(PVId(plv_idx)).minCoeff(), GetPLV(PVId(plv_idx)).maxCoeff()};
+  AssertPLVIsContiguous(plv_idx);
+  const auto& plv = GetPLV(PVId(plv_idx));
+  const auto extrema = PLVKernels::Extrema(PatternThreadPool(), plv.data(),
+                                           static_cast<size_t>(plv.cols()));
+  return {extrema.min_, extrema.max_};
+}
+
+void GPEngine::AssertPLVIsContiguous(size_t plv_idx) const {
+  Assert(GetPLV(PVId(plv_idx)).outerStride() == 4,
+         "PLV " + std::to_string(plv_idx) + " is not contiguous.");
 }
 
 void GPEngine::RescalePLVIfNeeded(size_t plv_idx) {
   auto [min_entry, max_entry] = PLVMinMax(plv_idx);
+  RescalePLVGivenExtrema(plv_idx, min_entry, max_entry);
+}
+
+void GPEngine::RescalePLVGivenExtrema(size_t plv_idx, double min_entry,
+                                      double max_entry) {
   Assert(min_entry >= 0., "PLV with negative entry (" + std::to_string(min_entry) +
                               ") passed to RescalePLVIfNeeded");
   if (max_entry == 0) {
@@ -596,6 +833,94 @@ void GPEngine::RescalePLVIfNeeded(size_t plv_idx) {
   RescalePLV(plv_idx, rescaling_count);
 }
 
+void GPEngine::PrepareUnrescaledPerPatternProducts(EigenVectorXd& result,
+                                                   size_t src1_idx,
+                                                   const Eigen::Matrix4d& matrix,
+                                                   size_t src2_idx) const {
+  Assert(!IsTipPLV(src1_idx) || !IsTipPLV(src2_idx),
+         "Per-pattern products need a PLV that isn't a leaf P-PLV.");
+  if (IsTipPLV(src1_idx)) {
+    // src1^T * matrix * src2 = src2^T * matrix^T * src1.
+    const Eigen::Matrix4d transposed_matrix = matrix.transpose();
+    PrepareUnrescaledPerPatternProducts(result, src2_idx, transposed_matrix, src1_idx);
+    return;
+  }
+  // else
+  AssertPLVIsContiguous(src1_idx);
+  const auto& src1 = GetPLV(PVId(src1_idx));
+  const auto pattern_count = static_cast<size_t>(src1.cols());
+  result.resize(src1.cols());
+  if (IsTipPLV(src2_idx)) {
+    PLVKernels::PerPatternLikelihoodsTip(PatternThreadPool(), result.data(),
+                                         src1.data(), matrix.data(),
+                                         TipCodes(src2_idx), pattern_count);
+    return;
+  }
+  // else
+  AssertPLVIsContiguous(src2_idx);
+  PLVKernels::PerPatternLikelihoods(PatternThreadPool(), result.data(), src1.data(),
+                                    matrix.data(), GetPLV(PVId(src2_idx)).data(),
+                                    pattern_count);
+}
+
+void GPEngine::PrepareRescaledPerPatternLogLikelihoods(EigenVectorXd& result,
+                                                       size_t src1_idx,
+                                                       const Eigen::Matrix4d& matrix,
+                                                       size_t src2_idx) {
+  PrepareUnrescaledPerPatternProducts(result, src1_idx, matrix, src2_idx);
+  const double log_rescaling = LogRescalingFor(src1_idx) + LogRescalingFor(src2_idx);
+  PLVKernels::ForEachPatternChunk(
+      PatternThreadPool(), static_cast<size_t>(result.size()),
+      [&result, log_rescaling](size_t, size_t begin, size_t end) {
+        auto chunk = result.segment(begin, end - begin);
+        chunk = chunk.array().log() + log_rescaling;
+      });
+}
+
+void GPEngine::PreparePerPatternLikelihoodDerivativeRatios() {
+  // If l_i is the per-site likelihood, the derivative of log(l_i) is the derivative
+  // of l_i divided by l_i.
+  per_pattern_likelihood_derivative_ratios_.resize(per_pattern_likelihoods_.size());
+  PLVKernels::ForEachPatternChunk(
+      PatternThreadPool(), static_cast<size_t>(per_pattern_likelihoods_.size()),
+      [this](size_t, size_t begin, size_t end) {
+        const auto length = end - begin;
+        per_pattern_likelihood_derivative_ratios_.segment(begin, length) =
+            per_pattern_likelihood_derivatives_.segment(begin, length).array() /
+            per_pattern_likelihoods_.segment(begin, length).array();
+      });
+}
+
+void GPEngine::PreparePerPatternLikelihoodSecondDerivativeRatios() {
+  // The second derivative of log(l_i) is (l_i'' l_i - l_i'^2) / l_i^2.
+  per_pattern_likelihood_second_derivative_ratios_.resize(
+      per_pattern_likelihoods_.size());
+  PLVKernels::ForEachPatternChunk(
+      PatternThreadPool(), static_cast<size_t>(per_pattern_likelihoods_.size()),
+      [this](size_t, size_t begin, size_t end) {
+        const auto length = end - begin;
+        const auto likelihoods =
+            per_pattern_likelihoods_.segment(begin, length).array();
+        const auto derivatives =
+            per_pattern_likelihood_derivatives_.segment(begin, length).array();
+        per_pattern_likelihood_second_derivative_ratios_.segment(begin, length) =
+            (per_pattern_likelihood_second_derivatives_.segment(begin, length).array() *
+                 likelihoods -
+             derivatives * derivatives) /
+            (likelihoods * likelihoods);
+      });
+}
+
+double GPEngine::SumOverSitePatterns(const EigenVectorXd& per_pattern_values) const {
+  return PLVKernels::WeightedSum(PatternThreadPool(), per_pattern_values.data(),
+                                 site_pattern_weights_.data(),
+                                 static_cast<size_t>(per_pattern_values.size()));
+}
+
+ThreadPool* GPEngine::PatternThreadPool() const {
+  return (thread_count_ > 1) ? &ThreadPool::Shared(thread_count_) : nullptr;
+}
+
 double GPEngine::LogRescalingFor(size_t plv_idx) {
   return static_cast<double>(rescaling_counts_(plv_idx)) * log_rescaling_threshold_;
 }
@@ -606,7 +931,7 @@ void GPEngine::InitializeBranchLengthHandler() {
       [this](EdgeId edge_id, PVId parent_id, PVId child_id, double log_branch_length) {
         SetTransitionMatrixToHaveBranchLength(exp(log_branch_length));
         PreparePerPatternLogLikelihoodsForGPCSP(parent_id.value_, child_id.value_);
-        return -per_pattern_log_likelihoods_.dot(site_pattern_weights_);
+        return -SumOverSitePatterns(per_pattern_log_likelihoods_);
       };
   branch_handler_.SetBrentFunc(brent_nongrad_func);
   // Set Gradient Brent.
@@ -747,13 +1072,16 @@ void GPEngine::TakeFirstBranchLength(const RootedTreeCollection& tree_collection
 
 EigenVectorXd GPEngine::CalculateQuartetHybridLikelihoods(
     const QuartetHybridRequest& request) {
-  auto CheckRescaling = [this](size_t plv_idx) {
+  // Recomputing an evicted PLV changes transition_matrix_, so this must come before
+  // we set it for the tip.
+  auto PrepareTipPLV = [this](size_t plv_idx) {
+    EnsurePLVIsResident(plv_idx);
     Assert(rescaling_counts_[plv_idx] == 0,
            "Rescaling not implemented in CalculateQuartetHybridLikelihoods.");
   };
   std::vector<double> result;
   for (const auto& rootward_tip : request.rootward_tips_) {
-    CheckRescaling(rootward_tip.plv_idx_);
+    PrepareTipPLV(rootward_tip.plv_idx_);
     const double rootward_tip_prior =
         unconditional_node_probabilities_[rootward_tip.tip_node_id_];
     const double log_rootward_tip_prior = log(rootward_tip_prior);
@@ -761,29 +1089,32 @@ EigenVectorXd GPEngine::CalculateQuartetHybridLikelihoods(
     // when coming down the tree.
     SetTransitionMatrixToHaveBranchLength(
         branch_handler_(EdgeId(rootward_tip.gpcsp_idx_)));
-    quartet_root_plv_ = transition_matrix_ * GetPLV(PVId(rootward_tip.plv_idx_));
+    quartet_root_plv_ =
+        transition_matrix_ * DoublePLV(rootward_tip.plv_idx_);
     for (const auto& sister_tip : request.sister_tips_) {
-      CheckRescaling(sister_tip.plv_idx_);
+      PrepareTipPLV(sister_tip.plv_idx_);
       // Form the PLV on the root side of the central edge.
       SetTransitionMatrixToHaveBranchLength(
           branch_handler_(EdgeId(sister_tip.gpcsp_idx_)));
       quartet_r_s_plv_.array() =
           quartet_root_plv_.array() *
-          (transition_matrix_ * GetPLV(PVId(sister_tip.plv_idx_))).array();
+          (transition_matrix_ * DoublePLV(sister_tip.plv_idx_))
+              .array();
       // Advance it along the edge.
       SetTransitionMatrixToHaveBranchLength(
           branch_handler_(EdgeId(request.central_gpcsp_idx_)));
       quartet_q_s_plv_ = transition_matrix_ * quartet_r_s_plv_;
       for (const auto& rotated_tip : request.rotated_tips_) {
-        CheckRescaling(rotated_tip.plv_idx_);
+        PrepareTipPLV(rotated_tip.plv_idx_);
         // Form the PLV on the root side of the sorted edge.
         SetTransitionMatrixToHaveBranchLength(
             branch_handler_(EdgeId(rotated_tip.gpcsp_idx_)));
         quartet_r_sorted_plv_.array() =
             quartet_q_s_plv_.array() *
-            (transition_matrix_ * GetPLV(PVId(rotated_tip.plv_idx_))).array();
+            (transition_matrix_ * DoublePLV(rotated_tip.plv_idx_))
+                .array();
         for (const auto& sorted_tip : request.sorted_tips_) {
-          CheckRescaling(sorted_tip.plv_idx_);
+          PrepareTipPLV(sorted_tip.plv_idx_);
           // P(sigma_{ijkl} | \eta)
           const double non_sequence_based_log_probability = log(
               inverted_sbn_prior_[rootward_tip.gpcsp_idx_] * q_[sister_tip.gpcsp_idx_] *
@@ -793,7 +1124,7 @@ EigenVectorXd GPEngine::CalculateQuartetHybridLikelihoods(
               branch_handler_(EdgeId(sorted_tip.gpcsp_idx_)));
           per_pattern_log_likelihoods_ =
               (quartet_r_sorted_plv_.transpose() * transition_matrix_ *
-               GetPLV(PVId(sorted_tip.plv_idx_)))
+               DoublePLV(sorted_tip.plv_idx_))
                   .diagonal()
                   .array()
                   .log();
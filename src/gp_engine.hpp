@@ -18,6 +18,10 @@
 #include "reindexer.hpp"
 #include "subsplit_dag_storage.hpp"
 #include "optimization.hpp"
+#include "plv_cache.hpp"
+#include "plv_kernels.hpp"
+#include "thread_pool.hpp"
+#include "transition_matrix_cache.hpp"
 #include "dag_branch_handler.hpp"
 #include "dag_data.hpp"
 
@@ -26,7 +30,8 @@ class GPEngine {
   GPEngine(SitePattern site_pattern, size_t node_count, size_t gpcsp_count,
            const std::string& mmap_file_path, double rescaling_threshold,
            EigenVectorXd sbn_prior, EigenVectorXd unconditional_node_probabilities,
-           EigenVectorXd inverted_sbn_prior, bool use_gradients);
+           EigenVectorXd inverted_sbn_prior, bool use_gradients,
+           std::optional<size_t> plv_byte_budget = std::nullopt);
 
   // Initialize prior with given starting values.
   void InitializePriors(EigenVectorXd sbn_prior,
@@ -70,8 +75,32 @@ class GPEngine {
   void operator()(const GPOperations::UpdateSBNProbabilities& op);
   void operator()(const GPOperations::PrepForMarginalization& op);
 
-  // Apply all operations in vector in order from beginning to end.
+  // Apply all operations in vector in order from beginning to end. With more than one
+  // thread, operations that don't depend on each other run concurrently (see
+  // GPOperations::DependencyLevels), and operations that run alone split their site
+  // patterns across the threads.
   void ProcessOperations(GPOperationVector operations);
+  size_t GetThreadCount() const { return thread_count_; }
+  void SetThreadCount(size_t thread_count);
+
+  // ** PLV Memory Budget
+
+  // Given a PLV byte budget, PLVs built up by operations may be evicted from memory,
+  // least recently used first, and are recomputed from the operations that built them
+  // when next needed (see PLVCache). ProcessOperations then applies operations one at
+  // a time. A recomputed PLV reflects the branch lengths and source PLVs at the time
+  // of recomputation, so only differs from a resident one if those have changed since
+  // it was built. Code that reads PLVs directly rather than through operations must
+  // call EnsurePLVIsResident first.
+  bool HasPLVByteBudget() const { return plv_cache_.has_value(); }
+  void EnsurePLVIsResident(size_t plv_idx);
+  // Bring back every evicted PLV and forget how they were built, so that they stay
+  // resident until next overwritten.
+  void MakeAllPLVsResident();
+  // Counts of PLV hits, misses, recomputed operations and evictions, along with the
+  // budget and the bytes currently resident.
+  StringSizeMap PLVCacheStatistics() const;
+  void ResetPLVCacheStatistics();
 
   // ** Branch Length Optimization
 
@@ -85,6 +114,9 @@ class GPEngine {
   void IncrementOptimizationCount() { branch_handler_.IncrementOptimizationCount(); }
   bool IsFirstOptimization() { return branch_handler_.IsFirstOptimization(); }
 
+  // Look up the transition matrix in the cache without adding to it, so this may be
+  // called while processing operations concurrently.
+  Eigen::Matrix4d TransitionMatrixForBranchLength(double branch_length) const;
   void SetTransitionMatrixToHaveBranchLength(double branch_length);
   void SetTransitionAndDerivativeMatricesToHaveBranchLength(double branch_length);
   void SetTransitionMatrixToHaveBranchLengthAndTranspose(double branch_length);
@@ -139,15 +171,33 @@ class GPEngine {
 
   double GetLogMarginalLikelihood() const;
   const Eigen::Matrix4d& GetTransitionMatrix() const { return transition_matrix_; };
+  const TransitionMatrixCache& GetTransitionMatrixCache() const {
+    return transition_matrix_cache_;
+  }
+  TransitionMatrixCache& GetTransitionMatrixCache() { return transition_matrix_cache_; }
 
   // Partial Likelihood Vector Handler.
   const PLVNodeHandler& GetPLVHandler() const { return plv_handler_; }
   NucleotidePLVRefVector& GetPLVs() { return plv_handler_.GetPVs(); }
   const NucleotidePLVRefVector& GetPLVs() const { return plv_handler_.GetPVs(); }
-  NucleotidePLVRef& GetPLV(const PVId plv_index) { return plv_handler_(plv_index); }
+  // The P-PLVs of the leaves are not stored (see IsTipPLV), so asking for one is an
+  // error: use DoublePLV to get a leaf PLV expanded from the site patterns.
+  NucleotidePLVRef& GetPLV(const PVId plv_index) {
+    AssertPLVIsStored(plv_index.value_);
+    return plv_handler_(plv_index);
+  }
   const NucleotidePLVRef& GetPLV(const PVId plv_index) const {
+    AssertPLVIsStored(plv_index.value_);
     return plv_handler_(plv_index);
   }
+  // Whether a PLV is the P-PLV of a leaf. These would only hold the site patterns, so
+  // we never fill them in and give their memory back: the kernels read the leaf's tip
+  // codes in their place, and everything else expands them with DoublePLV.
+  bool IsTipPLV(size_t plv_idx) const {
+    return plv_idx < site_pattern_.GetTipStates().TaxonCount();
+  }
+  // A copy of a PLV in double precision, expanded from the tip codes for a leaf.
+  NucleotidePV<double> DoublePLV(size_t plv_idx) const;
   NucleotidePLVRef& GetSparePLV(const PVId plv_index) {
     return plv_handler_.GetSparePV(plv_index);
   }
@@ -237,52 +287,101 @@ class GPEngine {
   // Initialize PLVs and populate leaf PLVs with taxon site data.
   void InitializePLVsWithSitePatterns();
 
+  // Apply an operation under the PLV byte budget, first recomputing the PLVs it needs.
+  // Operations replayed for recomputation are already part of a recipe, so aren't
+  // recorded again.
+  void ProcessOperationWithinBudget(const GPOperation& operation,
+                                    bool is_recomputation);
+  void EvictPLVsOverBudget();
+  // The bytes that evicting each padded PLV gives back to the system, for PLVCache.
+  SizeVector ReleasablePLVByteCounts() const;
+  // Cache the transition matrix that an operation will use, if any.
+  void PrecomputeTransitionMatrix(const GPOperation& operation);
+
+  // Processes operations within a dependency level, using a transition matrix and
+  // per-pattern scratch space of its own rather than the engine's.
+  struct ConcurrentOperationVisitor;
+
+  // The operations that use a transition matrix, given the matrix to use.
+  void IncrementWithWeightedEvolvedPLV(
+      const GPOperations::IncrementWithWeightedEvolvedPLV& op,
+      const Eigen::Matrix4d& transition_matrix);
+  void SetLikelihood(const GPOperations::Likelihood& op,
+                     const Eigen::Matrix4d& transition_matrix,
+                     EigenVectorXd& per_pattern_log_likelihoods);
+
   void RescalePLV(size_t plv_idx, int amount);
   void AssertPLVIsFinite(size_t plv_idx, const std::string& message) const;
   std::pair<double, double> PLVMinMax(size_t plv_idx) const;
+  // The PLV kernels need the patterns of a PLV to be packed one after another.
+  void AssertPLVIsContiguous(size_t plv_idx) const;
+  void AssertPLVIsStored(size_t plv_idx) const {
+    Assert(!IsTipPLV(plv_idx), "PLV " + std::to_string(plv_idx) +
+                                   " is the P-PLV of a leaf, which we don't store.");
+  }
+  const uint8_t* TipCodes(size_t plv_idx) const {
+    return site_pattern_.GetTipStates().Codes(plv_idx);
+  }
   // If a PLV all entries smaller than rescaling_threshold_ then rescale it up and
   // increment the corresponding entry in rescaling_counts_.
   void RescalePLVIfNeeded(size_t plv_idx);
+  // The same, given the smallest and largest entries of the PLV.
+  void RescalePLVGivenExtrema(size_t plv_idx, double min_entry, double max_entry);
   double LogRescalingFor(size_t plv_idx);
 
+  // Set result to the per-pattern products src1[:, p]^T * matrix * src2[:, p].
+  void PrepareUnrescaledPerPatternProducts(EigenVectorXd& result, size_t src1_idx,
+                                           const Eigen::Matrix4d& matrix,
+                                           size_t src2_idx) const;
+
   inline void PrepareUnrescaledPerPatternLikelihoodSecondDerivatives(size_t src1_idx,
                                                                      size_t src2_idx) {
-    per_pattern_likelihood_second_derivatives_ =
-        (GetPLV(PVId(src1_idx)).transpose() * hessian_matrix_ * GetPLV(PVId(src2_idx)))
-            .diagonal()
-            .array();
+    PrepareUnrescaledPerPatternProducts(per_pattern_likelihood_second_derivatives_,
+                                        src1_idx, hessian_matrix_, src2_idx);
   }
   inline void PrepareUnrescaledPerPatternLikelihoodDerivatives(size_t src1_idx,
                                                                size_t src2_idx) {
-    per_pattern_likelihood_derivatives_ = (GetPLV(PVId(src1_idx)).transpose() *
-                                           derivative_matrix_ * GetPLV(PVId(src2_idx)))
-                                              .diagonal()
-                                              .array();
+    PrepareUnrescaledPerPatternProducts(per_pattern_likelihood_derivatives_, src1_idx,
+                                        derivative_matrix_, src2_idx);
   }
 
   inline void PrepareUnrescaledPerPatternLikelihoods(size_t src1_idx, size_t src2_idx) {
-    per_pattern_likelihoods_ = (GetPLV(PVId(src1_idx)).transpose() *
-                                transition_matrix_ * GetPLV(PVId(src2_idx)))
-                                   .diagonal()
-                                   .array();
+    PrepareUnrescaledPerPatternProducts(per_pattern_likelihoods_, src1_idx,
+                                        transition_matrix_, src2_idx);
   }
 
+  // Set result to the per-pattern log likelihoods src1[:, p]^T * matrix * src2[:, p],
+  // accounting for the rescaling of the two PLVs.
+  void PrepareRescaledPerPatternLogLikelihoods(EigenVectorXd& result, size_t src1_idx,
+                                               const Eigen::Matrix4d& matrix,
+                                               size_t src2_idx);
+
   // This function is used to compute the marginal log likelihood over all trees that
   // have a given PCSP. We assume that transition_matrix_ is as desired, and src1_idx
   // and src2_idx are the two PLV indices on either side of the PCSP.
   inline void PreparePerPatternLogLikelihoodsForGPCSP(size_t src1_idx,
                                                       size_t src2_idx) {
-    per_pattern_log_likelihoods_ = (GetPLV(PVId(src1_idx)).transpose() *
-                                    transition_matrix_ * GetPLV(PVId(src2_idx)))
-                                       .diagonal()
-                                       .array()
-                                       .log() +
-                                   LogRescalingFor(src1_idx) +
-                                   LogRescalingFor(src2_idx);
+    PrepareRescaledPerPatternLogLikelihoods(per_pattern_log_likelihoods_, src1_idx,
+                                            transition_matrix_, src2_idx);
   }
 
+  // Compute the per-pattern ratios of the first (and second) derivatives of the
+  // likelihood to the likelihood, from the unrescaled per-pattern vectors.
+  void PreparePerPatternLikelihoodDerivativeRatios();
+  void PreparePerPatternLikelihoodSecondDerivativeRatios();
+
+  // The sum of per-pattern values weighted by the site pattern counts.
+  double SumOverSitePatterns(const EigenVectorXd& per_pattern_values) const;
+
+  // The pool that per-pattern work is split across in chunks of patterns (see
+  // PLVKernels), or nullptr to do it all on the calling thread.
+  ThreadPool* PatternThreadPool() const;
+
  public:
-  static constexpr double default_rescaling_threshold_ = 1e-40;
+  // The product of two PLVs that are just above the threshold must still be a normal
+  // PLVScalar, so float PLVs need a much larger threshold.
+  static constexpr double default_rescaling_threshold_ =
+      std::is_same_v<PLVScalar, float> ? 1e-16 : 1e-40;
 
  private:
   // Descriptor containing all taxa and sequence alignments.
@@ -351,6 +450,11 @@ class GPEngine {
   // available.
   EigenVectorXd hybrid_marginal_log_likelihoods_;
 
+  // The number of threads used by ProcessOperations and by the per-pattern kernels.
+  size_t thread_count_ = 1;
+  // Present when we have a PLV byte budget.
+  std::optional<PLVCache> plv_cache_;
+
   // Internal "temporaries" useful for likelihood and derivative calculation.
   EigenVectorXd per_pattern_log_likelihoods_;
   EigenVectorXd per_pattern_likelihoods_;
@@ -368,12 +472,12 @@ class GPEngine {
   Eigen::Matrix4d inverse_eigenmatrix_ =
       substitution_model_.GetInverseEigenvectors().reshaped(4, 4);
   Eigen::Vector4d eigenvalues_ = substitution_model_.GetEigenvalues();
-  Eigen::Vector4d diagonal_vector_;
   Eigen::DiagonalMatrix<double, 4> diagonal_matrix_;
   Eigen::Matrix4d transition_matrix_;
   Eigen::Matrix4d derivative_matrix_;
   Eigen::Matrix4d hessian_matrix_;
   Eigen::Vector4d stationary_distribution_ = substitution_model_.GetFrequencies();
+  TransitionMatrixCache transition_matrix_cache_{substitution_model_};
   EigenVectorXd site_pattern_weights_;
 };
 
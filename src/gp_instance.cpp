@@ -25,7 +25,8 @@ void GPInstance::PrintStatus() {
   } else {
     std::cout << "No trees loaded.\n";
   }
-  std::cout << alignment_.Data().size() << " sequences loaded.\n";
+  std::cout << (fasta_file_ ? fasta_file_->SequenceCount() : 0)
+            << " sequences loaded.\n";
   std::cout << GetDAG().NodeCount() << " DAG nodes with "
             << GetDAG().EdgeCountWithLeafSubsplits() << " edges representing "
             << GetDAG().TopologyCount() << " trees.\n";
@@ -44,40 +45,44 @@ StringSizeMap GPInstance::DAGSummaryStatistics() {
 }
 
 void GPInstance::ReadFastaFile(const std::string &fname) {
-  alignment_ = Alignment::ReadFasta(fname);
+  fasta_file_ = std::make_unique<FastaFile>(fname);
   fasta_path_ = fname;
 }
 
-void GPInstance::ReadNewickFile(const std::string &fname) {
+void GPInstance::ReadNewickFile(const std::string &fname, size_t thread_count) {
   Driver driver;
+  driver.SetThreadCount(thread_count);
   tree_collection_ =
       RootedTreeCollection::OfTreeCollection(driver.ParseNewickFile(fname));
   newick_path_ = fname;
 }
 
-void GPInstance::ReadNewickFileGZ(const std::string &fname) {
+void GPInstance::ReadNewickFileGZ(const std::string &fname, size_t thread_count) {
   Driver driver;
+  driver.SetThreadCount(thread_count);
   tree_collection_ =
       RootedTreeCollection::OfTreeCollection(driver.ParseNewickFileGZ(fname));
   newick_path_ = fname;
 }
 
-void GPInstance::ReadNexusFile(const std::string &fname) {
+void GPInstance::ReadNexusFile(const std::string &fname, size_t thread_count) {
   Driver driver;
+  driver.SetThreadCount(thread_count);
   tree_collection_ =
       RootedTreeCollection::OfTreeCollection(driver.ParseNexusFile(fname));
   nexus_path_ = fname;
 }
 
-void GPInstance::ReadNexusFileGZ(const std::string &fname) {
+void GPInstance::ReadNexusFileGZ(const std::string &fname, size_t thread_count) {
   Driver driver;
+  driver.SetThreadCount(thread_count);
   tree_collection_ =
       RootedTreeCollection::OfTreeCollection(driver.ParseNexusFileGZ(fname));
   nexus_path_ = fname;
 }
 
 void GPInstance::CheckSequencesLoaded() const {
-  if (alignment_.SequenceCount() == 0) {
+  if (!fasta_file_ || fasta_file_->SequenceCount() == 0) {
     Failwith(
         "Load an alignment into your GPInstance with which you wish to "
         "calculate phylogenetic likelihoods.");
@@ -111,17 +116,19 @@ bool GPInstance::HasDAG() const { return dag_ != nullptr; }
 
 void GPInstance::PrintDAG() { GetDAG().Print(); }
 
-SitePattern GPInstance::MakeSitePattern() const {
+SitePattern GPInstance::MakeSitePattern(size_t thread_count) const {
   CheckSequencesLoaded();
-  SitePattern site_pattern(alignment_, tree_collection_.TagTaxonMap());
+  SitePattern site_pattern(*fasta_file_, tree_collection_.TagTaxonMap(), thread_count);
   return site_pattern;
 }
 
 // ** GP Engine
 
-void GPInstance::MakeGPEngine(double rescaling_threshold, bool use_gradients) {
+void GPInstance::MakeGPEngine(double rescaling_threshold, bool use_gradients,
+                              std::optional<size_t> plv_byte_budget,
+                              size_t thread_count) {
   std::string mmap_gp_path = mmap_file_path_.value() + ".gp";
-  auto site_pattern = MakeSitePattern();
+  auto site_pattern = MakeSitePattern(thread_count);
   if (!HasDAG()) {
     MakeDAG();
   }
@@ -136,7 +143,8 @@ void GPInstance::MakeGPEngine(double rescaling_threshold, bool use_gradients) {
       GetDAG().EdgeCountWithLeafSubsplits(), mmap_gp_path, rescaling_threshold,
       std::move(sbn_prior),
       unconditional_node_probabilities.segment(0, GetDAG().NodeCountWithoutDAGRoot()),
-      std::move(inverted_sbn_prior), use_gradients);
+      std::move(inverted_sbn_prior), use_gradients, plv_byte_budget);
+  gp_engine_->SetThreadCount(thread_count);
 }
 
 void GPInstance::ReinitializePriors() {
@@ -32,10 +32,10 @@ class GPInstance {
   // ** I/O
 
   void ReadFastaFile(const std::string &fname);
-  void ReadNewickFile(const std::string &fname);
-  void ReadNewickFileGZ(const std::string &fname);
-  void ReadNexusFile(const std::string &fname);
-  void ReadNexusFileGZ(const std::string &fname);
+  void ReadNewickFile(const std::string &fname, size_t thread_count = 1);
+  void ReadNewickFileGZ(const std::string &fname, size_t thread_count = 1);
+  void ReadNexusFile(const std::string &fname, size_t thread_count = 1);
+  void ReadNexusFileGZ(const std::string &fname, size_t thread_count = 1);
 
   std::string GetFastaSourcePath() const {
     Assert(fasta_path_.has_value(), "No fasta source file has been read.");
@@ -59,12 +59,19 @@ class GPInstance {
   bool HasDAG() const;
   void PrintDAG();
 
-  SitePattern MakeSitePattern() const;
+  // Compress the sequences into site patterns on thread_count threads.
+  SitePattern MakeSitePattern(size_t thread_count = 1) const;
 
   // ** GP Engine
 
+  // Given plv_byte_budget, the engine keeps at most about that many bytes of PLVs in
+  // memory, recomputing the others as needed (see GPEngine::HasPLVByteBudget). The
+  // site patterns are made on thread_count threads, and the engine then runs on as
+  // many (see GPEngine::SetThreadCount).
   void MakeGPEngine(double rescaling_threshold = GPEngine::default_rescaling_threshold_,
-                    bool use_gradients = false);
+                    bool use_gradients = false,
+                    std::optional<size_t> plv_byte_budget = std::nullopt,
+                    size_t thread_count = 1);
   GPEngine &GetGPEngine() const;
   bool HasGPEngine() const;
   void ResizeEngineForDAG();
@@ -231,7 +238,8 @@ class GPInstance {
   std::optional<std::string> newick_path_ = std::nullopt;
   std::optional<std::string> nexus_path_ = std::nullopt;
   RootedTreeCollection tree_collection_;
-  Alignment alignment_;
+  // The sequences, indexed in place in the FASTA file rather than copied out.
+  std::unique_ptr<FastaFile> fasta_file_ = nullptr;
   std::unique_ptr<GPDAG> dag_ = nullptr;
   // Root filepath for storing mmapped data.
   std::optional<std::string> mmap_file_path_ = std::nullopt;
@@ -3,6 +3,8 @@
 
 #include "gp_operation.hpp"
 
+#include <unordered_map>
+
 GPOperations::PrepForMarginalization GPOperations::PrepForMarginalizationOfOperations(
     const GPOperationVector& operations) {
   return PrepForMarginalizationVisitor(operations).ToPrepForMarginalization();
@@ -27,3 +29,49 @@ void GPOperations::AppendGPOperations(GPOperationVector& operations,
   std::move(new_operations.begin(), new_operations.end(),
             std::back_inserter(operations));
 }
+
+std::vector<SizeVector> GPOperations::DependencyLevels(
+    const GPOperationVector& operations) {
+  std::vector<SizeVector> levels;
+  // The last level that wrote and read each resource in the current run of
+  // non-barrier operations.
+  std::unordered_map<size_t, size_t> last_write_level;
+  std::unordered_map<size_t, size_t> last_read_level;
+  // The first level that the current run of non-barrier operations may use.
+  size_t first_level = 0;
+  auto level_after = [](const std::unordered_map<size_t, size_t>& last_level,
+                        size_t resource, size_t level) {
+    auto search = last_level.find(resource);
+    return search == last_level.end() ? level : std::max(level, search->second + 1);
+  };
+  for (size_t op_idx = 0; op_idx < operations.size(); op_idx++) {
+    const GPOperationDependencies dependencies(operations[op_idx]);
+    if (dependencies.is_barrier_) {
+      levels.push_back({op_idx});
+      first_level = levels.size();
+      last_write_level.clear();
+      last_read_level.clear();
+      continue;
+    }
+    // else
+    size_t level = first_level;
+    for (const auto resource : dependencies.reads_) {
+      level = level_after(last_write_level, resource, level);
+    }
+    for (const auto resource : dependencies.writes_) {
+      level = level_after(last_write_level, resource, level);
+      level = level_after(last_read_level, resource, level);
+    }
+    if (level == levels.size()) {
+      levels.emplace_back();
+    }
+    levels[level].push_back(op_idx);
+    for (const auto resource : dependencies.reads_) {
+      last_read_level[resource] = std::max(level, last_read_level[resource]);
+    }
+    for (const auto resource : dependencies.writes_) {
+      last_write_level[resource] = level;
+    }
+  }
+  return levels;
+}
@@ -207,12 +207,79 @@ struct PrepForMarginalizationVisitor {
   }
 };
 
+// This visitor gathers what an operation reads and writes, so that we can tell which
+// operations may run concurrently. PLV `idx` is resource `2 * idx` and the row of
+// per-GPCSP log likelihoods for `idx` is resource `2 * idx + 1`. Operations that touch
+// state shared by the whole engine (branch lengths, SBN parameters, the marginal
+// likelihood, or the scratch space used by branch length optimization) are barriers,
+// which must run on their own.
+struct GPOperationDependencies {
+  bool is_barrier_ = false;
+  SizeVector reads_;
+  SizeVector writes_;
+
+  explicit GPOperationDependencies(const GPOperation& operation) {
+    std::visit(*this, operation);
+  }
+
+  static size_t PLVResource(size_t plv_idx) { return 2 * plv_idx; }
+  static size_t LikelihoodResource(size_t gpcsp_idx) { return 2 * gpcsp_idx + 1; }
+
+  void operator()(const GPOperations::ZeroPLV& op) {
+    writes_.push_back(PLVResource(op.dest_));
+  }
+  void operator()(const GPOperations::SetToStationaryDistribution& op) {
+    writes_.push_back(PLVResource(op.dest_));
+  }
+  void operator()(const GPOperations::IncrementWithWeightedEvolvedPLV& op) {
+    reads_.push_back(PLVResource(op.src_));
+    writes_.push_back(PLVResource(op.dest_));
+  }
+  void operator()(const GPOperations::Multiply& op) {
+    reads_.push_back(PLVResource(op.src1_));
+    reads_.push_back(PLVResource(op.src2_));
+    writes_.push_back(PLVResource(op.dest_));
+  }
+  void operator()(const GPOperations::Likelihood& op) {
+    reads_.push_back(PLVResource(op.child_));
+    reads_.push_back(PLVResource(op.parent_));
+    writes_.push_back(LikelihoodResource(op.dest_));
+  }
+  void operator()(const GPOperations::PrepForMarginalization& op) {
+    for (const auto src : op.src_vector_) {
+      reads_.push_back(PLVResource(src));
+    }
+    writes_.push_back(PLVResource(op.dest_));
+  }
+  void operator()(const GPOperations::ResetMarginalLikelihood&) {  // NOLINT
+    is_barrier_ = true;
+  }
+  void operator()(const GPOperations::IncrementMarginalLikelihood&) {  // NOLINT
+    is_barrier_ = true;
+  }
+  void operator()(const GPOperations::OptimizeBranchLength&) {  // NOLINT
+    is_barrier_ = true;
+  }
+  void operator()(const GPOperations::UpdateSBNProbabilities&) {  // NOLINT
+    is_barrier_ = true;
+  }
+};
+
 namespace GPOperations {
 void AppendGPOperations(GPOperationVector& operations,
                         GPOperationVector&& new_operations);
 
 PrepForMarginalization PrepForMarginalizationOfOperations(
     const GPOperationVector& operations);
+
+// Group the operations into dependency levels ("wavefronts"), given as vectors of
+// indices into `operations`, to be run one after another. The operations within a
+// level don't conflict with each other, so may run concurrently. Each operation lands
+// in the first level after every earlier operation that it conflicts with, that is,
+// that writes something it touches or reads something it writes. Operations with the
+// same dest_ therefore stay in their original order, which keeps sums of PLVs
+// deterministic. A barrier gets a level to itself.
+std::vector<SizeVector> DependencyLevels(const GPOperationVector& operations);
 };  // namespace GPOperations
 
 struct GPOperationOstream {
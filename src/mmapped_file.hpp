@@ -0,0 +1,71 @@
+// Copyright 2019-2022 bito project contributors.
+// bito is free software under the GPLv3; see LICENSE file for details.
+//
+// RAII class for read-only access to a whole file through mmap, so that we can scan
+// large input files in place rather than copying them into strings line by line.
+//
+// See mmapped_matrix.hpp for background on mmap.
+
+#pragma once
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string_view>
+#include <system_error>
+
+#include "sugar.hpp"
+
+class MmappedFile {
+ public:
+  explicit MmappedFile(const std::string &file_path) : file_path_(file_path) {
+    file_descriptor_ = open(file_path.c_str(), O_RDONLY);
+    if (file_descriptor_ == -1) {
+      Failwith("Cannot open the File : " + file_path_);
+    }
+    struct stat file_stat;
+    if (fstat(file_descriptor_, &file_stat) != 0) {
+      close(file_descriptor_);
+      throw std::system_error(errno, std::system_category(), "fstat");
+    }
+    byte_count_ = static_cast<size_t>(file_stat.st_size);
+    // mmap doesn't allow empty maps, so we leave empty files unmapped.
+    if (byte_count_ > 0) {
+      void *memory =
+          mmap(NULL, byte_count_, PROT_READ, MAP_PRIVATE, file_descriptor_, 0);
+      if (memory == MAP_FAILED) {
+        close(file_descriptor_);
+        throw std::system_error(errno, std::system_category(), "mmap");
+      }
+      mmapped_memory_ = static_cast<const char *>(memory);
+      // We read through the file from start to end.
+      madvise(memory, byte_count_, MADV_SEQUENTIAL);
+    }
+  }
+
+  ~MmappedFile() {
+    if (mmapped_memory_ != nullptr) {
+      munmap(const_cast<char *>(mmapped_memory_), byte_count_);
+    }
+    close(file_descriptor_);
+  }
+
+  MmappedFile(const MmappedFile &) = delete;
+  MmappedFile(const MmappedFile &&) = delete;
+  MmappedFile &operator=(const MmappedFile &) = delete;
+  MmappedFile &operator=(const MmappedFile &&) = delete;
+
+  // The contents of the file, valid for the life of this object.
+  std::string_view View() const { return {mmapped_memory_, byte_count_}; }
+  size_t ByteCount() const { return byte_count_; }
+
+ private:
+  std::string file_path_;
+  int file_descriptor_;
+  size_t byte_count_ = 0;
+  const char *mmapped_memory_ = nullptr;
+};
+
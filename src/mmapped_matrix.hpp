@@ -150,7 +150,50 @@ class MmappedMatrix {
 
   size_t ByteCount() const { return byte_count_; }
 
+  // The number of bytes that ReleaseMemory(begin, count) gives back to the operating
+  // system: those of the whole pages inside the range, or none on systems without
+  // MADV_REMOVE.
+  size_t ReleasableByteCount(const Scalar *begin, size_t count) const {
+#ifdef MADV_REMOVE
+    const auto [first_page, end_page] = WholePagesOf(begin, count);
+    return end_page - first_page;
+#else
+    return 0;
+#endif
+  }
+
+  // Give the physical memory behind `count` scalars starting at `begin` back to the
+  // operating system. Only the whole pages inside the range are released; these read
+  // as zeros afterwards, and the rest of the range is left as is. Does nothing on
+  // systems without MADV_REMOVE.
+  void ReleaseMemory(Scalar *begin, size_t count) {
+    Assert(begin >= mmapped_memory_ &&
+               begin + count <= mmapped_memory_ + byte_count_ / sizeof(Scalar),
+           "Range out of bounds in MmappedMatrix::ReleaseMemory.");
+#ifdef MADV_REMOVE
+    const auto [first_page, end_page] = WholePagesOf(begin, count);
+    if (first_page < end_page) {
+      if (madvise(reinterpret_cast<void *>(first_page), end_page - first_page,
+                  MADV_REMOVE) != 0) {
+        throw std::system_error(errno, std::system_category(), "madvise");
+      }
+    }
+#endif
+  }
+
  private:
+  // The addresses of the start of the first and the end of the last whole page inside
+  // the `count` scalars starting at `begin`, which are equal if there are none.
+  static std::pair<uintptr_t, uintptr_t> WholePagesOf(const Scalar *begin,
+                                                      size_t count) {
+    const auto page_size = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    const auto range_begin = reinterpret_cast<uintptr_t>(begin);
+    const auto range_end = reinterpret_cast<uintptr_t>(begin + count);
+    const uintptr_t first_page = (range_begin + page_size - 1) / page_size * page_size;
+    const uintptr_t end_page = range_end / page_size * page_size;
+    return {first_page, std::max(first_page, end_page)};
+  }
+
   Eigen::Index rows_;
   Eigen::Index cols_;
   size_t byte_count_;
@@ -170,5 +213,20 @@ TEST_CASE("MmappedMatrix") {
   }  // End of scope, so our mmap is destroyed and file written.
   MmappedMatrixXd mmapped_matrix("_ignore/mmapped_matrix.data", rows, cols);
   CHECK_EQ(mmapped_matrix.Get()(rows - 1, cols - 1), 5.);
+#ifdef MADV_REMOVE
+  // The mmapped memory starts on a page, but a range smaller than a page covers no
+  // whole page, so releasing it frees nothing and leaves its contents be.
+  const auto page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  CHECK_EQ(mmapped_matrix.ReleasableByteCount(mmapped_matrix.Get().data(), 4), 0);
+  MmappedMatrixXd big_matrix("_ignore/mmapped_matrix_big.data", rows,
+                             2 * page_size / sizeof(double));
+  double *data = big_matrix.Get().data();
+  CHECK_EQ(big_matrix.ReleasableByteCount(data, rows * page_size / sizeof(double)),
+           rows * page_size);
+  CHECK_EQ(big_matrix.ReleasableByteCount(data + 1, page_size / sizeof(double)), 0);
+  data[1] = 3.;
+  big_matrix.ReleaseMemory(data + 1, page_size / sizeof(double));
+  CHECK_EQ(data[1], 3.);
+#endif
 }
 #endif  // DOCTEST_LIBRARY_INCLUDED
@@ -11,30 +11,48 @@
 #include "eigen_sugar.hpp"
 #include "mmapped_matrix.hpp"
 
-using NucleotidePLV = Eigen::Matrix<double, 4, Eigen::Dynamic, Eigen::ColMajor>;
+// The scalar type in which partial likelihood vectors are stored. Configuring with
+// -DPLV_SINGLE_PRECISION=ON stores them as floats, which halves the memory and memory
+// bandwidth that they take. Per-pattern likelihoods, their derivatives, and their
+// logs are still computed and accumulated in double.
+#ifdef BITO_PLV_SINGLE_PRECISION
+using PLVScalar = float;
+#else
+using PLVScalar = double;
+#endif
+
+template <typename TScalar>
+using NucleotidePV = Eigen::Matrix<TScalar, 4, Eigen::Dynamic, Eigen::ColMajor>;
+
+using NucleotidePLV = NucleotidePV<PLVScalar>;
 using NucleotidePLVRef = Eigen::Ref<NucleotidePLV>;
 using NucleotidePLVRefVector = std::vector<NucleotidePLVRef>;
 
-class MmappedNucleotidePLV {
+template <typename TScalar>
+class MmappedNucleotidePV {
  public:
+  using PV = NucleotidePV<TScalar>;
+  using PVRef = Eigen::Ref<PV>;
+  using PVRefVector = std::vector<PVRef>;
+
   constexpr static Eigen::Index base_count_ = 4;
 
-  MmappedNucleotidePLV(const std::string &file_path, Eigen::Index total_plv_length)
+  MmappedNucleotidePV(const std::string &file_path, Eigen::Index total_plv_length)
       : mmapped_matrix_(file_path, base_count_, total_plv_length){};
 
   void Resize(Eigen::Index total_plv_length) {
     mmapped_matrix_.ResizeMMap(base_count_, total_plv_length);
   }
 
-  NucleotidePLVRefVector Subdivide(size_t into_count) {
-    Assert(into_count > 0, "into_count is zero in MmappedNucleotidePLV::Subdivide.");
+  PVRefVector Subdivide(size_t into_count) {
+    Assert(into_count > 0, "into_count is zero in MmappedNucleotidePV::Subdivide.");
     auto entire_plv = mmapped_matrix_.Get();
     const auto total_plv_length = entire_plv.cols();
     Assert(total_plv_length % into_count == 0,
            "into_count isn't a multiple of total PLV length in "
-           "MmappedNucleotidePLV::Subdivide.");
+           "MmappedNucleotidePV::Subdivide.");
     const size_t block_length = total_plv_length / into_count;
-    NucleotidePLVRefVector sub_plvs;
+    PVRefVector sub_plvs;
     sub_plvs.reserve(into_count);
     for (size_t idx = 0; idx < into_count; ++idx) {
       sub_plvs.push_back(
@@ -45,10 +63,24 @@ class MmappedNucleotidePLV {
 
   size_t ByteCount() const { return mmapped_matrix_.ByteCount(); }
 
+  // Release the memory behind one of the PVs from Subdivide (see
+  // MmappedMatrix::ReleaseMemory), and the number of bytes this gives back.
+  void ReleaseMemory(PVRef &pv) { mmapped_matrix_.ReleaseMemory(pv.data(), pv.size()); }
+  // The same for pv_count PVs from Subdivide, which lie one after another starting at
+  // first_pv.
+  void ReleaseMemory(PVRef &first_pv, size_t pv_count) {
+    mmapped_matrix_.ReleaseMemory(first_pv.data(), pv_count * first_pv.size());
+  }
+  size_t ReleasableByteCount(const PVRef &pv) const {
+    return mmapped_matrix_.ReleasableByteCount(pv.data(), pv.size());
+  }
+
  private:
-  MmappedMatrix<NucleotidePLV> mmapped_matrix_;
+  MmappedMatrix<PV> mmapped_matrix_;
 };
 
+using MmappedNucleotidePLV = MmappedNucleotidePV<PLVScalar>;
+
 #ifdef DOCTEST_LIBRARY_INCLUDED
 TEST_CASE("MmappedNucleotidePLV") {
   MmappedNucleotidePLV mmapped_plv("_ignore/mmapped_plv.data", 10);
@@ -57,5 +89,6 @@ TEST_CASE("MmappedNucleotidePLV") {
     CHECK_EQ(plv.rows(), MmappedNucleotidePLV::base_count_);
     CHECK_EQ(plv.cols(), 5);
   }
+  CHECK_EQ(mmapped_plv.ByteCount(), 4 * 10 * sizeof(PLVScalar));
 }
 #endif  // DOCTEST_LIBRARY_INCLUDED
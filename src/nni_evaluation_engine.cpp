@@ -19,6 +19,9 @@ NNIEvalEngineViaGP::NNIEvalEngineViaGP(NNIEngine &nni_engine, GPEngine &gp_engin
     : NNIEvalEngine(nni_engine), gp_engine_(&gp_engine) {}
 
 void NNIEvalEngineViaGP::Init() {
+  // We read PLVs directly, so they must all stay resident.
+  Assert(!GetGPEngine().HasPLVByteBudget(),
+         "NNIEvalEngineViaGP needs a GPEngine without a PLV byte budget.");
   GetGPEngine().GrowPLVs(GetDAG().NodeCountWithoutDAGRoot());
   GetGPEngine().GrowGPCSPs(GetDAG().EdgeCountWithLeafSubsplits());
 }
@@ -30,7 +30,7 @@ Node::Node(uint32_t leaf_id, Bitset leaves)
       hash_(SOHash(leaf_id)) {}
 
 Node::Node(NodePtrVec children, size_t id, Bitset leaves)
-    : children_(children), id_(id), leaves_(leaves) {
+    : children_(std::move(children)), id_(id), leaves_(std::move(leaves)) {
   Assert(!children_.empty(), "Called internal Node constructor with no children.");
   // Order the children by their max leaf ids.
   std::sort(children_.begin(), children_.end(), [](const auto& lhs, const auto& rhs) {
@@ -381,21 +381,38 @@ void Node::RootedSisterAndLeafTraversal(TwoNodeFun f) const {
 //
 // This function returns a map that maps the tags to their ids.
 TagSizeMap Node::Polish() {
+  PolishWithoutTagMap();
   TagSizeMap tag_id_map;
+  Postorder([&tag_id_map](const Node* node) {
+    SafeInsert(tag_id_map, node->Tag(), node->Id());
+  });
+  return tag_id_map;
+}
+
+void Node::PolishWithoutTagMap() {
   const size_t leaf_count = MaxLeafID() + 1;
   size_t next_id = leaf_count;
-  MutablePostorder([&tag_id_map, &next_id, &leaf_count](Node* node) {
+  // This is MutablePostorder written out, which saves a std::function call per node.
+  // The stack records the nodes and whether they have been visited or not.
+  std::vector<std::pair<Node*, bool>> stack = {{this, false}};
+  while (!stack.empty()) {
+    const auto [node, visited] = stack.back();
+    stack.pop_back();
     if (node->IsLeaf()) {
       node->id_ = node->MaxLeafID();
       node->leaves_ = Bitset::Singleton(leaf_count, node->id_);
-    } else {
+    } else if (visited) {
       node->id_ = next_id;
       next_id++;
       node->leaves_ = Node::LeavesOf(node->Children());
+    } else {
+      stack.emplace_back(node, true);
+      for (auto iter = node->children_.rbegin(); iter != node->children_.rend();
+           ++iter) {
+        stack.emplace_back(iter->get(), false);
+      }
     }
-    SafeInsert(tag_id_map, node->Tag(), node->id_);
-  });
-  return tag_id_map;
+  }
 }
 
 std::string Node::Newick(std::function<std::string(const Node*)> node_labeler,
@@ -499,7 +516,8 @@ Node::NodePtr Node::Leaf(uint32_t id, size_t taxon_count) {
   return Node::Leaf(id, Bitset::Singleton(taxon_count, id));
 }
 Node::NodePtr Node::Join(NodePtrVec children, size_t id) {
-  return std::make_shared<Node>(children, id, Node::LeavesOf(children));
+  auto leaves = Node::LeavesOf(children);
+  return std::make_shared<Node>(std::move(children), id, std::move(leaves));
 }
 Node::NodePtr Node::Join(NodePtr left, NodePtr right, size_t id) {
   return Join(std::vector<NodePtr>({left, right}), id);
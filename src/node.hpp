@@ -153,6 +153,10 @@ class Node {
   // the start of this document. It returns a map that maps the tags to their
   // indices. It's the verb, not the nationality.
   TagSizeMap Polish();
+  // The same, without building the map. Polish also checks that no two nodes share a
+  // tag (e.g. because a taxon appears twice), so callers of this must make sure of
+  // that themselves.
+  void PolishWithoutTagMap();
 
   NodePtr Deroot();
 
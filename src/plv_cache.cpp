@@ -0,0 +1,110 @@
+// Copyright 2019-2022 bito project contributors.
+// bito is free software under the GPLv3; see LICENSE file for details.
+
+#include "plv_cache.hpp"
+
+void PLVCache::Reset(const SizeVector& releasable_byte_counts) {
+  const size_t plv_count = releasable_byte_counts.size();
+  for (const size_t releasable_byte_count : releasable_byte_counts) {
+    Assert(releasable_byte_count <= plv_byte_count_,
+           "PLVCache: a PLV can't give back more bytes than it has.");
+  }
+  releasable_byte_counts_ = releasable_byte_counts;
+  resident_byte_count_ = plv_count * plv_byte_count_;
+  is_resident_.assign(plv_count, true);
+  recipes_.assign(plv_count, {});
+  pin_counts_.assign(plv_count, 0);
+  last_use_.assign(plv_count, 0);
+  tick_ = 0;
+  evictable_.clear();
+}
+
+void PLVCache::RecordOperation(const GPOperation& operation,
+                               const GPOperationPLVs& plvs) {
+  if (!plvs.dest_.has_value()) {
+    return;
+  }
+  // else
+  auto& recipe = recipes_.at(plvs.dest_.value());
+  if (plvs.overwrites_dest_) {
+    recipe = {operation};
+  } else if (!recipe.empty()) {
+    recipe.push_back(operation);
+  }
+  UpdateEvictability(plvs.dest_.value());
+}
+
+void PLVCache::ForgetRecipe(size_t plv_idx) {
+  recipes_.at(plv_idx).clear();
+  UpdateEvictability(plv_idx);
+}
+
+void PLVCache::Pin(size_t plv_idx) {
+  pin_counts_.at(plv_idx)++;
+  UpdateEvictability(plv_idx);
+}
+
+void PLVCache::Unpin(size_t plv_idx) {
+  Assert(pin_counts_.at(plv_idx) > 0, "Unpinning a PLV that isn't pinned.");
+  pin_counts_[plv_idx]--;
+  UpdateEvictability(plv_idx);
+}
+
+void PLVCache::Touch(size_t plv_idx) {
+  evictable_.erase({last_use_.at(plv_idx), plv_idx});
+  last_use_[plv_idx] = ++tick_;
+  UpdateEvictability(plv_idx);
+}
+
+void PLVCache::SetResident(size_t plv_idx) {
+  if (!is_resident_.at(plv_idx)) {
+    is_resident_[plv_idx] = true;
+    resident_byte_count_ += releasable_byte_counts_[plv_idx];
+  }
+  UpdateEvictability(plv_idx);
+}
+
+void PLVCache::SetEvicted(size_t plv_idx) {
+  Assert(is_resident_.at(plv_idx), "Evicting a PLV that isn't resident.");
+  Assert(!recipes_[plv_idx].empty(), "Evicting a PLV that we can't recompute.");
+  Assert(pin_counts_[plv_idx] == 0, "Evicting a pinned PLV.");
+  Assert(releasable_byte_counts_[plv_idx] > 0, "Evicting a PLV that frees nothing.");
+  is_resident_[plv_idx] = false;
+  resident_byte_count_ -= releasable_byte_counts_[plv_idx];
+  eviction_count_++;
+  UpdateEvictability(plv_idx);
+}
+
+std::optional<size_t> PLVCache::NextEviction() const {
+  if (!IsOverBudget() || evictable_.empty()) {
+    return std::nullopt;
+  }
+  // else
+  return evictable_.begin()->second;
+}
+
+StringSizeMap PLVCache::Statistics() const {
+  return {{"byte_budget", byte_budget_},
+          {"resident_bytes", GetResidentByteCount()},
+          {"hits", hit_count_},
+          {"misses", miss_count_},
+          {"recomputed_operations", recomputed_operation_count_},
+          {"evictions", eviction_count_}};
+}
+
+void PLVCache::ResetStatistics() {
+  hit_count_ = 0;
+  miss_count_ = 0;
+  recomputed_operation_count_ = 0;
+  eviction_count_ = 0;
+}
+
+void PLVCache::UpdateEvictability(size_t plv_idx) {
+  const std::pair<size_t, size_t> entry = {last_use_[plv_idx], plv_idx};
+  if (is_resident_[plv_idx] && !recipes_[plv_idx].empty() &&
+      pin_counts_[plv_idx] == 0 && releasable_byte_counts_[plv_idx] > 0) {
+    evictable_.insert(entry);
+  } else {
+    evictable_.erase(entry);
+  }
+}
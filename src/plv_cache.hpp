@@ -0,0 +1,205 @@
+// Copyright 2019-2022 bito project contributors.
+// bito is free software under the GPLv3; see LICENSE file for details.
+//
+// Bookkeeping for running GPEngine within a memory budget for its PLVs.
+//
+// For each PLV we keep a "recipe": the operations that have built up its current
+// contents since it was last overwritten. A ZeroPLV, SetToStationaryDistribution or
+// Multiply overwrites its dest_ and starts a new recipe, while
+// IncrementWithWeightedEvolvedPLV and PrepForMarginalization add to an existing one.
+// PLVs with a recipe may be evicted from memory when we are over budget, least recently
+// used first, and are recomputed from their recipe (and, recursively, from the PLVs of
+// their children or parents) when they are next needed. PLVs without a recipe, such as
+// the leaf PLVs holding the site patterns, always stay resident. Nor do we evict PLVs
+// that lie within a page, as only whole pages can be given back to the system.
+//
+// This class only does the bookkeeping: GPEngine moves the actual data.
+
+#pragma once
+
+#include <set>
+
+#include "gp_operation.hpp"
+#include "sugar.hpp"
+
+// This visitor gathers the PLVs that an operation needs to be resident, and the PLV
+// that it writes to (if any). An operation that overwrites its dest_ doesn't need it
+// to be resident beforehand; any other dest_ is also among the reads_.
+struct GPOperationPLVs {
+  SizeVector reads_;
+  std::optional<size_t> dest_;
+  bool overwrites_dest_ = false;
+
+  explicit GPOperationPLVs(const GPOperation& operation) {
+    std::visit(*this, operation);
+  }
+
+  void operator()(const GPOperations::ZeroPLV& op) {
+    dest_ = op.dest_;
+    overwrites_dest_ = true;
+  }
+  void operator()(const GPOperations::SetToStationaryDistribution& op) {
+    dest_ = op.dest_;
+    overwrites_dest_ = true;
+  }
+  void operator()(const GPOperations::IncrementWithWeightedEvolvedPLV& op) {
+    reads_ = {op.src_, op.dest_};
+    dest_ = op.dest_;
+  }
+  void operator()(const GPOperations::Multiply& op) {
+    reads_ = {op.src1_, op.src2_};
+    dest_ = op.dest_;
+    overwrites_dest_ = true;
+  }
+  void operator()(const GPOperations::Likelihood& op) {
+    reads_ = {op.child_, op.parent_};
+  }
+  void operator()(const GPOperations::PrepForMarginalization& op) {
+    // This only sets the rescaling count of dest_, but dest_ must be resident so that
+    // its data stays in step with its recipe.
+    reads_ = op.src_vector_;
+    reads_.push_back(op.dest_);
+    dest_ = op.dest_;
+  }
+  void operator()(const GPOperations::IncrementMarginalLikelihood& op) {
+    reads_ = {op.stationary_times_prior_, op.p_};
+  }
+  void operator()(const GPOperations::OptimizeBranchLength& op) {
+    reads_ = {op.rootward_, op.leafward_};
+  }
+  void operator()(const GPOperations::ResetMarginalLikelihood&) {}  // NOLINT
+  void operator()(const GPOperations::UpdateSBNProbabilities&) {}   // NOLINT
+};
+
+class PLVCache {
+ public:
+  PLVCache(size_t byte_budget, size_t plv_byte_count)
+      : byte_budget_(byte_budget), plv_byte_count_(plv_byte_count) {}
+
+  // Forget all recipes and consider all PLVs to be resident, where evicting PLV i
+  // gives back releasable_byte_counts[i] bytes. This is less than the size of a PLV
+  // unless the PLV covers whole pages (see MmappedMatrix::ReleasableByteCount), and we
+  // never evict PLVs that give back nothing. Statistics are kept.
+  void Reset(const SizeVector& releasable_byte_counts);
+
+  size_t GetByteBudget() const { return byte_budget_; }
+  size_t GetResidentByteCount() const { return resident_byte_count_; }
+  bool IsOverBudget() const { return GetResidentByteCount() > byte_budget_; }
+  size_t GetPLVCount() const { return is_resident_.size(); }
+  bool IsResident(size_t plv_idx) const { return is_resident_.at(plv_idx); }
+  const GPOperationVector& GetRecipe(size_t plv_idx) const {
+    return recipes_.at(plv_idx);
+  }
+
+  // Update the recipe of the PLV written by operation.
+  void RecordOperation(const GPOperation& operation, const GPOperationPLVs& plvs);
+  // Forget how to recompute a PLV, e.g. because its data was copied in from elsewhere.
+  // It will then stay resident until it is next overwritten by an operation.
+  void ForgetRecipe(size_t plv_idx);
+
+  // Pinned PLVs are never evicted. Pins nest.
+  void Pin(size_t plv_idx);
+  void Unpin(size_t plv_idx);
+  // Mark a PLV as the most recently used.
+  void Touch(size_t plv_idx);
+  void SetResident(size_t plv_idx);
+  void SetEvicted(size_t plv_idx);
+  // The least recently used PLV that may be evicted, if we are over budget.
+  std::optional<size_t> NextEviction() const;
+
+  // ** Statistics
+
+  void CountHit() { hit_count_++; }
+  void CountMiss() { miss_count_++; }
+  void CountRecomputedOperation() { recomputed_operation_count_++; }
+  // Hits and misses count the PLVs that operations needed to be resident, and
+  // recomputed_operations counts the operations replayed to bring missing PLVs back.
+  StringSizeMap Statistics() const;
+  void ResetStatistics();
+
+ private:
+  // Keep evictable_ in sync with the state of plv_idx.
+  void UpdateEvictability(size_t plv_idx);
+
+  size_t byte_budget_;
+  size_t plv_byte_count_;
+  // The bytes of the resident PLVs, less those given back by evicted PLVs.
+  size_t resident_byte_count_ = 0;
+  std::vector<bool> is_resident_;
+  SizeVector releasable_byte_counts_;
+  std::vector<GPOperationVector> recipes_;
+  SizeVector pin_counts_;
+  // The "time" at which each PLV was last used.
+  SizeVector last_use_;
+  size_t tick_ = 0;
+  // The resident PLVs that we may evict, as (last use, PLV index) pairs, so that the
+  // least recently used comes first.
+  std::set<std::pair<size_t, size_t>> evictable_;
+
+  size_t hit_count_ = 0;
+  size_t miss_count_ = 0;
+  size_t recomputed_operation_count_ = 0;
+  size_t eviction_count_ = 0;
+};
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+TEST_CASE("PLVCache") {
+  // Room for two PLVs of 8 bytes each.
+  PLVCache cache(16, 8);
+  cache.Reset(SizeVector(4, 8));
+  CHECK(cache.IsOverBudget());
+  // PLVs without a recipe can't be evicted.
+  CHECK_FALSE(cache.NextEviction().has_value());
+  auto record = [&cache](const GPOperation& operation) {
+    cache.RecordOperation(operation, GPOperationPLVs(operation));
+  };
+  record(GPOperations::ZeroPLV{1});
+  record(GPOperations::IncrementWithWeightedEvolvedPLV{1, 0, 0});
+  record(GPOperations::Multiply{2, 0, 1});
+  CHECK_EQ(cache.GetRecipe(1).size(), 2);
+  CHECK_EQ(cache.GetRecipe(2).size(), 1);
+  cache.Touch(2);
+  cache.Touch(1);
+  // PLV 2 was used less recently than PLV 1.
+  CHECK_EQ(cache.NextEviction(), std::optional<size_t>(2));
+  cache.Pin(2);
+  CHECK_EQ(cache.NextEviction(), std::optional<size_t>(1));
+  cache.Unpin(2);
+  cache.SetEvicted(2);
+  CHECK_EQ(cache.GetResidentByteCount(), 24);
+  CHECK_EQ(cache.NextEviction(), std::optional<size_t>(1));
+  cache.SetEvicted(1);
+  CHECK_FALSE(cache.IsOverBudget());
+  CHECK_FALSE(cache.NextEviction().has_value());
+  // Increments don't start a recipe of their own.
+  record(GPOperations::IncrementWithWeightedEvolvedPLV{3, 0, 0});
+  CHECK(cache.GetRecipe(3).empty());
+  cache.SetResident(1);
+  cache.ForgetRecipe(1);
+  CHECK(cache.GetRecipe(1).empty());
+  CHECK_EQ(cache.Statistics().at("evictions"), 2);
+}
+
+TEST_CASE("PLVCache: PLVs smaller than a page") {
+  // Room for two PLVs of 8 bytes each, but PLV 1 lies within a page and PLV 2 only
+  // covers half a page's worth of whole pages, so evicting them frees 0 and 4 bytes.
+  PLVCache cache(16, 8);
+  cache.Reset({8, 0, 4});
+  auto record = [&cache](const GPOperation& operation) {
+    cache.RecordOperation(operation, GPOperationPLVs(operation));
+  };
+  record(GPOperations::ZeroPLV{1});
+  record(GPOperations::ZeroPLV{2});
+  cache.Touch(1);
+  cache.Touch(2);
+  CHECK_EQ(cache.GetResidentByteCount(), 24);
+  // Evicting PLV 1 would free nothing, so we never do.
+  CHECK_EQ(cache.NextEviction(), std::optional<size_t>(2));
+  cache.SetEvicted(2);
+  CHECK_EQ(cache.GetResidentByteCount(), 20);
+  CHECK(cache.IsOverBudget());
+  CHECK_FALSE(cache.NextEviction().has_value());
+  cache.SetResident(2);
+  CHECK_EQ(cache.GetResidentByteCount(), 24);
+}
+#endif  // DOCTEST_LIBRARY_INCLUDED
@@ -0,0 +1,733 @@
+// Copyright 2019-2022 bito project contributors.
+// bito is free software under the GPLv3; see LICENSE file for details.
+
+#include "plv_kernels.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define BITO_PLV_KERNELS_X86
+// GCC's AVX-512 intrinsics use deliberately uninitialized vectors for unused lanes.
+#ifndef __clang__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+#include <immintrin.h>
+#ifndef __clang__
+#pragma GCC diagnostic pop
+#endif
+#define AVX2_TARGET __attribute__((target("avx2,fma")))
+#define AVX512_TARGET __attribute__((target("avx512f,avx2,fma")))
+#endif
+
+namespace {
+
+using PLVKernels::MultiplyExtrema;
+
+// ** Generic kernels
+
+// The kernels are templated on T, the type that PLVs are stored as (double or float).
+// We always compute in double, so float entries are widened as they are loaded and
+// narrowed as they are stored.
+
+template <typename T>
+void GenericIncrementWithWeightedEvolved(T *dest, const double *matrix, const T *src,
+                                         const double weight,
+                                         const size_t pattern_count) {
+  for (size_t pattern = 0; pattern < pattern_count; pattern++) {
+    const T *s = src + 4 * pattern;
+    T *d = dest + 4 * pattern;
+    for (size_t i = 0; i < 4; i++) {
+      d[i] = static_cast<T>(
+          static_cast<double>(d[i]) +
+          weight * (matrix[i] * static_cast<double>(s[0]) +
+                    matrix[4 + i] * static_cast<double>(s[1]) +
+                    matrix[8 + i] * static_cast<double>(s[2]) +
+                    matrix[12 + i] * static_cast<double>(s[3])));
+    }
+  }
+}
+
+template <typename T>
+MultiplyExtrema GenericMultiply(T *dest, const T *src1, const T *src2,
+                                const size_t pattern_count) {
+  MultiplyExtrema extrema = {std::numeric_limits<double>::infinity(),
+                             -std::numeric_limits<double>::infinity(), true};
+  for (size_t i = 0; i < 4 * pattern_count; i++) {
+    const double product = static_cast<double>(src1[i]) * static_cast<double>(src2[i]);
+    dest[i] = static_cast<T>(product);
+    extrema.min_ = std::min(extrema.min_, product);
+    extrema.max_ = std::max(extrema.max_, product);
+    extrema.is_finite_ &= std::isfinite(product);
+  }
+  return extrema;
+}
+
+template <typename T>
+void GenericPerPatternLikelihoods(double *result, const T *src1, const double *matrix,
+                                  const T *src2, const size_t pattern_count) {
+  for (size_t pattern = 0; pattern < pattern_count; pattern++) {
+    const T *a = src1 + 4 * pattern;
+    const T *b = src2 + 4 * pattern;
+    double likelihood = 0.;
+    for (size_t i = 0; i < 4; i++) {
+      likelihood += static_cast<double>(a[i]) *
+                    (matrix[i] * static_cast<double>(b[0]) +
+                     matrix[4 + i] * static_cast<double>(b[1]) +
+                     matrix[8 + i] * static_cast<double>(b[2]) +
+                     matrix[12 + i] * static_cast<double>(b[3]));
+    }
+    result[pattern] = likelihood;
+  }
+}
+
+// ** Tip kernels
+// A tip's PLV only takes 16 different values, one for each ambiguity code, so we
+// evolve each of those up front. The sum over the states of a code goes in the same
+// order as the sums of the generic kernels, so the generic tip kernels give exactly
+// the results of the generic kernels on the corresponding leaf PLV.
+
+using CodeColumns = double[16][4];
+
+void EvolveCodes(const double *matrix, const double weight, CodeColumns &columns) {
+  for (size_t code = 0; code < 16; code++) {
+    for (size_t i = 0; i < 4; i++) {
+      double sum = 0.;
+      for (size_t j = 0; j < 4; j++) {
+        if ((code >> j) & 1) {
+          sum += matrix[4 * j + i];
+        }
+      }
+      columns[code][i] = weight * sum;
+    }
+  }
+}
+
+inline uint8_t TipCode(const uint8_t *tip_codes, const size_t pattern) {
+  return (tip_codes[pattern / 2] >> (4 * (pattern % 2))) & 0xF;
+}
+
+template <typename T>
+void GenericIncrementWithWeightedEvolvedTip(T *dest, const double *matrix,
+                                            const uint8_t *tip_codes,
+                                            const double weight,
+                                            const size_t pattern_count) {
+  CodeColumns columns;
+  EvolveCodes(matrix, weight, columns);
+  for (size_t pattern = 0; pattern < pattern_count; pattern++) {
+    const double *column = columns[TipCode(tip_codes, pattern)];
+    T *d = dest + 4 * pattern;
+    for (size_t i = 0; i < 4; i++) {
+      d[i] = static_cast<T>(static_cast<double>(d[i]) + column[i]);
+    }
+  }
+}
+
+template <typename T>
+void GenericPerPatternLikelihoodsTip(double *result, const T *src1,
+                                     const double *matrix, const uint8_t *tip_codes,
+                                     const size_t pattern_count) {
+  CodeColumns columns;
+  EvolveCodes(matrix, 1., columns);
+  for (size_t pattern = 0; pattern < pattern_count; pattern++) {
+    const double *column = columns[TipCode(tip_codes, pattern)];
+    const T *a = src1 + 4 * pattern;
+    double likelihood = 0.;
+    for (size_t i = 0; i < 4; i++) {
+      likelihood += static_cast<double>(a[i]) * column[i];
+    }
+    result[pattern] = likelihood;
+  }
+}
+
+#ifdef BITO_PLV_KERNELS_X86
+
+// ** AVX2 kernels
+// A __m256d holds the four states of one pattern, and evolving it is a sum of the
+// matrix columns weighted by the states.
+
+AVX2_TARGET inline __m256d AVX2Load(const double *p) { return _mm256_loadu_pd(p); }
+AVX2_TARGET inline __m256d AVX2Load(const float *p) {
+  return _mm256_cvtps_pd(_mm_loadu_ps(p));
+}
+AVX2_TARGET inline void AVX2Store(double *p, const __m256d v) {
+  _mm256_storeu_pd(p, v);
+}
+AVX2_TARGET inline void AVX2Store(float *p, const __m256d v) {
+  _mm_storeu_ps(p, _mm256_cvtpd_ps(v));
+}
+
+template <typename T>
+AVX2_TARGET inline __m256d AVX2Evolve(const __m256d *columns, const T *s) {
+  __m256d evolved = _mm256_mul_pd(columns[0], _mm256_set1_pd(s[0]));
+  evolved = _mm256_fmadd_pd(columns[1], _mm256_set1_pd(s[1]), evolved);
+  evolved = _mm256_fmadd_pd(columns[2], _mm256_set1_pd(s[2]), evolved);
+  return _mm256_fmadd_pd(columns[3], _mm256_set1_pd(s[3]), evolved);
+}
+
+template <typename T>
+AVX2_TARGET void AVX2IncrementWithWeightedEvolved(T *dest, const double *matrix,
+                                                  const T *src, const double weight,
+                                                  const size_t pattern_count) {
+  // Fold the weight into the matrix.
+  const __m256d weight_vector = _mm256_set1_pd(weight);
+  __m256d columns[4];
+  for (size_t j = 0; j < 4; j++) {
+    columns[j] = _mm256_mul_pd(weight_vector, _mm256_loadu_pd(matrix + 4 * j));
+  }
+  for (size_t pattern = 0; pattern < pattern_count; pattern++) {
+    T *d = dest + 4 * pattern;
+    AVX2Store(d, _mm256_add_pd(AVX2Load(d), AVX2Evolve(columns, src + 4 * pattern)));
+  }
+}
+
+template <typename T>
+AVX2_TARGET MultiplyExtrema AVX2Multiply(T *dest, const T *src1, const T *src2,
+                                         const size_t pattern_count) {
+  const __m256d infinity = _mm256_set1_pd(std::numeric_limits<double>::infinity());
+  const __m256d sign_mask = _mm256_set1_pd(-0.);
+  __m256d min_vector = infinity;
+  __m256d max_vector = _mm256_set1_pd(-std::numeric_limits<double>::infinity());
+  // Lanes become all ones once they see a NaN or an infinity.
+  __m256d not_finite = _mm256_setzero_pd();
+  for (size_t pattern = 0; pattern < pattern_count; pattern++) {
+    const __m256d product =
+        _mm256_mul_pd(AVX2Load(src1 + 4 * pattern), AVX2Load(src2 + 4 * pattern));
+    AVX2Store(dest + 4 * pattern, product);
+    min_vector = _mm256_min_pd(min_vector, product);
+    max_vector = _mm256_max_pd(max_vector, product);
+    not_finite = _mm256_or_pd(
+        not_finite,
+        _mm256_cmp_pd(_mm256_andnot_pd(sign_mask, product), infinity, _CMP_NLT_UQ));
+  }
+  double mins[4];
+  double maxes[4];
+  _mm256_storeu_pd(mins, min_vector);
+  _mm256_storeu_pd(maxes, max_vector);
+  return {*std::min_element(mins, mins + 4), *std::max_element(maxes, maxes + 4),
+          _mm256_movemask_pd(not_finite) == 0};
+}
+
+// Sum each of the four vectors, giving a vector of the four sums.
+AVX2_TARGET inline __m256d AVX2HorizontalSums(
+    const __m256d t0, const __m256d t1, const __m256d t2, const __m256d t3) {
+  const __m256d sums01 = _mm256_hadd_pd(t0, t1);
+  const __m256d sums23 = _mm256_hadd_pd(t2, t3);
+  return _mm256_add_pd(_mm256_permute2f128_pd(sums01, sums23, 0x20),
+                       _mm256_permute2f128_pd(sums01, sums23, 0x31));
+}
+
+// The entries of src1[:, pattern] .* (matrix * src2[:, pattern]).
+template <typename T>
+AVX2_TARGET inline __m256d AVX2StateProducts(const __m256d *columns, const T *src1,
+                                             const T *src2, const size_t pattern) {
+  return _mm256_mul_pd(AVX2Load(src1 + 4 * pattern),
+                       AVX2Evolve(columns, src2 + 4 * pattern));
+}
+
+template <typename T>
+AVX2_TARGET void AVX2PerPatternLikelihoods(double *result, const T *src1,
+                                           const double *matrix, const T *src2,
+                                           const size_t pattern_count) {
+  __m256d columns[4];
+  for (size_t j = 0; j < 4; j++) {
+    columns[j] = _mm256_loadu_pd(matrix + 4 * j);
+  }
+  size_t pattern = 0;
+  for (; pattern + 4 <= pattern_count; pattern += 4) {
+    _mm256_storeu_pd(
+        result + pattern,
+        AVX2HorizontalSums(AVX2StateProducts(columns, src1, src2, pattern),
+                           AVX2StateProducts(columns, src1, src2, pattern + 1),
+                           AVX2StateProducts(columns, src1, src2, pattern + 2),
+                           AVX2StateProducts(columns, src1, src2, pattern + 3)));
+  }
+  GenericPerPatternLikelihoods(result + pattern, src1 + 4 * pattern, matrix,
+                               src2 + 4 * pattern, pattern_count - pattern);
+}
+
+// The tip kernels handle the two patterns of a byte of codes at a time. AVX-512 uses
+// these too, as a pattern's evolved column is a single load either way.
+
+template <typename T>
+AVX2_TARGET void AVX2IncrementWithWeightedEvolvedTip(T *dest, const double *matrix,
+                                                     const uint8_t *tip_codes,
+                                                     const double weight,
+                                                     const size_t pattern_count) {
+  CodeColumns columns;
+  EvolveCodes(matrix, weight, columns);
+  size_t pattern = 0;
+  for (; pattern + 2 <= pattern_count; pattern += 2) {
+    const uint8_t codes = tip_codes[pattern / 2];
+    T *d = dest + 4 * pattern;
+    AVX2Store(d, _mm256_add_pd(AVX2Load(d), _mm256_loadu_pd(columns[codes & 0xF])));
+    AVX2Store(d + 4,
+              _mm256_add_pd(AVX2Load(d + 4), _mm256_loadu_pd(columns[codes >> 4])));
+  }
+  GenericIncrementWithWeightedEvolvedTip(dest + 4 * pattern, matrix,
+                                         tip_codes + pattern / 2, weight,
+                                         pattern_count - pattern);
+}
+
+// The entries of src1[:, pattern] .* columns[code].
+template <typename T>
+AVX2_TARGET inline __m256d AVX2TipStateProducts(const CodeColumns &columns,
+                                                const T *src1, const size_t pattern,
+                                                const uint8_t code) {
+  return _mm256_mul_pd(AVX2Load(src1 + 4 * pattern), _mm256_loadu_pd(columns[code]));
+}
+
+template <typename T>
+AVX2_TARGET void AVX2PerPatternLikelihoodsTip(double *result, const T *src1,
+                                              const double *matrix,
+                                              const uint8_t *tip_codes,
+                                              const size_t pattern_count) {
+  CodeColumns columns;
+  EvolveCodes(matrix, 1., columns);
+  size_t pattern = 0;
+  for (; pattern + 4 <= pattern_count; pattern += 4) {
+    const uint8_t codes01 = tip_codes[pattern / 2];
+    const uint8_t codes23 = tip_codes[pattern / 2 + 1];
+    const __m256d products0 =
+        AVX2TipStateProducts(columns, src1, pattern, codes01 & 0xF);
+    const __m256d products1 =
+        AVX2TipStateProducts(columns, src1, pattern + 1, codes01 >> 4);
+    const __m256d products2 =
+        AVX2TipStateProducts(columns, src1, pattern + 2, codes23 & 0xF);
+    const __m256d products3 =
+        AVX2TipStateProducts(columns, src1, pattern + 3, codes23 >> 4);
+    _mm256_storeu_pd(result + pattern,
+                     AVX2HorizontalSums(products0, products1, products2, products3));
+  }
+  GenericPerPatternLikelihoodsTip(result + pattern, src1 + 4 * pattern, matrix,
+                                  tip_codes + pattern / 2, pattern_count - pattern);
+}
+
+// ** AVX-512 kernels
+// A __m512d holds the states of two consecutive patterns. We broadcast the matrix
+// columns to both halves, and each state to its own half.
+
+AVX512_TARGET inline __m512d AVX512Load(const double *p) { return _mm512_loadu_pd(p); }
+AVX512_TARGET inline __m512d AVX512Load(const float *p) {
+  return _mm512_cvtps_pd(_mm256_loadu_ps(p));
+}
+AVX512_TARGET inline void AVX512Store(double *p, const __m512d v) {
+  _mm512_storeu_pd(p, v);
+}
+AVX512_TARGET inline void AVX512Store(float *p, const __m512d v) {
+  _mm256_storeu_ps(p, _mm512_cvtpd_ps(v));
+}
+
+AVX512_TARGET inline __m512d AVX512Evolve(const __m512d *columns, const __m512d s) {
+  const __m512d s0 = _mm512_permutexvar_pd(_mm512_set_epi64(4, 4, 4, 4, 0, 0, 0, 0), s);
+  const __m512d s1 = _mm512_permutexvar_pd(_mm512_set_epi64(5, 5, 5, 5, 1, 1, 1, 1), s);
+  const __m512d s2 = _mm512_permutexvar_pd(_mm512_set_epi64(6, 6, 6, 6, 2, 2, 2, 2), s);
+  const __m512d s3 = _mm512_permutexvar_pd(_mm512_set_epi64(7, 7, 7, 7, 3, 3, 3, 3), s);
+  __m512d evolved = _mm512_mul_pd(columns[0], s0);
+  evolved = _mm512_fmadd_pd(columns[1], s1, evolved);
+  evolved = _mm512_fmadd_pd(columns[2], s2, evolved);
+  return _mm512_fmadd_pd(columns[3], s3, evolved);
+}
+
+AVX512_TARGET void AVX512LoadColumns(__m512d *columns, const double *matrix,
+                                     const double weight) {
+  const __m512d weight_vector = _mm512_set1_pd(weight);
+  for (size_t j = 0; j < 4; j++) {
+    columns[j] = _mm512_mul_pd(
+        weight_vector, _mm512_broadcast_f64x4(_mm256_loadu_pd(matrix + 4 * j)));
+  }
+}
+
+template <typename T>
+AVX512_TARGET void AVX512IncrementWithWeightedEvolved(T *dest, const double *matrix,
+                                                      const T *src, const double weight,
+                                                      const size_t pattern_count) {
+  __m512d columns[4];
+  AVX512LoadColumns(columns, matrix, weight);
+  size_t pattern = 0;
+  for (; pattern + 2 <= pattern_count; pattern += 2) {
+    T *d = dest + 4 * pattern;
+    const __m512d evolved = AVX512Evolve(columns, AVX512Load(src + 4 * pattern));
+    AVX512Store(d, _mm512_add_pd(AVX512Load(d), evolved));
+  }
+  GenericIncrementWithWeightedEvolved(dest + 4 * pattern, matrix, src + 4 * pattern,
+                                      weight, pattern_count - pattern);
+}
+
+template <typename T>
+AVX512_TARGET MultiplyExtrema AVX512Multiply(T *dest, const T *src1, const T *src2,
+                                             const size_t pattern_count) {
+  const __m512d infinity = _mm512_set1_pd(std::numeric_limits<double>::infinity());
+  __m512d min_vector = infinity;
+  __m512d max_vector = _mm512_set1_pd(-std::numeric_limits<double>::infinity());
+  __mmask8 not_finite = 0;
+  const size_t entry_count = 4 * pattern_count;
+  size_t i = 0;
+  for (; i + 8 <= entry_count; i += 8) {
+    const __m512d product = _mm512_mul_pd(AVX512Load(src1 + i), AVX512Load(src2 + i));
+    AVX512Store(dest + i, product);
+    min_vector = _mm512_min_pd(min_vector, product);
+    max_vector = _mm512_max_pd(max_vector, product);
+    not_finite |= _mm512_cmp_pd_mask(_mm512_abs_pd(product), infinity, _CMP_NLT_UQ);
+  }
+  // There are at most 4 entries (one pattern) left.
+  MultiplyExtrema extrema =
+      GenericMultiply(dest + i, src1 + i, src2 + i, (entry_count - i) / 4);
+  extrema.min_ = std::min(extrema.min_, _mm512_reduce_min_pd(min_vector));
+  extrema.max_ = std::max(extrema.max_, _mm512_reduce_max_pd(max_vector));
+  extrema.is_finite_ &= (not_finite == 0);
+  return extrema;
+}
+
+// The same as AVX2StateProducts for patterns pattern and pattern + 1.
+template <typename T>
+AVX512_TARGET inline __m512d AVX512StateProducts(const __m512d *columns, const T *src1,
+                                                 const T *src2, const size_t pattern) {
+  return _mm512_mul_pd(AVX512Load(src1 + 4 * pattern),
+                       AVX512Evolve(columns, AVX512Load(src2 + 4 * pattern)));
+}
+
+template <typename T>
+AVX512_TARGET void AVX512PerPatternLikelihoods(double *result, const T *src1,
+                                               const double *matrix, const T *src2,
+                                               const size_t pattern_count) {
+  __m512d columns[4];
+  AVX512LoadColumns(columns, matrix, 1.);
+  size_t pattern = 0;
+  for (; pattern + 4 <= pattern_count; pattern += 4) {
+    const __m512d products01 = AVX512StateProducts(columns, src1, src2, pattern);
+    const __m512d products23 = AVX512StateProducts(columns, src1, src2, pattern + 2);
+    _mm256_storeu_pd(result + pattern,
+                     AVX2HorizontalSums(_mm512_castpd512_pd256(products01),
+                                        _mm512_extractf64x4_pd(products01, 1),
+                                        _mm512_castpd512_pd256(products23),
+                                        _mm512_extractf64x4_pd(products23, 1)));
+  }
+  GenericPerPatternLikelihoods(result + pattern, src1 + 4 * pattern, matrix,
+                               src2 + 4 * pattern, pattern_count - pattern);
+}
+
+#endif  // BITO_PLV_KERNELS_X86
+
+// ** Dispatch
+
+template <typename T>
+struct KernelTable {
+  decltype(&GenericIncrementWithWeightedEvolved<T>) increment_with_weighted_evolved_;
+  decltype(&GenericMultiply<T>) multiply_;
+  decltype(&GenericPerPatternLikelihoods<T>) per_pattern_likelihoods_;
+  decltype(&GenericIncrementWithWeightedEvolvedTip<T>)
+      increment_with_weighted_evolved_tip_;
+  decltype(&GenericPerPatternLikelihoodsTip<T>) per_pattern_likelihoods_tip_;
+};
+
+template <typename T>
+const KernelTable<T> generic_kernels = {
+    GenericIncrementWithWeightedEvolved<T>, GenericMultiply<T>,
+    GenericPerPatternLikelihoods<T>, GenericIncrementWithWeightedEvolvedTip<T>,
+    GenericPerPatternLikelihoodsTip<T>};
+#ifdef BITO_PLV_KERNELS_X86
+template <typename T>
+const KernelTable<T> avx2_kernels = {
+    AVX2IncrementWithWeightedEvolved<T>, AVX2Multiply<T>, AVX2PerPatternLikelihoods<T>,
+    AVX2IncrementWithWeightedEvolvedTip<T>, AVX2PerPatternLikelihoodsTip<T>};
+template <typename T>
+const KernelTable<T> avx512_kernels = {
+    AVX512IncrementWithWeightedEvolved<T>, AVX512Multiply<T>,
+    AVX512PerPatternLikelihoods<T>, AVX2IncrementWithWeightedEvolvedTip<T>,
+    AVX2PerPatternLikelihoodsTip<T>};
+#endif  // BITO_PLV_KERNELS_X86
+
+std::atomic<PLVKernels::Isa> &CurrentIsa() {
+  static std::atomic<PLVKernels::Isa> current_isa(PLVKernels::AvailableIsas().back());
+  return current_isa;
+}
+
+template <typename T>
+const KernelTable<T> &Kernels() {
+  switch (CurrentIsa().load(std::memory_order_relaxed)) {
+#ifdef BITO_PLV_KERNELS_X86
+    case PLVKernels::Isa::AVX2:
+      return avx2_kernels<T>;
+    case PLVKernels::Isa::AVX512:
+      return avx512_kernels<T>;
+#endif  // BITO_PLV_KERNELS_X86
+    default:
+      return generic_kernels<T>;
+  }
+}
+
+// ** Pattern chunks
+
+MultiplyExtrema CombineExtrema(const std::vector<MultiplyExtrema> &chunk_extrema) {
+  MultiplyExtrema extrema = {std::numeric_limits<double>::infinity(),
+                             -std::numeric_limits<double>::infinity(), true};
+  for (const auto &chunk : chunk_extrema) {
+    extrema.min_ = std::min(extrema.min_, chunk.min_);
+    extrema.max_ = std::max(extrema.max_, chunk.max_);
+    extrema.is_finite_ &= chunk.is_finite_;
+  }
+  return extrema;
+}
+
+template <typename T>
+Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, 1>> EntriesOfPatterns(
+    const T *plv, const size_t begin, const size_t end) {
+  return {plv + 4 * begin, static_cast<Eigen::Index>(4 * (end - begin))};
+}
+
+}  // namespace
+
+std::vector<PLVKernels::Isa> PLVKernels::AvailableIsas() {
+  std::vector<Isa> isas = {Isa::Generic};
+#ifdef BITO_PLV_KERNELS_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    isas.push_back(Isa::AVX2);
+    if (__builtin_cpu_supports("avx512f")) {
+      isas.push_back(Isa::AVX512);
+    }
+  }
+#endif  // BITO_PLV_KERNELS_X86
+  return isas;
+}
+
+std::string PLVKernels::IsaName(const Isa isa) {
+  switch (isa) {
+    case Isa::Generic:
+      return "generic";
+    case Isa::AVX2:
+      return "avx2";
+    case Isa::AVX512:
+      return "avx512";
+  }
+  Failwith("Unknown PLV kernel ISA.");
+}
+
+PLVKernels::Isa PLVKernels::GetIsa() {
+  return CurrentIsa().load(std::memory_order_relaxed);
+}
+
+void PLVKernels::SetIsa(const Isa isa) {
+  const auto available_isas = AvailableIsas();
+  Assert(std::find(available_isas.begin(), available_isas.end(), isa) !=
+             available_isas.end(),
+         "PLV kernel ISA " + IsaName(isa) + " isn't supported by this CPU.");
+  CurrentIsa().store(isa, std::memory_order_relaxed);
+}
+
+template <typename T>
+void PLVKernels::IncrementWithWeightedEvolved(T *dest, const double *matrix,
+                                              const T *src, const double weight,
+                                              const size_t pattern_count) {
+  Kernels<T>().increment_with_weighted_evolved_(dest, matrix, src, weight,
+                                                pattern_count);
+}
+
+template <typename T>
+PLVKernels::MultiplyExtrema PLVKernels::Multiply(T *dest, const T *src1, const T *src2,
+                                                 const size_t pattern_count) {
+  return Kernels<T>().multiply_(dest, src1, src2, pattern_count);
+}
+
+template <typename T>
+void PLVKernels::PerPatternLikelihoods(double *result, const T *src1,
+                                       const double *matrix, const T *src2,
+                                       const size_t pattern_count) {
+  Kernels<T>().per_pattern_likelihoods_(result, src1, matrix, src2, pattern_count);
+}
+
+template <typename T>
+void PLVKernels::IncrementWithWeightedEvolvedTip(T *dest, const double *matrix,
+                                                 const uint8_t *tip_codes,
+                                                 const double weight,
+                                                 const size_t pattern_count) {
+  Kernels<T>().increment_with_weighted_evolved_tip_(dest, matrix, tip_codes, weight,
+                                                    pattern_count);
+}
+
+template <typename T>
+void PLVKernels::PerPatternLikelihoodsTip(double *result, const T *src1,
+                                          const double *matrix,
+                                          const uint8_t *tip_codes,
+                                          const size_t pattern_count) {
+  Kernels<T>().per_pattern_likelihoods_tip_(result, src1, matrix, tip_codes,
+                                            pattern_count);
+}
+
+size_t PLVKernels::PatternChunkCount(const size_t pattern_count) {
+  return (pattern_count + pattern_chunk_size - 1) / pattern_chunk_size;
+}
+
+void PLVKernels::ForEachPatternChunk(
+    ThreadPool *thread_pool, const size_t pattern_count,
+    const std::function<void(size_t, size_t, size_t)> &f) {
+  const size_t chunk_count = PatternChunkCount(pattern_count);
+  auto run_chunk = [&f, pattern_count](const size_t chunk_idx) {
+    const size_t begin = chunk_idx * pattern_chunk_size;
+    f(chunk_idx, begin, std::min(begin + pattern_chunk_size, pattern_count));
+  };
+  if (thread_pool == nullptr || chunk_count < 2) {
+    for (size_t chunk_idx = 0; chunk_idx < chunk_count; chunk_idx++) {
+      run_chunk(chunk_idx);
+    }
+    return;
+  }
+  // else
+  ThreadPool::TaskVector tasks;
+  for (size_t chunk_idx = 0; chunk_idx < chunk_count; chunk_idx++) {
+    tasks.push_back([&run_chunk, chunk_idx](size_t) { run_chunk(chunk_idx); });
+  }
+  thread_pool->Run(std::move(tasks));
+}
+
+template <typename T>
+void PLVKernels::IncrementWithWeightedEvolved(ThreadPool *thread_pool, T *dest,
+                                              const double *matrix, const T *src,
+                                              const double weight,
+                                              const size_t pattern_count) {
+  const auto &kernels = Kernels<T>();
+  ForEachPatternChunk(thread_pool, pattern_count,
+                      [&](size_t, size_t begin, size_t end) {
+                        kernels.increment_with_weighted_evolved_(
+                            dest + 4 * begin, matrix, src + 4 * begin, weight,
+                            end - begin);
+                      });
+}
+
+template <typename T>
+PLVKernels::MultiplyExtrema PLVKernels::Multiply(ThreadPool *thread_pool, T *dest,
+                                                 const T *src1, const T *src2,
+                                                 const size_t pattern_count) {
+  const auto &kernels = Kernels<T>();
+  std::vector<MultiplyExtrema> chunk_extrema(PatternChunkCount(pattern_count));
+  ForEachPatternChunk(thread_pool, pattern_count,
+                      [&](size_t chunk_idx, size_t begin, size_t end) {
+                        chunk_extrema[chunk_idx] =
+                            kernels.multiply_(dest + 4 * begin, src1 + 4 * begin,
+                                              src2 + 4 * begin, end - begin);
+                      });
+  return CombineExtrema(chunk_extrema);
+}
+
+template <typename T>
+void PLVKernels::PerPatternLikelihoods(ThreadPool *thread_pool, double *result,
+                                       const T *src1, const double *matrix,
+                                       const T *src2, const size_t pattern_count) {
+  const auto &kernels = Kernels<T>();
+  ForEachPatternChunk(thread_pool, pattern_count,
+                      [&](size_t, size_t begin, size_t end) {
+                        kernels.per_pattern_likelihoods_(result + begin,
+                                                         src1 + 4 * begin, matrix,
+                                                         src2 + 4 * begin, end - begin);
+                      });
+}
+
+// Chunks start at multiples of pattern_chunk_size, so their tip codes start on a byte.
+static_assert(PLVKernels::pattern_chunk_size % 2 == 0);
+
+template <typename T>
+void PLVKernels::IncrementWithWeightedEvolvedTip(ThreadPool *thread_pool, T *dest,
+                                                 const double *matrix,
+                                                 const uint8_t *tip_codes,
+                                                 const double weight,
+                                                 const size_t pattern_count) {
+  const auto &kernels = Kernels<T>();
+  ForEachPatternChunk(thread_pool, pattern_count,
+                      [&](size_t, size_t begin, size_t end) {
+                        kernels.increment_with_weighted_evolved_tip_(
+                            dest + 4 * begin, matrix, tip_codes + begin / 2, weight,
+                            end - begin);
+                      });
+}
+
+template <typename T>
+void PLVKernels::PerPatternLikelihoodsTip(ThreadPool *thread_pool, double *result,
+                                          const T *src1, const double *matrix,
+                                          const uint8_t *tip_codes,
+                                          const size_t pattern_count) {
+  const auto &kernels = Kernels<T>();
+  ForEachPatternChunk(thread_pool, pattern_count,
+                      [&](size_t, size_t begin, size_t end) {
+                        kernels.per_pattern_likelihoods_tip_(
+                            result + begin, src1 + 4 * begin, matrix,
+                            tip_codes + begin / 2, end - begin);
+                      });
+}
+
+template <typename T>
+PLVKernels::MultiplyExtrema PLVKernels::Extrema(ThreadPool *thread_pool, const T *src,
+                                                const size_t pattern_count) {
+  std::vector<MultiplyExtrema> chunk_extrema(PatternChunkCount(pattern_count));
+  ForEachPatternChunk(thread_pool, pattern_count,
+                      [&](size_t chunk_idx, size_t begin, size_t end) {
+                        const auto entries = EntriesOfPatterns(src, begin, end);
+                        chunk_extrema[chunk_idx] = {
+                            static_cast<double>(entries.minCoeff()),
+                            static_cast<double>(entries.maxCoeff()),
+                            entries.allFinite()};
+                      });
+  return CombineExtrema(chunk_extrema);
+}
+
+template <typename T>
+void PLVKernels::Scale(ThreadPool *thread_pool, T *dest, const double factor,
+                       const size_t pattern_count) {
+  ForEachPatternChunk(thread_pool, pattern_count,
+                      [&](size_t, size_t begin, size_t end) {
+                        T *d = dest + 4 * begin;
+                        for (size_t i = 0; i < 4 * (end - begin); i++) {
+                          d[i] = static_cast<T>(static_cast<double>(d[i]) * factor);
+                        }
+                      });
+}
+
+double PLVKernels::WeightedSum(ThreadPool *thread_pool, const double *values,
+                               const double *weights, const size_t pattern_count) {
+  DoubleVector chunk_sums(PatternChunkCount(pattern_count));
+  ForEachPatternChunk(
+      thread_pool, pattern_count, [&](size_t chunk_idx, size_t begin, size_t end) {
+        const auto length = static_cast<Eigen::Index>(end - begin);
+        chunk_sums[chunk_idx] =
+            Eigen::Map<const EigenVectorXd>(values + begin, length)
+                .dot(Eigen::Map<const EigenVectorXd>(weights + begin, length));
+      });
+  double sum = 0.;
+  for (const double chunk_sum : chunk_sums) {
+    sum += chunk_sum;
+  }
+  return sum;
+}
+
+// ** Explicit Instantiation
+
+#define BITO_PLV_KERNELS_INSTANTIATE(T)                                              \
+  template void PLVKernels::IncrementWithWeightedEvolved(T *, const double *,        \
+                                                         const T *, double, size_t); \
+  template PLVKernels::MultiplyExtrema PLVKernels::Multiply(T *, const T *,          \
+                                                            const T *, size_t);      \
+  template void PLVKernels::PerPatternLikelihoods(double *, const T *,               \
+                                                  const double *, const T *, size_t); \
+  template void PLVKernels::IncrementWithWeightedEvolvedTip(                         \
+      T *, const double *, const uint8_t *, double, size_t);                         \
+  template void PLVKernels::PerPatternLikelihoodsTip(                                \
+      double *, const T *, const double *, const uint8_t *, size_t);                 \
+  template void PLVKernels::IncrementWithWeightedEvolved(                            \
+      ThreadPool *, T *, const double *, const T *, double, size_t);                 \
+  template PLVKernels::MultiplyExtrema PLVKernels::Multiply(                         \
+      ThreadPool *, T *, const T *, const T *, size_t);                              \
+  template void PLVKernels::PerPatternLikelihoods(                                   \
+      ThreadPool *, double *, const T *, const double *, const T *, size_t);         \
+  template void PLVKernels::IncrementWithWeightedEvolvedTip(                         \
+      ThreadPool *, T *, const double *, const uint8_t *, double, size_t);           \
+  template void PLVKernels::PerPatternLikelihoodsTip(                                \
+      ThreadPool *, double *, const T *, const double *, const uint8_t *, size_t);   \
+  template PLVKernels::MultiplyExtrema PLVKernels::Extrema(ThreadPool *, const T *,  \
+                                                           size_t);                  \
+  template void PLVKernels::Scale(ThreadPool *, T *, double, size_t);
+
+BITO_PLV_KERNELS_INSTANTIATE(double)
+BITO_PLV_KERNELS_INSTANTIATE(float)
@@ -0,0 +1,347 @@
+// Copyright 2019-2022 bito project contributors.
+// bito is free software under the GPLv3; see LICENSE file for details.
+//
+// Fixed-size kernels for the 4-state (nucleotide) PLVs of the GP engine.
+//
+// A PLV is a column-major 4 x pattern_count matrix, so the four state entries of each
+// site pattern are contiguous. Going through dynamically sized Eigen expressions for
+// these operations makes Eigen build generic products, so instead we fuse each
+// operation into a single pass over the patterns:
+//
+// * IncrementWithWeightedEvolved: dest += weight * matrix * src,
+// * Multiply: dest = src1 .* src2, also gathering what we need to decide whether
+//   dest needs rescaling,
+// * PerPatternLikelihoods: result[p] = src1[:, p]^T * matrix * src2[:, p].
+//
+// IncrementWithWeightedEvolved and PerPatternLikelihoods also come in "tip" versions,
+// for when src or src2 is a leaf given by its packed ambiguity codes (see TipStates).
+// There are only 16 codes, so these evolve the leaf by looking up a precomputed column
+// for each code rather than multiplying through the matrix, and leaf PLVs needn't be
+// read at all. Tip codes must start at an even pattern, so that they start on a byte.
+//
+// Each kernel is compiled for several ISA levels (generic, AVX2 with FMA, AVX-512)
+// and the best level that the CPU supports is chosen at run time. SetIsa lets us
+// force a level, e.g. for benchmarking; it isn't safe to call while kernels are
+// running on other threads.
+//
+// Matrices are column-major 4 x 4, as in Eigen::Matrix4d.
+//
+// The PLVs may be stored as doubles or floats (see PLVScalar in mmapped_plv.hpp), but
+// matrices, per-pattern results and all arithmetic are in double precision.
+//
+// The kernels are independent across patterns, so each also comes in a version that
+// splits the patterns into fixed-size chunks and runs the chunks on a ThreadPool.
+// The chunks depend only on the pattern count, never on the thread count, and
+// per-chunk results are combined in chunk order, so the results are the same for
+// any number of threads. A null pool runs the chunks in order on the calling thread.
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "eigen_sugar.hpp"
+#include "sugar.hpp"
+#include "thread_pool.hpp"
+
+namespace PLVKernels {
+
+enum class Isa { Generic, AVX2, AVX512 };
+
+// The ISA levels supported by this CPU, from the most generic to the most specific.
+std::vector<Isa> AvailableIsas();
+std::string IsaName(Isa isa);
+Isa GetIsa();
+void SetIsa(Isa isa);
+
+// The smallest and largest entries written by Multiply, and whether all of them were
+// finite. The extrema are meaningless if not.
+struct MultiplyExtrema {
+  double min_;
+  double max_;
+  bool is_finite_;
+};
+
+// These are instantiated for TScalar = double and float.
+template <typename TScalar>
+void IncrementWithWeightedEvolved(TScalar *dest, const double *matrix,
+                                  const TScalar *src, double weight,
+                                  size_t pattern_count);
+template <typename TScalar>
+MultiplyExtrema Multiply(TScalar *dest, const TScalar *src1, const TScalar *src2,
+                         size_t pattern_count);
+template <typename TScalar>
+void PerPatternLikelihoods(double *result, const TScalar *src1, const double *matrix,
+                           const TScalar *src2, size_t pattern_count);
+template <typename TScalar>
+void IncrementWithWeightedEvolvedTip(TScalar *dest, const double *matrix,
+                                     const uint8_t *tip_codes, double weight,
+                                     size_t pattern_count);
+template <typename TScalar>
+void PerPatternLikelihoodsTip(double *result, const TScalar *src1,
+                              const double *matrix, const uint8_t *tip_codes,
+                              size_t pattern_count);
+
+// ** Pattern chunks
+
+// 1024 patterns of a PLV take 32KB, so the chunks of a kernel's operands sit in L2.
+constexpr size_t pattern_chunk_size = 1024;
+
+size_t PatternChunkCount(size_t pattern_count);
+// Run f(chunk_idx, begin, end) for each chunk [begin, end) of [0, pattern_count).
+void ForEachPatternChunk(ThreadPool *thread_pool, size_t pattern_count,
+                         const std::function<void(size_t, size_t, size_t)> &f);
+
+template <typename TScalar>
+void IncrementWithWeightedEvolved(ThreadPool *thread_pool, TScalar *dest,
+                                  const double *matrix, const TScalar *src,
+                                  double weight, size_t pattern_count);
+template <typename TScalar>
+MultiplyExtrema Multiply(ThreadPool *thread_pool, TScalar *dest, const TScalar *src1,
+                         const TScalar *src2, size_t pattern_count);
+template <typename TScalar>
+void PerPatternLikelihoods(ThreadPool *thread_pool, double *result,
+                           const TScalar *src1, const double *matrix,
+                           const TScalar *src2, size_t pattern_count);
+template <typename TScalar>
+void IncrementWithWeightedEvolvedTip(ThreadPool *thread_pool, TScalar *dest,
+                                     const double *matrix, const uint8_t *tip_codes,
+                                     double weight, size_t pattern_count);
+template <typename TScalar>
+void PerPatternLikelihoodsTip(ThreadPool *thread_pool, double *result,
+                              const TScalar *src1, const double *matrix,
+                              const uint8_t *tip_codes, size_t pattern_count);
+// The extrema of the entries of a PLV.
+template <typename TScalar>
+MultiplyExtrema Extrema(ThreadPool *thread_pool, const TScalar *src,
+                        size_t pattern_count);
+// Multiply every entry of a PLV by factor.
+template <typename TScalar>
+void Scale(ThreadPool *thread_pool, TScalar *dest, double factor,
+           size_t pattern_count);
+// The sum over patterns of values[p] * weights[p].
+double WeightedSum(ThreadPool *thread_pool, const double *values,
+                   const double *weights, size_t pattern_count);
+
+}  // namespace PLVKernels
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+TEST_CASE("PLVKernels") {
+  const size_t pattern_count = 37;  // Not a multiple of any vector width.
+  Eigen::Matrix<double, 4, Eigen::Dynamic> src1(4, pattern_count);
+  Eigen::Matrix<double, 4, Eigen::Dynamic> src2(4, pattern_count);
+  for (size_t i = 0; i < 4 * pattern_count; i++) {
+    src1.data()[i] = 0.25 + 0.5 * static_cast<double>((i * 7) % 11) / 11.;
+    src2.data()[i] = 0.1 + static_cast<double>((i * 5) % 13) / 13.;
+  }
+  src2(2, 30) = 1e-50;
+  Eigen::Matrix4d matrix;
+  matrix << 0.7, 0.1, 0.1, 0.1, 0.05, 0.8, 0.1, 0.05, 0.2, 0.1, 0.6, 0.1, 0.1, 0.3,
+      0.2, 0.4;
+  const double weight = 0.3;
+
+  const Eigen::Matrix<double, 4, Eigen::Dynamic> correct_incremented =
+      src1 + weight * matrix * src2;
+  const Eigen::Matrix<double, 4, Eigen::Dynamic> correct_product =
+      src1.array() * src2.array();
+  const EigenVectorXd correct_likelihoods =
+      (src1.transpose() * matrix * src2).diagonal();
+
+  const auto original_isa = PLVKernels::GetIsa();
+  for (const auto isa : PLVKernels::AvailableIsas()) {
+    PLVKernels::SetIsa(isa);
+    CHECK_EQ(PLVKernels::GetIsa(), isa);
+    Eigen::Matrix<double, 4, Eigen::Dynamic> dest = src1;
+    PLVKernels::IncrementWithWeightedEvolved(dest.data(), matrix.data(), src2.data(),
+                                             weight, pattern_count);
+    CHECK_LT((dest - correct_incremented).cwiseAbs().maxCoeff(), 1e-14);
+
+    const auto extrema = PLVKernels::Multiply(dest.data(), src1.data(), src2.data(),
+                                              pattern_count);
+    CHECK_LT((dest - correct_product).cwiseAbs().maxCoeff(), 1e-14);
+    CHECK(extrema.is_finite_);
+    CHECK_EQ(extrema.min_, correct_product.minCoeff());
+    CHECK_EQ(extrema.max_, correct_product.maxCoeff());
+    Eigen::Matrix<double, 4, Eigen::Dynamic> nan_src = src2;
+    nan_src(3, pattern_count - 1) = std::numeric_limits<double>::quiet_NaN();
+    CHECK_FALSE(PLVKernels::Multiply(dest.data(), src1.data(), nan_src.data(),
+                                     pattern_count)
+                    .is_finite_);
+    nan_src(3, pattern_count - 1) = std::numeric_limits<double>::infinity();
+    CHECK_FALSE(PLVKernels::Multiply(dest.data(), src1.data(), nan_src.data(),
+                                     pattern_count)
+                    .is_finite_);
+    // Only the last pattern is infinite.
+    CHECK(PLVKernels::Multiply(dest.data(), src1.data(), nan_src.data(),
+                               pattern_count - 1)
+              .is_finite_);
+
+    EigenVectorXd likelihoods(pattern_count);
+    PLVKernels::PerPatternLikelihoods(likelihoods.data(), src1.data(), matrix.data(),
+                                      src2.data(), pattern_count);
+    CHECK_LT((likelihoods - correct_likelihoods).cwiseAbs().maxCoeff(), 1e-14);
+  }
+  PLVKernels::SetIsa(original_isa);
+}
+
+TEST_CASE("PLVKernels: pattern chunks") {
+  // More than two chunks, with a partial chunk at the end.
+  const size_t pattern_count = 2 * PLVKernels::pattern_chunk_size + 37;
+  CHECK_EQ(PLVKernels::PatternChunkCount(pattern_count), 3);
+  CHECK_EQ(PLVKernels::PatternChunkCount(0), 0);
+  Eigen::Matrix<double, 4, Eigen::Dynamic> src1(4, pattern_count);
+  Eigen::Matrix<double, 4, Eigen::Dynamic> src2(4, pattern_count);
+  for (size_t i = 0; i < 4 * pattern_count; i++) {
+    src1.data()[i] = 0.25 + 0.5 * static_cast<double>((i * 7) % 11) / 11.;
+    src2.data()[i] = 0.1 + static_cast<double>((i * 5) % 13) / 13.;
+  }
+  src2(1, pattern_count - 5) = 1e-50;
+  Eigen::Matrix4d matrix;
+  matrix << 0.7, 0.1, 0.1, 0.1, 0.05, 0.8, 0.1, 0.05, 0.2, 0.1, 0.6, 0.1, 0.1, 0.3,
+      0.2, 0.4;
+  EigenVectorXd weights(pattern_count);
+  for (size_t pattern = 0; pattern < pattern_count; pattern++) {
+    weights(pattern) = static_cast<double>(1 + pattern % 3);
+  }
+
+  // Chunked results on the pool should be exactly those of running the chunks
+  // serially, and match the unchunked kernels up to rounding.
+  ThreadPool pool(3);
+  std::vector<Eigen::Matrix<double, 4, Eigen::Dynamic>> incremented(2, src1);
+  std::vector<Eigen::Matrix<double, 4, Eigen::Dynamic>> products(2, src1);
+  std::vector<EigenVectorXd> likelihoods(2, EigenVectorXd(pattern_count));
+  std::vector<PLVKernels::MultiplyExtrema> extrema(2);
+  DoubleVector sums(2);
+  for (size_t i = 0; i < 2; i++) {
+    ThreadPool *thread_pool = (i == 0) ? nullptr : &pool;
+    PLVKernels::IncrementWithWeightedEvolved(thread_pool, incremented[i].data(),
+                                             matrix.data(), src2.data(), 0.3,
+                                             pattern_count);
+    extrema[i] = PLVKernels::Multiply(thread_pool, products[i].data(), src1.data(),
+                                      src2.data(), pattern_count);
+    PLVKernels::PerPatternLikelihoods(thread_pool, likelihoods[i].data(), src1.data(),
+                                      matrix.data(), src2.data(), pattern_count);
+    sums[i] = PLVKernels::WeightedSum(thread_pool, likelihoods[i].data(),
+                                      weights.data(), pattern_count);
+  }
+  CHECK_EQ((incremented[0] - incremented[1]).cwiseAbs().maxCoeff(), 0.);
+  CHECK_EQ((products[0] - products[1]).cwiseAbs().maxCoeff(), 0.);
+  CHECK_EQ((likelihoods[0] - likelihoods[1]).cwiseAbs().maxCoeff(), 0.);
+  CHECK_EQ(sums[0], sums[1]);
+  CHECK_LT((incremented[1] - (src1 + 0.3 * matrix * src2)).cwiseAbs().maxCoeff(),
+           1e-14);
+  CHECK_EQ(extrema[1].min_, products[1].minCoeff());
+  CHECK_EQ(extrema[1].max_, products[1].maxCoeff());
+  CHECK(extrema[1].is_finite_);
+  CHECK_LT(fabs(sums[1] - likelihoods[1].dot(weights)), 1e-9);
+
+  const auto src_extrema = PLVKernels::Extrema(&pool, src2.data(), pattern_count);
+  CHECK_EQ(src_extrema.min_, src2.minCoeff());
+  CHECK_EQ(src_extrema.max_, src2.maxCoeff());
+  CHECK(src_extrema.is_finite_);
+  src2(0, 0) = std::numeric_limits<double>::infinity();
+  CHECK_FALSE(PLVKernels::Extrema(&pool, src2.data(), pattern_count).is_finite_);
+  const Eigen::Matrix<double, 4, Eigen::Dynamic> doubled = 2. * src1;
+  PLVKernels::Scale(&pool, src1.data(), 2., pattern_count);
+  CHECK_EQ((src1 - doubled).cwiseAbs().maxCoeff(), 0.);
+}
+
+TEST_CASE("PLVKernels: tips") {
+  // All 16 codes, over more than a chunk and an odd number of patterns.
+  const size_t pattern_count = PLVKernels::pattern_chunk_size + 37;
+  std::vector<uint8_t> tip_codes((pattern_count + 1) / 2, 0);
+  Eigen::Matrix<double, 4, Eigen::Dynamic> tip(4, pattern_count);
+  Eigen::Matrix<double, 4, Eigen::Dynamic> src1(4, pattern_count);
+  for (size_t pattern = 0; pattern < pattern_count; pattern++) {
+    const uint8_t code = (pattern * 7) % 16;
+    tip_codes[pattern / 2] |= static_cast<uint8_t>(code << (4 * (pattern % 2)));
+    for (size_t state = 0; state < 4; state++) {
+      tip(state, pattern) = (code >> state) & 1;
+      src1(state, pattern) = 0.25 + 0.5 * static_cast<double>((pattern + state) % 11);
+    }
+  }
+  Eigen::Matrix4d matrix;
+  matrix << 0.7, 0.1, 0.1, 0.1, 0.05, 0.8, 0.1, 0.05, 0.2, 0.1, 0.6, 0.1, 0.1, 0.3,
+      0.2, 0.4;
+
+  ThreadPool pool(3);
+  const auto original_isa = PLVKernels::GetIsa();
+  for (const auto isa : PLVKernels::AvailableIsas()) {
+    PLVKernels::SetIsa(isa);
+    // The generic tip kernels should match the generic kernels exactly.
+    const double tolerance = (isa == PLVKernels::Isa::Generic) ? 0. : 1e-14;
+    Eigen::Matrix<double, 4, Eigen::Dynamic> correct_incremented = src1;
+    PLVKernels::IncrementWithWeightedEvolved(correct_incremented.data(), matrix.data(),
+                                             tip.data(), 0.3, pattern_count);
+    EigenVectorXd correct_likelihoods(pattern_count);
+    PLVKernels::PerPatternLikelihoods(correct_likelihoods.data(), src1.data(),
+                                      matrix.data(), tip.data(), pattern_count);
+    for (ThreadPool *thread_pool : {static_cast<ThreadPool *>(nullptr), &pool}) {
+      Eigen::Matrix<double, 4, Eigen::Dynamic> incremented = src1;
+      PLVKernels::IncrementWithWeightedEvolvedTip(thread_pool, incremented.data(),
+                                                  matrix.data(), tip_codes.data(), 0.3,
+                                                  pattern_count);
+      CHECK_LE((incremented - correct_incremented).cwiseAbs().maxCoeff(), tolerance);
+      EigenVectorXd likelihoods(pattern_count);
+      PLVKernels::PerPatternLikelihoodsTip(thread_pool, likelihoods.data(),
+                                           src1.data(), matrix.data(),
+                                           tip_codes.data(), pattern_count);
+      CHECK_LE((likelihoods - correct_likelihoods).cwiseAbs().maxCoeff(),
+               tolerance * correct_likelihoods.maxCoeff());
+    }
+    const Eigen::Matrix<float, 4, Eigen::Dynamic> float_src1 = src1.cast<float>();
+    EigenVectorXd float_likelihoods(pattern_count);
+    PLVKernels::PerPatternLikelihoodsTip(float_likelihoods.data(), float_src1.data(),
+                                         matrix.data(), tip_codes.data(),
+                                         pattern_count);
+    CHECK_LT((float_likelihoods - correct_likelihoods).cwiseAbs().maxCoeff(), 1e-5);
+  }
+  PLVKernels::SetIsa(original_isa);
+}
+
+TEST_CASE("PLVKernels: single precision storage") {
+  // Float PLVs should give the double results up to float rounding of the stored
+  // entries.
+  const size_t pattern_count = PLVKernels::pattern_chunk_size + 37;
+  Eigen::Matrix<double, 4, Eigen::Dynamic> src1(4, pattern_count);
+  Eigen::Matrix<double, 4, Eigen::Dynamic> src2(4, pattern_count);
+  for (size_t i = 0; i < 4 * pattern_count; i++) {
+    src1.data()[i] = 0.25 + 0.5 * static_cast<double>((i * 7) % 11) / 11.;
+    src2.data()[i] = 0.1 + static_cast<double>((i * 5) % 13) / 13.;
+  }
+  const Eigen::Matrix<float, 4, Eigen::Dynamic> float_src1 = src1.cast<float>();
+  const Eigen::Matrix<float, 4, Eigen::Dynamic> float_src2 = src2.cast<float>();
+  Eigen::Matrix4d matrix;
+  matrix << 0.7, 0.1, 0.1, 0.1, 0.05, 0.8, 0.1, 0.05, 0.2, 0.1, 0.6, 0.1, 0.1, 0.3,
+      0.2, 0.4;
+  const Eigen::Matrix<double, 4, Eigen::Dynamic> correct_incremented =
+      src1 + 0.3 * matrix * src2;
+  const Eigen::Matrix<double, 4, Eigen::Dynamic> correct_product =
+      src1.array() * src2.array();
+  const EigenVectorXd correct_likelihoods =
+      (src1.transpose() * matrix * src2).diagonal();
+
+  ThreadPool pool(2);
+  const auto original_isa = PLVKernels::GetIsa();
+  for (const auto isa : PLVKernels::AvailableIsas()) {
+    PLVKernels::SetIsa(isa);
+    Eigen::Matrix<float, 4, Eigen::Dynamic> dest = float_src1;
+    PLVKernels::IncrementWithWeightedEvolved(&pool, dest.data(), matrix.data(),
+                                             float_src2.data(), 0.3, pattern_count);
+    CHECK_LT((dest.cast<double>() - correct_incremented).cwiseAbs().maxCoeff(), 1e-6);
+    const auto extrema = PLVKernels::Multiply(&pool, dest.data(), float_src1.data(),
+                                              float_src2.data(), pattern_count);
+    CHECK_LT((dest.cast<double>() - correct_product).cwiseAbs().maxCoeff(), 1e-6);
+    CHECK_LT(fabs(extrema.min_ - correct_product.minCoeff()), 1e-6);
+    CHECK_LT(fabs(extrema.max_ - correct_product.maxCoeff()), 1e-6);
+    EigenVectorXd likelihoods(pattern_count);
+    PLVKernels::PerPatternLikelihoods(&pool, likelihoods.data(), float_src1.data(),
+                                      matrix.data(), float_src2.data(), pattern_count);
+    CHECK_LT((likelihoods - correct_likelihoods).cwiseAbs().maxCoeff(), 1e-6);
+  }
+  PLVKernels::SetIsa(original_isa);
+}
+#endif  // DOCTEST_LIBRARY_INCLUDED
@@ -5,8 +5,8 @@
 
 // ** Resize
 
-template <class PVTypeEnum, class DAGElementId>
-void PartialVectorHandler<PVTypeEnum, DAGElementId>::Resize(
+template <class PVTypeEnum, class DAGElementId, class TScalar>
+void PartialVectorHandler<PVTypeEnum, DAGElementId, TScalar>::Resize(
     const size_t new_element_count, const size_t new_element_alloc,
     std::optional<size_t> new_element_spare) {
   const size_t old_pv_count = GetPVCount();
@@ -31,15 +31,15 @@ void PartialVectorHandler<PVTypeEnum, DAGElementId>::Resize(
   }
 }
 
-template <class PVTypeEnum, class DAGElementId>
-void PartialVectorHandler<PVTypeEnum, DAGElementId>::Reindex(
+template <class PVTypeEnum, class DAGElementId, class TScalar>
+void PartialVectorHandler<PVTypeEnum, DAGElementId, TScalar>::Reindex(
     const Reindexer pv_reindexer) {
   Reindexer::ReindexInPlace(pvs_, pv_reindexer, GetPVCount(), GetPV(GetPVCount()),
                             GetPV(GetPVCount() + 1));
 }
 
-template <class PVTypeEnum, class DAGElementId>
-Reindexer PartialVectorHandler<PVTypeEnum, DAGElementId>::BuildPVReindexer(
+template <class PVTypeEnum, class DAGElementId, class TScalar>
+Reindexer PartialVectorHandler<PVTypeEnum, DAGElementId, TScalar>::BuildPVReindexer(
     const Reindexer& element_reindexer, const size_t old_element_count,
     const size_t new_element_count) {
   Assert(old_element_count <= new_element_count,
@@ -70,7 +70,16 @@ Reindexer PartialVectorHandler<PVTypeEnum, DAGElementId>::BuildPVReindexer(
 }
 
 // ** Explicit Instantiation
-template class PartialVectorHandler<PLVTypeEnum, NodeId>;
-template class PartialVectorHandler<PLVTypeEnum, EdgeId>;
-template class PartialVectorHandler<PSVTypeEnum, NodeId>;
-template class PartialVectorHandler<PSVTypeEnum, EdgeId>;
+template class PartialVectorHandler<PLVTypeEnum, NodeId, PLVScalar>;
+template class PartialVectorHandler<PLVTypeEnum, EdgeId, PLVScalar>;
+template class PartialVectorHandler<PSVTypeEnum, NodeId, double>;
+template class PartialVectorHandler<PSVTypeEnum, EdgeId, double>;
+// The element-wise operations are for floating point PVs, so Fitch PVs only get these.
+template void PartialVectorHandler<PSVTypeEnum, EdgeId, uint64_t>::Resize(
+    const size_t, const size_t, std::optional<size_t>);
+template void PartialVectorHandler<PSVTypeEnum, EdgeId, uint64_t>::Reindex(
+    const Reindexer);
+template Reindexer
+PartialVectorHandler<PSVTypeEnum, EdgeId, uint64_t>::BuildPVReindexer(const Reindexer &,
+                                                                      const size_t,
+                                                                      const size_t);
@@ -105,12 +105,15 @@ using PSVTypeEnum = PartialVectorType::PSVTypeEnum;
 
 // PVTypeEnum determines which PV types need to be stored on each element of the
 // PVHandler (e.g. P-PVs, Q-PVs, R-PVs). DAGElementId decides whether indexing PVs
-// according to DAG's nodes or edges.
-template <class PVTypeEnum, class DAGElementId>
+// according to DAG's nodes or edges. TScalar is the type the PVs are stored as.
+template <class PVTypeEnum, class DAGElementId, class TScalar>
 class PartialVectorHandler {
  public:
   using TypeEnum = PVTypeEnum;
   using PVType = typename TypeEnum::Type;
+  using Scalar = TScalar;
+  using PVRef = typename MmappedNucleotidePV<TScalar>::PVRef;
+  using PVRefVector = typename MmappedNucleotidePV<TScalar>::PVRefVector;
 
   PartialVectorHandler(const std::string &mmap_file_path, const size_t elem_count,
                        const size_t pattern_count, const double resizing_factor = 2.0)
@@ -159,35 +162,51 @@ class PartialVectorHandler {
   // ** Access
 
   // Get vector of all Partial Vectors.
-  NucleotidePLVRefVector &GetPVs() { return pvs_; }
-  const NucleotidePLVRefVector &GetPVs() const { return pvs_; }
+  PVRefVector &GetPVs() { return pvs_; }
+  const PVRefVector &GetPVs() const { return pvs_; }
   // Get PV by absolute index from the vector of Partial Vectors.
-  NucleotidePLVRef &GetPV(const PVId pv_id) { return pvs_.at(pv_id.value_); }
-  const NucleotidePLVRef &GetPV(const PVId pv_id) const {
+  PVRef &GetPV(const PVId pv_id) { return pvs_.at(pv_id.value_); }
+  const PVRef &GetPV(const PVId pv_id) const {
     return pvs_.at(pv_id.value_);
   }
-  NucleotidePLVRef &operator()(const PVId pv_id) { return GetPV(pv_id); }
-  const NucleotidePLVRef &operator()(const PVId pv_id) const { return GetPV(pv_id); }
+  PVRef &operator()(const PVId pv_id) { return GetPV(pv_id); }
+  const PVRef &operator()(const PVId pv_id) const { return GetPV(pv_id); }
   // Get PV by PV type and node index from the vector of Partial Vectors.
-  NucleotidePLVRef &GetPV(const PVType pv_type, const DAGElementId elem_id) {
+  PVRef &GetPV(const PVType pv_type, const DAGElementId elem_id) {
     return GetPV(GetPVIndex(pv_type, elem_id));
   }
-  const NucleotidePLVRef &GetPV(const PVType pv_type,
+  const PVRef &GetPV(const PVType pv_type,
                                 const DAGElementId elem_id) const {
     return GetPV(GetPVIndex(pv_type, elem_id));
   }
-  NucleotidePLVRef &operator()(const PVType pv_type, const DAGElementId elem_id) {
+  PVRef &operator()(const PVType pv_type, const DAGElementId elem_id) {
     return GetPV(GetPVIndex(pv_type, elem_id));
   }
-  const NucleotidePLVRef &operator()(const PVType pv_type,
+  const PVRef &operator()(const PVType pv_type,
                                      const DAGElementId elem_id) const {
     return GetPV(GetPVIndex(pv_type, elem_id));
   }
+  // Give the memory behind a PV back to the operating system, leaving its contents
+  // undefined until it is next written.
+  void ReleasePVMemory(const PVId pv_id) {
+    mmapped_master_pvs_.ReleaseMemory(GetPV(pv_id));
+  }
+  // The same for the pv_count PVs starting at pv_id.
+  void ReleasePVMemory(const PVId pv_id, const size_t pv_count) {
+    if (pv_count > 0) {
+      mmapped_master_pvs_.ReleaseMemory(GetPV(pv_id), pv_count);
+    }
+  }
+  // The number of bytes that ReleasePVMemory gives back, which is less than the size
+  // of the PV unless it covers whole pages.
+  size_t ReleasablePVByteCount(const PVId pv_id) const {
+    return mmapped_master_pvs_.ReleasableByteCount(GetPV(pv_id));
+  }
   // Get Spare PV by index from the vector of Partial Vectors.
-  NucleotidePLVRef &GetSparePV(const PVId pv_id) {
+  PVRef &GetSparePV(const PVId pv_id) {
     return GetPV(GetSparePVIndex(pv_id));
   }
-  const NucleotidePLVRef &GetSparePV(const PVId pv_id) const {
+  const PVRef &GetSparePV(const PVId pv_id) const {
     return GetPV(GetSparePVIndex(pv_id));
   }
 
@@ -243,8 +262,8 @@ class PartialVectorHandler {
     const auto &src_pv_a = GetPV(src_pvid_a);
     return ApplyUnaryOperation(dest_pv, src_pv_a, una_fn);
   }
-  static void ApplyUnaryOperation(NucleotidePLVRef &dest_pv,
-                                  const NucleotidePLVRef &src_pv_a,
+  static void ApplyUnaryOperation(PVRef &dest_pv,
+                                  const PVRef &src_pv_a,
                                   UnaryFunction una_fn) {
     for (int i = 0; i < src_pv_a.rows(); i++) {
       for (int j = 0; j < src_pv_a.cols(); j++) {
@@ -268,9 +287,9 @@ class PartialVectorHandler {
     const auto &src_pv_b = GetPV(src_pvid_b);
     return ApplyBinaryOperation(dest_pv, src_pv_a, src_pv_b, bin_fn);
   }
-  static void ApplyBinaryOperation(NucleotidePLVRef &dest_pv,
-                                   const NucleotidePLVRef &src_pv_a,
-                                   const NucleotidePLVRef &src_pv_b,
+  static void ApplyBinaryOperation(PVRef &dest_pv,
+                                   const PVRef &src_pv_a,
+                                   const PVRef &src_pv_b,
                                    BinaryFunction bin_fn) {
     for (int i = 0; i < src_pv_a.rows(); i++) {
       for (int j = 0; j < src_pv_b.cols(); j++) {
@@ -306,8 +325,8 @@ class PartialVectorHandler {
   }
 
   // Find the maximum element-wise absolute difference between two PVs.
-  static double MaxDifference(const NucleotidePLVRef &pv_a,
-                              const NucleotidePLVRef &pv_b) {
+  static double MaxDifference(const PVRef &pv_a,
+                              const PVRef &pv_b) {
     double max_diff = 0;
     for (int i = 0; i < pv_a.rows(); i++) {
       for (int j = 0; j < pv_a.cols(); j++) {
@@ -348,7 +367,7 @@ class PartialVectorHandler {
     out << ToString(GetPV(pv_type, elem_id));
     return out.str();
   }
-  std::string ToString(const NucleotidePLVRef &pv) const {
+  std::string ToString(const PVRef &pv) const {
     std::stringstream out;
     for (int i = 0; i < pv.rows(); i++) {
       out << "[";
@@ -416,7 +435,7 @@ class PartialVectorHandler {
   std::string mmap_file_path_;
   // Master PV: Large data block of virtual memory for Partial Likelihood Vectors.
   // Subdivided into sections for pvs_.
-  MmappedNucleotidePLV mmapped_master_pvs_;
+  MmappedNucleotidePV<TScalar> mmapped_master_pvs_;
   // Partial Vectors.
   // Divides mmapped_master_pvs_.
   // For example, GP PLVs are divided as follows:
@@ -426,13 +445,13 @@ class PartialVectorHandler {
   // - [3*num_nodes, 4*num_nodes): rhat(s_right) = rhat(s_left).
   // - [4*num_nodes, 5*num_nodes): r(s_right).
   // - [5*num_nodes, 6*num_nodes): r(s_left).
-  NucleotidePLVRefVector pvs_;
+  PVRefVector pvs_;
 };
 
 // PLVHandler: Partial Likelihood Vector Handler
 template <class DAGElementId>
-class PLVHandler
-    : public PartialVectorHandler<PartialVectorType::PLVTypeEnum, DAGElementId> {
+class PLVHandler : public PartialVectorHandler<PartialVectorType::PLVTypeEnum,
+                                               DAGElementId, PLVScalar> {
  public:
   using PLVType = PartialVectorType::PLVType;
   using PLVTypeEnum = PartialVectorType::PLVTypeEnum;
@@ -451,7 +470,7 @@ class PLVHandler
 
   PLVHandler(const std::string &mmap_file_path, const size_t elem_count,
              const size_t pattern_count, const double resizing_factor = 2.0)
-      : PartialVectorHandler<PLVTypeEnum, DAGElementId>(
+      : PartialVectorHandler<PLVTypeEnum, DAGElementId, PLVScalar>(
             mmap_file_path, elem_count, pattern_count, resizing_factor) {}
 
   PVIdSet BuildPVIdSet(const DAGElementId elem_id) {
@@ -471,9 +490,10 @@ using PLVNodeHandler = PLVHandler<NodeId>;
 using PLVEdgeHandler = PLVHandler<EdgeId>;
 
 // PSVHandler: Partial Sankoff Vector Handler
+// Sankoff costs are always stored as doubles.
 template <class DAGElementId>
-class PSVHandler
-    : public PartialVectorHandler<PartialVectorType::PSVTypeEnum, DAGElementId> {
+class PSVHandler : public PartialVectorHandler<PartialVectorType::PSVTypeEnum,
+                                               DAGElementId, double> {
  public:
   using PSVType = PartialVectorType::PSVType;
   using PSVTypeEnum = PartialVectorType::PSVTypeEnum;
@@ -489,7 +509,7 @@ class PSVHandler
 
   PSVHandler(const std::string &mmap_file_path, const size_t elem_count,
              const size_t pattern_count, const double resizing_factor = 2.0)
-      : PartialVectorHandler<PSVTypeEnum, DAGElementId>(
+      : PartialVectorHandler<PSVTypeEnum, DAGElementId, double>(
             mmap_file_path, elem_count, pattern_count, resizing_factor) {}
 
   PVIdSet BuildPVIdSet(const DAGElementId elem_id) {
@@ -505,6 +525,24 @@ class PSVHandler
 using PSVNodeHandler = PSVHandler<NodeId>;
 using PSVEdgeHandler = PSVHandler<EdgeId>;
 
+// FitchHandler: Fitch Partial Vector Handler
+// The partials of a PSVHandler with unit costs, as the bit planes of FitchKernels. In
+// place of patterns, each PV has a column for every 64 patterns and one for the cost.
+template <class DAGElementId>
+class FitchHandler : public PartialVectorHandler<PartialVectorType::PSVTypeEnum,
+                                                 DAGElementId, uint64_t> {
+ public:
+  using PSVType = PartialVectorType::PSVType;
+  using PSVTypeEnum = PartialVectorType::PSVTypeEnum;
+
+  FitchHandler(const std::string &mmap_file_path, const size_t elem_count,
+               const size_t column_count, const double resizing_factor = 2.0)
+      : PartialVectorHandler<PSVTypeEnum, DAGElementId, uint64_t>(
+            mmap_file_path, elem_count, column_count, resizing_factor) {}
+};
+
+using FitchEdgeHandler = FitchHandler<EdgeId>;
+
 #ifdef DOCTEST_LIBRARY_INCLUDED
 
 // Check that PLV iterator iterates over all PLVs exactly once.
@@ -163,6 +163,13 @@ PYBIND11_MODULE(bito, m) {
           [](const RootedTree &self) { return self.Topology()->BuildVectorOfPCSPs(); },
           "Build vector of all PCSP edge bitsets for all edges in topology.");
 
+  const char export_tree_collection_docstring[] = R"raw(
+          Write the tree collection to a compact binary file, along with optional tree weights.
+
+          Loading this file with ``load`` is much faster than parsing Newick, so it is worth exporting a tree sample that
+          is used again and again.
+      )raw";
+
   // CLASS
   // RootedTreeCollection
   py::class_<RootedTreeCollection>(m, "RootedTreeCollection", R"raw(
@@ -183,6 +190,16 @@ PYBIND11_MODULE(bito, m) {
            py::arg("fraction"))
       .def("newick", &RootedTreeCollection::Newick,
            "Get the current set of trees as a big Newick string.")
+      .def("export", &RootedTreeCollection::Export, export_tree_collection_docstring,
+           py::arg("out_path"), py::arg("weights") = DoubleVector())
+      .def_static("load", &RootedTreeCollection::Load,
+                  "Load a tree collection written by ``export``, building the trees on "
+                  "``thread_count`` threads.",
+                  py::arg("path"), py::arg("thread_count") = 1)
+      .def_static("load_weights", &RootedTreeCollection::LoadWeights,
+                  "Load the tree weights written by ``export``, which are empty if "
+                  "there were none.",
+                  py::arg("path"))
       .def_readwrite("trees", &RootedTreeCollection::trees_);
 
   // CLASS
@@ -223,6 +240,16 @@ PYBIND11_MODULE(bito, m) {
            py::arg("fraction"))
       .def("newick", &UnrootedTreeCollection::Newick,
            "Get the current set of trees as a big Newick string.")
+      .def("export", &UnrootedTreeCollection::Export, export_tree_collection_docstring,
+           py::arg("out_path"), py::arg("weights") = DoubleVector())
+      .def_static("load", &UnrootedTreeCollection::Load,
+                  "Load a tree collection written by ``export``, building the trees on "
+                  "``thread_count`` threads.",
+                  py::arg("path"), py::arg("thread_count") = 1)
+      .def_static("load_weights", &UnrootedTreeCollection::LoadWeights,
+                  "Load the tree weights written by ``export``, which are empty if "
+                  "there were none.",
+                  py::arg("path"))
       .def_readwrite("trees", &UnrootedTreeCollection::trees_);
 
   // PhyloGradient
@@ -264,6 +291,11 @@ PYBIND11_MODULE(bito, m) {
             parameter matrices, and it's up to the user to set those model parameters after calling
             this function.
             Note that this tree count need not be the same as the number of threads (and is typically bigger).
+
+            ``tree_batch_size`` sets how many trees sharing model parameters are evaluated together in each
+            BEAGLE instance when computing log likelihoods of unrooted trees. Batching saves BEAGLE call
+            overhead for small trees and short alignments, at the cost of more BEAGLE buffers. Rooted
+            instances don't batch, so for them it must be 1.
            )raw";
 
   const char process_loaded_trees_docstring[] = R"raw(
@@ -273,6 +305,22 @@ PYBIND11_MODULE(bito, m) {
           parameters.
       )raw";
 
+  const char stream_tree_file_docstring[] = R"raw(
+          Count the topologies of a tree file without loading the trees, then process them as process_loaded_trees does.
+
+          Trees are parsed one at a time, so memory use depends on the number of unique topologies rather than the
+          number of trees. The first burn_in_count trees are dropped, and then every thinning-th tree is kept. The
+          tree collection of the instance is left empty.
+      )raw";
+
+  const char sample_indexer_representations_docstring[] = R"raw(
+          Sample topologies from the SBN on thread_count threads, without building trees.
+
+          Returns an array with a row for each sample holding its rooted indexer representation: the index of its
+          rootsplit and then those of its PCSPs. Pass this array to load_trees_from_indexer_representations to get
+          the trees, e.g. for likelihood computation.
+      )raw";
+
   const char read_sbn_parameters_from_csv_docstring[] = R"raw(
         Read SBN parameters from a CSV mapping a string representation of the GPCSP to its probability in linear (not
         log) space.
@@ -306,7 +354,8 @@ PYBIND11_MODULE(bito, m) {
           "prepare_for_phylo_likelihood", &RootedSBNInstance::PrepareForPhyloLikelihood,
           prepare_for_phylo_likelihood_docstring, py::arg("model_specification"),
           py::arg("thread_count"), py::arg("beagle_flags") = std::vector<BeagleFlags>(),
-          py::arg("use_tip_states") = true, py::arg("tree_count_option") = std::nullopt)
+          py::arg("use_tip_states") = true, py::arg("tree_count_option") = std::nullopt,
+          py::arg("tree_batch_size") = 1)
       .def("resize_phylo_model_params", &RootedSBNInstance::ResizePhyloModelParams,
            "Resize phylo_model_params.", py::arg("tree_count_option") = std::nullopt)
       .def("load_duplicates_of_first_tree",
@@ -341,8 +390,23 @@ PYBIND11_MODULE(bito, m) {
            read_sbn_parameters_from_csv_docstring)
       .def("calculate_sbn_probabilities", &RootedSBNInstance::CalculateSBNProbabilities,
            R"raw(Calculate the SBN probabilities of the currently loaded trees.)raw")
+      .def("sample_indexer_representations",
+           &RootedSBNInstance::SampleIndexerRepresentations,
+           sample_indexer_representations_docstring, py::arg("count"),
+           py::arg("thread_count") = 1)
       // ** END DUPLICATED CODE BLOCK between this and UnrootedSBNInstance
 
+      .def("load_trees_from_indexer_representations",
+           &RootedSBNInstance::LoadTreesFromIndexerRepresentations,
+           "Replace the stored trees with the trees of sampled indexer "
+           "representations, with unit branch lengths.",
+           py::arg("representations"))
+      .def("topology_gradients", &RootedSBNInstance::TopologyGradients,
+           R"raw(Calculate gradients of SBN parameters for a batch of rooted topologies
+           given by their indexer representations, as from
+           sample_indexer_representations.)raw",
+           py::arg("representations"), py::arg("log_f"), py::arg("use_vimco") = true,
+           py::arg("thread_count") = 1)
       .def("unconditional_subsplit_probabilities_to_csv",
            &RootedSBNInstance::UnconditionalSubsplitProbabilitiesToCSV,
            "Write out the overall probability of seeing each subsplit when we sample a "
@@ -374,9 +438,17 @@ PYBIND11_MODULE(bito, m) {
 
       // ** I/O
       .def("read_newick_file", &RootedSBNInstance::ReadNewickFile,
-           "Read trees from a Newick file.")
+           "Read trees from a Newick file.",
+           py::arg("fname"), py::arg("thread_count") = 1)
       .def("read_nexus_file", &RootedSBNInstance::ReadNexusFile,
-           "Read trees from a Nexus file.")
+           "Read trees from a Nexus file.",
+           py::arg("fname"), py::arg("thread_count") = 1)
+      .def("stream_newick_file", &RootedSBNInstance::StreamNewickFile,
+           stream_tree_file_docstring, py::arg("fname"), py::arg("burn_in_count") = 0,
+           py::arg("thinning") = 1)
+      .def("stream_nexus_file", &RootedSBNInstance::StreamNexusFile,
+           stream_tree_file_docstring, py::arg("fname"), py::arg("burn_in_count") = 0,
+           py::arg("thinning") = 1)
 
       // ** Member variables
       .def_readwrite("tree_collection", &RootedSBNInstance::tree_collection_);
@@ -416,6 +488,18 @@ PYBIND11_MODULE(bito, m) {
                  std::tuple(py::arg("flag_names_and_set_and_values"),
                             py::arg("use_defaults") = true)));
 
+  // EM acceleration
+  py::enum_<SBNProbability::EMAcceleration>(m, "EMAcceleration",
+                                            "How to speed up SBN-EM.")
+      .value("none", SBNProbability::EMAcceleration::None)
+      .value("squarem", SBNProbability::EMAcceleration::SQUAREM)
+      .value("anderson", SBNProbability::EMAcceleration::Anderson);
+  py::class_<SBNProbability::EMTrace>(m, "EMTrace",
+                                      R"raw(What a run of EM did, by iteration.)raw")
+      .def_readonly("score_history", &SBNProbability::EMTrace::score_history_)
+      .def_readonly("seconds", &SBNProbability::EMTrace::seconds_)
+      .def_readonly("em_step_counts", &SBNProbability::EMTrace::em_step_counts_);
+
   // CLASS
   // UnrootedSBNInstance
   py::class_<PreUnrootedSBNInstance>(m, "PreUnrootedSBNInstance");
@@ -433,7 +517,8 @@ PYBIND11_MODULE(bito, m) {
           &UnrootedSBNInstance::PrepareForPhyloLikelihood,
           prepare_for_phylo_likelihood_docstring, py::arg("model_specification"),
           py::arg("thread_count"), py::arg("beagle_flags") = std::vector<BeagleFlags>(),
-          py::arg("use_tip_states") = true, py::arg("tree_count_option") = std::nullopt)
+          py::arg("use_tip_states") = true, py::arg("tree_count_option") = std::nullopt,
+          py::arg("tree_batch_size") = 1)
       .def("resize_phylo_model_params", &UnrootedSBNInstance::ResizePhyloModelParams,
            "Resize phylo_model_params.", py::arg("tree_count_option") = std::nullopt)
       .def("load_duplicates_of_first_tree",
@@ -470,6 +555,10 @@ PYBIND11_MODULE(bito, m) {
       .def("calculate_sbn_probabilities",
            &UnrootedSBNInstance::CalculateSBNProbabilities,
            R"raw(Calculate the SBN probabilities of the currently loaded trees.)raw")
+      .def("sample_indexer_representations",
+           &UnrootedSBNInstance::SampleIndexerRepresentations,
+           sample_indexer_representations_docstring, py::arg("count"),
+           py::arg("thread_count") = 1)
       // ** END DUPLICATED CODE BLOCK between this and RootedSBNInstance
 
       .def("train_expectation_maximization",
@@ -483,10 +572,34 @@ PYBIND11_MODULE(bito, m) {
            Here we can supply alpha, the absolute maxiumum number of iterations, and
            a score-based termination criterion for EM. EM will stop if the scaled
            score increase is less than the provided ``score_epsilon``.
+
+           If ``packed``, EM runs over a packed copy of the trees on ``thread_count``
+           threads, which gives the same results much faster for large tree samples.
+
+           With an ``acceleration`` of ``squarem`` or ``anderson``, EM extrapolates
+           from its recent steps, which can take fewer EM steps to converge. An
+           iteration then takes several EM steps, and ``max_iter`` still bounds the
+           number of EM steps. The scores, timings and EM step counts of each
+           iteration are in ``em_trace``.
            )raw",
-           py::arg("alpha"), py::arg("max_iter"), py::arg("score_epsilon") = 0.)
+           py::arg("alpha"), py::arg("max_iter"), py::arg("score_epsilon") = 0.,
+           py::arg("packed") = false, py::arg("thread_count") = 1,
+           py::arg("acceleration") = SBNProbability::EMAcceleration::None)
+      .def("em_trace", &UnrootedSBNInstance::GetEMTrace,
+           "The trace of the last run of EM.")
       .def("sample_trees", &UnrootedSBNInstance::SampleTrees,
            "Sample trees from the SBN and store them internally.", py::arg("count"))
+      .def("load_trees_from_indexer_representations",
+           &UnrootedSBNInstance::LoadTreesFromIndexerRepresentations,
+           "Replace the stored trees with the unrooted trees of sampled indexer "
+           "representations, with zero branch lengths.",
+           py::arg("representations"))
+      .def("unrooted_indexer_representations_of",
+           &UnrootedSBNInstance::UnrootedIndexerRepresentationsOf,
+           "Make the indexer representations of every rooting of each of a batch of "
+           "sampled indexer representations, as make_indexer_representations would "
+           "for the loaded trees, without building the trees.",
+           py::arg("representations"), py::arg("thread_count") = 1)
       .def("make_indexer_representations",
            &UnrootedSBNInstance::MakeIndexerRepresentations,
            R"raw(
@@ -496,7 +609,8 @@ PYBIND11_MODULE(bito, m) {
 
             Note: any rootsplit or a PCSP that is not contained in the subsplit support is given an index equal
             to the length of ``sbn_parameters``. No warning is given.
-           )raw")
+           )raw",
+           py::arg("thread_count") = 1)
       .def("make_psp_indexer_representations",
            &UnrootedSBNInstance::MakePSPIndexerRepresentations, R"raw(
             Make the PSP indexer representation of each currently stored tree.
@@ -518,15 +632,36 @@ PYBIND11_MODULE(bito, m) {
                std::optional<PhyloFlags>)>(&UnrootedSBNInstance::PhyloGradients),
            "Calculate gradients of parameters for the current set of trees.",
            py::arg("phylo_flags") = std::nullopt)
-      .def("topology_gradients", &UnrootedSBNInstance::TopologyGradients,
+      .def("topology_gradients",
+           static_cast<EigenVectorXd (UnrootedSBNInstance::*)(EigenVectorXdRef, bool,
+                                                               size_t)>(
+               &UnrootedSBNInstance::TopologyGradients),
            R"raw(Calculate gradients of SBN parameters for the current set of trees.
-           Should be called after sampling trees and setting branch lengths.)raw")
+           Should be called after sampling trees and setting branch lengths.)raw",
+           py::arg("log_f"), py::arg("use_vimco") = true, py::arg("thread_count") = 1)
+      .def("topology_gradients",
+           static_cast<EigenVectorXd (UnrootedSBNInstance::*)(
+               const std::vector<UnrootedIndexerRepresentation> &, EigenVectorXdRef,
+               bool, size_t) const>(&UnrootedSBNInstance::TopologyGradients),
+           R"raw(Calculate gradients of SBN parameters for a batch of topologies
+           given by their indexer representations, as from
+           make_indexer_representations.)raw",
+           py::arg("indexer_representations"), py::arg("log_f"),
+           py::arg("use_vimco") = true, py::arg("thread_count") = 1)
 
       // ** I/O
       .def("read_newick_file", &UnrootedSBNInstance::ReadNewickFile,
-           "Read trees from a Newick file.")
+           "Read trees from a Newick file.",
+           py::arg("fname"), py::arg("thread_count") = 1)
       .def("read_nexus_file", &UnrootedSBNInstance::ReadNexusFile,
-           "Read trees from a Nexus file.")
+           "Read trees from a Nexus file.",
+           py::arg("fname"), py::arg("thread_count") = 1)
+      .def("stream_newick_file", &UnrootedSBNInstance::StreamNewickFile,
+           stream_tree_file_docstring, py::arg("fname"), py::arg("burn_in_count") = 0,
+           py::arg("thinning") = 1)
+      .def("stream_nexus_file", &UnrootedSBNInstance::StreamNexusFile,
+           stream_tree_file_docstring, py::arg("fname"), py::arg("burn_in_count") = 0,
+           py::arg("thinning") = 1)
 
       // ** Member variables
       .def_readonly("psp_indexer", &UnrootedSBNInstance::psp_indexer_)
@@ -619,13 +754,17 @@ PYBIND11_MODULE(bito, m) {
 
       // ** I/O
       .def("read_newick_file", &GPInstance::ReadNewickFile,
-           "Read trees from a Newick file.")
+           "Read trees from a Newick file.",
+           py::arg("fname"), py::arg("thread_count") = 1)
       .def("read_newick_file_gz", &GPInstance::ReadNewickFileGZ,
-           "Read trees from a gzip-ed Newick file.")
+           "Read trees from a gzip-ed Newick file.",
+           py::arg("fname"), py::arg("thread_count") = 1)
       .def("read_nexus_file", &GPInstance::ReadNexusFile,
-           "Read trees from a Nexus file.")
+           "Read trees from a Nexus file.",
+           py::arg("fname"), py::arg("thread_count") = 1)
       .def("read_nexus_file_gz", &GPInstance::ReadNexusFileGZ,
-           "Read trees from a gzip-ed Nexus file.")
+           "Read trees from a gzip-ed Nexus file.",
+           py::arg("fname"), py::arg("thread_count") = 1)
       .def("read_fasta_file", &GPInstance::ReadFastaFile,
            "Read a sequence alignment from a FASTA file.")
       .def("sbn_parameters_to_csv", &GPInstance::SBNParametersToCSV,
@@ -726,7 +865,8 @@ PYBIND11_MODULE(bito, m) {
       // ** DAG Engines
       .def("make_gp_engine", &GPInstance::MakeGPEngine, "Initialize GP Engine.",
            py::arg("rescaling_threshold") = GPEngine::default_rescaling_threshold_,
-           py::arg("use_gradients") = false)
+           py::arg("use_gradients") = false, py::arg("plv_byte_budget") = std::nullopt,
+           py::arg("thread_count") = 1)
       .def("get_gp_engine", &GPInstance::GetGPEngine,
            py::return_value_policy::reference, "Get GP Engine.")
       .def("make_nni_engine", &GPInstance::MakeNNIEngine, "Initialize NNI Engine.")
@@ -852,7 +992,22 @@ PYBIND11_MODULE(bito, m) {
                                        "An engine for computing Generalized Pruning.");
   gp_engine_class.def("node_count", &GPEngine::GetNodeCount, "Get number of nodes.")
       .def("plv_count", &GPEngine::GetPLVCount, "Get number of PLVs.")
-      .def("edge_count", &GPEngine::GetGPCSPCount, "Get number of edges.");
+      .def("edge_count", &GPEngine::GetGPCSPCount, "Get number of edges.")
+      .def("set_thread_count", &GPEngine::SetThreadCount,
+           "Set the number of threads used to process GP operations.",
+           py::arg("thread_count"))
+      .def("plv_cache_statistics", &GPEngine::PLVCacheStatistics,
+           "Get the PLV hit, miss, recomputation and eviction counts of an engine with "
+           "a PLV byte budget.")
+      .def("reset_plv_cache_statistics", &GPEngine::ResetPLVCacheStatistics,
+           "Reset the PLV cache counts.")
+      .def(
+          "transition_matrix_cache_statistics",
+          [](const GPEngine &self) {
+            return self.GetTransitionMatrixCache().Statistics();
+          },
+          "Get the hit, miss, precomputation and eviction counts of the transition "
+          "matrix cache.");
 
   py::class_<TPEngine> tp_engine_class(m, "tp_engine",
                                        "An engine for computing Top Pruning.");
@@ -17,6 +17,38 @@ StringSet RootedSBNInstance::StringIndexerRepresentationOf(
       sbn_support_.IndexerRepresentationOf(topology, out_of_sample_index));
 }
 
+void RootedSBNInstance::LoadTreesFromIndexerRepresentations(
+    const IndexerRepresentationMatrix &representations) {
+  CheckSBNSupportNonEmpty();
+  Assert(static_cast<size_t>(representations.cols()) == sbn_support_.TaxonCount() - 1,
+         "LoadTreesFromIndexerRepresentations: representations of the wrong length.");
+  tree_collection_.trees_.clear();
+  tree_collection_.trees_.reserve(representations.rows());
+  RootedIndexerRepresentation rooted_representation(representations.cols());
+  for (Eigen::Index row = 0; row < representations.rows(); row++) {
+    Eigen::Map<IndexerRepresentationMatrix>(rooted_representation.data(), 1,
+                                            representations.cols()) =
+        representations.row(row);
+    tree_collection_.trees_.push_back(
+        RootedTree::UnitBranchLengthTreeOf(RootedTopologyOf(rooted_representation)));
+  }
+}
+
+EigenVectorXd RootedSBNInstance::TopologyGradients(
+    const IndexerRepresentationMatrix &representations, const EigenVectorXdRef log_f,
+    bool use_vimco, size_t thread_count) const {
+  Assert(log_f.size() == representations.rows(),
+         "TopologyGradients needs a log_f entry for each topology.");
+  const EigenVectorXd multiplicative_factors =
+      use_vimco ? CalculateVIMCOMultiplicativeFactors(log_f)
+                : CalculateMultiplicativeFactors(log_f);
+  EigenVectorXd normalized_sbn_parameters_in_log = sbn_parameters_;
+  ProbabilityNormalizeSBNParametersInLog(normalized_sbn_parameters_in_log);
+  return GetSBNGradientEngine().Gradient(normalized_sbn_parameters_in_log,
+                                         representations, multiplicative_factors,
+                                         thread_count);
+}
+
 BitsetDoubleMap RootedSBNInstance::UnconditionalSubsplitProbabilities() const {
   if (tree_collection_.TreeCount() == 0) {
     Failwith(
@@ -101,14 +133,16 @@ std::vector<DoubleVector> RootedSBNInstance::GradientLogDeterminantJacobian() {
                                                      phylo_model_params_, rescaling_);
 }
 
-void RootedSBNInstance::ReadNewickFile(const std::string &fname) {
+void RootedSBNInstance::ReadNewickFile(const std::string &fname, size_t thread_count) {
   Driver driver;
+  driver.SetThreadCount(thread_count);
   tree_collection_ =
       RootedTreeCollection::OfTreeCollection(driver.ParseNewickFile(fname));
 }
 
-void RootedSBNInstance::ReadNexusFile(const std::string &fname) {
+void RootedSBNInstance::ReadNexusFile(const std::string &fname, size_t thread_count) {
   Driver driver;
+  driver.SetThreadCount(thread_count);
   tree_collection_ =
       RootedTreeCollection::OfTreeCollection(driver.ParseNexusFile(fname));
 }
@@ -28,6 +28,20 @@ class RootedSBNInstance : public PreRootedSBNInstance {
   StringSet StringIndexerRepresentationOf(const Node::NodePtr& topology,
                                           size_t out_of_sample_index) const;
 
+  // Replace the stored trees with the topologies of a batch of rooted indexer
+  // representations (see SampleIndexerRepresentations), with unit branch lengths.
+  void LoadTreesFromIndexerRepresentations(
+      const IndexerRepresentationMatrix& representations);
+
+  // The gradient of the VIMCO (or, if not use_vimco, the RWS) estimator with respect to
+  // the SBN parameters for a batch of rooted topologies given by their indexer
+  // representations, e.g. from SampleIndexerRepresentations, with log_f holding an
+  // entry for each. The topologies are split over thread_count threads; see
+  // SBNGradientEngine.
+  EigenVectorXd TopologyGradients(const IndexerRepresentationMatrix& representations,
+                                  EigenVectorXdRef log_f, bool use_vimco = true,
+                                  size_t thread_count = 1) const;
+
   // Make a map from each subsplit to its overall probability when we sample a tree from
   // the SBN.
   BitsetDoubleMap UnconditionalSubsplitProbabilities() const;
@@ -57,8 +71,8 @@ class RootedSBNInstance : public PreRootedSBNInstance {
 
   // ** I/O
 
-  void ReadNewickFile(const std::string& fname);
-  void ReadNexusFile(const std::string& fname);
+  void ReadNewickFile(const std::string& fname, size_t thread_count = 1);
+  void ReadNexusFile(const std::string& fname, size_t thread_count = 1);
 
   void SetDatesToBeConstant(bool initialize_time_trees_using_branch_lengths);
   void ParseDatesFromTaxonNames(bool initialize_time_trees_using_branch_lengths);
@@ -264,6 +278,83 @@ TEST_CASE("RootedSBNInstance: TrainSimpleAverage on 20 taxa") {
   }
 }
 
+TEST_CASE("RootedSBNInstance: streaming a tree file") {
+  auto loaded_inst = MakeRootedSimpleAverageInstance();
+  RootedSBNInstance streamed_inst("streamed");
+  streamed_inst.StreamNewickFile("data/rooted_simple_average.nwk");
+  CHECK_EQ(streamed_inst.TreeCount(), 0);
+  CHECK_EQ(streamed_inst.TaxonNames(), loaded_inst.TaxonNames());
+  CHECK_EQ(streamed_inst.PrettyIndexer(), loaded_inst.PrettyIndexer());
+  CHECK_EQ(streamed_inst.TopologyCounter(), loaded_inst.TopologyCounter());
+  CHECK_THROWS(streamed_inst.ProcessLoadedTrees());
+  streamed_inst.TrainSimpleAverage();
+  CheckVectorXdEquality(streamed_inst.SBNParameters(), loaded_inst.SBNParameters(),
+                        1e-12);
+}
+
+TEST_CASE("RootedSBNInstance: sampling indexer representations") {
+  auto inst = MakeRootedSimpleAverageInstance();
+  const size_t sample_count = 1000;
+  const auto representations = inst.SampleIndexerRepresentations(sample_count, 2);
+  CHECK_EQ(representations.rows(), sample_count);
+  CHECK_EQ(representations.cols(), inst.TaxonNames().size() - 1);
+  // Loading the samples as trees gives back the same representations.
+  inst.LoadTreesFromIndexerRepresentations(representations);
+  CHECK_EQ(inst.TreeCount(), sample_count);
+  const auto loaded_representations = inst.MakeIndexerRepresentations();
+  for (size_t sample_idx = 0; sample_idx < sample_count; sample_idx++) {
+    const size_t *row = representations.row(sample_idx).data();
+    SizeVector sampled(row, row + representations.cols());
+    SizeVector loaded = loaded_representations[sample_idx];
+    std::sort(sampled.begin() + 1, sampled.end());
+    std::sort(loaded.begin() + 1, loaded.end());
+    CHECK(sampled == loaded);
+  }
+}
+
+TEST_CASE("RootedSBNInstance: batched topology gradients") {
+  auto inst = MakeRootedSimpleAverageInstance();
+  for (Eigen::Index idx = 0; idx < inst.sbn_parameters_.size(); idx++) {
+    inst.sbn_parameters_[idx] += 0.1 * static_cast<double>(idx % 7);
+  }
+  const size_t sample_count = 20;
+  const auto representations = inst.SampleIndexerRepresentations(sample_count);
+  EigenVectorXd log_f(sample_count);
+  for (size_t sample_idx = 0; sample_idx < sample_count; sample_idx++) {
+    log_f[sample_idx] = -300. - static_cast<double>((sample_idx * 37) % 11);
+  }
+  const EigenVectorXd multiplicative_factors =
+      inst.CalculateVIMCOMultiplicativeFactors(log_f);
+  // The objective: the sum of the multiplicative factors times log q.
+  auto objective = [&inst, &representations, &multiplicative_factors]() {
+    EigenVectorXd normalized_sbn_parameters_in_log = inst.sbn_parameters_;
+    inst.ProbabilityNormalizeSBNParametersInLog(normalized_sbn_parameters_in_log);
+    double result = 0.;
+    for (Eigen::Index row = 0; row < representations.rows(); row++) {
+      for (Eigen::Index col = 0; col < representations.cols(); col++) {
+        result += multiplicative_factors[row] *
+                  normalized_sbn_parameters_in_log[representations(row, col)];
+      }
+    }
+    return result;
+  };
+  const EigenVectorXd gradient = inst.TopologyGradients(representations, log_f);
+  CheckVectorXdEquality(inst.TopologyGradients(representations, log_f, true, 3),
+                        gradient, 1e-12);
+  // Check against centered finite differences.
+  const double eps = 1e-6;
+  for (Eigen::Index idx = 0; idx < gradient.size(); idx += 5) {
+    const double parameter = inst.sbn_parameters_[idx];
+    inst.sbn_parameters_[idx] = parameter + eps;
+    const double objective_plus = objective();
+    inst.sbn_parameters_[idx] = parameter - eps;
+    const double objective_minus = objective();
+    inst.sbn_parameters_[idx] = parameter;
+    CHECK_LT(fabs((objective_plus - objective_minus) / (2 * eps) - gradient[idx]),
+             1e-6);
+  }
+}
+
 RootedSBNInstance MakeFluInstance(bool initialize_time_trees) {
   RootedSBNInstance inst("charlie");
   inst.ReadNewickFile("data/fluA.tree");
@@ -454,6 +545,15 @@ TEST_CASE("RootedSBNInstance: uninitialized time trees raise an exception") {
   CHECK_THROWS(inst.PhyloGradients());
 }
 
+TEST_CASE("RootedSBNInstance: rooted trees are not evaluated in batches") {
+  RootedSBNInstance inst("charlie");
+  inst.ReadNewickFile("data/fluA.tree");
+  inst.ReadFastaFile("data/fluA.fa");
+  PhyloModelSpecification simple_specification{"JC69", "constant", "strict"};
+  CHECK_THROWS(inst.PrepareForPhyloLikelihood(simple_specification, 1, {}, true,
+                                              std::nullopt, 2));
+}
+
 TEST_CASE("RootedSBNInstance: reading SBN parameters from a CSV") {
   auto inst = MakeFiveTaxonRootedInstance();
   inst.ReadSBNParametersFromCSV("data/test_modifying_sbn_parameters.csv");
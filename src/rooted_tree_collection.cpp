@@ -20,6 +20,13 @@ RootedTreeCollection RootedTreeCollection::OfTreeCollection(
   return RootedTreeCollection(std::move(rooted_trees), trees.TagTaxonMap());
 }
 
+RootedTreeCollection RootedTreeCollection::Load(const std::string& path,
+                                                size_t thread_count) {
+  auto pre_collection = PreRootedTreeCollection::Load(path, thread_count);
+  return RootedTreeCollection(std::move(pre_collection.trees_),
+                              pre_collection.TagTaxonMap());
+}
+
 RootedTreeCollection RootedTreeCollection::BuildCollectionByDuplicatingFirst(
     size_t number_of_times) {
   return RootedTreeCollection(
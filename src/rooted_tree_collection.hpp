@@ -23,6 +23,9 @@ class RootedTreeCollection : public PreRootedTreeCollection {
                        const TagDateMap& tag_date_map);
 
   static RootedTreeCollection OfTreeCollection(const TreeCollection& trees);
+  // Load a collection written by Export. Tip dates aren't saved, so they need to be
+  // set up again.
+  static RootedTreeCollection Load(const std::string& path, size_t thread_count = 1);
   // Build a tree collection by duplicating the first tree.
   RootedTreeCollection BuildCollectionByDuplicatingFirst(size_t number_of_times);
 
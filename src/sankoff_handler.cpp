@@ -17,28 +17,15 @@ void SankoffHandler::GenerateLeafPartials() {
          "psv_handler_ should be initialized to accomodate"
          "the number of leaf nodes in the site_pattern_.");
 
-  // Iterate over all leaf nodes to instantiate each with P partial values
+  static_assert(state_count_ == TipStates::state_count_);
+  const auto &tip_states = site_pattern_.GetTipStates();
+  // Iterate over all leaf nodes to instantiate each with P partial values. The states
+  // that a leaf can't be in cost big_double_, so leaves with gaps in sequence and
+  // ambiguous nucleotides are assigned sankoff partial vector [0, 0, 0, 0] at the
+  // corresponding site.
   for (NodeId leaf_node = 0; leaf_node < site_pattern_.TaxonCount(); leaf_node++) {
     SankoffPartial node_partials(state_count_, site_pattern_.PatternCount());
-    // set leaf node partial to have big_double_ infinity substitute
-    node_partials.block(0, 0, state_count_, site_pattern_.PatternCount())
-        .fill(big_double_);
-    // now fill in appropriate entries of the leaf-partial where non-infinite
-    for (size_t pattern_idx = 0; pattern_idx < site_pattern_.PatternCount();
-         pattern_idx++) {
-      auto site_val = site_pattern_.GetPatternSymbol(leaf_node.value_, pattern_idx);
-      if (site_val < state_count_) {
-        node_partials(site_val, pattern_idx) = 0.;
-      } else if (site_val == state_count_) {
-        // Leaves with gaps in sequence and ambiguous nucleotides are assigned sankoff
-        // partial vector [0, 0, 0, 0] at the corresponding site.
-        node_partials.col(pattern_idx).fill(0);
-      } else {
-        Failwith(
-            "Error in SankoffHandler::GenerateLeafPartials: Invalid nucleotide state "
-            "in sequence alignment.");
-      }
-    }
+    tip_states.Expand(leaf_node.value_, 0., big_double_, node_partials.data());
     psv_handler_.GetPV(PSVType::PLeft, leaf_node) = node_partials;
     psv_handler_.GetPV(PSVType::PRight, leaf_node).fill(0);
   }
@@ -69,34 +56,46 @@ EigenVectorXd SankoffHandler::TotalPPartial(NodeId node_id, size_t site_idx) {
          psv_handler_.GetPV(PSVType::PRight, node_id).col(site_idx);
 }
 
+void SankoffHandler::EvolveChild(double *dest, const NodeId child_id,
+                                 const double *sum_with) {
+  const double *costs = mutation_costs_.GetMatrix().data();
+  const size_t pattern_count = site_pattern_.PatternCount();
+  if (child_id.value_ < site_pattern_.TaxonCount()) {
+    const uint8_t *tip_codes = site_pattern_.GetTipStates().Codes(child_id.value_);
+    if (sum_with == nullptr) {
+      SankoffKernels::EvolveTip(dest, costs, tip_codes, big_double_, pattern_count);
+    } else {
+      SankoffKernels::EvolveTipSum(dest, costs, tip_codes, big_double_, sum_with,
+                                   pattern_count);
+    }
+    return;
+  }
+  // else
+  const double *p_left = psv_handler_.GetPV(PSVType::PLeft, child_id).data();
+  const double *p_right = psv_handler_.GetPV(PSVType::PRight, child_id).data();
+  if (sum_with == nullptr) {
+    SankoffKernels::Evolve(dest, costs, p_left, p_right, pattern_count);
+  } else {
+    SankoffKernels::EvolveSum(dest, costs, p_left, p_right, sum_with, pattern_count);
+  }
+}
+
 void SankoffHandler::PopulateRootwardParsimonyPVForNode(const NodeId parent_id,
                                                         const NodeId left_child_id,
                                                         const NodeId right_child_id) {
-  for (size_t pattern_idx = 0; pattern_idx < site_pattern_.PatternCount();
-       pattern_idx++) {
-    // Which child partial is in right or left doesn't actually matter because they
-    // are summed when calculating q_partials.
-    psv_handler_.GetPV(PSVType::PLeft, parent_id).col(pattern_idx) =
-        ParentPartial(TotalPPartial(left_child_id, pattern_idx));
-
-    psv_handler_.GetPV(PSVType::PRight, parent_id).col(pattern_idx) =
-        ParentPartial(TotalPPartial(right_child_id, pattern_idx));
-  }
+  // Which child partial is in right or left doesn't actually matter because they are
+  // summed when calculating q_partials.
+  EvolveChild(psv_handler_.GetPV(PSVType::PLeft, parent_id).data(), left_child_id);
+  EvolveChild(psv_handler_.GetPV(PSVType::PRight, parent_id).data(), right_child_id);
 }
 
 void SankoffHandler::PopulateLeafwardParsimonyPVForNode(const NodeId parent_id,
                                                         const NodeId left_child_id,
                                                         const NodeId right_child_id) {
-  for (size_t pattern_idx = 0; pattern_idx < site_pattern_.PatternCount();
-       pattern_idx++) {
-    auto partials_from_parent =
-        ParentPartial(psv_handler_.GetPV(PSVType::Q, parent_id).col(pattern_idx));
-    for (const auto child_id : {left_child_id, right_child_id}) {
-      NodeId sister_id = ((child_id == left_child_id) ? right_child_id : left_child_id);
-      auto partials_from_sister = ParentPartial(TotalPPartial(sister_id, pattern_idx));
-      psv_handler_.GetPV(PSVType::Q, child_id).col(pattern_idx) =
-          partials_from_sister + partials_from_parent;
-    }
+  const double *parent_q = psv_handler_.GetPV(PSVType::Q, parent_id).data();
+  for (const auto child_id : {left_child_id, right_child_id}) {
+    NodeId sister_id = ((child_id == left_child_id) ? right_child_id : left_child_id);
+    EvolveChild(psv_handler_.GetPV(PSVType::Q, child_id).data(), sister_id, parent_q);
   }
 }
 
@@ -132,21 +131,17 @@ void SankoffHandler::RunSankoff(Node::NodePtr topology) {
 }
 
 double SankoffHandler::ParsimonyScore(NodeId node_id) {
-  auto weights = site_pattern_.GetWeights();
-  double total_parsimony = 0.;
-  for (size_t pattern = 0; pattern < site_pattern_.PatternCount(); pattern++) {
-    // Note: doing ParentPartial first for the left and right p_partials and then adding
-    // them together will give the same minimum parsimony score, but doesn't give
-    // correct Sankoff Partial vector for the new rooting
-    auto total_tree = ParentPartial(TotalPPartial(node_id, pattern));
-    total_tree += ParentPartial(psv_handler_.GetPV(PSVType::Q, node_id).col(pattern));
-
-    // If node_id is the root node, calculating the total_tree vector like so does not
-    // yield the SankoffPartial of an actual rooting, but this will not change the
-    // minimum value in the partial, so the root node can still be used to calculate the
-    // parsimony score.
-    total_parsimony +=
-        *std::min_element(total_tree.begin(), total_tree.end()) * weights[pattern];
-  }
-  return total_parsimony;
+  // Note: doing ParentPartial first for the left and right p_partials and then adding
+  // them together will give the same minimum parsimony score, but doesn't give correct
+  // Sankoff Partial vector for the new rooting.
+  //
+  // If node_id is the root node, the total tree vector does not yield the
+  // SankoffPartial of an actual rooting, but this will not change its minimum value,
+  // so the root node can still be used to calculate the parsimony score.
+  return SankoffKernels::ParsimonyScore(
+      mutation_costs_.GetMatrix().data(),
+      psv_handler_.GetPV(PSVType::PLeft, node_id).data(),
+      psv_handler_.GetPV(PSVType::PRight, node_id).data(),
+      psv_handler_.GetPV(PSVType::Q, node_id).data(), site_pattern_.GetWeights().data(),
+      site_pattern_.PatternCount());
 }
@@ -7,6 +7,7 @@
 
 #include "eigen_sugar.hpp"
 #include "sugar.hpp"
+#include "sankoff_kernels.hpp"
 #include "sankoff_matrix.hpp"
 #include "site_pattern.hpp"
 #include "node.hpp"
@@ -14,8 +15,9 @@
 #include "pv_handler.hpp"
 #include "gp_dag.hpp"
 
-// Partial vector for one node across all sites
-using SankoffPartial = NucleotidePLV;
+// Partial vector for one node across all sites. Sankoff costs are always stored as
+// doubles, whatever the PLV precision.
+using SankoffPartial = NucleotidePV<double>;
 // Each SankoffPartial represents calculations for one node
 using SankoffPartialVec = std::vector<SankoffPartial>;
 // references for SankoffPartials
@@ -124,6 +126,11 @@ class SankoffHandler {
   SitePattern site_pattern_;
   double resizing_factor_;
   PSVNodeHandler psv_handler_;
+
+  // Write ParentPartial(TotalPPartial(child_id, pattern_idx)) for every pattern to
+  // dest, plus ParentPartial of the sum_with PSV if it is given. Leaf children are
+  // read from their tip codes (see SankoffKernels).
+  void EvolveChild(double *dest, NodeId child_id, const double *sum_with = nullptr);
 };
 
 #ifdef DOCTEST_LIBRARY_INCLUDED
@@ -0,0 +1,343 @@
+// Copyright 2019-2022 bito project contributors.
+// bito is free software under the GPLv3; see LICENSE file for details.
+
+#include "sankoff_kernels.hpp"
+
+#include <algorithm>
+
+#include "plv_kernels.hpp"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define BITO_SANKOFF_KERNELS_X86
+#include <immintrin.h>
+#define AVX2_TARGET __attribute__((target("avx2,fma")))
+#endif
+
+namespace {
+
+// ** Children
+// A child gives the evolved PSV entries E(child[:, p]) of each pattern, for either
+// the sum of two PSVs or a tip.
+
+using CodeColumns = double[16][4];
+
+inline uint8_t TipCode(const uint8_t *tip_codes, const size_t pattern) {
+  return (tip_codes[pattern / 2] >> (4 * (pattern % 2))) & 0xF;
+}
+
+// E(a) for a single pattern, in the order of SankoffHandler::ParentPartial.
+template <bool unit_cost>
+inline void GenericEvolveEntries(const double *costs, const double *a, double *out) {
+  if constexpr (unit_cost) {
+    const double least = std::min(std::min(a[0], a[1]), std::min(a[2], a[3])) + 1.;
+    for (size_t i = 0; i < 4; i++) {
+      out[i] = std::min(a[i], least);
+    }
+  } else {
+    for (size_t i = 0; i < 4; i++) {
+      double least = costs[i] + a[0];
+      for (size_t j = 1; j < 4; j++) {
+        least = std::min(least, costs[4 * j + i] + a[j]);
+      }
+      out[i] = least;
+    }
+  }
+}
+
+template <bool unit_cost>
+struct GenericSumChild {
+  const double *costs_;
+  const double *src1_;
+  const double *src2_;
+
+  void operator()(const size_t pattern, double *out) const {
+    double a[4];
+    for (size_t i = 0; i < 4; i++) {
+      a[i] = src1_[4 * pattern + i] + src2_[4 * pattern + i];
+    }
+    GenericEvolveEntries<unit_cost>(costs_, a, out);
+  }
+};
+
+// Evolve the PSV of a leaf with each code, which is the sum of its PLeft PSV (0 or
+// disallowed_cost) and its PRight PSV (0).
+template <bool unit_cost>
+void EvolveCodes(const double *costs, const double disallowed_cost,
+                 CodeColumns &columns) {
+  for (size_t code = 0; code < 16; code++) {
+    double a[4];
+    for (size_t j = 0; j < 4; j++) {
+      a[j] = (((code >> j) & 1) ? 0. : disallowed_cost) + 0.;
+    }
+    GenericEvolveEntries<unit_cost>(costs, a, columns[code]);
+  }
+}
+
+struct GenericTipChild {
+  const CodeColumns &columns_;
+  const uint8_t *tip_codes_;
+
+  void operator()(const size_t pattern, double *out) const {
+    std::copy_n(columns_[TipCode(tip_codes_, pattern)], 4, out);
+  }
+};
+
+// ** Generic kernels
+
+template <typename Child>
+void GenericEvolve(double *dest, const Child &child, const size_t pattern_count) {
+  for (size_t pattern = 0; pattern < pattern_count; pattern++) {
+    child(pattern, dest + 4 * pattern);
+  }
+}
+
+template <bool unit_cost, typename Child>
+void GenericEvolveSum(double *dest, const double *costs, const Child &child,
+                      const double *src3, const size_t pattern_count) {
+  for (size_t pattern = 0; pattern < pattern_count; pattern++) {
+    double evolved[4];
+    double evolved3[4];
+    child(pattern, evolved);
+    GenericEvolveEntries<unit_cost>(costs, src3 + 4 * pattern, evolved3);
+    for (size_t i = 0; i < 4; i++) {
+      dest[4 * pattern + i] = evolved[i] + evolved3[i];
+    }
+  }
+}
+
+template <bool unit_cost, typename Child>
+double GenericParsimonyScore(const double *costs, const Child &child,
+                             const double *src3, const double *weights,
+                             const size_t pattern_count) {
+  double score = 0.;
+  for (size_t pattern = 0; pattern < pattern_count; pattern++) {
+    double evolved[4];
+    double evolved3[4];
+    child(pattern, evolved);
+    GenericEvolveEntries<unit_cost>(costs, src3 + 4 * pattern, evolved3);
+    double least = evolved[0] + evolved3[0];
+    for (size_t i = 1; i < 4; i++) {
+      least = std::min(least, evolved[i] + evolved3[i]);
+    }
+    score += least * weights[pattern];
+  }
+  return score;
+}
+
+#ifdef BITO_SANKOFF_KERNELS_X86
+
+// ** AVX2 kernels
+// As for the PLV kernels, a __m256d holds the four states of one pattern. Evolving it
+// takes the minimum over the columns of the costs, each plus a broadcast state.
+
+// The minimum of the entries of a, in every lane.
+AVX2_TARGET inline __m256d AVX2BroadcastMinimum(const __m256d a) {
+  const __m256d pairs = _mm256_min_pd(a, _mm256_permute_pd(a, 0b0101));
+  return _mm256_min_pd(pairs, _mm256_permute2f128_pd(pairs, pairs, 1));
+}
+
+template <bool unit_cost>
+AVX2_TARGET inline __m256d AVX2EvolveEntries(const __m256d *columns, const __m256d a) {
+  if constexpr (unit_cost) {
+    return _mm256_min_pd(
+        a, _mm256_add_pd(AVX2BroadcastMinimum(a), _mm256_set1_pd(1.)));
+  } else {
+    // Broadcasting from memory is cheaper than shuffling each state out of a.
+    alignas(32) double a_memory[4];
+    _mm256_store_pd(a_memory, a);
+    __m256d least = _mm256_add_pd(columns[0], _mm256_set1_pd(a_memory[0]));
+    for (size_t j = 1; j < 4; j++) {
+      least =
+          _mm256_min_pd(least, _mm256_add_pd(columns[j], _mm256_set1_pd(a_memory[j])));
+    }
+    return least;
+  }
+}
+
+template <bool unit_cost>
+struct AVX2SumChild {
+  const __m256d *columns_;
+  const double *src1_;
+  const double *src2_;
+
+  AVX2_TARGET __m256d operator()(const size_t pattern) const {
+    return AVX2EvolveEntries<unit_cost>(
+        columns_, _mm256_add_pd(_mm256_loadu_pd(src1_ + 4 * pattern),
+                                _mm256_loadu_pd(src2_ + 4 * pattern)));
+  }
+};
+
+struct AVX2TipChild {
+  const CodeColumns &columns_;
+  const uint8_t *tip_codes_;
+
+  AVX2_TARGET __m256d operator()(const size_t pattern) const {
+    return _mm256_loadu_pd(columns_[TipCode(tip_codes_, pattern)]);
+  }
+};
+
+AVX2_TARGET inline void AVX2LoadColumns(const double *costs, __m256d *columns) {
+  for (size_t j = 0; j < 4; j++) {
+    columns[j] = _mm256_loadu_pd(costs + 4 * j);
+  }
+}
+
+template <typename Child>
+AVX2_TARGET void AVX2Evolve(double *dest, const Child &child,
+                            const size_t pattern_count) {
+  for (size_t pattern = 0; pattern < pattern_count; pattern++) {
+    _mm256_storeu_pd(dest + 4 * pattern, child(pattern));
+  }
+}
+
+template <bool unit_cost, typename Child>
+AVX2_TARGET void AVX2EvolveSum(double *dest, const __m256d *columns,
+                               const Child &child, const double *src3,
+                               const size_t pattern_count) {
+  for (size_t pattern = 0; pattern < pattern_count; pattern++) {
+    const __m256d evolved3 =
+        AVX2EvolveEntries<unit_cost>(columns, _mm256_loadu_pd(src3 + 4 * pattern));
+    _mm256_storeu_pd(dest + 4 * pattern, _mm256_add_pd(child(pattern), evolved3));
+  }
+}
+
+template <bool unit_cost, typename Child>
+AVX2_TARGET double AVX2ParsimonyScore(const __m256d *columns, const Child &child,
+                                      const double *src3, const double *weights,
+                                      const size_t pattern_count) {
+  // The score is summed a pattern at a time, as in the generic kernel.
+  double score = 0.;
+  for (size_t pattern = 0; pattern < pattern_count; pattern++) {
+    const __m256d evolved3 =
+        AVX2EvolveEntries<unit_cost>(columns, _mm256_loadu_pd(src3 + 4 * pattern));
+    const __m256d least =
+        AVX2BroadcastMinimum(_mm256_add_pd(child(pattern), evolved3));
+    score += _mm256_cvtsd_f64(least) * weights[pattern];
+  }
+  return score;
+}
+
+#endif  // BITO_SANKOFF_KERNELS_X86
+
+bool UseAVX2() {
+#ifdef BITO_SANKOFF_KERNELS_X86
+  return PLVKernels::GetIsa() != PLVKernels::Isa::Generic;
+#else
+  return false;
+#endif  // BITO_SANKOFF_KERNELS_X86
+}
+
+// Call f with std::true_type if the costs are unit costs, and std::false_type if not.
+template <typename F>
+auto WithUnitCost(const double *costs, F f) {
+  if (SankoffKernels::IsUnitCost(costs)) {
+    return f(std::true_type());
+  }
+  // else
+  return f(std::false_type());
+}
+
+}  // namespace
+
+bool SankoffKernels::IsUnitCost(const double *costs) {
+  for (size_t j = 0; j < 4; j++) {
+    for (size_t i = 0; i < 4; i++) {
+      if (costs[4 * j + i] != (i == j ? 0. : 1.)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void SankoffKernels::Evolve(double *dest, const double *costs, const double *src1,
+                            const double *src2, const size_t pattern_count) {
+  WithUnitCost(costs, [&](auto unit_cost) {
+#ifdef BITO_SANKOFF_KERNELS_X86
+    if (UseAVX2()) {
+      __m256d columns[4];
+      AVX2LoadColumns(costs, columns);
+      AVX2Evolve(dest, AVX2SumChild<unit_cost>{columns, src1, src2}, pattern_count);
+      return;
+    }
+#endif  // BITO_SANKOFF_KERNELS_X86
+    GenericEvolve(dest, GenericSumChild<unit_cost>{costs, src1, src2}, pattern_count);
+  });
+}
+
+void SankoffKernels::EvolveSum(double *dest, const double *costs, const double *src1,
+                               const double *src2, const double *src3,
+                               const size_t pattern_count) {
+  WithUnitCost(costs, [&](auto unit_cost) {
+#ifdef BITO_SANKOFF_KERNELS_X86
+    if (UseAVX2()) {
+      __m256d columns[4];
+      AVX2LoadColumns(costs, columns);
+      AVX2EvolveSum<unit_cost>(dest, columns,
+                               AVX2SumChild<unit_cost>{columns, src1, src2}, src3,
+                               pattern_count);
+      return;
+    }
+#endif  // BITO_SANKOFF_KERNELS_X86
+    GenericEvolveSum<unit_cost>(dest, costs,
+                                GenericSumChild<unit_cost>{costs, src1, src2}, src3,
+                                pattern_count);
+  });
+}
+
+double SankoffKernels::ParsimonyScore(const double *costs, const double *src1,
+                                      const double *src2, const double *src3,
+                                      const double *weights,
+                                      const size_t pattern_count) {
+  return WithUnitCost(costs, [&](auto unit_cost) {
+#ifdef BITO_SANKOFF_KERNELS_X86
+    if (UseAVX2()) {
+      __m256d columns[4];
+      AVX2LoadColumns(costs, columns);
+      return AVX2ParsimonyScore<unit_cost>(
+          columns, AVX2SumChild<unit_cost>{columns, src1, src2}, src3, weights,
+          pattern_count);
+    }
+#endif  // BITO_SANKOFF_KERNELS_X86
+    return GenericParsimonyScore<unit_cost>(
+        costs, GenericSumChild<unit_cost>{costs, src1, src2}, src3, weights,
+        pattern_count);
+  });
+}
+
+void SankoffKernels::EvolveTip(double *dest, const double *costs,
+                               const uint8_t *tip_codes, const double disallowed_cost,
+                               const size_t pattern_count) {
+  WithUnitCost(costs, [&](auto unit_cost) {
+    CodeColumns code_columns;
+    EvolveCodes<unit_cost>(costs, disallowed_cost, code_columns);
+#ifdef BITO_SANKOFF_KERNELS_X86
+    if (UseAVX2()) {
+      AVX2Evolve(dest, AVX2TipChild{code_columns, tip_codes}, pattern_count);
+      return;
+    }
+#endif  // BITO_SANKOFF_KERNELS_X86
+    GenericEvolve(dest, GenericTipChild{code_columns, tip_codes}, pattern_count);
+  });
+}
+
+void SankoffKernels::EvolveTipSum(double *dest, const double *costs,
+                                  const uint8_t *tip_codes,
+                                  const double disallowed_cost, const double *src3,
+                                  const size_t pattern_count) {
+  WithUnitCost(costs, [&](auto unit_cost) {
+    CodeColumns code_columns;
+    EvolveCodes<unit_cost>(costs, disallowed_cost, code_columns);
+#ifdef BITO_SANKOFF_KERNELS_X86
+    if (UseAVX2()) {
+      __m256d columns[4];
+      AVX2LoadColumns(costs, columns);
+      AVX2EvolveSum<unit_cost>(dest, columns, AVX2TipChild{code_columns, tip_codes},
+                               src3, pattern_count);
+      return;
+    }
+#endif  // BITO_SANKOFF_KERNELS_X86
+    GenericEvolveSum<unit_cost>(dest, costs, GenericTipChild{code_columns, tip_codes},
+                                src3, pattern_count);
+  });
+}
@@ -0,0 +1,136 @@
+// Copyright 2019-2022 bito project contributors.
+// bito is free software under the GPLv3; see LICENSE file for details.
+//
+// Kernels for the partial vectors of the Sankoff algorithm (PSVs). Like a PLV, a PSV
+// is a column-major 4 x pattern_count matrix of doubles, holding for each pattern
+// the least cost of the subtree below given each state at its top.
+//
+// Moving a PSV up a branch is a min-plus product with the 4 x 4 cost matrix, whose
+// (i, j) entry is the cost of mutating from parent state i to child state j. The child
+// PSV is always the sum of two PSVs (e.g. the PLeft and PRight PSVs of a node), so
+// writing E(a) for the min-plus product of the costs with a, we have
+//
+// * Evolve: dest[:, p] = E(src1[:, p] + src2[:, p]),
+// * EvolveSum: dest[:, p] = E(src1[:, p] + src2[:, p]) + E(src3[:, p]),
+// * ParsimonyScore: the sum over patterns of weights[p] times the smallest entry of
+//   E(src1[:, p] + src2[:, p]) + E(src3[:, p]).
+//
+// These go through the patterns in a single pass, without temporaries. The sums and
+// products are taken in the same order as SankoffHandler::ParentPartial, so results
+// are exactly those of going a pattern at a time.
+//
+// The tip versions take a leaf by its packed ambiguity codes (see TipStates) in place
+// of src1 + src2: the states a leaf can't be in cost disallowed_cost, and the others
+// cost nothing. There are only 16 codes, so we evolve each code once per call. Tip
+// codes must start at an even pattern, so that they start on a byte.
+//
+// With unit costs (1 off the diagonal), which is Fitch parsimony, E(a)[i] is simply
+// min(a[i], min_j a[j] + 1), and the kernels take that shortcut.
+//
+// Cost matrices are column-major 4 x 4, as in CostMatrix. The AVX2 versions of the
+// kernels are used whenever PLVKernels is using AVX2 or better.
+
+#pragma once
+
+#include <cstdint>
+
+#include "sugar.hpp"
+
+namespace SankoffKernels {
+
+// Whether the costs are 0 on the diagonal and 1 elsewhere.
+bool IsUnitCost(const double *costs);
+
+void Evolve(double *dest, const double *costs, const double *src1, const double *src2,
+            size_t pattern_count);
+void EvolveSum(double *dest, const double *costs, const double *src1,
+               const double *src2, const double *src3, size_t pattern_count);
+double ParsimonyScore(const double *costs, const double *src1, const double *src2,
+                      const double *src3, const double *weights, size_t pattern_count);
+
+void EvolveTip(double *dest, const double *costs, const uint8_t *tip_codes,
+               double disallowed_cost, size_t pattern_count);
+void EvolveTipSum(double *dest, const double *costs, const uint8_t *tip_codes,
+                  double disallowed_cost, const double *src3, size_t pattern_count);
+
+}  // namespace SankoffKernels
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+#include "plv_kernels.hpp"
+#include "sankoff_matrix.hpp"
+
+TEST_CASE("SankoffKernels") {
+  const size_t pattern_count = 37;
+  const double big = 1e9;
+  // Costs in whole numbers, and some states ruled out, as for Sankoff partials.
+  Eigen::Matrix<double, 4, Eigen::Dynamic> src1(4, pattern_count);
+  Eigen::Matrix<double, 4, Eigen::Dynamic> src2(4, pattern_count);
+  Eigen::Matrix<double, 4, Eigen::Dynamic> src3(4, pattern_count);
+  std::vector<uint8_t> tip_codes((pattern_count + 1) / 2, 0);
+  Eigen::Matrix<double, 4, Eigen::Dynamic> tip(4, pattern_count);
+  EigenVectorXd weights(pattern_count);
+  for (size_t pattern = 0; pattern < pattern_count; pattern++) {
+    const uint8_t code = (pattern * 7) % 16;
+    tip_codes[pattern / 2] |= static_cast<uint8_t>(code << (4 * (pattern % 2)));
+    for (size_t state = 0; state < 4; state++) {
+      const size_t i = 4 * pattern + state;
+      src1(state, pattern) = (i % 7 == 0) ? big : static_cast<double>((i * 5) % 9);
+      src2(state, pattern) = static_cast<double>((i * 3) % 4);
+      src3(state, pattern) = static_cast<double>((i * 11) % 6);
+      tip(state, pattern) = ((code >> state) & 1) ? 0. : big;
+    }
+    weights(pattern) = static_cast<double>(1 + pattern % 3);
+  }
+  CostMatrix unit_costs;
+  unit_costs.setOnes();
+  unit_costs.diagonal().setZero();
+  CostMatrix costs;
+  costs << 0., 2.5, 1., 2.5, 2.5, 0., 2.5, 1., 1., 2.5, 0., 2.5, 2.5, 1., 2.5, 0.;
+  CHECK(SankoffKernels::IsUnitCost(unit_costs.data()));
+  CHECK_FALSE(SankoffKernels::IsUnitCost(costs.data()));
+
+  // The min-plus product of the costs with each column of a PSV.
+  auto evolve = [](const CostMatrix &cost_matrix,
+                   const Eigen::Matrix<double, 4, Eigen::Dynamic> &psv) {
+    Eigen::Matrix<double, 4, Eigen::Dynamic> evolved(4, psv.cols());
+    for (Eigen::Index pattern = 0; pattern < psv.cols(); pattern++) {
+      for (Eigen::Index i = 0; i < 4; i++) {
+        evolved(i, pattern) = (cost_matrix.row(i).transpose() + psv.col(pattern))
+                                  .minCoeff();
+      }
+    }
+    return evolved;
+  };
+
+  const auto original_isa = PLVKernels::GetIsa();
+  for (const auto isa : PLVKernels::AvailableIsas()) {
+    PLVKernels::SetIsa(isa);
+    for (const auto &cost_matrix : {unit_costs, costs}) {
+      const Eigen::Matrix<double, 4, Eigen::Dynamic> correct_evolved =
+          evolve(cost_matrix, src1 + src2);
+      const Eigen::Matrix<double, 4, Eigen::Dynamic> correct_sum =
+          correct_evolved + evolve(cost_matrix, src3);
+      const Eigen::Matrix<double, 4, Eigen::Dynamic> correct_tip_sum =
+          evolve(cost_matrix, tip) + evolve(cost_matrix, src3);
+      Eigen::Matrix<double, 4, Eigen::Dynamic> dest(4, pattern_count);
+      SankoffKernels::Evolve(dest.data(), cost_matrix.data(), src1.data(), src2.data(),
+                             pattern_count);
+      CHECK((dest.array() == correct_evolved.array()).all());
+      SankoffKernels::EvolveSum(dest.data(), cost_matrix.data(), src1.data(),
+                                src2.data(), src3.data(), pattern_count);
+      CHECK((dest.array() == correct_sum.array()).all());
+      CHECK_EQ(SankoffKernels::ParsimonyScore(cost_matrix.data(), src1.data(),
+                                              src2.data(), src3.data(), weights.data(),
+                                              pattern_count),
+               correct_sum.colwise().minCoeff().dot(weights));
+      SankoffKernels::EvolveTip(dest.data(), cost_matrix.data(), tip_codes.data(), big,
+                                pattern_count);
+      CHECK((dest.array() == evolve(cost_matrix, tip).array()).all());
+      SankoffKernels::EvolveTipSum(dest.data(), cost_matrix.data(), tip_codes.data(),
+                                   big, src3.data(), pattern_count);
+      CHECK((dest.array() == correct_tip_sum.array()).all());
+    }
+  }
+  PLVKernels::SetIsa(original_isa);
+}
+#endif  // DOCTEST_LIBRARY_INCLUDED
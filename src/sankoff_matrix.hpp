@@ -36,10 +36,10 @@ class SankoffMatrix {
                std::to_string(child_state) + " should have cost of 0.");
     cost_matrix_(parent_state, child_state) = cost;
   };
-  double GetCost(size_t parent_state, size_t child_state) {
+  double GetCost(size_t parent_state, size_t child_state) const {
     return cost_matrix_(parent_state, child_state);
   };
-  CostMatrix GetMatrix() { return cost_matrix_; };
+  const CostMatrix &GetMatrix() const { return cost_matrix_; };
 
  private:
   CostMatrix cost_matrix_;
@@ -0,0 +1,151 @@
+// Copyright 2019-2022 bito project contributors.
+// bito is free software under the GPLv3; see LICENSE file for details.
+
+#include "sbn_gradient_engine.hpp"
+
+#include "numerical_utils.hpp"
+#include "thread_pool.hpp"
+
+SBNGradientEngine::SBNGradientEngine(const SBNSupport &sbn_support)
+    : range_starts_(sbn_support.GPCSPCount(), 0),
+      clade_ranges_(sbn_support.SubsplitCladeRanges()) {
+  for (const auto &[parent, range] : sbn_support.ParentToRange()) {
+    const auto &[start, end] = range;
+    std::fill(range_starts_.begin() + start, range_starts_.begin() + end, start);
+  }
+}
+
+void SBNGradientEngine::AccumulateRooting(const size_t *begin, const size_t *end,
+                                          const double weight, double *entry_weights,
+                                          double *range_weights) const {
+  // Every rooting picks its rootsplit from the range of rootsplits, which starts at 0.
+  range_weights[0] += weight;
+  for (const size_t *entry = begin; entry != end; ++entry) {
+    entry_weights[*entry] += weight;
+    for (size_t side = 0; side < 2; side++) {
+      const auto &[start, range_end] = clade_ranges_[2 * *entry + side];
+      if (start != range_end) {
+        range_weights[start] += weight;
+      }
+    }
+  }
+}
+
+EigenVectorXd SBNGradientEngine::Gradient(
+    EigenConstVectorXdRef normalized_sbn_parameters_in_log, const size_t sample_count,
+    const std::function<double(size_t)> &cost,
+    const std::function<void(size_t, double *, double *)> &accumulate,
+    const size_t thread_count) const {
+  Assert(static_cast<size_t>(normalized_sbn_parameters_in_log.size()) == GPCSPCount(),
+         "SBNGradientEngine needs a parameter for each rootsplit and PCSP.");
+  // As in PackedIndexerRepresentationCounter, each range of samples gets its own
+  // accumulators, so that the results don't depend on which worker takes which range.
+  const SizeVector boundaries =
+      (thread_count < 2) ? SizeVector({0, sample_count})
+                         : ThreadPool::ChunkBoundaries(sample_count, cost, thread_count);
+  const size_t range_count = boundaries.size() - 1;
+  EigenMatrixXd entry_weights = EigenMatrixXd::Zero(range_count, GPCSPCount());
+  EigenMatrixXd range_weights = EigenMatrixXd::Zero(range_count, GPCSPCount());
+  auto accumulate_range = [&](const size_t range_idx) {
+    double *range_entry_weights = entry_weights.row(range_idx).data();
+    double *range_range_weights = range_weights.row(range_idx).data();
+    for (size_t sample_idx = boundaries[range_idx];
+         sample_idx < boundaries[range_idx + 1]; sample_idx++) {
+      accumulate(sample_idx, range_entry_weights, range_range_weights);
+    }
+  };
+  if (range_count < 2) {
+    for (size_t range_idx = 0; range_idx < range_count; range_idx++) {
+      accumulate_range(range_idx);
+    }
+  } else {
+    ThreadPool::TaskVector tasks;
+    for (size_t range_idx = 0; range_idx < range_count; range_idx++) {
+      tasks.push_back([&accumulate_range, range_idx](size_t) {
+        accumulate_range(range_idx);
+      });
+    }
+    ThreadPool::Shared(thread_count).Run(std::move(tasks));
+  }
+  const EigenVectorXd total_entry_weights = entry_weights.colwise().sum();
+  const EigenVectorXd total_range_weights = range_weights.colwise().sum();
+  EigenVectorXd gradient(GPCSPCount());
+  for (size_t idx = 0; idx < GPCSPCount(); idx++) {
+    gradient[idx] = total_entry_weights[idx] -
+                    total_range_weights[range_starts_[idx]] *
+                        exp(normalized_sbn_parameters_in_log[idx]);
+  }
+  return gradient;
+}
+
+EigenVectorXd SBNGradientEngine::Gradient(
+    EigenConstVectorXdRef normalized_sbn_parameters_in_log,
+    const std::vector<UnrootedIndexerRepresentation> &indexer_representations,
+    EigenConstVectorXdRef multiplicative_factors, const size_t thread_count) const {
+  Assert(static_cast<size_t>(multiplicative_factors.size()) ==
+             indexer_representations.size(),
+         "SBNGradientEngine needs a multiplicative factor for each topology.");
+  const size_t gpcsp_count = GPCSPCount();
+  auto cost = [&indexer_representations](const size_t sample_idx) {
+    const auto &indexer_representation = indexer_representations[sample_idx];
+    return static_cast<double>(indexer_representation.size() *
+                               indexer_representation.front().size());
+  };
+  auto accumulate = [&](const size_t sample_idx, double *entry_weights,
+                        double *range_weights) {
+    const auto &indexer_representation = indexer_representations[sample_idx];
+    // The log probability of each rooting, which is -inf for those out of the support.
+    EigenVectorXd log_rooted_probabilities(indexer_representation.size());
+    for (size_t rooting = 0; rooting < indexer_representation.size(); rooting++) {
+      const auto &rooted_representation = indexer_representation[rooting];
+      log_rooted_probabilities[rooting] =
+          SBNProbability::IsInSBNSupport(rooted_representation, gpcsp_count)
+              ? SBNProbability::SumOf(normalized_sbn_parameters_in_log,
+                                      rooted_representation, 0.)
+              : DOUBLE_NEG_INF;
+    }
+    const double log_q = NumericalUtils::LogSum(log_rooted_probabilities);
+    if (log_q == DOUBLE_NEG_INF) {
+      return;
+    }
+    for (size_t rooting = 0; rooting < indexer_representation.size(); rooting++) {
+      if (log_rooted_probabilities[rooting] == DOUBLE_NEG_INF) {
+        continue;
+      }
+      const auto &rooted_representation = indexer_representation[rooting];
+      AccumulateRooting(
+          rooted_representation.data(),
+          rooted_representation.data() + rooted_representation.size(),
+          multiplicative_factors[sample_idx] *
+              exp(log_rooted_probabilities[rooting] - log_q),
+          entry_weights, range_weights);
+    }
+  };
+  return Gradient(normalized_sbn_parameters_in_log, indexer_representations.size(),
+                  cost, accumulate, thread_count);
+}
+
+EigenVectorXd SBNGradientEngine::Gradient(
+    EigenConstVectorXdRef normalized_sbn_parameters_in_log,
+    const IndexerRepresentationMatrix &indexer_representations,
+    EigenConstVectorXdRef multiplicative_factors, const size_t thread_count) const {
+  const auto sample_count = static_cast<size_t>(indexer_representations.rows());
+  Assert(static_cast<size_t>(multiplicative_factors.size()) == sample_count,
+         "SBNGradientEngine needs a multiplicative factor for each topology.");
+  const size_t gpcsp_count = GPCSPCount();
+  const auto length = static_cast<size_t>(indexer_representations.cols());
+  auto accumulate = [&](const size_t sample_idx, double *entry_weights,
+                        double *range_weights) {
+    const size_t *begin = indexer_representations.row(sample_idx).data();
+    const size_t *end = begin + length;
+    // A rooted topology is its only rooting, so its weight is just the factor.
+    if (std::all_of(begin, end,
+                    [gpcsp_count](const size_t idx) { return idx < gpcsp_count; })) {
+      AccumulateRooting(begin, end, multiplicative_factors[sample_idx], entry_weights,
+                        range_weights);
+    }
+  };
+  return Gradient(
+      normalized_sbn_parameters_in_log, sample_count, [](size_t) { return 1.; },
+      accumulate, thread_count);
+}
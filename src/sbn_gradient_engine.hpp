@@ -0,0 +1,68 @@
+// Copyright 2019-2022 bito project contributors.
+// bito is free software under the GPLv3; see LICENSE file for details.
+//
+// Compute the gradient of a weighted sum of log q over a batch of topologies with
+// respect to the SBN parameters, as needed for the VIMCO and RWS estimators of
+// TopologyGradients.
+//
+// The gradient of log q(tau_rho) for a rooting rho of tau (eq:gradLogQ) is 1 at each
+// rootsplit and PCSP of tau_rho minus the probability of each entry in a range that
+// tau_rho picks from, and the gradient of log q(tau) is the mean of these weighted by
+// q(tau_rho) / q(tau). UnrootedSBNInstance::GradientOfLogQ does this one topology at a
+// time, looking up the ranges of each rooting by their subsplits and writing a whole
+// vector per topology. Here we look up the ranges once per support, and note that the
+// probability term only depends on the range. So for each sample we only add its
+// weight to its entries and to a total for each of its ranges, and at the end subtract
+// the range totals times the probabilities in one pass over the parameters.
+//
+// Samples are split over threads, each with its own accumulators, which we then sum.
+
+#pragma once
+
+#include <functional>
+
+#include "sbn_support.hpp"
+
+class SBNGradientEngine {
+ public:
+  SBNGradientEngine() = default;
+  explicit SBNGradientEngine(const SBNSupport &sbn_support);
+
+  size_t GPCSPCount() const { return range_starts_.size(); }
+
+  // The gradient with respect to the SBN parameters of
+  // sum_i multiplicative_factors[i] * log q(tau_i), where the tau_i are given by their
+  // unrooted indexer representations and normalized_sbn_parameters_in_log holds
+  // log-normalized SBN parameters. Rootings that are not in the support are skipped,
+  // as are topologies that have none in the support.
+  EigenVectorXd Gradient(
+      EigenConstVectorXdRef normalized_sbn_parameters_in_log,
+      const std::vector<UnrootedIndexerRepresentation> &indexer_representations,
+      EigenConstVectorXdRef multiplicative_factors, size_t thread_count = 1) const;
+  // The same for rooted topologies, given by the rows of a matrix of rooted indexer
+  // representations.
+  EigenVectorXd Gradient(EigenConstVectorXdRef normalized_sbn_parameters_in_log,
+                         const IndexerRepresentationMatrix &indexer_representations,
+                         EigenConstVectorXdRef multiplicative_factors,
+                         size_t thread_count = 1) const;
+
+ private:
+  // The start of the range of each rootsplit and PCSP, which is 0 for rootsplits.
+  SizeVector range_starts_;
+  // See SBNSupport::SubsplitCladeRanges.
+  std::vector<SizePair> clade_ranges_;
+
+  // Add weight to the entries of the rooted indexer representation in [begin, end), and
+  // to the total of each range it picks from, indexed by the start of the range.
+  void AccumulateRooting(const size_t *begin, const size_t *end, double weight,
+                         double *entry_weights, double *range_weights) const;
+  // Split samples [0, sample_count) into ranges of about equal cost, and run
+  // accumulate(sample_idx, entry_weights, range_weights) on each sample with the
+  // accumulators of its range on thread_count threads. Then put the gradient together
+  // from the summed accumulators.
+  EigenVectorXd Gradient(
+      EigenConstVectorXdRef normalized_sbn_parameters_in_log, size_t sample_count,
+      const std::function<double(size_t)> &cost,
+      const std::function<void(size_t, double *, double *)> &accumulate,
+      size_t thread_count) const;
+};
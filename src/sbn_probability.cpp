@@ -5,13 +5,17 @@
 
 #include <algorithm>
 #include <cmath>
+#include <deque>
 #include <iostream>
+#include <limits>
 #include <numeric>
 #include <utility>
 #include <vector>
 
 #include "ProgressBar.hpp"
 #include "numerical_utils.hpp"
+#include "stopwatch.hpp"
+#include "thread_pool.hpp"
 
 // Increment all entries from an index vector by a log(value).
 void IncrementByInLog(EigenVectorXdRef vec, const SizeVector& indices, double value) {
@@ -209,55 +213,334 @@ void SBNProbability::SimpleAverage(
                parent_to_range);
 }
 
+// The E-step and the counting of the M-step of Algorithm 1: set log_m_bar to the
+// q-weighted counts in log space given the sbn_parameters, and return the log
+// probability of the training topologies.
+using EMCountingStep =
+    std::function<double(EigenConstVectorXdRef sbn_parameters, EigenVectorXdRef)>;
+
+// The EM update of Algorithm 1, as a map on normalized SBN parameters in log space.
+class EMMap {
+ public:
+  // Here log_m_tilde is as in RunExpectationMaximization, already scaled by alpha.
+  EMMap(const EigenVectorXd& log_m_tilde, double alpha, size_t rootsplit_count,
+        const BitsetSizePairMap& parent_to_range, const EMCountingStep& counting_step)
+      : log_m_tilde_(log_m_tilde),
+        log_m_bar_(log_m_tilde.size()),
+        alpha_(alpha),
+        rootsplit_count_(rootsplit_count),
+        parent_to_range_(parent_to_range),
+        counting_step_(counting_step) {
+    if (alpha_ > 0.) {
+      // We also need exp(log_m_tilde) = \alpha * tilde{m}_{s|t} for the regularized EM
+      // algorithm.
+      m_tilde_for_positive_alpha_ = log_m_tilde_.array().exp();
+    }
+  }
+
+  // Set next to the EM update of sbn_parameters, and return the log probability of the
+  // training topologies under sbn_parameters.
+  double Step(EigenConstVectorXdRef sbn_parameters, EigenVectorXd& next) {
+    const double log_p_topologies = counting_step_(sbn_parameters, log_m_bar_);
+    // Store the proper value in next.
+    next = (alpha_ > 0.) ? NumericalUtils::LogAddVectors(log_m_bar_, log_m_tilde_)
+                         : log_m_bar_;
+    Normalize(next);
+    step_count_++;
+    return log_p_topologies;
+  }
+  // The prior term of the score (last line of the section on EM in doc/tex).
+  double Prior(EigenConstVectorXdRef sbn_parameters) const {
+    return (alpha_ > 0.) ? m_tilde_for_positive_alpha_.dot(sbn_parameters) : 0.;
+  }
+  void Normalize(EigenVectorXdRef sbn_parameters) const {
+    SBNProbability::ProbabilityNormalizeParamsInLog(sbn_parameters, rootsplit_count_,
+                                                    parent_to_range_);
+  }
+  size_t StepCount() const { return step_count_; }
+
+ private:
+  EigenVectorXd log_m_tilde_;
+  EigenVectorXd log_m_bar_;
+  EigenVectorXd m_tilde_for_positive_alpha_;
+  double alpha_;
+  size_t rootsplit_count_;
+  const BitsetSizePairMap& parent_to_range_;
+  const EMCountingStep& counting_step_;
+  size_t step_count_ = 0;
+};
+
+// Zero out the entries of a difference of log parameter vectors that aren't finite,
+// which come from parameters that are (or have become) zero.
+EigenVectorXd FiniteDifference(const EigenVectorXd& to, const EigenVectorXd& from) {
+  const EigenVectorXd difference = to - from;
+  return difference.array().isFinite().select(difference, 0.);
+}
+
+// Where an extrapolation in log space isn't finite, fall back to a plain EM iterate.
+void KeepFiniteOrFallBack(EigenVectorXd& extrapolated, const EigenVectorXd& fallback) {
+  extrapolated = extrapolated.array().isFinite().select(extrapolated, fallback);
+}
+
+// SQUAREM, scheme "S3" of Varadhan and Roland (Scand. J. Stat. 2008). Each iteration
+// takes two EM steps, extrapolates along them, and keeps the extrapolation if it
+// doesn't decrease the score. Else it falls back on the second EM step. Long steps in
+// log space can push parameters onto the boundary, from where EM hardly moves, so as
+// in the SQUAREM R package we cap the step length, and let the cap grow by
+// step_length_factor_ while steps that reach it succeed.
+class SQUAREMExtrapolator {
+ public:
+  static constexpr double step_length_factor_ = 4.;
+  // The most EM steps that an iteration takes.
+  static constexpr size_t max_em_step_count_ = 3;
+
+  // Iterate from sbn_parameters, where next is its EM update and score its score. We
+  // update sbn_parameters and next, and return the log probability of the topologies
+  // under the new sbn_parameters.
+  double Iteration(EMMap& em_map, EigenVectorXd& sbn_parameters, EigenVectorXd& next,
+                   const double score) {
+    EigenVectorXd next_next;
+    em_map.Step(next, next_next);
+    const EigenVectorXd r = FiniteDifference(next, sbn_parameters);
+    const EigenVectorXd v = FiniteDifference(next_next, next) - r;
+    const double v_norm = v.norm();
+    // A step length of 1 gives next_next, so we only extrapolate past that.
+    const double unbounded_step_length = (v_norm > 0.) ? r.norm() / v_norm : 1.;
+    const bool at_max_step_length = unbounded_step_length >= max_step_length_;
+    const double step_length = std::min(max_step_length_, unbounded_step_length);
+    if (step_length > 1.) {
+      EigenVectorXd extrapolated =
+          sbn_parameters + 2. * step_length * r + step_length * step_length * v;
+      KeepFiniteOrFallBack(extrapolated, next_next);
+      em_map.Normalize(extrapolated);
+      EigenVectorXd extrapolated_next;
+      const double log_p_topologies = em_map.Step(extrapolated, extrapolated_next);
+      if (log_p_topologies + em_map.Prior(extrapolated) >= score) {
+        if (at_max_step_length) {
+          max_step_length_ *= step_length_factor_;
+        }
+        sbn_parameters = std::move(extrapolated);
+        next = std::move(extrapolated_next);
+        return log_p_topologies;
+      }
+      // else
+      if (at_max_step_length) {
+        max_step_length_ = std::max(1., max_step_length_ / step_length_factor_);
+      }
+    } else if (at_max_step_length) {
+      max_step_length_ *= step_length_factor_;
+    }
+    sbn_parameters = std::move(next_next);
+    return em_map.Step(sbn_parameters, next);
+  }
+
+ private:
+  double max_step_length_ = 1.;
+};
+
+// Anderson mixing of the last few EM steps (type II, as in Walker and Ni, SIAM J.
+// Numer. Anal. 2011), keeping the last anderson_depth_ differences. We keep a mixed
+// iterate if it doesn't decrease the score, and otherwise forget the history and fall
+// back on the EM update.
+class AndersonMixer {
+ public:
+  static constexpr size_t anderson_depth_ = 5;
+  static constexpr double log_parameter_floor_ = -30.;
+  // The most EM steps that an iteration takes.
+  static constexpr size_t max_em_step_count_ = 2;
+
+  // Like SQUAREMExtrapolator::Iteration.
+  double Iteration(EMMap& em_map, EigenVectorXd& sbn_parameters, EigenVectorXd& next,
+                   const double score) {
+    const EigenVectorXd floored_next = Floored(next);
+    const EigenVectorXd residual = floored_next - Floored(sbn_parameters);
+    if (previous_residual_.size() > 0) {
+      residual_differences_.push_back(residual - previous_residual_);
+      next_differences_.push_back(floored_next - previous_next_);
+      if (residual_differences_.size() > anderson_depth_) {
+        residual_differences_.pop_front();
+        next_differences_.pop_front();
+      }
+    }
+    previous_residual_ = residual;
+    previous_next_ = floored_next;
+    if (!residual_differences_.empty()) {
+      const auto depth = static_cast<Eigen::Index>(residual_differences_.size());
+      Eigen::MatrixXd residual_matrix(residual.size(), depth);
+      Eigen::MatrixXd next_matrix(residual.size(), depth);
+      for (Eigen::Index k = 0; k < depth; k++) {
+        residual_matrix.col(k) = residual_differences_[k];
+        next_matrix.col(k) = next_differences_[k];
+      }
+      const EigenVectorXd gamma = residual_matrix.colPivHouseholderQr().solve(residual);
+      EigenVectorXd mixed = next - next_matrix * gamma;
+      KeepFiniteOrFallBack(mixed, next);
+      em_map.Normalize(mixed);
+      EigenVectorXd mixed_next;
+      const double log_p_topologies = em_map.Step(mixed, mixed_next);
+      if (log_p_topologies + em_map.Prior(mixed) >= score) {
+        sbn_parameters = std::move(mixed);
+        next = std::move(mixed_next);
+        return log_p_topologies;
+      }
+      // else
+      Clear();
+    }
+    sbn_parameters = next;
+    return em_map.Step(sbn_parameters, next);
+  }
+
+ private:
+  std::deque<EigenVectorXd> residual_differences_;
+  std::deque<EigenVectorXd> next_differences_;
+  EigenVectorXd previous_residual_;
+  EigenVectorXd previous_next_;
+
+  // Without alpha, EM drives some parameters towards zero, and their log parameters
+  // fall without bound. Such steps would swamp the residuals, so we only mix
+  // parameters above log_parameter_floor_, and leave the rest to EM.
+  static EigenVectorXd Floored(const EigenVectorXd& sbn_parameters) {
+    return sbn_parameters.cwiseMax(log_parameter_floor_);
+  }
+
+  void Clear() {
+    residual_differences_.clear();
+    next_differences_.clear();
+    previous_residual_.resize(0);
+  }
+};
+
 // All references to equations, etc, are to the 2018 NeurIPS paper.
 // However, if you are doing a detailed read see doc/tex, because our definition of
 // score differs from that in the NeurIPS paper, and also for details of how the prior
 // calculation works.
-EigenVectorXd SBNProbability::ExpectationMaximization(
-    EigenVectorXdRef sbn_parameters,
-    const UnrootedIndexerRepresentationCounter& indexer_representation_counter,
+// Here log_m_tilde holds the log counts of the rootsplits and PCSPs over all
+// rootings, and counting_step does the per-topology work of each EM iteration.
+// max_iter is the number of EM steps (an E-step and an M-step each) that we may take.
+EigenVectorXd RunExpectationMaximization(
+    EigenVectorXdRef sbn_parameters, EigenVectorXd log_m_tilde, size_t edge_count,
     size_t rootsplit_count, const BitsetSizePairMap& parent_to_range, double alpha,
-    size_t max_iter, double score_epsilon) {
-  Assert(!indexer_representation_counter.empty(),
-         "Empty indexer_representation_counter.");
-  auto edge_count = indexer_representation_counter[0].first.size();
-  // The \bar{m} vectors (Algorithm 1) in log space.
-  // They are packed into a single vector as sbn_parameters is.
-  EigenVectorXd log_m_bar(sbn_parameters.size());
-  // The q weight of a rootsplit is the probability of each rooting given the current
-  // SBN parameters.
-  EigenVectorXd log_q_weights(edge_count);
+    size_t max_iter, double score_epsilon, const EMCountingStep& counting_step,
+    SBNProbability::EMAcceleration acceleration, SBNProbability::EMTrace* trace) {
+  using SBNProbability::EMAcceleration;
+  Stopwatch timer(true, Stopwatch::TimeScale::SecondScale);
   // The \tilde{m} vectors (p.6): the counts vector before normalization to get the
   // SimpleAverage estimate. If alpha is nonzero log_m_tilde gets scaled by it below.
-  EigenVectorXd log_m_tilde(sbn_parameters.size());
-  SetLogCounts(log_m_tilde, indexer_representation_counter, rootsplit_count,
-               parent_to_range);
   // m_tilde is the counts, but marginalized over a uniform distribution on the rooting
   // edge. Thus we take the total counts and then divide by the edge count.
   log_m_tilde = log_m_tilde.array() - log(static_cast<double>(edge_count));
   // The normalized version of m_tilde is the SA estimate, which is our starting point.
-  sbn_parameters = log_m_tilde;
-  // We need to ensure sbn_parameters is normalized as we are computing log P(S_1, T^u)
-  // repeatedly.
-  ProbabilityNormalizeParamsInLog(sbn_parameters, rootsplit_count, parent_to_range);
-  // We need an exponentiated version of log_m_tilde for the score calculation if alpha
-  // is nonzero.
-  EigenVectorXd m_tilde_for_positive_alpha;
+  EigenVectorXd current_parameters = log_m_tilde;
+  // For the regularized case, we always need log(alpha) + log_m_tilde so we store
+  // this in log_m_tilde.
   if (alpha > 0.) {
-    // For the regularized case, we always need log(alpha) + log_m_tilde so we store
-    // this in log_m_tilde.
     log_m_tilde = log_m_tilde.array() + log(alpha);
-    // We also need exp(log_m_tilde) = \alpha * tilde{m}_{s|t} for the regularized EM
-    // algorithm.
-    m_tilde_for_positive_alpha = log_m_tilde.array().exp();
+  }
+  EMMap em_map(log_m_tilde, alpha, rootsplit_count, parent_to_range, counting_step);
+  // We need to ensure sbn_parameters is normalized as we are computing log P(S_1, T^u)
+  // repeatedly.
+  em_map.Normalize(current_parameters);
+  // The EM update of current_parameters, and the log probability of the topologies
+  // under them.
+  EigenVectorXd next;
+  double log_p_topologies = 0.;
+  if (acceleration != EMAcceleration::None && max_iter > 0) {
+    log_p_topologies = em_map.Step(current_parameters, next);
+  }
+  SQUAREMExtrapolator squarem_extrapolator;
+  AndersonMixer anderson_mixer;
+  // Plain EM takes an EM step per iteration. An accelerated iteration takes a varying
+  // number, so we only start one while it can't take us over max_iter.
+  size_t max_em_step_count = 1;
+  if (acceleration == EMAcceleration::SQUAREM) {
+    max_em_step_count = SQUAREMExtrapolator::max_em_step_count_;
+  } else if (acceleration == EMAcceleration::Anderson) {
+    max_em_step_count = AndersonMixer::max_em_step_count_;
   }
   // Our score is the marginal log likelihood of the training collection of trees (see
-  // doc/tex).
+  // doc/tex). With plain EM, an iteration scores the topologies before its update and
+  // the prior after it. Accelerated EM can't be scored that way, as it doesn't move to
+  // the EM update, so there an iteration has the score of its starting point.
   EigenVectorXd score_history = EigenVectorXd::Zero(max_iter);
-  // Do the specified number of EM loops.
+  EigenVectorXd seconds = EigenVectorXd::Zero(max_iter);
+  SizeVector em_step_counts(max_iter);
+  size_t iteration_count = 0;
+  // Do EM loops until we converge or run out of EM steps. The progress bar counts EM
+  // steps.
   ProgressBar progress_bar(max_iter);
-  for (size_t em_idx = 0; em_idx < max_iter; ++em_idx) {
+  size_t progress_step_count = 0;
+  for (size_t em_idx = 0; em_map.StepCount() + max_em_step_count <= max_iter;
+       ++em_idx) {
+    if (acceleration == EMAcceleration::None) {
+      score_history[em_idx] += em_map.Step(current_parameters, current_parameters);
+      score_history[em_idx] += em_map.Prior(current_parameters);
+    } else {
+      const double score = log_p_topologies + em_map.Prior(current_parameters);
+      score_history[em_idx] = score;
+      log_p_topologies =
+          (acceleration == EMAcceleration::SQUAREM)
+              ? squarem_extrapolator.Iteration(em_map, current_parameters, next, score)
+              : anderson_mixer.Iteration(em_map, current_parameters, next, score);
+    }
+    seconds[em_idx] = timer.GetElapsedOfCurrentInterval();
+    em_step_counts[em_idx] = em_map.StepCount();
+    iteration_count = em_idx + 1;
+    // Return if we've converged according to score.
+    if (em_idx > 0) {
+      double scaled_score_improvement =
+          (score_history[em_idx] - score_history[em_idx - 1]) /
+          fabs(score_history[em_idx - 1]);
+      // To monitor correctness of EM, we check to ensure that the score is
+      // monotonically increasing (modulo numerical instability).
+      // SHJ: -EPS is too small, I noticed the assertion failure for
+      // scaled_score_improvement of -6e-16. Using ERR_TOLERANCE.
+      Assert(scaled_score_improvement > -ERR_TOLERANCE, "Score function decreased.");
+      if (fabs(scaled_score_improvement) < score_epsilon) {
+        std::cout << "EM converged according to normalized score improvement < "
+                  << score_epsilon << "." << std::endl;
+        break;
+      }
+    }
+    for (; progress_step_count < em_map.StepCount(); progress_step_count++) {
+      ++progress_bar;
+    }
+    progress_bar.display();
+  }  // End of EM loop.
+  progress_bar.done();
+  NumericalUtils::ReportFloatingPointEnvironmentExceptions("|After EM|");
+  sbn_parameters = current_parameters;
+  score_history.conservativeResize(iteration_count);
+  if (trace != nullptr) {
+    trace->score_history_ = score_history;
+    trace->seconds_ = seconds.head(iteration_count);
+    trace->em_step_counts_.assign(em_step_counts.begin(),
+                                  em_step_counts.begin() + iteration_count);
+  }
+  return score_history;
+}
+
+EigenVectorXd SBNProbability::ExpectationMaximization(
+    EigenVectorXdRef sbn_parameters,
+    const UnrootedIndexerRepresentationCounter& indexer_representation_counter,
+    size_t rootsplit_count, const BitsetSizePairMap& parent_to_range, double alpha,
+    size_t max_iter, double score_epsilon, EMAcceleration acceleration,
+    EMTrace* trace) {
+  Assert(!indexer_representation_counter.empty(),
+         "Empty indexer_representation_counter.");
+  auto edge_count = indexer_representation_counter[0].first.size();
+  // The q weight of a rootsplit is the probability of each rooting given the current
+  // SBN parameters.
+  EigenVectorXd log_q_weights(edge_count);
+  EigenVectorXd log_m_tilde(sbn_parameters.size());
+  SetLogCounts(log_m_tilde, indexer_representation_counter, rootsplit_count,
+               parent_to_range);
+  auto counting_step = [&](EigenConstVectorXdRef sbn_parameters,
+                           EigenVectorXdRef log_m_bar) {
+    double log_p_topologies = 0.;
     log_m_bar.setConstant(DOUBLE_NEG_INF);
+    // We take a raised overflow or underflow flag below for one in SumOf, so we clear
+    // any that were left raised before, e.g. by normalizing the parameters.
+    feclearexcept(FE_OVER_AND_UNDER_FLOW_EXCEPT);
     // Loop over topologies (as manifested by their indexer representations).
     for (const auto& [indexer_representation, int_topology_count] :
          indexer_representation_counter) {
@@ -285,7 +568,7 @@ EigenVectorXd SBNProbability::ExpectationMaximization(
         }
       }  // End of looping over rooting positions.
       double log_p_unrooted_topology = NumericalUtils::LogSum(log_q_weights);
-      score_history[em_idx] += topology_count * log_p_unrooted_topology;
+      log_p_topologies += topology_count * log_p_unrooted_topology;
       // Normalize q_weights to achieve the E-step of Algorithm 1.
       // For the increment step (M-step of Algorithm 1) we want a full topology
       // count rather than just the unique count. So we multiply the q_weights by the
@@ -295,39 +578,168 @@ EigenVectorXd SBNProbability::ExpectationMaximization(
       // Increment the SBN-parameters-to-be by the q-weighted counts.
       IncrementByInLog(log_m_bar, indexer_representation, log_q_weights);
     }  // End of looping over topologies.
-    // Store the proper value in sbn_parameters.
-    sbn_parameters = (alpha > 0.)
-                         ? NumericalUtils::LogAddVectors(log_m_bar, log_m_tilde)
-                         : log_m_bar;
-    // We normalize sbn_parameters right away to ensure that it is always normalized.
-    ProbabilityNormalizeParamsInLog(sbn_parameters, rootsplit_count, parent_to_range);
-    if (alpha > 0.) {
-      // Last line of the section on EM in doc/tex.
-      score_history[em_idx] += m_tilde_for_positive_alpha.dot(sbn_parameters);
+    return log_p_topologies;
+  };
+  return RunExpectationMaximization(sbn_parameters, std::move(log_m_tilde), edge_count,
+                                    rootsplit_count, parent_to_range, alpha, max_iter,
+                                    score_epsilon, counting_step, acceleration, trace);
+}
+
+EigenVectorXd SBNProbability::ExpectationMaximization(
+    EigenVectorXdRef sbn_parameters,
+    const PackedIndexerRepresentationCounter& packed_counter, size_t rootsplit_count,
+    const BitsetSizePairMap& parent_to_range, double alpha, size_t max_iter,
+    double score_epsilon, size_t thread_count, EMAcceleration acceleration,
+    EMTrace* trace) {
+  Assert(packed_counter.TopologyCount() > 0, "Empty packed_counter.");
+  EigenVectorXd log_m_tilde(sbn_parameters.size());
+  packed_counter.SetCounts(log_m_tilde);
+  log_m_tilde = log_m_tilde.array().log();
+  auto counting_step = [&](EigenConstVectorXdRef sbn_parameters,
+                           EigenVectorXdRef log_m_bar) {
+    return packed_counter.ExpectedLogCounts(sbn_parameters, log_m_bar, thread_count);
+  };
+  return RunExpectationMaximization(
+      sbn_parameters, std::move(log_m_tilde), packed_counter.RootingCount(),
+      rootsplit_count, parent_to_range, alpha, max_iter, score_epsilon, counting_step,
+      acceleration, trace);
+}
+
+// ** PackedIndexerRepresentationCounter
+
+SBNProbability::PackedIndexerRepresentationCounter::PackedIndexerRepresentationCounter(
+    const UnrootedIndexerRepresentationCounter& indexer_representation_counter) {
+  Assert(!indexer_representation_counter.empty(),
+         "Empty indexer_representation_counter.");
+  rooting_count_ = indexer_representation_counter[0].first.size();
+  topology_counts_.resize(indexer_representation_counter.size());
+  index_offsets_.reserve(indexer_representation_counter.size() * rooting_count_ + 1);
+  index_offsets_.push_back(0);
+  for (size_t topology_idx = 0; topology_idx < indexer_representation_counter.size();
+       topology_idx++) {
+    const auto& [indexer_representation, int_topology_count] =
+        indexer_representation_counter[topology_idx];
+    Assert(indexer_representation.size() == rooting_count_,
+           "Indexer representation length is not constant.");
+    topology_counts_[topology_idx] = static_cast<double>(int_topology_count);
+    for (const auto& rooted_representation : indexer_representation) {
+      for (const auto idx : rooted_representation) {
+        Assert(idx <= std::numeric_limits<uint32_t>::max(),
+               "Too many SBN parameters for PackedIndexerRepresentationCounter.");
+        indices_.push_back(static_cast<uint32_t>(idx));
+      }
+      index_offsets_.push_back(indices_.size());
     }
-    // Return if we've converged according to score.
-    if (em_idx > 0) {
-      double scaled_score_improvement =
-          (score_history[em_idx] - score_history[em_idx - 1]) /
-          fabs(score_history[em_idx - 1]);
-      // To monitor correctness of EM, we check to ensure that the score is
-      // monotonically increasing (modulo numerical instability).
-      // SHJ: -EPS is too small, I noticed the assertion failure for
-      // scaled_score_improvement of -6e-16. Using ERR_TOLERANCE.
-      Assert(scaled_score_improvement > -ERR_TOLERANCE, "Score function decreased.");
-      if (fabs(scaled_score_improvement) < score_epsilon) {
-        std::cout << "EM converged according to normalized score improvement < "
-                  << score_epsilon << "." << std::endl;
-        score_history.resize(em_idx + 1);
-        break;
+  }
+}
+
+void SBNProbability::PackedIndexerRepresentationCounter::ForEachTopologyRange(
+    const size_t thread_count,
+    const std::function<void(size_t, size_t, size_t)>& f) const {
+  if (thread_count < 2) {
+    f(0, 0, TopologyCount());
+    return;
+  }
+  // else
+  // We give each range its own slot rather than each worker, so that the results don't
+  // depend on which worker takes which range.
+  const auto boundaries = ThreadPool::ChunkBoundaries(
+      TopologyCount(),
+      [this](const size_t topology_idx) {
+        const size_t row = topology_idx * rooting_count_;
+        return static_cast<double>(index_offsets_[row + rooting_count_] -
+                                   index_offsets_[row]);
+      },
+      thread_count);
+  ThreadPool::TaskVector tasks;
+  for (size_t range_idx = 0; range_idx + 1 < boundaries.size(); range_idx++) {
+    tasks.push_back([&f, &boundaries, range_idx](size_t) {
+      f(range_idx, boundaries[range_idx], boundaries[range_idx + 1]);
+    });
+  }
+  ThreadPool::Shared(thread_count).Run(std::move(tasks));
+}
+
+void SBNProbability::PackedIndexerRepresentationCounter::SetCounts(
+    EigenVectorXdRef counts) const {
+  counts.setZero();
+  for (size_t topology_idx = 0; topology_idx < TopologyCount(); topology_idx++) {
+    const size_t row_begin = topology_idx * rooting_count_;
+    for (size_t idx = index_offsets_[row_begin];
+         idx < index_offsets_[row_begin + rooting_count_]; idx++) {
+      counts[indices_[idx]] += topology_counts_[topology_idx];
+    }
+  }
+}
+
+double SBNProbability::PackedIndexerRepresentationCounter::ExpectedLogCounts(
+    EigenConstVectorXdRef sbn_parameters, EigenVectorXdRef log_m_bar,
+    const size_t thread_count) const {
+  // We count in linear space, which is much faster than adding in log space. However,
+  // once EM drives parameters towards zero, some q-weighted counts underflow, and
+  // rounding them to zero would zero out their parameters. Such counts go to a
+  // log-space tally instead.
+  const double log_smallest_count = std::log(std::numeric_limits<double>::min());
+  const size_t range_count = std::max(thread_count, size_t(1));
+  // Each range counts into its own row, and we sum them at the end.
+  EigenMatrixXd range_m_bars = EigenMatrixXd::Zero(range_count, log_m_bar.size());
+  EigenMatrixXd range_log_tiny_m_bars =
+      EigenMatrixXd::Constant(range_count, log_m_bar.size(), DOUBLE_NEG_INF);
+  EigenVectorXd range_log_p = EigenVectorXd::Zero(range_count);
+  ForEachTopologyRange(thread_count, [&](const size_t range_idx, const size_t begin,
+                                         const size_t end) {
+    double *range_m_bar = range_m_bars.row(range_idx).data();
+    double *range_log_tiny_m_bar = range_log_tiny_m_bars.row(range_idx).data();
+    EigenVectorXd log_q_weights(rooting_count_);
+    for (size_t topology_idx = begin; topology_idx < end; topology_idx++) {
+      const size_t row_begin = topology_idx * rooting_count_;
+      // E-step: gather the SBN probability of each rooting of this topology.
+      for (size_t rooting = 0; rooting < rooting_count_; rooting++) {
+        const size_t row = row_begin + rooting;
+        double log_p_rooted_topology = 0.;
+        for (size_t idx = index_offsets_[row]; idx < index_offsets_[row + 1]; idx++) {
+          log_p_rooted_topology += sbn_parameters[indices_[idx]];
+        }
+        // Sums of very negative parameters can overflow, as in the serial version.
+        log_q_weights[rooting] =
+            std::isinf(log_p_rooted_topology) ? DOUBLE_MINIMUM : log_p_rooted_topology;
+      }
+      const double max_log_q = log_q_weights.maxCoeff();
+      const double log_p_unrooted_topology =
+          max_log_q + log((log_q_weights.array() - max_log_q).exp().sum());
+      const double topology_count = topology_counts_[topology_idx];
+      range_log_p[range_idx] += topology_count * log_p_unrooted_topology;
+      // M-step: scatter the q-weighted topology count of each rooting.
+      const double log_topology_count = log(topology_count);
+      for (size_t rooting = 0; rooting < rooting_count_; rooting++) {
+        const size_t row = row_begin + rooting;
+        const double log_q_weight =
+            log_topology_count + log_q_weights[rooting] - log_p_unrooted_topology;
+        if (log_q_weight >= log_smallest_count) {
+          const double q_weight = exp(log_q_weight);
+          for (size_t idx = index_offsets_[row]; idx < index_offsets_[row + 1]; idx++) {
+            range_m_bar[indices_[idx]] += q_weight;
+          }
+        } else {
+          for (size_t idx = index_offsets_[row]; idx < index_offsets_[row + 1]; idx++) {
+            range_log_tiny_m_bar[indices_[idx]] = NumericalUtils::LogAdd(
+                range_log_tiny_m_bar[indices_[idx]], log_q_weight);
+          }
+        }
       }
     }
-    ++progress_bar;
-    progress_bar.display();
-  }  // End of EM loop.
-  progress_bar.done();
-  NumericalUtils::ReportFloatingPointEnvironmentExceptions("|After EM|");
-  return score_history;
+  });
+  log_m_bar = range_m_bars.colwise().sum().transpose().array().log();
+  for (Eigen::Index range_idx = 0; range_idx < range_log_tiny_m_bars.rows();
+       range_idx++) {
+    for (Eigen::Index idx = 0; idx < log_m_bar.size(); idx++) {
+      const double log_tiny_m_bar = range_log_tiny_m_bars(range_idx, idx);
+      if (log_tiny_m_bar > DOUBLE_NEG_INF) {
+        log_m_bar[idx] = NumericalUtils::LogAdd(log_m_bar[idx], log_tiny_m_bar);
+      }
+    }
+  }
+  return range_log_p.sum();
 }
 
 bool SBNProbability::IsInSBNSupport(
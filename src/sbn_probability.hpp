@@ -8,11 +8,51 @@
 
 #pragma once
 
+#include <cstdint>
+#include <functional>
+
 #include "eigen_sugar.hpp"
 #include "sbn_maps.hpp"
 
 namespace SBNProbability {
 
+// An UnrootedIndexerRepresentationCounter packed into flat CSR-style arrays for EM.
+// Rooting r of topology t is row t * RootingCount() + r, and its rooted representation
+// is indices_[index_offsets_[row]] up to indices_[index_offsets_[row + 1]]. The E-step
+// is then a gather and the M-step a scatter over these rows, which we split across
+// threads by topology.
+class PackedIndexerRepresentationCounter {
+ public:
+  explicit PackedIndexerRepresentationCounter(
+      const UnrootedIndexerRepresentationCounter& indexer_representation_counter);
+
+  size_t TopologyCount() const { return static_cast<size_t>(topology_counts_.size()); }
+  size_t RootingCount() const { return rooting_count_; }
+  const EigenVectorXd& TopologyCounts() const { return topology_counts_; }
+
+  // Set counts to the number of times each rootsplit and PCSP appears over all
+  // rootings of the topologies, each topology counted as many times as it was seen.
+  void SetCounts(EigenVectorXdRef counts) const;
+  // Do the E-step of Algorithm 1 and the counting of its M-step: set log_m_bar to the
+  // log of the q-weighted counts of the rootsplits and PCSPs given the sbn_parameters
+  // (which are in log space). Returns the log probability of the topologies, each
+  // counted as many times as it was seen. Topologies are split over thread_count
+  // threads, which each count into their own vector.
+  double ExpectedLogCounts(EigenConstVectorXdRef sbn_parameters,
+                           EigenVectorXdRef log_m_bar, size_t thread_count) const;
+
+ private:
+  size_t rooting_count_ = 0;
+  EigenVectorXd topology_counts_;
+  SizeVector index_offsets_;
+  std::vector<uint32_t> indices_;
+
+  // Run f(m_bar_idx, begin, end) on consecutive ranges of topologies of about equal
+  // size, one per thread.
+  void ForEachTopologyRange(
+      size_t thread_count, const std::function<void(size_t, size_t, size_t)>& f) const;
+};
+
 // The "SBN-SA" estimator described in the "Maximum Lower Bound Estimates" section of
 // the 2018 NeurIPS paper.
 void SimpleAverage(
@@ -25,14 +65,46 @@ void SimpleAverage(
     const RootedIndexerRepresentationCounter& indexer_representation_counter,
     size_t rootsplit_count, const BitsetSizePairMap& parent_to_range);
 
+// EM is a fixed-point iteration on the SBN parameters, which we can speed up by
+// extrapolating from recent EM steps (in log space). Both methods fall back on plain EM
+// steps whenever extrapolating would decrease the score, so they keep the fixed points
+// of EM. Whether they take fewer EM steps to converge depends on the problem: when EM
+// drives parameters towards zero, as it does without alpha, extrapolating often fails,
+// and Anderson mixing can take more EM steps than plain EM.
+// * SQUAREM: scheme "S3" of Varadhan and Roland (2008), which extrapolates along the
+//   last two EM steps. An iteration takes two or three EM steps.
+// * Anderson: Anderson mixing of the last few EM steps. An iteration takes one or two
+//   EM steps.
+enum class EMAcceleration { None, SQUAREM, Anderson };
+
+// What a run of EM did, by iteration.
+struct EMTrace {
+  EigenVectorXd score_history_;
+  // The wall time in seconds from the start of EM to the end of each iteration.
+  EigenVectorXd seconds_;
+  // The number of EM steps (an E-step and an M-step each) taken by the end of each
+  // iteration.
+  SizeVector em_step_counts_;
+};
+
 // The "SBN-EM" estimator described in the "Expectation Maximization" section of
 // the 2018 NeurIPS paper. Returns the sequence of scores (defined in the paper)
-// obtained by the EM iterations.
+// obtained by the EM iterations, and fills in the trace if given. max_iter bounds the
+// number of EM steps, of which an accelerated iteration takes several.
 EigenVectorXd ExpectationMaximization(
     EigenVectorXdRef sbn_parameters,
     const UnrootedIndexerRepresentationCounter& indexer_representation_counter,
     size_t rootsplit_count, const BitsetSizePairMap& parent_to_range, double alpha,
-    size_t max_iter, double score_epsilon);
+    size_t max_iter, double score_epsilon,
+    EMAcceleration acceleration = EMAcceleration::None, EMTrace* trace = nullptr);
+// The same estimator run over a PackedIndexerRepresentationCounter on thread_count
+// threads. Results match the above up to rounding.
+EigenVectorXd ExpectationMaximization(
+    EigenVectorXdRef sbn_parameters,
+    const PackedIndexerRepresentationCounter& packed_counter, size_t rootsplit_count,
+    const BitsetSizePairMap& parent_to_range, double alpha, size_t max_iter,
+    double score_epsilon, size_t thread_count,
+    EMAcceleration acceleration = EMAcceleration::None, EMTrace* trace = nullptr);
 
 // Calculate the probability of an indexer_representation of a rooted topology.
 double ProbabilityOfSingle(EigenConstVectorXdRef sbn_parameters,
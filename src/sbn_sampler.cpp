@@ -0,0 +1,128 @@
+// Copyright 2019-2022 bito project contributors.
+// bito is free software under the GPLv3; see LICENSE file for details.
+
+#include "sbn_sampler.hpp"
+
+#include <random>
+
+#include "thread_pool.hpp"
+
+SBNSampler::SBNSampler(const SBNSupport &sbn_support,
+                       EigenConstVectorXdRef normalized_sbn_parameters)
+    : rootsplit_count_(sbn_support.RootsplitCount()),
+      representation_length_(sbn_support.TaxonCount() - 1),
+      alias_probabilities_(sbn_support.GPCSPCount()),
+      aliases_(sbn_support.GPCSPCount()),
+      clade_ranges_(sbn_support.SubsplitCladeRanges()) {
+  Assert(static_cast<size_t>(normalized_sbn_parameters.size()) == GPCSPCount(),
+         "SBNSampler needs a parameter for each rootsplit and PCSP of the support.");
+  Assert(rootsplit_count_ > 0, "SBNSampler needs a nonempty support.");
+  BuildAliasTable(normalized_sbn_parameters, {0, rootsplit_count_});
+  for (const auto &[parent, range] : sbn_support.ParentToRange()) {
+    BuildAliasTable(normalized_sbn_parameters, range);
+  }
+}
+
+void SBNSampler::BuildAliasTable(EigenConstVectorXdRef normalized_sbn_parameters,
+                                 const SizePair range) {
+  const auto &[start, end] = range;
+  Assert(start < end && end <= GPCSPCount(), "BuildAliasTable given an invalid range.");
+  const size_t range_size = end - start;
+  // Scale the probabilities so that they average 1, and pair off the positions below 1
+  // with those above it (Vose, IEEE Trans. Softw. Eng. 1991).
+  EigenVectorXd scaled = normalized_sbn_parameters.segment(start, range_size);
+  scaled *= static_cast<double>(range_size) / scaled.sum();
+  SizeVector small, large;
+  for (size_t k = 0; k < range_size; k++) {
+    (scaled[k] < 1. ? small : large).push_back(k);
+  }
+  while (!small.empty() && !large.empty()) {
+    const size_t less = small.back();
+    small.pop_back();
+    const size_t more = large.back();
+    alias_probabilities_[start + less] = scaled[less];
+    aliases_[start + less] = start + more;
+    scaled[more] -= 1. - scaled[less];
+    if (scaled[more] < 1.) {
+      large.pop_back();
+      small.push_back(more);
+    }
+  }
+  // What is left is 1 up to rounding.
+  for (const auto &remaining : {small, large}) {
+    for (const size_t k : remaining) {
+      alias_probabilities_[start + k] = 1.;
+      aliases_[start + k] = start + k;
+    }
+  }
+}
+
+template <typename Generator>
+void SBNSampler::SampleRange(size_t *representations, const size_t begin,
+                             const size_t end, Generator &generator) const {
+  // Draw from the alias table of a range, using the top 53 bits of one random number
+  // for both the position and the coin.
+  auto draw = [this, &generator](const SizePair &range) {
+    const auto &[start, range_end] = range;
+    const double u = static_cast<double>(generator() >> 11) * 0x1.0p-53 *
+                     static_cast<double>(range_end - start);
+    const auto position = std::min(static_cast<size_t>(u), range_end - start - 1);
+    const size_t idx = start + position;
+    return (u - static_cast<double>(position) < alias_probabilities_[idx])
+               ? idx
+               : aliases_[idx];
+  };
+  // The clades still to sample, as their child ranges.
+  std::vector<SizePair> pending;
+  pending.reserve(representation_length_);
+  for (size_t sample_idx = begin; sample_idx < end; sample_idx++) {
+    size_t *representation = representations + sample_idx * representation_length_;
+    size_t written = 0;
+    size_t idx = draw({0, rootsplit_count_});
+    while (true) {
+      Assert(written < representation_length_,
+             "SBNSampler sampled a topology with too many internal nodes.");
+      representation[written++] = idx;
+      for (size_t side = 0; side < 2; side++) {
+        if (clade_ranges_[2 * idx + side] != SBNSupport::leaf_clade_range_) {
+          pending.push_back(clade_ranges_[2 * idx + side]);
+        }
+      }
+      if (pending.empty()) {
+        break;
+      }
+      idx = draw(pending.back());
+      pending.pop_back();
+    }
+    Assert(written == representation_length_,
+           "SBNSampler sampled a topology with too few internal nodes.");
+  }
+}
+
+void SBNSampler::Sample(size_t *representations, const size_t sample_count,
+                        const uint64_t seed, const size_t thread_count) const {
+  Assert(representation_length_ > 0, "SBNSampler has no alias tables to sample from.");
+  const size_t block_count =
+      (sample_count + stream_block_size_ - 1) / stream_block_size_;
+  auto sample_block = [&](const size_t block_idx) {
+    std::seed_seq seed_sequence = {static_cast<uint32_t>(seed),
+                                   static_cast<uint32_t>(seed >> 32),
+                                   static_cast<uint32_t>(block_idx)};
+    std::mt19937_64 generator(seed_sequence);
+    const size_t begin = block_idx * stream_block_size_;
+    SampleRange(representations, begin,
+                std::min(begin + stream_block_size_, sample_count), generator);
+  };
+  if (thread_count < 2 || block_count < 2) {
+    for (size_t block_idx = 0; block_idx < block_count; block_idx++) {
+      sample_block(block_idx);
+    }
+    return;
+  }
+  // else
+  ThreadPool::TaskVector tasks;
+  for (size_t block_idx = 0; block_idx < block_count; block_idx++) {
+    tasks.push_back([&sample_block, block_idx](size_t) { sample_block(block_idx); });
+  }
+  ThreadPool::Shared(thread_count).Run(std::move(tasks));
+}
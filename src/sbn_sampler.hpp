@@ -0,0 +1,66 @@
+// Copyright 2019-2022 bito project contributors.
+// bito is free software under the GPLv3; see LICENSE file for details.
+//
+// Sample rooted topologies from an SBN as rooted indexer representations, using alias
+// tables.
+//
+// GenericSBNInstance::SampleTopology normalizes the parameters of a child range and
+// builds a std::discrete_distribution at every internal node of every sample, and looks
+// up the range of each child clade by its subsplit. Here we do all of that once per set
+// of parameters: for each range of the SBN parameters we build a Walker alias table
+// (using Vose's method), so that drawing from it takes one random number and one
+// comparison, and for each rootsplit and PCSP we store the ranges of the two clades
+// below its subsplit.
+//
+// A sample is written as the rooted indexer representation of the sampled topology
+// (see RootedSBNMaps::IndexerRepresentationOf): its rootsplit index followed by the
+// indices of its PCSPs, here in preorder. All representations have
+// RepresentationLength() entries, so a batch of samples fits in a preallocated buffer
+// with a row per sample.
+//
+// Samples are drawn in blocks of stream_block_size_, each with its own std::mt19937_64
+// seeded from the seed and the block index, and the blocks are spread over threads.
+// The samples thus only depend on the seed, not on the number of threads.
+
+#pragma once
+
+#include "sbn_support.hpp"
+
+class SBNSampler {
+ public:
+  static constexpr size_t stream_block_size_ = 4096;
+
+  SBNSampler() = default;
+  // Build the alias tables for normalized_sbn_parameters, which are in linear space and
+  // indexed by the support.
+  SBNSampler(const SBNSupport &sbn_support,
+             EigenConstVectorXdRef normalized_sbn_parameters);
+
+  size_t GPCSPCount() const { return alias_probabilities_.size(); }
+  // The number of entries in each rooted indexer representation: the rootsplit and a
+  // PCSP for each of the other internal nodes.
+  size_t RepresentationLength() const { return representation_length_; }
+
+  // Sample sample_count topologies on thread_count threads, writing the rooted indexer
+  // representation of sample i to representations[i * RepresentationLength()] and on.
+  void Sample(size_t *representations, size_t sample_count, uint64_t seed,
+              size_t thread_count) const;
+
+ private:
+  size_t rootsplit_count_ = 0;
+  size_t representation_length_ = 0;
+  // The alias table: drawing position k of a range keeps k with probability
+  // alias_probabilities_[k], and otherwise moves to aliases_[k].
+  EigenVectorXd alias_probabilities_;
+  SizeVector aliases_;
+  // The child ranges of the two clades of the subsplit of each rootsplit and PCSP; see
+  // SBNSupport::SubsplitCladeRanges.
+  std::vector<SizePair> clade_ranges_;
+
+  void BuildAliasTable(EigenConstVectorXdRef normalized_sbn_parameters,
+                       SizePair range);
+  // Sample samples [begin, end) of a block with the given generator.
+  template <typename Generator>
+  void SampleRange(size_t *representations, size_t begin, size_t end,
+                   Generator &generator) const;
+};
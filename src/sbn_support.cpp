@@ -3,6 +3,8 @@
 
 #include "sbn_support.hpp"
 
+#include <array>
+
 StringVector SBNSupport::PrettyIndexer() const {
   StringVector pretty_representation(indexer_.size());
   for (const auto& [key, idx] : indexer_) {
@@ -42,3 +44,25 @@ void SBNSupport::ProbabilityNormalizeSBNParametersInLog(
   SBNProbability::ProbabilityNormalizeParamsInLog(sbn_parameters, rootsplits_.size(),
                                                   parent_to_child_range_);
 }
+
+std::vector<SizePair> SBNSupport::SubsplitCladeRanges() const {
+  std::vector<SizePair> clade_ranges(2 * GPCSPCount(), leaf_clade_range_);
+  for (size_t idx = 0; idx < GPCSPCount(); idx++) {
+    const Bitset &subsplit =
+        (idx < RootsplitCount()) ? RootsplitsAt(idx) : IndexToChildAt(idx);
+    const std::array<Bitset, 2> turned_subsplits = {subsplit,
+                                                    subsplit.SubsplitRotate()};
+    for (size_t side = 0; side < 2; side++) {
+      const Bitset &turned = turned_subsplits[side];
+      if (turned.SubsplitGetClade(SubsplitClade::Right).SingletonOption()) {
+        continue;
+      }
+      if (!ParentInSupport(turned)) {
+        Failwith("SubsplitCladeRanges: the support has no children for clade " +
+                 turned.SubsplitGetClade(SubsplitClade::Right).ToString() + ".");
+      }
+      clade_ranges[2 * idx + side] = ParentToRangeAt(turned);
+    }
+  }
+  return clade_ranges;
+}
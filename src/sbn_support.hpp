@@ -18,6 +18,10 @@
 #include "psp_indexer.hpp"
 #include "sbn_probability.hpp"
 
+// A batch of rooted indexer representations of the same length, one per row.
+using IndexerRepresentationMatrix =
+    Eigen::Matrix<size_t, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+
 class SBNSupport {
  public:
   explicit SBNSupport(StringVector taxon_names)
@@ -59,6 +63,13 @@ class SBNSupport {
 
   void ProbabilityNormalizeSBNParametersInLog(EigenVectorXdRef sbn_parameters) const;
 
+  // For each rootsplit and PCSP, the child ranges of the two clades of its subsplit, at
+  // 2 * idx and 2 * idx + 1. As in GenericSBNInstance::SampleTopology, the child range
+  // of a clade is that of the subsplit turned so that the clade is on the right. A
+  // clade that is a leaf gets the empty range leaf_clade_range_.
+  std::vector<SizePair> SubsplitCladeRanges() const;
+  static constexpr SizePair leaf_clade_range_ = {0, 0};
+
  protected:
   // A vector of the taxon names.
   StringVector taxon_names_;
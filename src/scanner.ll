@@ -94,6 +94,10 @@ BLANK [ \t\r]
 void
 Driver::ScanString(const std::string &str) {
   yy_flex_debug = trace_scanning_;
+  // Free the buffer of the previous string rather than leaking one per tree.
+  if (YY_CURRENT_BUFFER) {
+    yy_delete_buffer(YY_CURRENT_BUFFER);
+  }
   yy_scan_string(str.c_str());
 }
 
@@ -3,14 +3,21 @@
 
 #include "site_pattern.hpp"
 
+#include <algorithm>
+#include <array>
 #include <cstdio>
+#include <cstring>
+#include <functional>
+#include <mutex>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <utility>
 #include <vector>
 
 #include "intpack.hpp"
 #include "sugar.hpp"
+#include "thread_pool.hpp"
 
 // DNA assumption here.
 CharIntMap SitePattern::GetSymbolTable() {
@@ -74,58 +81,391 @@ struct IntVectorHasher {
   }
 };
 
-void SitePattern::Compress() {
-  CharIntMap symbol_table = GetSymbolTable();
-  size_t sequence_length = alignment_.Length();
-  std::unordered_map<SymbolVector, double, IntVectorHasher> patterns;
+namespace {
 
-  std::unordered_map<size_t, std::string> taxon_number_to_sequence;
+// Look symbols up by character, with -1 for characters not in the symbol table.
+std::array<int, 256> SymbolArrayOf(const CharIntMap &symbol_table) {
+  std::array<int, 256> symbols;
+  symbols.fill(-1);
+  for (const auto &[c, symbol] : symbol_table) {
+    symbols[static_cast<unsigned char>(c)] = symbol;
+  }
+  return symbols;
+}
+
+// Run f(begin, end) on chunks of [0, count), on the shared pool if we have more than
+// one thread.
+void ForEachChunk(size_t thread_count, size_t count,
+                  const std::function<void(size_t, size_t)> &f) {
+  if (thread_count == 1) {
+    f(0, count);
+  } else {
+    ThreadPool::Shared(thread_count)
+        .ParallelFor(
+            count, [](size_t) { return 1.; },
+            [&f](size_t, size_t begin, size_t end) { f(begin, end); });
+  }
+}
+
+// Symbols fit in 4 bits, so we pack the columns of an alignment 16 symbols to a word.
+constexpr size_t symbols_per_word = 16;
+constexpr size_t bits_per_symbol = 4;
+// Compressing an Alignment packs about this many bytes of columns at a time.
+constexpr size_t packing_block_byte_count = 1 << 18;
+// The number of independently locked parts of the map that merges the patterns found
+// on each thread.
+constexpr size_t pattern_shard_count = 64;
+
+// Patterns have always come out in the iteration order of an unordered_map of
+// SymbolVectors filled in order of first appearance. We keep that order, so that
+// results don't depend on which way we compress, by putting the distinct patterns
+// through such a map in the same order. Given pattern_count patterns in order of first
+// appearance, where fill_pattern(idx, pattern) writes the symbols of pattern idx into
+// a zeroed SymbolVector of length sequence_count, return the indices of the patterns
+// in that order.
+SizeVector LegacyPatternOrder(
+    size_t pattern_count, size_t sequence_count,
+    const std::function<void(size_t, SymbolVector &)> &fill_pattern) {
+  std::unordered_map<SymbolVector, size_t, IntVectorHasher> patterns;
+  for (size_t pattern_idx = 0; pattern_idx < pattern_count; pattern_idx++) {
+    SymbolVector pattern(sequence_count, 0);
+    fill_pattern(pattern_idx, pattern);
+    patterns.emplace(std::move(pattern), pattern_idx);
+  }
+  SizeVector pattern_order;
+  pattern_order.reserve(pattern_count);
+  for (const auto &[pattern, pattern_idx] : patterns) {
+    pattern_order.push_back(pattern_idx);
+  }
+  return pattern_order;
+}
+
+}  // namespace
+
+void SitePattern::Compress(const Alignment &alignment, size_t thread_count) {
+  const CharIntMap symbol_table = GetSymbolTable();
+  const auto symbols = SymbolArrayOf(symbol_table);
+  const size_t sequence_count = alignment.SequenceCount();
+  // The sequence of each taxon number, if any.
+  std::vector<const std::string *> sequences(sequence_count, nullptr);
   for (const auto &[tag, taxon] : tag_taxon_map_) {
     const auto taxon_number = static_cast<size_t>(MaxLeafIDOfTag(tag));
-    SafeInsert(taxon_number_to_sequence, taxon_number, alignment_.at(taxon));
+    Assert(taxon_number < sequence_count && sequences[taxon_number] == nullptr,
+           "Bad taxon number in SitePattern::Compress.");
+    sequences[taxon_number] = &alignment.at(taxon);
   }
 
-  for (size_t pos = 0; pos < sequence_length; pos++) {
-    SymbolVector pattern(alignment_.SequenceCount());
-    for (const auto &[taxon_number, sequence] : taxon_number_to_sequence) {
-      const auto symbol_to_find = sequence[pos];
-      pattern[taxon_number] = SymbolTableAt(symbol_table, symbol_to_find);
+  // Pack each column into words, indexed by taxon number, and hash it. Rows without a
+  // taxon are left as 0, as in the SymbolVector of a pattern.
+  const size_t word_count = (sequence_count + symbols_per_word - 1) / symbols_per_word;
+  std::vector<uint64_t> packed_columns(site_count_ * word_count, 0);
+  std::vector<uint64_t> hashes(site_count_);
+  auto column_words = [&packed_columns, word_count](size_t site) {
+    return packed_columns.data() + site * word_count;
+  };
+  const size_t block_site_count =
+      std::max(size_t(64), packing_block_byte_count / (word_count * sizeof(uint64_t)));
+  auto pack_sites = [&](size_t begin, size_t end) {
+    for (size_t taxon_number = 0; taxon_number < sequence_count; taxon_number++) {
+      if (sequences[taxon_number] == nullptr) {
+        continue;
+      }
+      const std::string &sequence = *sequences[taxon_number];
+      const size_t word_idx = taxon_number / symbols_per_word;
+      const size_t shift = bits_per_symbol * (taxon_number % symbols_per_word);
+      for (size_t site = begin; site < end; site++) {
+        int symbol = symbols[static_cast<unsigned char>(sequence[site])];
+        if (symbol < 0) {
+          symbol = SymbolTableAt(symbol_table, sequence[site]);
+        }
+        column_words(site)[word_idx] |= static_cast<uint64_t>(symbol) << shift;
+      }
     }
-    if (patterns.find(pattern) == patterns.end()) {
-      SafeInsert(patterns, pattern, 1.);
-    } else {
-      patterns[pattern]++;
+    for (size_t site = begin; site < end; site++) {
+      uint64_t hash = 0;
+      for (size_t word_idx = 0; word_idx < word_count; word_idx++) {
+        hash = (hash ^ column_words(site)[word_idx]) * 0x9e3779b97f4a7c15;
+        hash ^= hash >> 32;
+      }
+      hashes[site] = hash;
     }
+  };
+
+  // Columns are identified by the index of a site that has them.
+  struct ColumnHash {
+    const uint64_t *hashes;
+    size_t operator()(size_t site) const { return static_cast<size_t>(hashes[site]); }
+  };
+  struct ColumnEqual {
+    const uint64_t *packed_columns;
+    size_t word_count;
+    bool operator()(size_t site, size_t other_site) const {
+      return std::equal(packed_columns + site * word_count,
+                        packed_columns + (site + 1) * word_count,
+                        packed_columns + other_site * word_count);
+    }
+  };
+  using ColumnMap = std::unordered_map<size_t, size_t, ColumnHash, ColumnEqual>;
+  const ColumnHash column_hash{hashes.data()};
+  const ColumnEqual column_equal{packed_columns.data(), word_count};
+  // The distinct columns, each with the first site that has it and its count.
+  struct Column {
+    size_t first_site;
+    double count;
+  };
+  // A concurrent map from columns to their index in `columns`, in shards that each
+  // have their own lock.
+  struct Shard {
+    std::mutex mutex;
+    ColumnMap column_indices;
+    std::vector<Column> columns;
+  };
+  std::vector<Shard> shards(pattern_shard_count);
+  for (auto &shard : shards) {
+    shard.column_indices = ColumnMap(0, column_hash, column_equal);
   }
+  // For each site, the first site of the chunk with its column, and then the site
+  // that stands for its column in the shard.
+  SizeVector site_representatives(site_count_);
 
-  // Collect the site patterns per taxon.
-  for (const auto &iter_tag_taxon : tag_taxon_map_) {
-    SymbolVector compressed_sequence;
-    auto taxon_number = static_cast<size_t>(MaxLeafIDOfTag(iter_tag_taxon.first));
-    for (const auto &iter_patterns : patterns) {
-      compressed_sequence.push_back(iter_patterns.first[taxon_number]);
+  ForEachChunk(thread_count, site_count_, [&](size_t chunk_begin, size_t chunk_end) {
+    for (size_t begin = chunk_begin; begin < chunk_end; begin += block_site_count) {
+      pack_sites(begin, std::min(begin + block_site_count, chunk_end));
+    }
+    // Find the distinct columns of this chunk, and then merge them into the shards.
+    ColumnMap chunk_columns(0, column_hash, column_equal);
+    std::vector<Column> chunk_counts;
+    for (size_t site = chunk_begin; site < chunk_end; site++) {
+      const auto [iter, inserted] = chunk_columns.emplace(site, chunk_counts.size());
+      if (inserted) {
+        chunk_counts.push_back({site, 1.});
+      } else {
+        chunk_counts[iter->second].count++;
+      }
+      site_representatives[site] = chunk_counts[iter->second].first_site;
+    }
+    std::unordered_map<size_t, size_t> merged_representatives;
+    for (const auto &[first_site, count] : chunk_counts) {
+      auto &shard = shards[hashes[first_site] % pattern_shard_count];
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      const auto [iter, inserted] =
+          shard.column_indices.emplace(first_site, shard.columns.size());
+      if (inserted) {
+        shard.columns.push_back({first_site, count});
+      } else {
+        auto &column = shard.columns[iter->second];
+        column.first_site = std::min(column.first_site, first_site);
+        column.count += count;
+      }
+      merged_representatives[first_site] = iter->first;
     }
-    patterns_[taxon_number] = compressed_sequence;
+    for (size_t site = chunk_begin; site < chunk_end; site++) {
+      site_representatives[site] = merged_representatives[site_representatives[site]];
+    }
+  });
+
+  // Put the distinct columns in order of first appearance.
+  std::vector<std::pair<Column, size_t>> columns;
+  for (const auto &shard : shards) {
+    for (const auto &[representative, column_idx] : shard.column_indices) {
+      columns.emplace_back(shard.columns[column_idx], representative);
+    }
+  }
+  std::sort(columns.begin(), columns.end(), [](const auto &lhs, const auto &rhs) {
+    return lhs.first.first_site < rhs.first.first_site;
+  });
+  auto symbol_at = [&column_words, &columns](size_t column_idx, size_t taxon_number) {
+    const uint64_t *words = column_words(columns[column_idx].second);
+    return static_cast<int>((words[taxon_number / symbols_per_word] >>
+                             (bits_per_symbol * (taxon_number % symbols_per_word))) &
+                            0xf);
+  };
+  const SizeVector pattern_order = LegacyPatternOrder(
+      columns.size(), sequence_count,
+      [&symbol_at, sequence_count](size_t column_idx, SymbolVector &pattern) {
+        for (size_t taxon_number = 0; taxon_number < sequence_count; taxon_number++) {
+          pattern[taxon_number] = symbol_at(column_idx, taxon_number);
+        }
+      });
+  SizeVector pattern_of_representative(site_count_);
+  for (const size_t column_idx : pattern_order) {
+    pattern_of_representative[columns[column_idx].second] = weights_.size();
+    weights_.push_back(columns[column_idx].first.count);
+  }
+  site_pattern_indices_.resize(site_count_);
+  for (size_t site = 0; site < site_count_; site++) {
+    site_pattern_indices_[site] = pattern_of_representative[site_representatives[site]];
   }
 
-  // Collect the site weights.
-  for (const auto &iter : patterns) {
-    weights_.push_back(iter.second);
+  // Collect the site patterns per taxon.
+  for (const auto &[tag, taxon] : tag_taxon_map_) {
+    const auto taxon_number = static_cast<size_t>(MaxLeafIDOfTag(tag));
+    auto &compressed_sequence = patterns_[taxon_number];
+    compressed_sequence.resize(pattern_order.size());
+    for (size_t pattern_idx = 0; pattern_idx < pattern_order.size(); pattern_idx++) {
+      compressed_sequence[pattern_idx] =
+          symbol_at(pattern_order[pattern_idx], taxon_number);
+    }
   }
 }
 
-const std::vector<double> SitePattern::GetPartials(size_t sequence_idx) const {
-  // DNA assumption here.
-  size_t state_count = 4;
-  std::vector<double> partials(state_count * PatternCount(), 0.);
-  for (size_t pattern_idx = 0; pattern_idx < PatternCount(); pattern_idx++) {
-    if (patterns_[sequence_idx][pattern_idx] < static_cast<int>(state_count)) {
-      partials[pattern_idx * state_count + patterns_[sequence_idx][pattern_idx]] = 1.0;
-    } else {
-      for (size_t state_idx = 0; state_idx < state_count; state_idx++) {
-        partials[pattern_idx * state_count + state_idx] = 1.0;
+SitePattern::SitePattern(const FastaFile &fasta_file, TagStringMap tag_taxon_map,
+                         size_t thread_count)
+    : site_count_(fasta_file.SiteCount()), tag_taxon_map_(std::move(tag_taxon_map)) {
+  patterns_.resize(fasta_file.SequenceCount());
+  Compress(fasta_file, thread_count);
+  tip_states_ = TipStates(patterns_, TaxonCount());
+}
+
+void SitePattern::Compress(const FastaFile &fasta_file, size_t thread_count) {
+  const CharIntMap symbol_table = GetSymbolTable();
+  const auto symbols = SymbolArrayOf(symbol_table);
+  const size_t taxon_count = tag_taxon_map_.size();
+  SizeVector sequence_of_taxon(taxon_count);
+  for (const auto &[tag, taxon] : tag_taxon_map_) {
+    const auto taxon_number = static_cast<size_t>(MaxLeafIDOfTag(tag));
+    Assert(taxon_number < taxon_count && taxon_number < patterns_.size(),
+           "Taxon number out of range in SitePattern::Compress.");
+    sequence_of_taxon[taxon_number] = fasta_file.SequenceIndex(taxon);
+  }
+
+  // We go through the alignment in blocks of sites. Each block is transposed into
+  // columns of symbols, one byte per taxon, and the distinct columns of the block are
+  // kept in order of first appearance along with their counts.
+  struct Block {
+    std::vector<char> columns;
+    std::vector<double> weights;
+    // The index in `columns` of the column of each site of the block.
+    SizeVector site_columns;
+  };
+  const size_t block_site_count =
+      std::max(size_t(64), fasta_block_byte_count_ / std::max(taxon_count, size_t(1)));
+  const size_t block_count = (site_count_ + block_site_count - 1) / block_site_count;
+  std::vector<Block> blocks(block_count);
+  auto compress_block = [&](size_t block_idx) {
+    const size_t begin = block_idx * block_site_count;
+    const size_t end = std::min(begin + block_site_count, site_count_);
+    auto &columns = blocks[block_idx].columns;
+    auto &weights = blocks[block_idx].weights;
+    auto &site_columns = blocks[block_idx].site_columns;
+    columns.resize((end - begin) * taxon_count);
+    std::string row;
+    for (size_t taxon_number = 0; taxon_number < taxon_count; taxon_number++) {
+      const size_t sequence_idx = sequence_of_taxon[taxon_number];
+      std::string_view sites = fasta_file.SitesView(sequence_idx, begin, end);
+      if (sites.empty()) {
+        row.resize(end - begin);
+        fasta_file.CopySites(sequence_idx, begin, end, row.data());
+        sites = row;
+      }
+      for (size_t site = 0; site < sites.size(); site++) {
+        int symbol = symbols[static_cast<unsigned char>(sites[site])];
+        if (symbol < 0) {
+          symbol = SymbolTableAt(symbol_table, sites[site]);
+        }
+        columns[site * taxon_count + taxon_number] = static_cast<char>(symbol);
+      }
+    }
+    // Move each new column down to the end of the distinct columns found so far, which
+    // never overwrites a column that we have yet to look at.
+    std::unordered_map<std::string_view, size_t> column_indices;
+    for (size_t site = 0; site < end - begin; site++) {
+      const std::string_view column(columns.data() + site * taxon_count, taxon_count);
+      const auto search = column_indices.find(column);
+      if (search != column_indices.end()) {
+        weights[search->second]++;
+        site_columns.push_back(search->second);
+        continue;
       }
+      char *destination = columns.data() + weights.size() * taxon_count;
+      std::memmove(destination, column.data(), taxon_count);
+      column_indices.emplace(std::string_view(destination, taxon_count),
+                             weights.size());
+      site_columns.push_back(weights.size());
+      weights.push_back(1.);
     }
+    columns.resize(weights.size() * taxon_count);
+  };
+  ForEachChunk(thread_count, block_count, [&compress_block](size_t begin, size_t end) {
+    for (size_t block_idx = begin; block_idx < end; block_idx++) {
+      compress_block(block_idx);
+    }
+  });
+
+  // Merge the blocks in order, so the distinct columns are in order of their first
+  // site.
+  std::unordered_map<std::string_view, size_t> column_indices;
+  std::vector<const char *> distinct_columns;
+  DoubleVector column_weights;
+  SizeVector site_column_indices;
+  site_column_indices.reserve(site_count_);
+  for (const auto &block : blocks) {
+    SizeVector block_column_indices(block.weights.size());
+    for (size_t column_idx = 0; column_idx < block.weights.size(); column_idx++) {
+      const std::string_view column(block.columns.data() + column_idx * taxon_count,
+                                    taxon_count);
+      const auto [iter, inserted] =
+          column_indices.emplace(column, column_weights.size());
+      if (inserted) {
+        distinct_columns.push_back(column.data());
+        column_weights.push_back(block.weights[column_idx]);
+      } else {
+        column_weights[iter->second] += block.weights[column_idx];
+      }
+      block_column_indices[column_idx] = iter->second;
+    }
+    for (const auto column_idx : block.site_columns) {
+      site_column_indices.push_back(block_column_indices[column_idx]);
+    }
+  }
+  // Then put them in the order that Compress(const Alignment&) gives. Rows without a
+  // taxon are 0 there.
+  const SizeVector pattern_order = LegacyPatternOrder(
+      distinct_columns.size(), patterns_.size(),
+      [&distinct_columns, taxon_count](size_t column_idx, SymbolVector &pattern) {
+        for (size_t taxon_number = 0; taxon_number < taxon_count; taxon_number++) {
+          pattern[taxon_number] = distinct_columns[column_idx][taxon_number];
+        }
+      });
+  const size_t pattern_count = pattern_order.size();
+  std::vector<const char *> pattern_columns(pattern_count);
+  SizeVector pattern_of_column(pattern_count);
+  weights_.resize(pattern_count);
+  for (size_t pattern_idx = 0; pattern_idx < pattern_count; pattern_idx++) {
+    const size_t column_idx = pattern_order[pattern_idx];
+    pattern_columns[pattern_idx] = distinct_columns[column_idx];
+    pattern_of_column[column_idx] = pattern_idx;
+    weights_[pattern_idx] = column_weights[column_idx];
   }
+  site_pattern_indices_.resize(site_count_);
+  for (size_t site = 0; site < site_count_; site++) {
+    site_pattern_indices_[site] = pattern_of_column[site_column_indices[site]];
+  }
+  ForEachChunk(thread_count, taxon_count,
+               [this, &pattern_columns, pattern_count](size_t begin, size_t end) {
+                 for (size_t taxon_number = begin; taxon_number < end; taxon_number++) {
+                   auto &pattern = patterns_[taxon_number];
+                   pattern.resize(pattern_count);
+                   for (size_t pattern_idx = 0; pattern_idx < pattern_count;
+                        pattern_idx++) {
+                     pattern[pattern_idx] = pattern_columns[pattern_idx][taxon_number];
+                   }
+                 }
+               });
+}
+
+DoubleVector SitePattern::ExpandToSites(const DoubleVector &pattern_values) const {
+  Assert(pattern_values.size() == PatternCount(),
+         "Need a value for each pattern in SitePattern::ExpandToSites.");
+  DoubleVector site_values(site_pattern_indices_.size());
+  for (size_t site = 0; site < site_values.size(); site++) {
+    site_values[site] = pattern_values[site_pattern_indices_[site]];
+  }
+  return site_values;
+}
+
+const std::vector<double> SitePattern::GetPartials(size_t sequence_idx) const {
+  std::vector<double> partials(TipStates::state_count_ * PatternCount());
+  tip_states_.Expand(sequence_idx, 1., 0., partials.data());
   return partials;
 }
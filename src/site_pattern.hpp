@@ -5,26 +5,36 @@
 
 #pragma once
 
+#include <set>
 #include <string>
 #include <vector>
 
 #include "alignment.hpp"
+#include "fasta_file.hpp"
 #include "sugar.hpp"
+#include "tip_states.hpp"
 
 class SitePattern {
  public:
   SitePattern() = default;
-  SitePattern(const Alignment& alignment, TagStringMap tag_taxon_map)
-      : alignment_(alignment), tag_taxon_map_(std::move(tag_taxon_map)) {
+  // Compress an alignment, hashing its columns on thread_count threads.
+  SitePattern(const Alignment& alignment, TagStringMap tag_taxon_map,
+              size_t thread_count = 1)
+      : site_count_(alignment.Length()), tag_taxon_map_(std::move(tag_taxon_map)) {
     patterns_.resize(alignment.SequenceCount());
-    Compress();
+    Compress(alignment, thread_count);
+    tip_states_ = TipStates(patterns_, TaxonCount());
   }
+  // Compress the sequences of a FASTA file straight from the file, without building
+  // an Alignment, on thread_count threads. The patterns come out in the same order as
+  // those made from an Alignment, so likelihoods are summed in the same order.
+  SitePattern(const FastaFile& fasta_file, TagStringMap tag_taxon_map,
+              size_t thread_count = 1);
 
   static CharIntMap GetSymbolTable();
   static SymbolVector SymbolVectorOf(const CharIntMap& symbol_table,
                                      const std::string& str);
 
-  Alignment GetAlignment() const { return alignment_; }
   const std::vector<SymbolVector>& GetPatterns() const { return patterns_; }
   size_t PatternCount() const { return patterns_.at(0).size(); }
   size_t GetPatternSymbol(size_t sequence_idx, size_t pattern_idx) const {
@@ -32,10 +42,18 @@ class SitePattern {
   };
   size_t SequenceCount() const { return patterns_.size(); }
   size_t TaxonCount() const { return tag_taxon_map_.size(); }
-  size_t SiteCount() const { return alignment_.Length(); }
+  size_t SiteCount() const { return site_count_; }
   const std::vector<double>& GetWeights() const { return weights_; }
-  // Make a flattened partial likelihood vector for a given sequence, where anything
-  // above 4 is given a uniform distribution.
+  // The index of the pattern of each site of the alignment.
+  const SizeVector& GetSitePatternIndices() const { return site_pattern_indices_; }
+  // Expand values for each pattern, such as per-pattern log likelihoods, to values for
+  // each site of the alignment.
+  DoubleVector ExpandToSites(const DoubleVector& pattern_values) const;
+  // The patterns packed as 4-bit ambiguity codes, which is how the engines read the
+  // leaves.
+  const TipStates& GetTipStates() const { return tip_states_; }
+  // Make a flattened partial likelihood vector for a given sequence, where a gap is
+  // given a uniform distribution.
   const std::vector<double> GetPartials(size_t sequence_idx) const;
 
   static SitePattern HelloSitePattern() {
@@ -45,9 +63,8 @@ class SitePattern {
   }
 
  private:
-  // The multiple sequence alignments represented by the site pattern, as a collection
-  // of taxon names and sequences.
-  Alignment alignment_;
+  // The number of sites of the alignment that we compressed.
+  size_t site_count_ = 0;
   // A map from a unique tag to the taxon name.
   TagStringMap tag_taxon_map_;
   // The first index of patterns_ is across sequences, and the second is across site
@@ -55,8 +72,17 @@ class SitePattern {
   std::vector<SymbolVector> patterns_;
   // The number of times each site pattern was seen in the alignment.
   std::vector<double> weights_;
+  // The index of the pattern of each site.
+  SizeVector site_pattern_indices_;
+  // patterns_ as ambiguity codes.
+  TipStates tip_states_;
 
-  void Compress();
+  // Roughly how many bytes of sites FastaFile compression handles at a time, chosen so
+  // that a block of columns stays in cache while we transpose it.
+  static inline const size_t fasta_block_byte_count_ = 1 << 18;
+
+  void Compress(const Alignment& alignment, size_t thread_count);
+  void Compress(const FastaFile& fasta_file, size_t thread_count);
   static int SymbolTableAt(const CharIntMap& symbol_table, char c);
 };
 
@@ -67,4 +93,106 @@ TEST_CASE("SitePattern") {
   SymbolVector correct_symbol_vector = {4, 3, 2, 1, 0, 3, 2, 1, 0, 4};
   CHECK_EQ(symbol_vector, correct_symbol_vector);
 }
+
+TEST_CASE("SitePattern: Compress") {
+  // The patterns come out in the same order as they always have.
+  const auto site_pattern = SitePattern::HelloSitePattern();
+  const std::vector<SymbolVector> correct_patterns = {
+      {2, 1, 0, 1, 2, 1, 0, 0, 2, 2, 4, 0, 0, 3, 4},
+      {0, 2, 0, 1, 2, 1, 2, 1, 0, 2, 1, 3, 3, 3, 2},
+      {0, 2, 0, 1, 2, 2, 2, 1, 2, 0, 1, 0, 3, 3, 2}};
+  CHECK_EQ(site_pattern.GetPatterns(), correct_patterns);
+  const DoubleVector correct_weights = {1, 1, 4, 4, 9, 1, 1, 1, 1, 1, 1, 1, 1, 3, 1};
+  CHECK_EQ(site_pattern.GetWeights(), correct_weights);
+  // Each site has the pattern of its column.
+  const auto alignment = Alignment::HelloAlignment();
+  const auto symbol_table = SitePattern::GetSymbolTable();
+  const StringVector taxa = {"mars", "saturn", "jupiter"};
+  const auto& site_pattern_indices = site_pattern.GetSitePatternIndices();
+  REQUIRE_EQ(site_pattern_indices.size(), alignment.Length());
+  for (size_t site = 0; site < alignment.Length(); site++) {
+    for (size_t taxon_idx = 0; taxon_idx < taxa.size(); taxon_idx++) {
+      CHECK_EQ(site_pattern.GetPatternSymbol(taxon_idx, site_pattern_indices[site]),
+               symbol_table.at(alignment.at(taxa[taxon_idx])[site]));
+    }
+  }
+  // Each pattern is spread over as many sites as its weight.
+  const auto site_weights = site_pattern.ExpandToSites(site_pattern.GetWeights());
+  double pattern_count = 0.;
+  for (const auto weight : site_weights) {
+    pattern_count += 1. / weight;
+  }
+  CHECK_EQ(pattern_count, doctest::Approx(site_pattern.PatternCount()));
+  // Hashing on several threads gives the same result.
+  const auto ds1 = Alignment::ReadFasta("data/DS1.fasta");
+  TagStringMap tag_taxon_map;
+  for (const auto& [taxon, sequence] : ds1.Data()) {
+    tag_taxon_map[PackInts(static_cast<uint32_t>(tag_taxon_map.size()), 1)] = taxon;
+  }
+  const SitePattern serial(ds1, tag_taxon_map);
+  const SitePattern parallel(ds1, tag_taxon_map, 3);
+  CHECK_EQ(parallel.GetPatterns(), serial.GetPatterns());
+  CHECK_EQ(parallel.GetWeights(), serial.GetWeights());
+  CHECK_EQ(parallel.GetSitePatternIndices(), serial.GetSitePatternIndices());
+}
+
+TEST_CASE("SitePattern: sequences that are not in the tree") {
+  // Only mars and saturn are in the tree, so jupiter takes no part in the patterns.
+  const TagStringMap tag_taxon_map = {{PackInts(0, 1), "mars"},
+                                      {PackInts(1, 1), "saturn"}};
+  const auto alignment = Alignment::HelloAlignment();
+  std::set<std::pair<char, char>> columns;
+  for (size_t site = 0; site < alignment.Length(); site++) {
+    columns.emplace(alignment.at("mars")[site], alignment.at("saturn")[site]);
+  }
+  const SitePattern site_pattern(alignment, tag_taxon_map);
+  CHECK_EQ(site_pattern.SequenceCount(), 3);
+  CHECK_EQ(site_pattern.TaxonCount(), 2);
+  CHECK_EQ(site_pattern.PatternCount(), columns.size());
+  CHECK_EQ(site_pattern.GetTipStates().TaxonCount(), 2);
+  CHECK_EQ(site_pattern.GetTipStates().PatternCount(), columns.size());
+  CHECK_EQ(site_pattern.GetPartials(1).size(), 4 * columns.size());
+}
+
+TEST_CASE("SitePattern: FastaFile") {
+  // Repeat DS1 to make an alignment that takes several blocks to compress, written
+  // with lines of a different length than the original.
+  const auto ds1 = Alignment::ReadFasta("data/DS1.fasta");
+  const std::string fasta_path = "_ignore/long_ds1.fasta";
+  TagStringMap tag_taxon_map;
+  {
+    std::ofstream fasta(fasta_path);
+    for (const auto& [taxon, sequence] : ds1.Data()) {
+      tag_taxon_map[PackInts(static_cast<uint32_t>(tag_taxon_map.size()), 1)] = taxon;
+      std::string long_sequence;
+      for (size_t copy_idx = 0; copy_idx < 10; copy_idx++) {
+        long_sequence += sequence;
+      }
+      fasta << '>' << taxon << '\n';
+      for (size_t site = 0; site < long_sequence.size(); site += 70) {
+        fasta << long_sequence.substr(site, 70) << '\n';
+      }
+    }
+  }
+  const SitePattern from_alignment(Alignment::ReadFasta(fasta_path), tag_taxon_map);
+  CHECK_EQ(from_alignment.SiteCount(), 10 * ds1.Length());
+  const FastaFile fasta_file(fasta_path);
+  for (const size_t thread_count : {1, 3}) {
+    const SitePattern from_fasta(fasta_file, tag_taxon_map, thread_count);
+    CHECK_EQ(from_fasta.SiteCount(), from_alignment.SiteCount());
+    CHECK_EQ(from_fasta.SequenceCount(), from_alignment.SequenceCount());
+    // The patterns are in the same order either way.
+    CHECK_EQ(from_fasta.GetPatterns(), from_alignment.GetPatterns());
+    CHECK_EQ(from_fasta.GetWeights(), from_alignment.GetWeights());
+    CHECK_EQ(from_fasta.GetSitePatternIndices(),
+             from_alignment.GetSitePatternIndices());
+  }
+  // Unknown symbols are reported as they are for an Alignment.
+  {
+    std::ofstream fasta(fasta_path);
+    fasta << ">mars\nAC\n>saturn\nAZ\n";
+  }
+  CHECK_THROWS(SitePattern(FastaFile(fasta_path),
+                           {{PackInts(0, 1), "mars"}, {PackInts(1, 1), "saturn"}}));
+}
 #endif  // DOCTEST_LIBRARY_INCLUDED
@@ -0,0 +1,189 @@
+// Copyright 2019-2022 bito project contributors.
+// bito is free software under the GPLv3; see LICENSE file for details.
+
+#include "thread_pool.hpp"
+
+#include <map>
+#include <numeric>
+
+ThreadPool::ThreadPool(const size_t thread_count) {
+  Assert(thread_count > 0, "ThreadPool needs a strictly positive thread count.");
+  for (size_t i = 0; i < thread_count; i++) {
+    workers_.push_back(std::make_unique<Worker>());
+  }
+  // Start the threads only once all of the deques exist, as workers steal.
+  for (size_t i = 0; i < thread_count; i++) {
+    workers_[i]->thread_ = std::thread(&ThreadPool::WorkerLoop, this, i);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_all();
+  for (auto &worker : workers_) {
+    if (worker->thread_.joinable()) {
+      worker->thread_.join();
+    }
+  }
+}
+
+void ThreadPool::Run(TaskVector tasks) {
+  if (tasks.empty()) {
+    return;
+  }
+  if (current_pool_ == this) {
+    for (auto &task : tasks) {
+      task(current_worker_idx_);
+    }
+    return;
+  }
+  // else
+  Batch batch;
+  batch.remaining_count_ = tasks.size();
+  const size_t start = next_worker_.fetch_add(tasks.size());
+  {
+    // Hold the sleep lock while dealing so that no worker can count a job as taken
+    // before we count it as queued.
+    std::lock_guard<std::mutex> sleep_lock(sleep_mutex_);
+    for (size_t i = 0; i < tasks.size(); i++) {
+      auto &worker = *workers_[(start + i) % workers_.size()];
+      std::lock_guard<std::mutex> lock(worker.mutex_);
+      worker.deque_.push_back({std::move(tasks[i]), &batch});
+    }
+    queued_count_ += tasks.size();
+  }
+  wake_.notify_all();
+
+  std::unique_lock<std::mutex> lock(batch.mutex_);
+  batch.done_.wait(lock, [&batch] { return batch.remaining_count_ == 0; });
+  if (batch.exception_ptr_ != nullptr) {
+    std::rethrow_exception(batch.exception_ptr_);
+  }
+}
+
+void ThreadPool::ParallelFor(const size_t count,
+                             const std::function<double(size_t)> &cost,
+                             const std::function<void(size_t, size_t, size_t)> &f) {
+  const auto boundaries =
+      ChunkBoundaries(count, cost, chunks_per_worker_ * ThreadCount());
+  TaskVector tasks;
+  for (size_t chunk = 0; chunk + 1 < boundaries.size(); chunk++) {
+    const size_t begin = boundaries[chunk];
+    const size_t end = boundaries[chunk + 1];
+    tasks.push_back([&f, begin, end](size_t worker_idx) { f(worker_idx, begin, end); });
+  }
+  Run(std::move(tasks));
+}
+
+ThreadPool &ThreadPool::Shared(const size_t thread_count) {
+  static std::mutex mutex;
+  static std::map<size_t, std::unique_ptr<ThreadPool>> pools;
+  std::lock_guard<std::mutex> lock(mutex);
+  auto &pool = pools[thread_count];
+  if (pool == nullptr) {
+    pool = std::make_unique<ThreadPool>(thread_count);
+  }
+  return *pool;
+}
+
+SizeVector ThreadPool::ChunkBoundaries(const size_t count,
+                                       const std::function<double(size_t)> &cost,
+                                       const size_t chunk_count) {
+  SizeVector boundaries = {0};
+  if (count == 0) {
+    return boundaries;
+  }
+  DoubleVector costs(count);
+  for (size_t i = 0; i < count; i++) {
+    costs[i] = cost(i);
+  }
+  double total_cost = std::accumulate(costs.begin(), costs.end(), 0.);
+  if (total_cost <= 0.) {
+    // Without meaningful costs, treat every item as equally expensive.
+    std::fill(costs.begin(), costs.end(), 1.);
+    total_cost = static_cast<double>(count);
+  }
+  const double target_cost =
+      total_cost / static_cast<double>(std::max(chunk_count, size_t(1)));
+  double cumulative_cost = 0.;
+  for (size_t i = 0; i + 1 < count; i++) {
+    cumulative_cost += costs[i];
+    if (boundaries.size() < chunk_count &&
+        cumulative_cost >= target_cost * static_cast<double>(boundaries.size())) {
+      boundaries.push_back(i + 1);
+    }
+  }
+  boundaries.push_back(count);
+  return boundaries;
+}
+
+void ThreadPool::WorkerLoop(const size_t worker_idx) {
+  current_pool_ = this;
+  current_worker_idx_ = worker_idx;
+  Job job;
+  while (true) {
+    if (TryTakeJob(worker_idx, job)) {
+      RunJob(job, worker_idx);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(sleep_mutex_);
+    wake_.wait(lock, [this] { return stopping_ || queued_count_ > 0; });
+    if (stopping_ && queued_count_ == 0) {
+      return;
+    }
+  }
+}
+
+bool ThreadPool::TryTakeJob(const size_t worker_idx, Job &job) {
+  const size_t worker_count = workers_.size();
+  // Our own deque first (from the front), then the others' (from the back).
+  for (size_t offset = 0; offset < worker_count; offset++) {
+    auto &worker = *workers_[(worker_idx + offset) % worker_count];
+    std::unique_lock<std::mutex> deque_lock(worker.mutex_);
+    if (worker.deque_.empty()) {
+      continue;
+    }
+    if (offset == 0) {
+      job = std::move(worker.deque_.front());
+      worker.deque_.pop_front();
+    } else {
+      job = std::move(worker.deque_.back());
+      worker.deque_.pop_back();
+    }
+    deque_lock.unlock();
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+    queued_count_--;
+    return true;
+  }
+  return false;
+}
+
+void ThreadPool::RunJob(Job &job, const size_t worker_idx) {
+  Batch &batch = *job.batch_;
+  bool skip;
+  {
+    std::lock_guard<std::mutex> lock(batch.mutex_);
+    skip = (batch.exception_ptr_ != nullptr);
+  }
+  if (!skip) {
+    try {
+      job.task_(worker_idx);
+    } catch (...) {
+      // Record the exception for the thread that called Run.
+      std::lock_guard<std::mutex> lock(batch.mutex_);
+      if (batch.exception_ptr_ == nullptr) {
+        batch.exception_ptr_ = std::current_exception();
+      }
+    }
+  }
+  job.task_ = nullptr;
+  // Take the batch lock to decrement so that Run can't miss the notification and
+  // destroy the batch while we are still using it.
+  std::lock_guard<std::mutex> lock(batch.mutex_);
+  if (--batch.remaining_count_ == 0) {
+    batch.done_.notify_all();
+  }
+}
@@ -0,0 +1,169 @@
+// Copyright 2019-2022 bito project contributors.
+// bito is free software under the GPLv3; see LICENSE file for details.
+//
+// A persistent work-stealing thread pool.
+//
+// TaskProcessor starts and joins a thread per executor on every call, which is fine
+// for a few big tasks but dominates the run time when we evaluate small batches of
+// trees thousands of times per second. A ThreadPool instead keeps its worker threads
+// alive for the life of the process.
+//
+// Each worker has its own deque of tasks. Tasks from a call to Run are dealt out
+// round-robin across the deques; a worker pops from the front of its own deque and,
+// once that is empty, steals from the back of the others'. Tasks are given the index
+// of the worker running them, so per-thread resources (such as one FatBeagle per
+// worker) can be kept in a vector indexed by worker and used without locking.
+//
+// Pools are shared process-wide through ThreadPool::Shared, one per thread count, so
+// that all Engines asking for the same number of threads share the same workers.
+// Several threads can call Run on the same pool concurrently. A task may itself call
+// Run on the pool that is running it, in which case the nested tasks run one after
+// another on that worker: blocking the worker instead could leave no thread free to
+// run them.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "sugar.hpp"
+
+class ThreadPool {
+ public:
+  // A task takes the index of the worker it is run on.
+  using Task = std::function<void(size_t)>;
+  using TaskVector = std::vector<Task>;
+
+  explicit ThreadPool(size_t thread_count);
+  ~ThreadPool();
+  // Delete (copy + move) x (constructor + assignment) because the workers hold a
+  // pointer to the pool.
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool(const ThreadPool &&) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &&) = delete;
+
+  size_t ThreadCount() const { return workers_.size(); }
+
+  // Run all of the tasks on the pool, blocking until they are complete. If any task
+  // throws, the remaining tasks of this call are skipped and the first exception is
+  // rethrown here.
+  void Run(TaskVector tasks);
+
+  // Split the half-open range [0, count) into consecutive chunks of roughly equal
+  // total cost, and run `f(worker_idx, begin, end)` on each chunk. We make a few
+  // chunks per worker so that stealing can balance out uneven costs.
+  void ParallelFor(size_t count, const std::function<double(size_t)> &cost,
+                   const std::function<void(size_t, size_t, size_t)> &f);
+
+  // Get the process-wide pool with the given number of threads, starting it if
+  // needed.
+  static ThreadPool &Shared(size_t thread_count);
+
+  // Partition [0, count) into at most `chunk_count` consecutive chunks of roughly
+  // equal total cost, returned as the chunk boundaries (starting with 0 and ending
+  // with count).
+  static SizeVector ChunkBoundaries(size_t count,
+                                    const std::function<double(size_t)> &cost,
+                                    size_t chunk_count);
+
+  static inline const size_t chunks_per_worker_ = 4;
+
+ private:
+  // Bookkeeping shared by the tasks of one call to Run.
+  struct Batch {
+    std::atomic<size_t> remaining_count_;
+    std::exception_ptr exception_ptr_ = nullptr;
+    std::mutex mutex_;
+    std::condition_variable done_;
+  };
+  struct Job {
+    Task task_;
+    Batch *batch_;
+  };
+  struct Worker {
+    std::thread thread_;
+    std::deque<Job> deque_;
+    std::mutex mutex_;
+  };
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  // The number of jobs sitting in deques, guarded by sleep_mutex_ for waking.
+  size_t queued_count_ = 0;
+  bool stopping_ = false;
+  std::mutex sleep_mutex_;
+  std::condition_variable wake_;
+  // Where the next call to Run starts dealing out its jobs.
+  std::atomic<size_t> next_worker_ = 0;
+
+  // The pool and worker index of the current thread, if it is a worker.
+  static inline thread_local const ThreadPool *current_pool_ = nullptr;
+  static inline thread_local size_t current_worker_idx_ = 0;
+
+  void WorkerLoop(size_t worker_idx);
+  // Take a job from our own deque, or else steal one.
+  bool TryTakeJob(size_t worker_idx, Job &job);
+  static void RunJob(Job &job, size_t worker_idx);
+};
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+TEST_CASE("ThreadPool") {
+  ThreadPool pool(4);
+  CHECK_EQ(pool.ThreadCount(), 4);
+  // Each task records which worker it ran on, and the work is the same as in the
+  // TaskProcessor test.
+  std::vector<float> results(64);
+  std::vector<size_t> worker_of_task(results.size());
+  ThreadPool::TaskVector tasks;
+  for (size_t i = 0; i < results.size(); i++) {
+    tasks.push_back([&results, &worker_of_task, i](size_t worker_idx) {
+      results[i] = static_cast<float>(i);
+      worker_of_task[i] = worker_idx;
+    });
+  }
+  pool.Run(tasks);
+  for (size_t i = 0; i < results.size(); i++) {
+    CHECK_EQ(results[i], static_cast<float>(i));
+    CHECK_LT(worker_of_task[i], pool.ThreadCount());
+  }
+  // The pool can be reused, and exceptions make it back to the caller.
+  pool.Run(tasks);
+  CHECK_THROWS(pool.Run({[](size_t) { Failwith("Task failed."); }}));
+  pool.Run({});
+  // Chunks follow the cost: the expensive first item gets a chunk to itself.
+  auto cost = [](size_t i) { return i == 0 ? 10. : 1.; };
+  CHECK_EQ(ThreadPool::ChunkBoundaries(11, cost, 2), SizeVector({0, 1, 11}));
+  CHECK_EQ(ThreadPool::ChunkBoundaries(3, cost, 8), SizeVector({0, 1, 2, 3}));
+  CHECK_EQ(ThreadPool::ChunkBoundaries(0, cost, 8), SizeVector({0}));
+  // ParallelFor covers every index exactly once.
+  std::vector<int> visit_counts(1000, 0);
+  pool.ParallelFor(
+      visit_counts.size(), [](size_t i) { return static_cast<double>(i % 7); },
+      [&visit_counts](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+          visit_counts[i]++;
+        }
+      });
+  CHECK_EQ(std::count(visit_counts.begin(), visit_counts.end(), 1), 1000);
+  // Nested calls run on the calling worker rather than deadlocking.
+  std::vector<int> nested_counts(8, 0);
+  pool.ParallelFor(
+      nested_counts.size(), [](size_t) { return 1.; },
+      [&pool, &nested_counts](size_t worker_idx, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+          pool.Run({[&nested_counts, i, worker_idx](size_t nested_worker_idx) {
+            nested_counts[i] += (nested_worker_idx == worker_idx) ? 1 : 2;
+          }});
+        }
+      });
+  CHECK_EQ(std::count(nested_counts.begin(), nested_counts.end(), 1), 8);
+  CHECK_EQ(&ThreadPool::Shared(2), &ThreadPool::Shared(2));
+  CHECK_EQ(ThreadPool::Shared(3).ThreadCount(), 3);
+}
+#endif  // DOCTEST_LIBRARY_INCLUDED
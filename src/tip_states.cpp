@@ -0,0 +1,37 @@
+// Copyright 2019-2022 bito project contributors.
+// bito is free software under the GPLv3; see LICENSE file for details.
+
+#include "tip_states.hpp"
+
+#include <string>
+
+TipStates::TipStates(const std::vector<SymbolVector>& patterns,
+                     const size_t taxon_count)
+    : taxon_count_(taxon_count),
+      pattern_count_(taxon_count == 0 ? 0 : patterns[0].size()),
+      bytes_per_taxon_((pattern_count_ + 1) / 2),
+      codes_(taxon_count_ * bytes_per_taxon_, 0) {
+  Assert(taxon_count_ <= patterns.size(), "Too few taxa for TipStates.");
+  for (size_t taxon_idx = 0; taxon_idx < taxon_count_; taxon_idx++) {
+    const auto& pattern = patterns[taxon_idx];
+    Assert(pattern.size() == pattern_count_,
+           "Taxa have different numbers of patterns in TipStates.");
+    uint8_t* codes = codes_.data() + taxon_idx * bytes_per_taxon_;
+    for (size_t pattern_idx = 0; pattern_idx < pattern_count_; pattern_idx++) {
+      codes[pattern_idx / 2] |= static_cast<uint8_t>(CodeOfSymbol(pattern[pattern_idx])
+                                                      << (4 * (pattern_idx % 2)));
+    }
+  }
+}
+
+uint8_t TipStates::CodeOfSymbol(const int symbol) {
+  if (symbol >= 0 && static_cast<size_t>(symbol) < state_count_) {
+    return static_cast<uint8_t>(1 << symbol);
+  }
+  // else
+  if (static_cast<size_t>(symbol) == state_count_) {
+    return any_state_code_;
+  }
+  // else
+  Failwith("Invalid nucleotide symbol " + std::to_string(symbol) + " in TipStates.");
+}
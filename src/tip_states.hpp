@@ -0,0 +1,104 @@
+// Copyright 2019-2022 bito project contributors.
+// bito is free software under the GPLv3; see LICENSE file for details.
+//
+// The nucleotide states of each taxon at each site pattern, packed as 4-bit ambiguity
+// codes. Bit s of a code is set when the taxon may be in state s, so A, C, G and T
+// are 1, 2, 4 and 8, and a gap (or any symbol that we treat as one) is 15. Two
+// patterns share a byte: the even pattern is in the low nibble and the odd one in the
+// high nibble.
+//
+// This is the one description of the leaves that the likelihood and parsimony engines
+// share. It takes half a byte per pattern, where a double precision leaf PLV takes 32,
+// and the "tip" PLV kernels read it directly (see PLVKernels).
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "sugar.hpp"
+
+class TipStates {
+ public:
+  static constexpr size_t state_count_ = 4;
+  // The code of a taxon that may be in any state.
+  static constexpr uint8_t any_state_code_ = 0xF;
+
+  TipStates() = default;
+  // Pack patterns as given by SitePattern::GetPatterns, in which symbols below
+  // state_count_ are nucleotides and state_count_ is a gap.
+  explicit TipStates(const std::vector<SymbolVector>& patterns)
+      : TipStates(patterns, patterns.size()) {}
+  // Pack only the patterns of the first taxon_count sequences, which are those of the
+  // taxa when the alignment has sequences that are not in the tree.
+  TipStates(const std::vector<SymbolVector>& patterns, size_t taxon_count);
+
+  size_t TaxonCount() const { return taxon_count_; }
+  size_t PatternCount() const { return pattern_count_; }
+  size_t ByteCount() const { return codes_.size(); }
+
+  static uint8_t CodeOfSymbol(int symbol);
+
+  uint8_t Code(size_t taxon_idx, size_t pattern_idx) const {
+    return (Codes(taxon_idx)[pattern_idx / 2] >> (4 * (pattern_idx % 2))) & 0xF;
+  }
+  // The packed codes of a taxon. Each taxon starts on a byte of its own.
+  const uint8_t* Codes(size_t taxon_idx) const {
+    return codes_.data() + taxon_idx * bytes_per_taxon_;
+  }
+
+  // Write a column-major state_count_ x PatternCount() matrix for a taxon, with
+  // allowed_value for the states that the taxon may be in and disallowed_value for the
+  // others. A leaf PLV has (1, 0), and a leaf Sankoff partial has (0, a big cost).
+  template <typename TScalar>
+  void Expand(size_t taxon_idx, TScalar allowed_value, TScalar disallowed_value,
+              TScalar* dest) const {
+    for (size_t pattern_idx = 0; pattern_idx < pattern_count_; pattern_idx++) {
+      const uint8_t code = Code(taxon_idx, pattern_idx);
+      for (size_t state = 0; state < state_count_; state++) {
+        dest[state_count_ * pattern_idx + state] =
+            ((code >> state) & 1) ? allowed_value : disallowed_value;
+      }
+    }
+  }
+
+ private:
+  size_t taxon_count_ = 0;
+  size_t pattern_count_ = 0;
+  size_t bytes_per_taxon_ = 0;
+  std::vector<uint8_t> codes_;
+};
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+TEST_CASE("TipStates") {
+  // Symbols as in SitePattern, with 4 for a gap. An odd pattern count leaves the last
+  // byte of each taxon half full.
+  const std::vector<SymbolVector> patterns = {{0, 1, 2, 3, 4}, {4, 3, 3, 0, 1}};
+  const TipStates tip_states(patterns);
+  CHECK_EQ(tip_states.TaxonCount(), 2);
+  CHECK_EQ(tip_states.PatternCount(), 5);
+  CHECK_EQ(tip_states.ByteCount(), 6);
+  CHECK_EQ(tip_states.Code(0, 0), 1);
+  CHECK_EQ(tip_states.Code(0, 3), 8);
+  CHECK_EQ(tip_states.Code(0, 4), TipStates::any_state_code_);
+  CHECK_EQ(tip_states.Code(1, 0), TipStates::any_state_code_);
+  CHECK_EQ(tip_states.Code(1, 4), 2);
+  CHECK_EQ(tip_states.Codes(1)[0], 0x8F);
+  CHECK_THROWS(TipStates::CodeOfSymbol(5));
+  // Rows past taxon_count, such as the empty rows of sequences that are not in the
+  // tree, are left out.
+  const TipStates first_taxon(std::vector<SymbolVector>({{0, 1, 2, 3, 4}, {}}), 1);
+  CHECK_EQ(first_taxon.TaxonCount(), 1);
+  CHECK_EQ(first_taxon.PatternCount(), 5);
+  CHECK_EQ(first_taxon.Code(0, 3), 8);
+
+  std::vector<double> plv(4 * 5);
+  tip_states.Expand(1, 1., 0., plv.data());
+  CHECK_EQ(plv, std::vector<double>({1, 1, 1, 1, 0, 0, 0, 1, 0, 0, 0, 1,  //
+                                     1, 0, 0, 0, 0, 1, 0, 0}));
+  std::vector<float> costs(4 * 5);
+  tip_states.Expand(0, 0.f, 9.f, costs.data());
+  CHECK_EQ(costs, std::vector<float>({0, 9, 9, 9, 9, 0, 9, 9, 9, 9, 0, 9,  //
+                                      9, 9, 9, 0, 0, 0, 0, 0}));
+}
+#endif  // DOCTEST_LIBRARY_INCLUDED
@@ -348,14 +348,21 @@ class TPEngine {
     Assert(HasLikelihoodEvalEngine(), "Must MakeLikelihoodEvalEngine before access.");
     return GetLikelihoodEvalEngine().GetPVs();
   }
+  // TPEvalEngineViaFitch keeps its partials in its Fitch PVs instead, so there are no
+  // PSVs to get when the costs are unit costs.
   PSVEdgeHandler &GetParsimonyPVs() {
-    Assert(HasParsimonyEvalEngine(), "Must MakeParsimonyEvalEngine before access.");
+    AssertParsimonyPVsHavePartials();
     return GetParsimonyEvalEngine().GetPVs();
   }
   const PSVEdgeHandler &GetParsimonyPVs() const {
-    Assert(HasParsimonyEvalEngine(), "Must MakeParsimonyEvalEngine before access.");
+    AssertParsimonyPVsHavePartials();
     return GetParsimonyEvalEngine().GetPVs();
   }
+  void AssertParsimonyPVsHavePartials() const {
+    Assert(HasParsimonyEvalEngine(), "Must MakeParsimonyEvalEngine before access.");
+    Assert(GetParsimonyEvalEngine().HasPartialsInPVs(),
+           "The parsimony engine keeps its partials in Fitch PVs, not in PSVs.");
+  }
   EigenVectorXd &GetBranchLengths() {
     Assert(HasLikelihoodEvalEngine(), "Must MakeLikelihoodEvalEngine before access.");
     return GetLikelihoodEvalEngine().GetDAGBranchHandler().GetBranchLengthData();
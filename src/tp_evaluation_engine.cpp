@@ -135,6 +135,7 @@ void TPEvalEngineViaLikelihood::ZeroPVs() {
 }
 
 void TPEvalEngineViaLikelihood::PopulatePVs() {
+  PrecomputeTransitionMatrices();
   // Rootward Pass (populate P PVs)
   PopulateRootwardPVs();
   // Leafward Pass (populate R PVs)
@@ -846,18 +847,9 @@ void TPEvalEngineViaLikelihood::PopulateLeafwardPVForEdge(const EdgeId edge_id)
 void TPEvalEngineViaLikelihood::PopulateLeafPVsWithSitePatterns() {
   auto BuildPVForSitePattern = [this](const TaxonId taxon_id, const PVId pv_id) {
     auto &pv = GetPVs().GetPV(pv_id);
-    pv.setZero();
-    const auto &pattern = GetSitePattern().GetPatterns()[taxon_id.value_];
-    size_t site_idx = 0;
-    for (const int symbol : pattern) {
-      Assert(symbol >= 0, "Negative symbol!");
-      if (symbol == MmappedNucleotidePLV::base_count_) {  // Gap character.
-        pv.col(site_idx).setConstant(1.);
-      } else if (symbol < MmappedNucleotidePLV::base_count_) {
-        pv(symbol, site_idx) = 1.;
-      }
-      site_idx++;
-    }
+    Assert(pv.outerStride() == 4, "Leaf PVs need to be contiguous.");
+    GetSitePattern().GetTipStates().Expand(taxon_id.value_, PLVScalar(1),
+                                           PLVScalar(0), pv.data());
   };
 
   for (const auto taxon_id : GetDAG().GetTaxonIds()) {
@@ -902,6 +894,7 @@ void TPEvalEngineViaLikelihood::PopulateRootPVsWithStationaryDistribution() {
 }
 
 void TPEvalEngineViaLikelihood::ComputeScores() {
+  PrecomputeTransitionMatrices();
   for (EdgeId edge_id = 0; edge_id < GetDAG().EdgeCountWithLeafSubsplits(); edge_id++) {
     const auto choices = GetTPEngine().GetChoiceMap().GetEdgeChoice(edge_id);
     if (choices.parent_edge_id != NoId) {
@@ -921,9 +914,7 @@ void TPEvalEngineViaLikelihood::InitializeBranchLengthHandler() {
       [this](EdgeId edge_id, PVId parent_id, PVId child_id, double log_branch_length) {
         SetTransitionMatrixToHaveBranchLength(exp(log_branch_length));
         PreparePerPatternLogLikelihoodsForEdge(parent_id, child_id);
-        double result =
-            -per_pattern_log_likelihoods_.dot(GetTPEngine().GetSitePatternWeights());
-        return result;
+        return -SumOverSitePatterns(per_pattern_log_likelihoods_);
       };
   branch_handler_.SetBrentFunc(brent_nongrad_func);
   // Set Gradient Brent.
@@ -971,6 +962,7 @@ void TPEvalEngineViaLikelihood::BranchLengthOptimization(
   bool check_branch_convergence_ = check_branch_convergence.has_value()
                                        ? check_branch_convergence.value()
                                        : !IsFirstOptimization();
+  PrecomputeTransitionMatrices();
   // Update R-PVs and optimize branch lengths leafward.
   const EdgeIdVector edge_ids = GetDAG().RootwardEdgeTraversalTrace(false);
   for (const EdgeId edge_id : edge_ids) {
@@ -1005,6 +997,13 @@ void TPEvalEngineViaLikelihood::EvolvePPVUpEdge(const EdgeId rootward_edge_id,
   const auto focal = GetDAG().GetFocalClade(leafward_edge_id);
   const PVId parent_phatfocal_pvid =
       GetPVs().GetPVIndex(PLVTypeEnum::PPLVType(focal), rootward_edge_id);
+  if (GetDAG().IsEdgeLeaf(leafward_edge_id)) {
+    // The P-PV of a leaf edge is the site pattern of the leaf.
+    const auto leaf_id = GetDAG().GetDAGEdge(leafward_edge_id).GetChild();
+    SetToEvolvedTip(parent_phatfocal_pvid, leafward_edge_id, TaxonId(leaf_id.value_));
+    return;
+  }
+  // else
   const PVId child_p_pvid = GetPVs().GetPVIndex(PLVType::P, leafward_edge_id);
   SetToEvolvedPV(parent_phatfocal_pvid, leafward_edge_id, child_p_pvid);
 }
@@ -1103,9 +1102,15 @@ void TPEvalEngineViaLikelihood::TakePVValue(const PVId dest_id, const PVId src_i
 
 void TPEvalEngineViaLikelihood::MultiplyPVs(const PVId dest_id, const PVId src1_id,
                                             const PVId src2_id) {
-  GetPVs().GetPV(dest_id).array() =
-      GetPVs().GetPV(src1_id).array() * GetPVs().GetPV(src2_id).array();
-  // #462: Need to add rescaling to PVs.
+  auto &dest = GetPVs().GetPV(dest_id);
+  const auto &src1 = GetPVs().GetPV(src1_id);
+  const auto &src2 = GetPVs().GetPV(src2_id);
+  Assert(dest.outerStride() == 4 && src1.outerStride() == 4 && src2.outerStride() == 4,
+         "MultiplyPVs needs contiguous PVs.");
+  PLVKernels::Multiply(PatternThreadPool(), dest.data(), src1.data(), src2.data(),
+                       static_cast<size_t>(dest.cols()));
+  // #462: Need to add rescaling to PVs. Until then, float PVs (PLVScalar) underflow
+  // on much smaller trees than double PVs do.
 }
 
 void TPEvalEngineViaLikelihood::ComputeLikelihood(const EdgeId dest_id,
@@ -1119,16 +1124,121 @@ void TPEvalEngineViaLikelihood::ComputeLikelihood(const EdgeId dest_id,
 void TPEvalEngineViaLikelihood::SetToEvolvedPV(const PVId dest_id, const EdgeId edge_id,
                                                const PVId src_id) {
   SetTransitionMatrixToHaveBranchLength(branch_handler_(edge_id));
-  GetPVs().GetPV(dest_id).array() = (transition_matrix_ * GetPVs().GetPV(src_id));
+  auto &dest = GetPVs().GetPV(dest_id);
+  const auto &src = GetPVs().GetPV(src_id);
+  Assert(dest.outerStride() == 4 && src.outerStride() == 4,
+         "SetToEvolvedPV needs contiguous PVs.");
+  dest.setZero();
+  PLVKernels::IncrementWithWeightedEvolved(PatternThreadPool(), dest.data(),
+                                           transition_matrix_.data(), src.data(), 1.,
+                                           static_cast<size_t>(dest.cols()));
+}
+
+void TPEvalEngineViaLikelihood::SetToEvolvedTip(const PVId dest_id,
+                                                const EdgeId edge_id,
+                                                const TaxonId taxon_id) {
+  SetTransitionMatrixToHaveBranchLength(branch_handler_(edge_id));
+  auto &dest = GetPVs().GetPV(dest_id);
+  Assert(dest.outerStride() == 4, "SetToEvolvedTip needs a contiguous PV.");
+  dest.setZero();
+  PLVKernels::IncrementWithWeightedEvolvedTip(
+      PatternThreadPool(), dest.data(), transition_matrix_.data(),
+      GetSitePattern().GetTipStates().Codes(taxon_id.value_), 1.,
+      static_cast<size_t>(dest.cols()));
 }
 
 void TPEvalEngineViaLikelihood::MultiplyWithEvolvedPV(const PVId dest_id,
                                                       const EdgeId edge_id,
                                                       const PVId src_id) {
   SetTransitionMatrixToHaveBranchLength(branch_handler_(edge_id));
-  GetPVs().GetPV(dest_id).array() =
-      GetPVs().GetPV(dest_id).array() *
-      (transition_matrix_ * GetPVs().GetPV(src_id)).array();
+  auto &dest = GetPVs().GetPV(dest_id);
+  const auto &src = GetPVs().GetPV(src_id);
+  PLVKernels::ForEachPatternChunk(
+      PatternThreadPool(), static_cast<size_t>(dest.cols()),
+      [this, &dest, &src](size_t, size_t begin, size_t end) {
+        const auto length = end - begin;
+        dest.middleCols(begin, length).array() *=
+            (transition_matrix_ * src.middleCols(begin, length).cast<double>())
+                .array()
+                .cast<PLVScalar>();
+      });
+}
+
+void TPEvalEngineViaLikelihood::PrepareUnrescaledPerPatternProducts(
+    EigenVectorXd &result, const PVId src1_idx, const Eigen::Matrix4d &matrix,
+    const PVId src2_idx) const {
+  const auto &src1 = GetPVs().GetPV(src1_idx);
+  const auto &src2 = GetPVs().GetPV(src2_idx);
+  Assert(src1.outerStride() == 4 && src2.outerStride() == 4,
+         "PrepareUnrescaledPerPatternProducts needs contiguous PVs.");
+  result.resize(src1.cols());
+  PLVKernels::PerPatternLikelihoods(PatternThreadPool(), result.data(), src1.data(),
+                                    matrix.data(), src2.data(),
+                                    static_cast<size_t>(src1.cols()));
+}
+
+void TPEvalEngineViaLikelihood::PreparePerPatternLogLikelihoodsForEdge(
+    const PVId src1_idx, const PVId src2_idx) {
+  PrepareUnrescaledPerPatternProducts(per_pattern_log_likelihoods_, src1_idx,
+                                      transition_matrix_, src2_idx);
+  PLVKernels::ForEachPatternChunk(
+      PatternThreadPool(), static_cast<size_t>(per_pattern_log_likelihoods_.size()),
+      [this](size_t, size_t begin, size_t end) {
+        auto chunk = per_pattern_log_likelihoods_.segment(begin, end - begin);
+        chunk = chunk.array().log();
+      });
+}
+
+void TPEvalEngineViaLikelihood::PreparePerPatternLikelihoodDerivativeRatios() {
+  // If l_i is the per-site likelihood, the derivative of log(l_i) is the derivative
+  // of l_i divided by l_i.
+  per_pattern_likelihood_derivative_ratios_.resize(per_pattern_likelihoods_.size());
+  PLVKernels::ForEachPatternChunk(
+      PatternThreadPool(), static_cast<size_t>(per_pattern_likelihoods_.size()),
+      [this](size_t, size_t begin, size_t end) {
+        const auto length = end - begin;
+        per_pattern_likelihood_derivative_ratios_.segment(begin, length) =
+            per_pattern_likelihood_derivatives_.segment(begin, length).array() /
+            per_pattern_likelihoods_.segment(begin, length).array();
+      });
+}
+
+void TPEvalEngineViaLikelihood::PreparePerPatternLikelihoodSecondDerivativeRatios() {
+  // The second derivative of log(l_i) is (l_i'' l_i - l_i'^2) / l_i^2.
+  per_pattern_likelihood_second_derivative_ratios_.resize(
+      per_pattern_likelihoods_.size());
+  PLVKernels::ForEachPatternChunk(
+      PatternThreadPool(), static_cast<size_t>(per_pattern_likelihoods_.size()),
+      [this](size_t, size_t begin, size_t end) {
+        const auto length = end - begin;
+        const auto likelihoods =
+            per_pattern_likelihoods_.segment(begin, length).array();
+        const auto derivatives =
+            per_pattern_likelihood_derivatives_.segment(begin, length).array();
+        per_pattern_likelihood_second_derivative_ratios_.segment(begin, length) =
+            (per_pattern_likelihood_second_derivatives_.segment(begin, length).array() *
+                 likelihoods -
+             derivatives * derivatives) /
+            (likelihoods * likelihoods);
+      });
+}
+
+double TPEvalEngineViaLikelihood::SumOverSitePatterns(
+    const EigenVectorXd &per_pattern_values) const {
+  const auto &site_pattern_weights = GetTPEngine().GetSitePatternWeights();
+  return PLVKernels::WeightedSum(PatternThreadPool(), per_pattern_values.data(),
+                                 site_pattern_weights.data(),
+                                 static_cast<size_t>(per_pattern_values.size()));
+}
+
+void TPEvalEngineViaLikelihood::SetThreadCount(const size_t thread_count) {
+  Assert(thread_count > 0,
+         "TPEvalEngineViaLikelihood needs a strictly positive thread count.");
+  thread_count_ = thread_count;
+}
+
+ThreadPool *TPEvalEngineViaLikelihood::PatternThreadPool() const {
+  return (thread_count_ > 1) ? &ThreadPool::Shared(thread_count_) : nullptr;
 }
 
 DoublePair TPEvalEngineViaLikelihood::LogLikelihoodAndDerivative(const EdgeId edge_id) {
@@ -1138,8 +1248,7 @@ DoublePair TPEvalEngineViaLikelihood::LogLikelihoodAndDerivative(const EdgeId ed
   // The prior is expressed using the current value of q_.
   // The phylogenetic component of the likelihood is weighted with the number of times
   // we see the site patterns.
-  const double log_likelihood =
-      per_pattern_log_likelihoods_.dot(GetTPEngine().GetSitePatternWeights());
+  const double log_likelihood = SumOverSitePatterns(per_pattern_log_likelihoods_);
 
   // The per-site likelihood derivative is calculated in the same way as the per-site
   // likelihood, but using the derivative matrix instead of the transition matrix.
@@ -1147,13 +1256,9 @@ DoublePair TPEvalEngineViaLikelihood::LogLikelihoodAndDerivative(const EdgeId ed
   // rescalings cancel out in the ratio below.
   PrepareUnrescaledPerPatternLikelihoodDerivatives(parent_pvid, child_pvid);
   PrepareUnrescaledPerPatternLikelihoods(parent_pvid, child_pvid);
-  // If l_i is the per-site likelihood, the derivative of log(l_i) is the derivative
-  // of l_i divided by l_i.
-  per_pattern_likelihood_derivative_ratios_ =
-      per_pattern_likelihood_derivatives_.array() / per_pattern_likelihoods_.array();
+  PreparePerPatternLikelihoodDerivativeRatios();
   const double log_likelihood_derivative =
-      per_pattern_likelihood_derivative_ratios_.dot(
-          GetTPEngine().GetSitePatternWeights());
+      SumOverSitePatterns(per_pattern_likelihood_derivative_ratios_);
   return {log_likelihood, log_likelihood_derivative};
 }
 
@@ -1163,8 +1268,7 @@ TPEvalEngineViaLikelihood::LogLikelihoodAndFirstTwoDerivatives(const EdgeId edge
   SetTransitionAndDerivativeMatricesToHaveBranchLength(branch_handler_(edge_id));
   PreparePerPatternLogLikelihoodsForEdge(parent_pvid, child_pvid);
 
-  const double log_likelihood =
-      per_pattern_log_likelihoods_.dot(GetTPEngine().GetSitePatternWeights());
+  const double log_likelihood = SumOverSitePatterns(per_pattern_log_likelihoods_);
 
   // The per-site likelihood derivative is calculated in the same way as the per-site
   // likelihood, but using the derivative matrix instead of the transition matrix.
@@ -1172,49 +1276,37 @@ TPEvalEngineViaLikelihood::LogLikelihoodAndFirstTwoDerivatives(const EdgeId edge
   // rescalings cancel out in the ratio below.
   PrepareUnrescaledPerPatternLikelihoodDerivatives(parent_pvid, child_pvid);
   PrepareUnrescaledPerPatternLikelihoods(parent_pvid, child_pvid);
-  // If l_i is the per-site likelihood, the derivative of log(l_i) is the derivative
-  // of l_i divided by l_i.
-  per_pattern_likelihood_derivative_ratios_ =
-      per_pattern_likelihood_derivatives_.array() / per_pattern_likelihoods_.array();
-  const double log_likelihood_gradient = per_pattern_likelihood_derivative_ratios_.dot(
-      GetTPEngine().GetSitePatternWeights());
+  PreparePerPatternLikelihoodDerivativeRatios();
+  const double log_likelihood_gradient =
+      SumOverSitePatterns(per_pattern_likelihood_derivative_ratios_);
   // Second derivative is calculated the same way, but has an extra term due to
   // the product rule.
   PrepareUnrescaledPerPatternLikelihoodSecondDerivatives(parent_pvid, child_pvid);
-
-  per_pattern_likelihood_second_derivative_ratios_ =
-      (per_pattern_likelihood_second_derivatives_.array() *
-           per_pattern_likelihoods_.array() -
-       per_pattern_likelihood_derivatives_.array() *
-           per_pattern_likelihood_derivatives_.array()) /
-      (per_pattern_likelihoods_.array() * per_pattern_likelihoods_.array());
-
+  PreparePerPatternLikelihoodSecondDerivativeRatios();
   const double log_likelihood_hessian =
-      per_pattern_likelihood_second_derivative_ratios_.dot(
-          GetTPEngine().GetSitePatternWeights());
+      SumOverSitePatterns(per_pattern_likelihood_second_derivative_ratios_);
 
   return std::make_tuple(log_likelihood, log_likelihood_gradient,
                          log_likelihood_hessian);
 }
 
+void TPEvalEngineViaLikelihood::PrecomputeTransitionMatrices() {
+  transition_matrix_cache_.Precompute(branch_handler_.GetBranchLengthData().segment(
+      0, GetDAG().EdgeCountWithLeafSubsplits()));
+}
+
 void TPEvalEngineViaLikelihood::SetTransitionMatrixToHaveBranchLength(
     double branch_length) {
-  diagonal_matrix_.diagonal() = (branch_length * eigenvalues_).array().exp();
-  transition_matrix_ = eigenmatrix_ * diagonal_matrix_ * inverse_eigenmatrix_;
+  transition_matrix_ = transition_matrix_cache_.GetTransitionMatrix(branch_length);
 }
 
 void TPEvalEngineViaLikelihood::SetTransitionAndDerivativeMatricesToHaveBranchLength(
     double branch_length) {
-  diagonal_vector_ = (branch_length * eigenvalues_).array().exp();
-  diagonal_matrix_.diagonal() = diagonal_vector_;
-  transition_matrix_ = eigenmatrix_ * diagonal_matrix_ * inverse_eigenmatrix_;
-  // Now calculating derivative matrix
-  diagonal_matrix_.diagonal() = eigenvalues_.array() * diagonal_vector_.array();
-  derivative_matrix_ = eigenmatrix_ * diagonal_matrix_ * inverse_eigenmatrix_;
-  // Now calculating hessian matrix
-  diagonal_matrix_.diagonal() =
-      eigenvalues_.array() * eigenvalues_.array() * diagonal_vector_.array();
-  hessian_matrix_ = eigenmatrix_ * diagonal_matrix_ * inverse_eigenmatrix_;
+  const auto &matrices =
+      transition_matrix_cache_.GetMatricesWithDerivatives(branch_length);
+  transition_matrix_ = matrices.transition_;
+  derivative_matrix_ = matrices.derivative_;
+  hessian_matrix_ = matrices.hessian_;
 }
 
 void TPEvalEngineViaLikelihood::SetTransitionMatrixToHaveBranchLengthAndTranspose(
@@ -1228,9 +1320,15 @@ void TPEvalEngineViaLikelihood::SetTransitionMatrixToHaveBranchLengthAndTranspos
 
 TPEvalEngineViaParsimony::TPEvalEngineViaParsimony(TPEngine &tp_engine,
                                                    const std::string &mmap_path)
+    : TPEvalEngineViaParsimony(tp_engine, mmap_path,
+                               tp_engine.GetSitePattern().PatternCount()) {}
+
+TPEvalEngineViaParsimony::TPEvalEngineViaParsimony(TPEngine &tp_engine,
+                                                   const std::string &mmap_path,
+                                                   const size_t psv_pattern_count)
     : TPEvalEngine(tp_engine),
       parsimony_pvs_(mmap_path, GetDAG().EdgeCountWithLeafSubsplits(),
-                     GetSitePattern().PatternCount(), 2.0) {
+                     psv_pattern_count, 2.0) {
   GrowNodeData(GetDAG().NodeCount(), std::nullopt, std::nullopt, true);
   GrowEdgeData(GetDAG().EdgeCountWithLeafSubsplits(), std::nullopt, std::nullopt, true);
 }
@@ -1371,8 +1469,43 @@ double TPEvalEngineViaParsimony::GetTopTreeScoreWithProposedNNI(
     const NNIOperation &post_nni, const NNIOperation &pre_nni,
     const size_t spare_offset, std::optional<BitsetEdgeIdMap> best_edge_map) {
   using NNIClade = NNIOperation::NNIClade;
-  using NNICladeEnum = NNIOperation::NNICladeEnum;
+  // Each proposed NNI needs the spare PVs of a spare edge.
+  GrowSpareEdgeData(spare_offset + 1);
   GrowEdgeData(GetDAG().EdgeCountWithLeafSubsplits());
+  const auto post_id_map = GetPostNNIEdgeIds(post_nni, pre_nni);
+  // Get temp PVs for post-NNI PVs.
+  const PVId q_pvid = GetPVs().GetSparePVIndex(PVId(spare_offset * 3));
+  const PVId pleft_pvid = GetPVs().GetSparePVIndex(PVId((spare_offset * 3) + 1));
+  const PVId pright_pvid = GetPVs().GetSparePVIndex(PVId((spare_offset * 3) + 2));
+  const double *costs = parsimony_cost_matrix_.GetMatrix().data();
+  const size_t pattern_count = GetSitePattern().PatternCount();
+  auto pv_data = [this](const PSVType pv_type, const EdgeId edge_id) {
+    return GetPVs().GetPV(pv_type, edge_id).data();
+  };
+  // Compute Pleft and Pright.
+  for (const auto &[dest_pvid, child_id] :
+       {std::make_pair(pleft_pvid, post_id_map[NNIClade::ChildLeft]),
+        std::make_pair(pright_pvid, post_id_map[NNIClade::ChildRight])}) {
+    SankoffKernels::Evolve(GetPVs().GetPV(dest_pvid).data(), costs,
+                           pv_data(PSVType::PLeft, child_id),
+                           pv_data(PSVType::PRight, child_id), pattern_count);
+  }
+  // Compute Q, which combines the parent with the sister of the right child.
+  const EdgeId sister_id = post_id_map[NNIClade::ChildLeft];
+  SankoffKernels::EvolveSum(GetPVs().GetPV(q_pvid).data(), costs,
+                            pv_data(PSVType::PLeft, sister_id),
+                            pv_data(PSVType::PRight, sister_id),
+                            pv_data(PSVType::Q, post_id_map[NNIClade::ParentFocal]),
+                            pattern_count);
+  // Compute total parsimony.
+  double score = ParsimonyScore(q_pvid, pleft_pvid, pright_pvid);
+  return score;
+}
+
+NNIOperation::NNICladeEnum::Array<EdgeId> TPEvalEngineViaParsimony::GetPostNNIEdgeIds(
+    const NNIOperation &post_nni, const NNIOperation &pre_nni) const {
+  using NNIClade = NNIOperation::NNIClade;
+  using NNICladeEnum = NNIOperation::NNICladeEnum;
   // Node ids from pre-NNI in DAG.
   NNICladeEnum::Array<EdgeId> pre_id_map;
   NNICladeEnum::Array<EdgeId> post_id_map;
@@ -1390,38 +1523,7 @@ double TPEvalEngineViaParsimony::GetTopTreeScoreWithProposedNNI(
   for (const auto nni_clade : NNICladeEnum::Iterator()) {
     post_id_map[nni_clade] = pre_id_map[clade_map[nni_clade]];
   }
-  // Get temp PVs for post-NNI PVs and edge lengths.
-  const PVId q_pvid = PVId(spare_offset * 3);
-  const PVId pleft_pvid = PVId((spare_offset * 3) + 1);
-  const PVId pright_pvid = PVId((spare_offset * 3) + 2);
-  // Compute Pleft and Pright.
-  for (size_t pattern_idx = 0; pattern_idx < GetSitePattern().PatternCount();
-       pattern_idx++) {
-    GetPVs().GetPV(pleft_pvid).col(pattern_idx) =
-        ParentPartial(TotalPPartial(post_id_map[NNIClade::ChildLeft], pattern_idx));
-    GetPVs().GetPV(pright_pvid).col(pattern_idx) =
-        ParentPartial(TotalPPartial(post_id_map[NNIClade::ChildRight], pattern_idx));
-  }
-  // Compute Q.
-  for (size_t pattern_idx = 0; pattern_idx < GetSitePattern().PatternCount();
-       pattern_idx++) {
-    auto partials_from_parent =
-        ParentPartial(GetPVs()
-                          .GetPV(PSVType::Q, post_id_map[NNIClade::ParentFocal])
-                          .col(pattern_idx));
-    for (const auto child_id :
-         {post_id_map[NNIClade::ChildLeft], post_id_map[NNIClade::ChildRight]}) {
-      EdgeId sister_id = ((child_id == post_id_map[NNIClade::ChildLeft])
-                              ? post_id_map[NNIClade::ChildRight]
-                              : post_id_map[NNIClade::ChildLeft]);
-      auto partials_from_sister = ParentPartial(TotalPPartial(sister_id, pattern_idx));
-      GetPVs().GetPV(q_pvid).col(pattern_idx) =
-          partials_from_sister + partials_from_parent;
-    }
-  }
-  // Compute total parsimony.
-  double score = ParsimonyScore(q_pvid, pleft_pvid, pright_pvid);
-  return score;
+  return post_id_map;
 }
 
 void TPEvalEngineViaParsimony::CopyEdgeData(const EdgeId src_edge_id,
@@ -1442,27 +1544,12 @@ void TPEvalEngineViaParsimony::PopulateLeafParsimonyPVsWithSitePatterns() {
       for (const auto adj_node_id :
            GetDAG().GetDAGNode(node_id).GetNeighbors(Direction::Rootward, clade)) {
         const auto edge_id = GetDAG().GetEdgeIdx(adj_node_id, node_id);
+        // The states that the leaf can't be in cost big_double_, so leaves with gaps
+        // in sequence and ambiguous nucleotides are assigned sankoff partial vector
+        // [0, 0, 0, 0] at the corresponding site.
         SankoffPartial leaf_partials(state_count_, GetSitePattern().PatternCount());
-        // set leaf node partial to have big_double_ infinity substitute
-        leaf_partials.block(0, 0, state_count_, GetSitePattern().PatternCount())
-            .fill(big_double_);
-        // now fill in appropriate entries of the leaf-partial where non-infinite
-        for (size_t pattern_idx = 0; pattern_idx < GetSitePattern().PatternCount();
-             pattern_idx++) {
-          auto site_val =
-              GetSitePattern().GetPatternSymbol(node_id.value_, pattern_idx);
-          if (site_val < state_count_) {
-            leaf_partials(site_val, pattern_idx) = 0.;
-          } else if (site_val == state_count_) {
-            // Leaves with gaps in sequence and ambiguous nucleotides are assigned
-            // sankoff partial vector [0, 0, 0, 0] at the corresponding site.
-            leaf_partials.col(pattern_idx).fill(0);
-          } else {
-            Failwith(
-                "Error in SankoffHandler::GenerateLeafPartials: Invalid nucleotide "
-                "state in sequence alignment.");
-          }
-        }
+        GetSitePattern().GetTipStates().Expand(node_id.value_, 0., big_double_,
+                                               leaf_partials.data());
         GetPVs().GetPV(PSVType::PLeft, edge_id) = leaf_partials;
         GetPVs().GetPV(PSVType::PRight, edge_id).fill(0);
       }
@@ -1565,29 +1652,29 @@ EigenVectorXd TPEvalEngineViaParsimony::TotalPPartial(const PVId edge_pleft_pvid
 
 void TPEvalEngineViaParsimony::PopulateRootwardParsimonyPVForEdge(
     const EdgeId parent_id, const EdgeId left_child_id, const EdgeId right_child_id) {
-  for (size_t pattern_idx = 0; pattern_idx < GetSitePattern().PatternCount();
-       pattern_idx++) {
-    // Which child partial is in right or left doesn't actually matter because they
-    // are summed when calculating q_partials.
-    GetPVs().GetPV(PSVType::PLeft, parent_id).col(pattern_idx) =
-        ParentPartial(TotalPPartial(left_child_id, pattern_idx));
-    GetPVs().GetPV(PSVType::PRight, parent_id).col(pattern_idx) =
-        ParentPartial(TotalPPartial(right_child_id, pattern_idx));
+  // Which child partial is in right or left doesn't actually matter because they are
+  // summed when calculating q_partials.
+  for (const auto &[pv_type, child_id] :
+       {std::make_pair(PSVType::PLeft, left_child_id),
+        std::make_pair(PSVType::PRight, right_child_id)}) {
+    SankoffKernels::Evolve(GetPVs().GetPV(pv_type, parent_id).data(),
+                           parsimony_cost_matrix_.GetMatrix().data(),
+                           GetPVs().GetPV(PSVType::PLeft, child_id).data(),
+                           GetPVs().GetPV(PSVType::PRight, child_id).data(),
+                           GetSitePattern().PatternCount());
   }
 }
 
 void TPEvalEngineViaParsimony::PopulateLeafwardParsimonyPVForEdge(
     const EdgeId parent_id, const EdgeId left_child_id, const EdgeId right_child_id) {
-  for (size_t pattern_idx = 0; pattern_idx < GetSitePattern().PatternCount();
-       pattern_idx++) {
-    auto partials_from_parent =
-        ParentPartial(GetPVs().GetPV(PSVType::Q, parent_id).col(pattern_idx));
-    for (const auto child_id : {left_child_id, right_child_id}) {
-      EdgeId sister_id = ((child_id == left_child_id) ? right_child_id : left_child_id);
-      auto partials_from_sister = ParentPartial(TotalPPartial(sister_id, pattern_idx));
-      GetPVs().GetPV(PSVType::Q, child_id).col(pattern_idx) =
-          partials_from_sister + partials_from_parent;
-    }
+  for (const auto child_id : {left_child_id, right_child_id}) {
+    EdgeId sister_id = ((child_id == left_child_id) ? right_child_id : left_child_id);
+    SankoffKernels::EvolveSum(GetPVs().GetPV(PSVType::Q, child_id).data(),
+                              parsimony_cost_matrix_.GetMatrix().data(),
+                              GetPVs().GetPV(PSVType::PLeft, sister_id).data(),
+                              GetPVs().GetPV(PSVType::PRight, sister_id).data(),
+                              GetPVs().GetPV(PSVType::Q, parent_id).data(),
+                              GetSitePattern().PatternCount());
   }
 }
 
@@ -1600,22 +1687,137 @@ double TPEvalEngineViaParsimony::ParsimonyScore(const EdgeId edge_id) {
 double TPEvalEngineViaParsimony::ParsimonyScore(const PVId edge_q_pvid,
                                                 const PVId edge_pleft_pvid,
                                                 const PVId edge_pright_pvid) {
-  auto weights = GetSitePattern().GetWeights();
-  double total_parsimony = 0.;
-  for (size_t pattern = 0; pattern < GetSitePattern().PatternCount(); pattern++) {
-    // Note: doing ParentPartial first for the left and right p_partials and then
-    // adding them together will give the same minimum parsimony score, but doesn't
-    // give correct Sankoff Partial vector for the new rooting
-    auto total_tree =
-        ParentPartial(TotalPPartial(edge_pleft_pvid, edge_pright_pvid, pattern));
-    total_tree += ParentPartial(GetPVs().GetPV(edge_q_pvid).col(pattern));
-
-    // If node_id is the root node, calculating the total_tree vector like so does not
-    // yield the SankoffPartial of an actual rooting, but this will not change the
-    // minimum value in the partial, so the root node can still be used to calculate
-    // the parsimony score.
-    total_parsimony +=
-        *std::min_element(total_tree.begin(), total_tree.end()) * weights[pattern];
+  // Note: doing ParentPartial first for the left and right p_partials and then adding
+  // them together will give the same minimum parsimony score, but doesn't give correct
+  // Sankoff Partial vector for the new rooting.
+  return SankoffKernels::ParsimonyScore(
+      parsimony_cost_matrix_.GetMatrix().data(), GetPVs().GetPV(edge_pleft_pvid).data(),
+      GetPVs().GetPV(edge_pright_pvid).data(), GetPVs().GetPV(edge_q_pvid).data(),
+      GetSitePattern().GetWeights().data(), GetSitePattern().PatternCount());
+}
+
+// ** TPEvalEngineViaFitch
+
+TPEvalEngineViaFitch::TPEvalEngineViaFitch(TPEngine &tp_engine,
+                                           const std::string &mmap_path)
+    // The PSVs are only used for their count, so they get a single pattern.
+    : TPEvalEngineViaParsimony(tp_engine, mmap_path, 1),
+      fitch_kernels_(GetSitePattern().GetWeights()),
+      fitch_pvs_(mmap_path + ".fitch", GetDAG().EdgeCountWithLeafSubsplits(),
+                 fitch_kernels_.ColumnCount(), 2.0) {
+  GrowEdgeData(GetDAG().EdgeCountWithLeafSubsplits(), std::nullopt, std::nullopt, true);
+}
+
+bool TPEvalEngineViaFitch::IsApplicable(const SankoffMatrix &cost_matrix,
+                                        const SitePattern &site_pattern) {
+  return SankoffKernels::IsUnitCost(cost_matrix.GetMatrix().data()) &&
+         FitchKernels::SupportsWeights(site_pattern.GetWeights());
+}
+
+double TPEvalEngineViaFitch::GetTopTreeScoreWithProposedNNI(
+    const NNIOperation &post_nni, const NNIOperation &pre_nni,
+    const size_t spare_offset, std::optional<BitsetEdgeIdMap> best_edge_map) {
+  using NNIClade = NNIOperation::NNIClade;
+  // Each proposed NNI needs the spare PVs of a spare edge.
+  GrowSpareEdgeData(spare_offset + 1);
+  GrowEdgeData(GetDAG().EdgeCountWithLeafSubsplits());
+  const auto post_id_map = GetPostNNIEdgeIds(post_nni, pre_nni);
+  // Get temp PVs for post-NNI PVs.
+  auto spare_pv = [this, spare_offset](const size_t pv_idx) {
+    const PVId pv_id = GetFitchPVs().GetSparePVIndex(PVId((spare_offset * 3) + pv_idx));
+    return GetFitchPVs().GetPV(pv_id).data();
+  };
+  uint64_t *q_pv = spare_pv(0);
+  uint64_t *pleft_pv = spare_pv(1);
+  uint64_t *pright_pv = spare_pv(2);
+  // Compute Pleft and Pright.
+  for (const auto &[dest_pv, child_id] :
+       {std::make_pair(pleft_pv, post_id_map[NNIClade::ChildLeft]),
+        std::make_pair(pright_pv, post_id_map[NNIClade::ChildRight])}) {
+    fitch_kernels_.Combine(dest_pv, FitchPV(PSVType::PLeft, child_id),
+                           FitchPV(PSVType::PRight, child_id));
+  }
+  // Compute Q, which combines the parent with the sister of the right child.
+  const EdgeId sister_id = post_id_map[NNIClade::ChildLeft];
+  fitch_kernels_.CombineSum(q_pv, FitchPV(PSVType::PLeft, sister_id),
+                            FitchPV(PSVType::PRight, sister_id),
+                            FitchPV(PSVType::Q, post_id_map[NNIClade::ParentFocal]));
+  // Compute total parsimony.
+  return fitch_kernels_.ParsimonyScore(pleft_pv, pright_pv, q_pv);
+}
+
+void TPEvalEngineViaFitch::GrowEdgeData(const size_t edge_count,
+                                        std::optional<const Reindexer> edge_reindexer,
+                                        std::optional<const size_t> explicit_alloc,
+                                        const bool on_init) {
+  TPEvalEngineViaParsimony::GrowEdgeData(edge_count, edge_reindexer, explicit_alloc,
+                                         on_init);
+  // Build resizer for resizing data.
+  Resizer resizer =
+      Resizer(GetTPEngine().GetEdgeCount(), GetTPEngine().GetSpareEdgeCount(),
+              GetTPEngine().GetAllocatedEdgeCount(), edge_count, std::nullopt,
+              explicit_alloc, GetTPEngine().GetResizingFactor());
+  GetFitchPVs().Resize(resizer.GetNewCount(), resizer.GetNewAlloc(),
+                       resizer.GetNewSpare());
+  // Reindex work space to realign with DAG.
+  if (edge_reindexer.has_value()) {
+    auto pv_reindexer = GetFitchPVs().BuildPVReindexer(
+        edge_reindexer.value(), resizer.GetOldCount(), resizer.GetNewCount());
+    GetFitchPVs().Reindex(pv_reindexer);
   }
-  return total_parsimony;
+}
+
+void TPEvalEngineViaFitch::ZeroPVs() {
+  for (EdgeId edge_id = 0; edge_id < GetFitchPVs().GetCount(); edge_id++) {
+    for (const auto pv_type : PSVTypeEnum::Iterator()) {
+      fitch_kernels_.SetAnyState(FitchPV(pv_type, edge_id));
+    }
+  }
+}
+
+void TPEvalEngineViaFitch::PopulateLeafParsimonyPVsWithSitePatterns() {
+  Assert(GetFitchPVs().GetCount() >= GetSitePattern().TaxonCount(),
+         "Error in TPEvalEngineViaFitch::PopulateLeafParsimonyPVsWithSitePatterns: "
+         "fitch_pvs_ should be initialized to accomodate "
+         "the number of leaf nodes in the GetSitePattern().");
+
+  for (const auto node_id : GetDAG().GetLeafNodeIds()) {
+    const uint8_t *tip_codes = GetSitePattern().GetTipStates().Codes(node_id.value_);
+    for (const auto clade : {SubsplitClade::Left, SubsplitClade::Right}) {
+      for (const auto adj_node_id :
+           GetDAG().GetDAGNode(node_id).GetNeighbors(Direction::Rootward, clade)) {
+        const auto edge_id = GetDAG().GetEdgeIdx(adj_node_id, node_id);
+        fitch_kernels_.SetTip(FitchPV(PSVType::PLeft, edge_id), tip_codes);
+        fitch_kernels_.SetAnyState(FitchPV(PSVType::PRight, edge_id));
+      }
+    }
+  }
+}
+
+void TPEvalEngineViaFitch::PopulateRootwardParsimonyPVForEdge(
+    const EdgeId parent_id, const EdgeId left_child_id, const EdgeId right_child_id) {
+  for (const auto &[pv_type, child_id] :
+       {std::make_pair(PSVType::PLeft, left_child_id),
+        std::make_pair(PSVType::PRight, right_child_id)}) {
+    fitch_kernels_.Combine(FitchPV(pv_type, parent_id),
+                           FitchPV(PSVType::PLeft, child_id),
+                           FitchPV(PSVType::PRight, child_id));
+  }
+}
+
+void TPEvalEngineViaFitch::PopulateLeafwardParsimonyPVForEdge(
+    const EdgeId parent_id, const EdgeId left_child_id, const EdgeId right_child_id) {
+  for (const auto child_id : {left_child_id, right_child_id}) {
+    EdgeId sister_id = ((child_id == left_child_id) ? right_child_id : left_child_id);
+    fitch_kernels_.CombineSum(FitchPV(PSVType::Q, child_id),
+                              FitchPV(PSVType::PLeft, sister_id),
+                              FitchPV(PSVType::PRight, sister_id),
+                              FitchPV(PSVType::Q, parent_id));
+  }
+}
+
+double TPEvalEngineViaFitch::ParsimonyScore(const EdgeId edge_id) {
+  return fitch_kernels_.ParsimonyScore(FitchPV(PSVType::PLeft, edge_id),
+                                       FitchPV(PSVType::PRight, edge_id),
+                                       FitchPV(PSVType::Q, edge_id));
 }
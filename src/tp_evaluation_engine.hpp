@@ -18,10 +18,13 @@
 #include "pv_handler.hpp"
 #include "tp_choice_map.hpp"
 #include "nni_operation.hpp"
+#include "fitch_kernels.hpp"
 #include "sankoff_handler.hpp"
 #include "dag_branch_handler.hpp"
 #include "optimization.hpp"
+#include "plv_kernels.hpp"
 #include "substitution_model.hpp"
+#include "transition_matrix_cache.hpp"
 
 class TPEngine;
 using BitsetEdgeIdMap = std::unordered_map<Bitset, EdgeId>;
@@ -229,6 +232,12 @@ class TPEvalEngineViaLikelihood : public TPEvalEngine {
   const EigenMatrixXd &GetMatrix() const { return log_likelihoods_; }
   DAGBranchHandler &GetDAGBranchHandler() { return branch_handler_; }
   const DAGBranchHandler &GetDAGBranchHandler() const { return branch_handler_; }
+  const TransitionMatrixCache &GetTransitionMatrixCache() const {
+    return transition_matrix_cache_;
+  }
+  // The number of threads that per-pattern PV work is split across.
+  size_t GetThreadCount() const { return thread_count_; }
+  void SetThreadCount(const size_t thread_count);
 
   // ** PV Operations
 
@@ -335,47 +344,49 @@ class TPEvalEngineViaLikelihood : public TPEvalEngine {
                          const PVId parent_id);
   // Evolve src_id along the branch edge_id and store at dest_id.
   void SetToEvolvedPV(const PVId dest_id, const EdgeId edge_id, const PVId src_id);
+  // The same, for the site pattern of a taxon, read from its tip codes.
+  void SetToEvolvedTip(const PVId dest_id, const EdgeId edge_id,
+                       const TaxonId taxon_id);
   // Evolve src_id along the branch edge_id and multiply with contents of dest_id.
   void MultiplyWithEvolvedPV(const PVId dest_id, const EdgeId edge_id,
                              const PVId src_id);
+  // Set result to the per-pattern products src1[:, p]^T * matrix * src2[:, p], using
+  // the same kernel as GPEngine.
+  void PrepareUnrescaledPerPatternProducts(EigenVectorXd &result, const PVId src1_idx,
+                                           const Eigen::Matrix4d &matrix,
+                                           const PVId src2_idx) const;
   // Intermediate computation step for log likelihoods. Stored in temporary variable.
-  inline void PreparePerPatternLogLikelihoodsForEdge(const PVId src1_idx,
-                                                     const PVId src2_idx) {
-    per_pattern_log_likelihoods_ = (GetPVs().GetPV(src1_idx).transpose() *
-                                    transition_matrix_ * GetPVs().GetPV(src2_idx))
-                                       .diagonal()
-                                       .array()
-                                       .log();
-  }
+  void PreparePerPatternLogLikelihoodsForEdge(const PVId src1_idx, const PVId src2_idx);
   // Intermediate computation step for first derivative of log likelihoods. Stored in
   // temporary variable.
   inline void PrepareUnrescaledPerPatternLikelihoodDerivatives(const PVId src1_idx,
                                                                const PVId src2_idx) {
-    per_pattern_likelihood_derivatives_ =
-        (GetPVs().GetPV(src1_idx).transpose() * derivative_matrix_ *
-         GetPVs().GetPV(src2_idx))
-            .diagonal()
-            .array();
+    PrepareUnrescaledPerPatternProducts(per_pattern_likelihood_derivatives_, src1_idx,
+                                        derivative_matrix_, src2_idx);
   }
   // Intermediate computation step for second derivative of log likelihoods. Stored in
   // temporary variable.
   inline void PrepareUnrescaledPerPatternLikelihoodSecondDerivatives(
       const PVId src1_idx, const PVId src2_idx) {
-    per_pattern_likelihood_second_derivatives_ =
-        (GetPVs().GetPV(src1_idx).transpose() * hessian_matrix_ *
-         GetPVs().GetPV(src2_idx))
-            .diagonal()
-            .array();
+    PrepareUnrescaledPerPatternProducts(per_pattern_likelihood_second_derivatives_,
+                                        src1_idx, hessian_matrix_, src2_idx);
   }
   // Intermediate computation step for log likelihoods, but without rescaling. Stored in
   // temporary variable.
   inline void PrepareUnrescaledPerPatternLikelihoods(const PVId src1_idx,
                                                      const PVId src2_idx) {
-    per_pattern_likelihoods_ = (GetPVs().GetPV(src1_idx).transpose() *
-                                transition_matrix_ * GetPVs().GetPV(src2_idx))
-                                   .diagonal()
-                                   .array();
+    PrepareUnrescaledPerPatternProducts(per_pattern_likelihoods_, src1_idx,
+                                        transition_matrix_, src2_idx);
   }
+  // Compute the per-pattern ratios of the first (and second) derivatives of the
+  // likelihood to the likelihood, from the unrescaled per-pattern vectors.
+  void PreparePerPatternLikelihoodDerivativeRatios();
+  void PreparePerPatternLikelihoodSecondDerivativeRatios();
+  // The sum of per-pattern values weighted by the site pattern counts.
+  double SumOverSitePatterns(const EigenVectorXd &per_pattern_values) const;
+  // The pool that per-pattern work is split across in chunks of patterns (see
+  // PLVKernels), or nullptr to do it all on the calling thread.
+  ThreadPool *PatternThreadPool() const;
 
   // ** Branch Length Optimization Helpers
 
@@ -384,6 +395,9 @@ class TPEvalEngineViaLikelihood : public TPEvalEngine {
   // Compute log likelihood and first and second derivative for given edge.
   std::tuple<double, double, double> LogLikelihoodAndFirstTwoDerivatives(
       const EdgeId edge_id);
+  // Cache the transition matrices for the current branch lengths of all edges, so that
+  // a sweep only does lookups.
+  void PrecomputeTransitionMatrices();
   // Prep temporary transition matrix variable to use given branch length.
   void SetTransitionMatrixToHaveBranchLength(const double branch_length);
   // Prep temporary transition and derivative matrix variables to use given branch
@@ -404,6 +418,8 @@ class TPEvalEngineViaLikelihood : public TPEvalEngine {
   bool optimize_new_edges_ = true;
   // Number of optimization iterations.
   size_t optimize_max_iter_ = 1;
+  // Number of threads that per-pattern PV work is split across.
+  size_t thread_count_ = 1;
   // Temporary map of optimized edge lengths.
   std::map<Bitset, double> tmp_optimized_edges;
 
@@ -423,6 +439,7 @@ class TPEvalEngineViaLikelihood : public TPEvalEngine {
       substitution_model_.GetInverseEigenvectors().reshaped(4, 4);
   Eigen::Vector4d eigenvalues_ = substitution_model_.GetEigenvalues();
   Eigen::Vector4d stationary_distribution_ = substitution_model_.GetFrequencies();
+  TransitionMatrixCache transition_matrix_cache_{substitution_model_};
 
   // ** Temporaries
   // Stores intermediate computations useful for calculation.
@@ -432,7 +449,6 @@ class TPEvalEngineViaLikelihood : public TPEvalEngine {
   EigenVectorXd per_pattern_likelihood_derivative_ratios_;
   EigenVectorXd per_pattern_likelihood_second_derivatives_;
   EigenVectorXd per_pattern_likelihood_second_derivative_ratios_;
-  Eigen::Vector4d diagonal_vector_;
   Eigen::DiagonalMatrix<double, 4> diagonal_matrix_;
   Eigen::Matrix4d transition_matrix_;
   Eigen::Matrix4d derivative_matrix_;
@@ -506,7 +522,7 @@ class TPEvalEngineViaParsimony : public TPEvalEngine {
   // ** Populate PVs
 
   // Initialize PVs with zero.
-  void ZeroPVs();
+  virtual void ZeroPVs();
   // Populate rootward and leafward PVs.
   void PopulatePVs();
   // Populate P-PVs in a Rootward Pass of DAG.
@@ -518,8 +534,16 @@ class TPEvalEngineViaParsimony : public TPEvalEngine {
 
   PSVEdgeHandler &GetPVs() { return parsimony_pvs_; }
   const PSVEdgeHandler &GetPVs() const { return parsimony_pvs_; }
+  // Whether the PSVs hold the partials. Engines that keep their partials elsewhere only
+  // use the PSVs for their count.
+  virtual bool HasPartialsInPVs() const { return true; }
 
  protected:
+  // For engines that keep their partials elsewhere, the PSVs can be given fewer
+  // patterns.
+  TPEvalEngineViaParsimony(TPEngine &tp_engine, const std::string &mmap_path,
+                           size_t psv_pattern_count);
+
   // ** Scoring Helpers
 
   // Compute the rootward P-PVs for given node or edge.
@@ -529,7 +553,7 @@ class TPEvalEngineViaParsimony : public TPEvalEngine {
   void PopulateLeafwardParsimonyPVForNode(const NodeId node_id);
   void PopulateLeafwardParsimonyPVForEdge(const EdgeId edge_id);
   // Set the P-PVs to match the observed site patterns at the leaves.
-  void PopulateLeafParsimonyPVsWithSitePatterns();
+  virtual void PopulateLeafParsimonyPVsWithSitePatterns();
   // Calculate the PV for a given parent-child pair.
   EigenVectorXd ParentPartial(EigenVectorXd child_partials);
   // Sum P-PVs for right and left children of node 'node_id'
@@ -541,19 +565,22 @@ class TPEvalEngineViaParsimony : public TPEvalEngine {
   // Populate rootward P-PVs for given edge.
   // Updates parent's Pleft PV with sum of left child P PVs and parent's PRight PV with
   // sum of right child P PVs.
-  void PopulateRootwardParsimonyPVForEdge(const EdgeId parent_id,
-                                          const EdgeId left_child_id,
-                                          const EdgeId right_child_id);
+  virtual void PopulateRootwardParsimonyPVForEdge(const EdgeId parent_id,
+                                                  const EdgeId left_child_id,
+                                                  const EdgeId right_child_id);
   // Populate leafward Q-PVs for given edge.
   // Updates parent's Q PV by combining with sister's sum of P PVs.
-  void PopulateLeafwardParsimonyPVForEdge(const EdgeId parent_id,
-                                          const EdgeId left_child_id,
-                                          const EdgeId right_child_id);
+  virtual void PopulateLeafwardParsimonyPVForEdge(const EdgeId parent_id,
+                                                  const EdgeId left_child_id,
+                                                  const EdgeId right_child_id);
   // Calculates parsimony score on given edge.
   // Takes the minimum element after taking sum of edge's P and Q PVs.
-  double ParsimonyScore(const EdgeId edge_id);
+  virtual double ParsimonyScore(const EdgeId edge_id);
   double ParsimonyScore(const PVId edge_q_pvid, const PVId edge_pleft_pvid,
                         const PVId edge_pright_pvid);
+  // The edges whose PVs make up the post-NNI PVs of a proposed NNI, by NNI clade.
+  NNIOperation::NNICladeEnum::Array<EdgeId> GetPostNNIEdgeIds(
+      const NNIOperation &post_nni, const NNIOperation &pre_nni) const;
 
  protected:
   // Partial Vector for computing Parsimony scores.
@@ -571,3 +598,63 @@ class TPEvalEngineViaParsimony : public TPEvalEngine {
   // Number of spare edges needed to be allocated per proposed NNI.
   static constexpr size_t spare_edges_per_nni_ = 5;
 };
+
+// TPEngine helper for evaluating Top Trees using Fitch parsimony, which is parsimony
+// with unit costs. It runs the passes of TPEvalEngineViaParsimony on the bit-parallel
+// partials of FitchKernels rather than on PSVs, and gives the same scores. TPEngine
+// uses it in place of TPEvalEngineViaParsimony whenever IsApplicable.
+class TPEvalEngineViaFitch : public TPEvalEngineViaParsimony {
+ public:
+  TPEvalEngineViaFitch(TPEngine &tp_engine, const std::string &mmap_path);
+
+  // Whether Fitch parsimony gives the same scores as Sankoff parsimony with these
+  // costs and site patterns.
+  static bool IsApplicable(const SankoffMatrix &cost_matrix,
+                           const SitePattern &site_pattern);
+
+  // ** Scoring
+
+  double GetTopTreeScoreWithProposedNNI(
+      const NNIOperation &post_nni, const NNIOperation &pre_nni,
+      const size_t spare_offset = 0,
+      std::optional<BitsetEdgeIdMap> = std::nullopt) override;
+
+  // ** Resize
+
+  void GrowEdgeData(const size_t edge_count,
+                    std::optional<const Reindexer> edge_reindexer = std::nullopt,
+                    std::optional<const size_t> explicit_alloc = std::nullopt,
+                    const bool on_init = false) override;
+
+  // ** Populate PVs
+
+  // Initialize PVs with the partials of zero PSVs.
+  void ZeroPVs() override;
+
+  // ** Access
+
+  FitchEdgeHandler &GetFitchPVs() { return fitch_pvs_; }
+  const FitchEdgeHandler &GetFitchPVs() const { return fitch_pvs_; }
+  bool HasPartialsInPVs() const override { return false; }
+
+ protected:
+  // ** Scoring Helpers
+
+  void PopulateLeafParsimonyPVsWithSitePatterns() override;
+  void PopulateRootwardParsimonyPVForEdge(const EdgeId parent_id,
+                                          const EdgeId left_child_id,
+                                          const EdgeId right_child_id) override;
+  void PopulateLeafwardParsimonyPVForEdge(const EdgeId parent_id,
+                                          const EdgeId left_child_id,
+                                          const EdgeId right_child_id) override;
+  double ParsimonyScore(const EdgeId edge_id) override;
+
+  uint64_t *FitchPV(const PSVType pv_type, const EdgeId edge_id) {
+    return GetFitchPVs().GetPV(pv_type, edge_id).data();
+  }
+
+ protected:
+  FitchKernels fitch_kernels_;
+  // Fitch partials, in place of the PSVs of TPEvalEngineViaParsimony.
+  FitchEdgeHandler fitch_pvs_;
+};
@@ -0,0 +1,118 @@
+// Copyright 2019-2022 bito project contributors.
+// bito is free software under the GPLv3; see LICENSE file for details.
+
+#include "transition_matrix_cache.hpp"
+
+void TransitionMatrixCache::SetModel(const SubstitutionModel& model) {
+  Assert(model.GetStateCount() == 4,
+         "TransitionMatrixCache only handles nucleotide models.");
+  eigenmatrix_ = model.GetEigenvectors().reshaped(4, 4);
+  inverse_eigenmatrix_ = model.GetInverseEigenvectors().reshaped(4, 4);
+  eigenvalues_ = model.GetEigenvalues();
+  matrices_.clear();
+  insertion_order_.clear();
+  oldest_position_ = 0;
+}
+
+const Eigen::Matrix4d& TransitionMatrixCache::GetTransitionMatrix(
+    double branch_length) {
+  auto search = matrices_.find(branch_length);
+  if (search != matrices_.end()) {
+    hit_count_++;
+    return search->second.transition_;
+  }
+  // else
+  miss_count_++;
+  return Insert(branch_length).transition_;
+}
+
+const TransitionMatrixCache::Matrices&
+TransitionMatrixCache::GetMatricesWithDerivatives(double branch_length) {
+  auto search = matrices_.find(branch_length);
+  if (search != matrices_.end() && search->second.has_derivatives_) {
+    hit_count_++;
+    return search->second;
+  }
+  // else
+  miss_count_++;
+  auto& matrices =
+      (search == matrices_.end()) ? Insert(branch_length) : search->second;
+  FillDerivatives(branch_length, matrices);
+  return matrices;
+}
+
+Eigen::Matrix4d TransitionMatrixCache::FindTransitionMatrix(
+    double branch_length) const {
+  auto search = matrices_.find(branch_length);
+  if (search != matrices_.end()) {
+    hit_count_++;
+    return search->second.transition_;
+  }
+  // else
+  miss_count_++;
+  return MatrixWithDiagonal((branch_length * eigenvalues_).array().exp());
+}
+
+void TransitionMatrixCache::Precompute(double branch_length) {
+  if (matrices_.find(branch_length) == matrices_.end()) {
+    Insert(branch_length);
+    precomputed_count_++;
+  }
+}
+
+void TransitionMatrixCache::Precompute(EigenConstVectorXdRef branch_lengths) {
+  for (Eigen::Index idx = 0; idx < branch_lengths.size(); idx++) {
+    Precompute(branch_lengths[idx]);
+  }
+}
+
+double TransitionMatrixCache::HitRate() const {
+  const size_t lookup_count = hit_count_ + miss_count_;
+  return (lookup_count == 0)
+             ? 0.
+             : static_cast<double>(hit_count_) / static_cast<double>(lookup_count);
+}
+
+StringSizeMap TransitionMatrixCache::Statistics() const {
+  return {{"hits", hit_count_},
+          {"misses", miss_count_},
+          {"precomputed", precomputed_count_},
+          {"evictions", eviction_count_},
+          {"entries", GetEntryCount()}};
+}
+
+void TransitionMatrixCache::ResetStatistics() {
+  hit_count_ = 0;
+  miss_count_ = 0;
+  precomputed_count_ = 0;
+  eviction_count_ = 0;
+}
+
+Eigen::Matrix4d TransitionMatrixCache::MatrixWithDiagonal(
+    const Eigen::Vector4d& diagonal) const {
+  return eigenmatrix_ * diagonal.asDiagonal() * inverse_eigenmatrix_;
+}
+
+TransitionMatrixCache::Matrices& TransitionMatrixCache::Insert(double branch_length) {
+  if (insertion_order_.size() < max_entry_count_) {
+    insertion_order_.push_back(branch_length);
+  } else {
+    matrices_.erase(insertion_order_[oldest_position_]);
+    eviction_count_++;
+    insertion_order_[oldest_position_] = branch_length;
+    oldest_position_ = (oldest_position_ + 1) % max_entry_count_;
+  }
+  auto& matrices = matrices_[branch_length];
+  matrices.transition_ =
+      MatrixWithDiagonal((branch_length * eigenvalues_).array().exp());
+  return matrices;
+}
+
+void TransitionMatrixCache::FillDerivatives(double branch_length,
+                                            Matrices& matrices) const {
+  const Eigen::Vector4d diagonal = (branch_length * eigenvalues_).array().exp();
+  matrices.derivative_ = MatrixWithDiagonal(eigenvalues_.array() * diagonal.array());
+  matrices.hessian_ = MatrixWithDiagonal(eigenvalues_.array() * eigenvalues_.array() *
+                                         diagonal.array());
+  matrices.has_derivatives_ = true;
+}
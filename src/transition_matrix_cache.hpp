@@ -0,0 +1,143 @@
+// Copyright 2019-2022 bito project contributors.
+// bito is free software under the GPLv3; see LICENSE file for details.
+//
+// A cache of transition matrices, and of their first two derivatives with respect to
+// branch length, keyed by exact branch length. Many edges share a branch length (for
+// example the default one), and branch length optimization re-evaluates at converged
+// values, so GP and TP sweeps would otherwise recompute the same matrices many times.
+//
+// The cache is tied to the eigendecomposition of a substitution model, and SetModel
+// forgets everything cached for the previous one. Lookups are counted so that we can
+// report a hit rate; Precompute fills the cache ahead of a sweep without counting.
+//
+// Once the cache is full, each new entry evicts the oldest one. Lookups may run on
+// several threads at once, so we don't reorder entries on a hit as an LRU cache would.
+
+#pragma once
+
+#include <atomic>
+#include <unordered_map>
+#include <vector>
+
+#include "eigen_sugar.hpp"
+#include "substitution_model.hpp"
+#include "sugar.hpp"
+
+class TransitionMatrixCache {
+ public:
+  struct Matrices {
+    Eigen::Matrix4d transition_;
+    // The derivatives are only filled in when asked for.
+    bool has_derivatives_ = false;
+    Eigen::Matrix4d derivative_;
+    Eigen::Matrix4d hessian_;
+  };
+
+  explicit TransitionMatrixCache(const SubstitutionModel& model) { SetModel(model); }
+
+  // Use the eigendecomposition of the given model, forgetting any cached matrices.
+  void SetModel(const SubstitutionModel& model);
+
+  // The transition matrix for branch_length, computed and cached if need be.
+  const Eigen::Matrix4d& GetTransitionMatrix(double branch_length);
+  // The same, with the derivative and hessian matrices filled in.
+  const Matrices& GetMatricesWithDerivatives(double branch_length);
+  // Look up a transition matrix without caching it on a miss. As long as nothing is
+  // being added at the same time, this is safe to call from several threads.
+  Eigen::Matrix4d FindTransitionMatrix(double branch_length) const;
+  // Cache transition matrices ahead of a sweep, so that the sweep only does lookups.
+  void Precompute(double branch_length);
+  void Precompute(EigenConstVectorXdRef branch_lengths);
+
+  size_t GetEntryCount() const { return matrices_.size(); }
+  // The fraction of lookups that were hits, or 0 if there have been no lookups.
+  double HitRate() const;
+  // Counts of lookup hits and misses, matrices added by Precompute, entries evicted to
+  // make room, and entries.
+  StringSizeMap Statistics() const;
+  void ResetStatistics();
+
+  // To keep the cache from growing without bound as optimization tries out new branch
+  // lengths, it holds at most this many entries.
+  static constexpr size_t max_entry_count_ = 1 << 16;
+
+ private:
+  Eigen::Matrix4d MatrixWithDiagonal(const Eigen::Vector4d& diagonal) const;
+  Matrices& Insert(double branch_length);
+  void FillDerivatives(double branch_length, Matrices& matrices) const;
+
+  Eigen::Matrix4d eigenmatrix_;
+  Eigen::Matrix4d inverse_eigenmatrix_;
+  Eigen::Vector4d eigenvalues_;
+  std::unordered_map<double, Matrices> matrices_;
+  // The branch lengths of the entries in the order that they were added, as a ring
+  // whose oldest entry is at oldest_position_ once the cache is full.
+  std::vector<double> insertion_order_;
+  size_t oldest_position_ = 0;
+
+  mutable std::atomic<size_t> hit_count_{0};
+  mutable std::atomic<size_t> miss_count_{0};
+  size_t precomputed_count_ = 0;
+  size_t eviction_count_ = 0;
+};
+
+#ifdef DOCTEST_LIBRARY_INCLUDED
+TEST_CASE("TransitionMatrixCache") {
+  JC69Model model;
+  TransitionMatrixCache cache(model);
+  // Computed directly:
+  // https://en.wikipedia.org/wiki/Models_of_DNA_evolution#JC69_model_%28Jukes_and_Cantor_1969%29
+  CHECK(fabs(0.52590958087 - cache.GetTransitionMatrix(0.75)(0, 0)) < 1e-10);
+  CHECK(fabs(0.1580301397 - cache.GetTransitionMatrix(0.75)(0, 1)) < 1e-10);
+  CHECK_EQ(cache.Statistics().at("misses"), 1);
+  CHECK_EQ(cache.Statistics().at("hits"), 1);
+  CHECK_EQ(cache.HitRate(), 0.5);
+  // The derivative of P_00(t) = 1/4 + 3/4 exp(-4t/3) is -exp(-4t/3), and the second
+  // derivative is 4/3 exp(-4t/3).
+  const auto& matrices = cache.GetMatricesWithDerivatives(0.75);
+  CHECK(matrices.has_derivatives_);
+  CHECK(fabs(-exp(-1.) - matrices.derivative_(0, 0)) < 1e-10);
+  CHECK(fabs(4. / 3. * exp(-1.) - matrices.hessian_(0, 0)) < 1e-10);
+  CHECK_EQ(cache.GetEntryCount(), 1);
+
+  EigenVectorXd branch_lengths(3);
+  branch_lengths << 0.1, 0.2, 0.1;
+  cache.Precompute(branch_lengths);
+  CHECK_EQ(cache.GetEntryCount(), 3);
+  CHECK_EQ(cache.Statistics().at("precomputed"), 2);
+  const Eigen::Matrix4d found = cache.FindTransitionMatrix(0.2);
+  CHECK(found.cwiseEqual(cache.GetTransitionMatrix(0.2)).all());
+  CHECK_EQ(cache.Statistics().at("hits"), 3);
+  // Misses in FindTransitionMatrix aren't cached.
+  cache.FindTransitionMatrix(0.3);
+  CHECK_EQ(cache.GetEntryCount(), 3);
+
+  cache.SetModel(model);
+  CHECK_EQ(cache.GetEntryCount(), 0);
+  cache.ResetStatistics();
+  CHECK_EQ(cache.HitRate(), 0.);
+
+  // A full cache evicts its oldest entry for each new one, rather than all of them.
+  const size_t max_entry_count = TransitionMatrixCache::max_entry_count_;
+  for (size_t idx = 0; idx < max_entry_count + 2; idx++) {
+    cache.Precompute(static_cast<double>(idx) / max_entry_count);
+  }
+  CHECK_EQ(cache.GetEntryCount(), max_entry_count);
+  CHECK_EQ(cache.Statistics().at("evictions"), 2);
+  cache.ResetStatistics();
+  cache.FindTransitionMatrix(0.);
+  cache.FindTransitionMatrix(1. / max_entry_count);
+  CHECK_EQ(cache.Statistics().at("misses"), 2);
+  cache.FindTransitionMatrix(2. / max_entry_count);
+  cache.FindTransitionMatrix(1. + 1. / max_entry_count);
+  CHECK_EQ(cache.Statistics().at("hits"), 2);
+  // The ring carries on from where it was, so adding 0 evicts 2 / max_entry_count.
+  cache.GetTransitionMatrix(0.);
+  CHECK_EQ(cache.GetEntryCount(), max_entry_count);
+  CHECK_EQ(cache.Statistics().at("evictions"), 1);
+  cache.FindTransitionMatrix(2. / max_entry_count);
+  cache.FindTransitionMatrix(3. / max_entry_count);
+  CHECK_EQ(cache.Statistics().at("misses"), 4);
+  CHECK_EQ(cache.Statistics().at("hits"), 3);
+}
+#endif  // DOCTEST_LIBRARY_INCLUDED
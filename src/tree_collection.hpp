@@ -29,4 +29,51 @@ TEST_CASE("TreeCollection") {
   collection.DropFirst(1.);
   CHECK_EQ(collection.TreeCount(), 0);
 }
+
+TEST_CASE("TreeCollection: Export and Load") {
+  auto trees = Tree::ExampleTrees();
+  DoubleVector weights;
+  for (size_t tree_idx = 0; tree_idx < trees.size(); tree_idx++) {
+    weights.push_back(0.5 * static_cast<double>(tree_idx));
+    auto& branch_lengths = trees[tree_idx].branch_lengths_;
+    for (size_t node_id = 0; node_id < branch_lengths.size(); node_id++) {
+      branch_lengths[node_id] = 0.1 * static_cast<double>(tree_idx) + 0.01 * node_id;
+    }
+  }
+  const TreeCollection collection(trees, StringVector({"mouse", "rat", "human", "ape"}));
+  collection.Export("_ignore/example_trees.bito");
+  CHECK_EQ(TreeCollection::Load("_ignore/example_trees.bito"), collection);
+  CHECK_EQ(TreeCollection::Load("_ignore/example_trees.bito", 3), collection);
+  CHECK(TreeCollection::LoadWeights("_ignore/example_trees.bito").empty());
+  collection.Export("_ignore/weighted_example_trees.bito", weights);
+  CHECK_EQ(TreeCollection::Load("_ignore/weighted_example_trees.bito"), collection);
+  CHECK_EQ(TreeCollection::LoadWeights("_ignore/weighted_example_trees.bito"), weights);
+  CHECK_THROWS(collection.Export("_ignore/example_trees.bito", {1.}));
+  // A failure part of the way through writing leaves the previous file be, and no
+  // partial file behind.
+  CHECK_THROWS(TreeCollectionFile::Write(
+      "_ignore/example_trees.bito", collection.TagTaxonMap(), collection.TreeCount(),
+      [&collection](size_t tree_idx) -> const Tree& {
+        if (tree_idx > 0) {
+          Failwith("Tree not available.");
+        }
+        return collection.GetTree(tree_idx);
+      },
+      {}));
+  CHECK_EQ(TreeCollection::Load("_ignore/example_trees.bito"), collection);
+  CHECK_FALSE(std::ifstream("_ignore/example_trees.bito.partial").good());
+  const TreeCollection empty_collection({}, collection.TagTaxonMap());
+  empty_collection.Export("_ignore/empty_trees.bito");
+  CHECK_EQ(TreeCollection::Load("_ignore/empty_trees.bito", 2), empty_collection);
+  // A truncated file is caught.
+  {
+    std::ifstream in("_ignore/example_trees.bito", std::ios::binary);
+    std::string contents((std::istreambuf_iterator<char>(in)),
+                         std::istreambuf_iterator<char>());
+    std::ofstream out("_ignore/truncated_trees.bito", std::ios::binary);
+    out << contents.substr(0, contents.size() - 4);
+  }
+  CHECK_THROWS(TreeCollection::Load("_ignore/truncated_trees.bito"));
+  CHECK_THROWS(TreeCollection::Load("data/five_taxon_unrooted.nwk"));
+}
 #endif  // DOCTEST_LIBRARY_INCLUDED
@@ -0,0 +1,230 @@
+// Copyright 2019-2022 bito project contributors.
+// bito is free software under the GPLv3; see LICENSE file for details.
+
+#include "tree_collection_file.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+namespace {
+
+constexpr size_t magic_size = 8;
+constexpr size_t header_size = 32;
+
+size_t PaddedSize(size_t byte_count) { return (byte_count + 7) / 8 * 8; }
+
+template <typename T>
+void WriteValue(std::ofstream &out, const T &value) {
+  out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <typename T>
+void WriteVector(std::ofstream &out, const std::vector<T> &values) {
+  out.write(reinterpret_cast<const char *>(values.data()),
+            static_cast<std::streamsize>(values.size() * sizeof(T)));
+}
+
+}  // namespace
+
+void TreeCollectionFile::Write(const std::string &path,
+                               const TagStringMap &tag_taxon_map, size_t tree_count,
+                               const TreeAt &tree_at, const DoubleVector &weights) {
+  if (!weights.empty() && weights.size() != tree_count) {
+    Failwith("Need a weight for each tree when writing a tree collection file.");
+  }
+  // Write to a temporary file and move it into place once it is complete, so that a
+  // failure part of the way through doesn't leave a truncated file at path.
+  const std::string partial_path = path + ".partial";
+  std::ofstream out(partial_path, std::ios::binary);
+  if (!out) {
+    Failwith("Cannot open the File : " + partial_path);
+  }
+  try {
+    WriteContents(out, tag_taxon_map, tree_count, tree_at, weights);
+    out.close();
+    if (!out) {
+      Failwith("Could not write the tree collection file " + path);
+    }
+    if (std::rename(partial_path.c_str(), path.c_str()) != 0) {
+      Failwith("Could not move the tree collection file into place at " + path);
+    }
+  } catch (...) {
+    out.close();
+    std::remove(partial_path.c_str());
+    throw;
+  }
+}
+
+void TreeCollectionFile::WriteContents(std::ofstream &out,
+                                       const TagStringMap &tag_taxon_map,
+                                       size_t tree_count, const TreeAt &tree_at,
+                                       const DoubleVector &weights) {
+  // Taxon names are given by their leaf id, as in GenericTreeCollection::TaxonNames.
+  StringVector taxon_names(tag_taxon_map.size());
+  for (const auto &[tag, name] : tag_taxon_map) {
+    const auto leaf_id = MaxLeafIDOfTag(tag);
+    Assert(leaf_id < taxon_names.size(),
+           "Leaf ID is out of range when writing a tree collection file.");
+    taxon_names[leaf_id] = name;
+  }
+  out.write(magic_, magic_size);
+  WriteValue(out, version_);
+  WriteValue(out, static_cast<uint32_t>(taxon_names.size()));
+  WriteValue(out, static_cast<uint64_t>(tree_count));
+  WriteValue(out, weights.empty() ? uint64_t(0) : has_weights_flag_);
+  size_t names_size = 0;
+  for (const auto &name : taxon_names) {
+    WriteValue(out, static_cast<uint32_t>(name.size()));
+    out.write(name.data(), static_cast<std::streamsize>(name.size()));
+    names_size += sizeof(uint32_t) + name.size();
+  }
+  const std::vector<char> padding(PaddedSize(names_size) - names_size, 0);
+  WriteVector(out, padding);
+  std::vector<uint64_t> node_offsets(tree_count + 1, 0);
+  for (size_t tree_idx = 0; tree_idx < tree_count; tree_idx++) {
+    node_offsets[tree_idx + 1] =
+        node_offsets[tree_idx] + tree_at(tree_idx).BranchLengths().size();
+  }
+  WriteVector(out, node_offsets);
+  for (size_t tree_idx = 0; tree_idx < tree_count; tree_idx++) {
+    WriteVector(out, tree_at(tree_idx).BranchLengths());
+  }
+  WriteVector(out, weights);
+  std::vector<uint32_t> parent_ids;
+  for (size_t tree_idx = 0; tree_idx < tree_count; tree_idx++) {
+    const auto parent_id_vector = tree_at(tree_idx).ParentIdVector();
+    parent_ids.resize(parent_id_vector.size());
+    for (size_t node_id = 0; node_id < parent_id_vector.size(); node_id++) {
+      if (parent_id_vector[node_id] <= node_id) {
+        Failwith(
+            "Tree collection files need node ids in postorder, as assigned by "
+            "Node::Polish.");
+      }
+      parent_ids[node_id] = static_cast<uint32_t>(parent_id_vector[node_id]);
+    }
+    WriteVector(out, parent_ids);
+  }
+}
+
+TreeCollectionFile::TreeCollectionFile(const std::string &path)
+    : path_(path), mmapped_file_(path) {
+  const char *data = mmapped_file_.View().data();
+  const size_t byte_count = mmapped_file_.ByteCount();
+  size_t position = 0;
+  // Get a pointer to count values of type T at the current position.
+  auto take = [this, data, byte_count, &position](size_t count, auto *&pointer) {
+    using T = std::remove_const_t<std::remove_reference_t<decltype(*pointer)>>;
+    if (position > byte_count || count > (byte_count - position) / sizeof(T)) {
+      FailCorrupt("it is too short");
+    }
+    pointer = reinterpret_cast<const T *>(data + position);
+    position += count * sizeof(T);
+  };
+  if (byte_count < header_size || std::memcmp(data, magic_, magic_size) != 0) {
+    FailCorrupt("it doesn't start with " + std::string(magic_));
+  }
+  position = magic_size;
+  const uint32_t *version;
+  take(1, version);
+  if (*version != version_) {
+    FailCorrupt("it has format version " + std::to_string(*version));
+  }
+  const uint32_t *taxon_count;
+  take(1, taxon_count);
+  taxon_count_ = *taxon_count;
+  const uint64_t *tree_count;
+  take(1, tree_count);
+  tree_count_ = *tree_count;
+  // Each tree takes up more than a byte, which also keeps tree_count_ + 1 in range.
+  if (tree_count_ > byte_count) {
+    FailCorrupt("it is too short");
+  }
+  const uint64_t *flags;
+  take(1, flags);
+  for (uint32_t leaf_id = 0; leaf_id < taxon_count_; leaf_id++) {
+    const uint32_t *name_size;
+    take(1, name_size);
+    const char *name;
+    take(*name_size, name);
+    SafeInsert(tag_taxon_map_, PackInts(leaf_id, 1), std::string(name, *name_size));
+  }
+  position = PaddedSize(position);
+  take(tree_count_ + 1, node_offsets_);
+  const uint64_t node_count = node_offsets_[tree_count_];
+  if (node_offsets_[0] != 0) {
+    FailCorrupt("its first tree doesn't start at node 0");
+  }
+  for (size_t tree_idx = 0; tree_idx < tree_count_; tree_idx++) {
+    if (node_offsets_[tree_idx + 1] < node_offsets_[tree_idx] + taxon_count_ ||
+        node_offsets_[tree_idx + 1] == node_offsets_[tree_idx]) {
+      FailCorrupt("tree " + std::to_string(tree_idx) + " has too few nodes");
+    }
+  }
+  take(node_count, branch_lengths_);
+  weights_ = nullptr;
+  if (*flags & has_weights_flag_) {
+    take(tree_count_, weights_);
+  }
+  take(node_count - tree_count_, parent_ids_);
+  if (position != byte_count) {
+    FailCorrupt("it is too long");
+  }
+}
+
+DoubleVector TreeCollectionFile::Weights() const {
+  if (weights_ == nullptr) {
+    return {};
+  }
+  return DoubleVector(weights_, weights_ + tree_count_);
+}
+
+Node::NodePtr TreeCollectionFile::TopologyAt(size_t tree_idx) const {
+  Assert(tree_idx < tree_count_, "Tree index out of range in TopologyAt.");
+  const size_t node_count = node_offsets_[tree_idx + 1] - node_offsets_[tree_idx];
+  const uint32_t *parent_ids = parent_ids_ + node_offsets_[tree_idx] - tree_idx;
+  // The children of internal node taxon_count_ + i gather in children[i]. We size
+  // these vectors up front to save on reallocation.
+  std::vector<Node::NodePtrVec> children(node_count - taxon_count_);
+  SizeVector child_counts(children.size(), 0);
+  for (size_t node_id = 0; node_id + 1 < node_count; node_id++) {
+    const auto parent_id = parent_ids[node_id];
+    if (parent_id <= node_id || parent_id < taxon_count_ || parent_id >= node_count) {
+      FailCorrupt("node " + std::to_string(node_id) + " of tree " +
+                  std::to_string(tree_idx) + " has parent " + std::to_string(parent_id));
+    }
+    child_counts[parent_id - taxon_count_]++;
+  }
+  for (size_t internal_idx = 0; internal_idx < children.size(); internal_idx++) {
+    if (child_counts[internal_idx] == 0) {
+      FailCorrupt("node " + std::to_string(taxon_count_ + internal_idx) + " of tree " +
+                  std::to_string(tree_idx) + " has no children");
+    }
+    children[internal_idx].reserve(child_counts[internal_idx]);
+  }
+  // Children have smaller ids than their parents, so going through the nodes in order
+  // of id we have built all of the children of a node by the time we get to it.
+  Node::NodePtr node;
+  for (uint32_t node_id = 0; node_id < node_count; node_id++) {
+    if (node_id < taxon_count_) {
+      node = Node::Leaf(node_id, taxon_count_);
+    } else {
+      node = Node::Join(std::move(children[node_id - taxon_count_]), node_id);
+    }
+    if (node_id + 1 < node_count) {
+      children[parent_ids[node_id] - taxon_count_].push_back(std::move(node));
+    }
+  }
+  // The root is the node with the largest id.
+  return node;
+}
+
+Tree::BranchLengthVector TreeCollectionFile::BranchLengthsAt(size_t tree_idx) const {
+  Assert(tree_idx < tree_count_, "Tree index out of range in BranchLengthsAt.");
+  return Tree::BranchLengthVector(branch_lengths_ + node_offsets_[tree_idx],
+                                  branch_lengths_ + node_offsets_[tree_idx + 1]);
+}
+
+void TreeCollectionFile::FailCorrupt(const std::string &problem) const {
+  Failwith("Problem reading tree collection file " + path_ + ": " + problem + ".");
+}
@@ -0,0 +1,79 @@
+// Copyright 2019-2022 bito project contributors.
+// bito is free software under the GPLv3; see LICENSE file for details.
+//
+// A compact binary file format for tree collections, so that a sample of trees only
+// has to be parsed from Newick once. The file holds, in order:
+//
+// * a 32 byte header: the magic string "BITOTREE", the format version (uint32), the
+//   taxon count (uint32), the tree count (uint64), and flags (uint64), of which bit 0
+//   says whether there are tree weights;
+// * the taxon names in leaf id order, each as its length (uint32) followed by its
+//   characters, padded with zeros to a multiple of 8 bytes;
+// * for each tree, the index of its first node in the branch length array (uint64),
+//   followed by the total node count, so that tree i has nodes [offset_i,
+//   offset_{i+1});
+// * the branch lengths of each tree, indexed by node id (double);
+// * the tree weights, if any (double);
+// * the parent ids of each tree, as in Node::ParentIdVector (uint32). Tree i has
+//   offset_{i+1} - offset_i - 1 of these, as the root has no parent.
+//
+// Node ids must be as assigned by Node::Polish, so that every child has a smaller id
+// than its parent. Numbers are in native byte order.
+//
+// Reading maps the file into memory, and each tree is built straight from the file
+// when it is asked for, so that trees can be built lazily or on several threads.
+
+#pragma once
+
+#include <functional>
+#include <iosfwd>
+#include <string>
+
+#include "mmapped_file.hpp"
+#include "sugar.hpp"
+#include "tree.hpp"
+
+class TreeCollectionFile {
+ public:
+  // Gives the tree with the given index.
+  using TreeAt = std::function<const Tree &(size_t)>;
+
+  // Write tree_count trees to a file. The weights are either empty, or give a weight
+  // for each tree.
+  static void Write(const std::string &path, const TagStringMap &tag_taxon_map,
+                    size_t tree_count, const TreeAt &tree_at,
+                    const DoubleVector &weights);
+
+  explicit TreeCollectionFile(const std::string &path);
+
+  size_t TaxonCount() const { return taxon_count_; }
+  size_t TreeCount() const { return tree_count_; }
+  const TagStringMap &TagTaxonMap() const { return tag_taxon_map_; }
+  // The tree weights, or an empty vector if the file doesn't have any.
+  DoubleVector Weights() const;
+  // Build the topology of a tree from the file.
+  Node::NodePtr TopologyAt(size_t tree_idx) const;
+  Tree::BranchLengthVector BranchLengthsAt(size_t tree_idx) const;
+
+ private:
+  static inline const char magic_[] = "BITOTREE";
+  static inline const uint32_t version_ = 1;
+  static inline const uint64_t has_weights_flag_ = 1;
+
+  std::string path_;
+  MmappedFile mmapped_file_;
+  uint32_t taxon_count_;
+  uint64_t tree_count_;
+  TagStringMap tag_taxon_map_;
+  // Pointers into the mapped file for each section.
+  const uint64_t *node_offsets_;
+  const double *branch_lengths_;
+  const double *weights_;
+  const uint32_t *parent_ids_;
+
+  // Write the contents of the file for Write, which has checked the weights.
+  static void WriteContents(std::ofstream &out, const TagStringMap &tag_taxon_map,
+                            size_t tree_count, const TreeAt &tree_at,
+                            const DoubleVector &weights);
+  [[noreturn]] void FailCorrupt(const std::string &problem) const;
+};
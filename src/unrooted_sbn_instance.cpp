@@ -5,6 +5,7 @@
 
 #include <iostream>
 #include <memory>
+#include <tuple>
 #include <unordered_set>
 
 #include "eigen_sugar.hpp"
@@ -12,15 +13,27 @@
 
 // ** Building SBN-related items
 
-EigenVectorXd UnrootedSBNInstance::TrainExpectationMaximization(double alpha,
-                                                                size_t max_iter,
-                                                                double score_epsilon) {
+EigenVectorXd UnrootedSBNInstance::TrainExpectationMaximization(
+    double alpha, size_t max_iter, double score_epsilon, bool packed,
+    size_t thread_count, SBNProbability::EMAcceleration acceleration) {
   CheckTopologyCounter();
   auto indexer_representation_counter =
       sbn_support_.IndexerRepresentationCounterOf(topology_counter_);
+  if (packed) {
+    const SBNProbability::PackedIndexerRepresentationCounter packed_counter(
+        indexer_representation_counter);
+    // The packed counter holds all that EM needs.
+    indexer_representation_counter.clear();
+    return SBNProbability::ExpectationMaximization(
+        sbn_parameters_, packed_counter, sbn_support_.RootsplitCount(),
+        sbn_support_.ParentToRange(), alpha, max_iter, score_epsilon, thread_count,
+        acceleration, &em_trace_);
+  }
+  // else
   return SBNProbability::ExpectationMaximization(
       sbn_parameters_, indexer_representation_counter, sbn_support_.RootsplitCount(),
-      sbn_support_.ParentToRange(), alpha, max_iter, score_epsilon);
+      sbn_support_.ParentToRange(), alpha, max_iter, score_epsilon, acceleration,
+      &em_trace_);
 }
 
 Node::NodePtr UnrootedSBNInstance::SampleTopology() const {
@@ -42,6 +55,213 @@ void UnrootedSBNInstance::SampleTrees(size_t count) {
   }
 }
 
+void UnrootedSBNInstance::LoadTreesFromIndexerRepresentations(
+    const IndexerRepresentationMatrix &representations) {
+  CheckSBNSupportNonEmpty();
+  Assert(static_cast<size_t>(representations.cols()) == sbn_support_.TaxonCount() - 1,
+         "LoadTreesFromIndexerRepresentations: representations of the wrong length.");
+  const size_t edge_count = 2 * sbn_support_.TaxonCount() - 2;
+  tree_collection_.trees_.clear();
+  tree_collection_.trees_.reserve(representations.rows());
+  RootedIndexerRepresentation rooted_representation(representations.cols());
+  for (Eigen::Index row = 0; row < representations.rows(); row++) {
+    Eigen::Map<IndexerRepresentationMatrix>(rooted_representation.data(), 1,
+                                            representations.cols()) =
+        representations.row(row);
+    auto topology = RootedTopologyOf(rooted_representation)->Deroot();
+    topology->Polish();
+    tree_collection_.trees_.emplace_back(
+        UnrootedTree(topology, std::vector<double>(edge_count)));
+  }
+}
+
+std::vector<UnrootedIndexerRepresentation>
+UnrootedSBNInstance::UnrootedIndexerRepresentationsOf(
+    const IndexerRepresentationMatrix &representations,
+    const size_t thread_count) const {
+  CheckSBNSupportNonEmpty();
+  Assert(static_cast<size_t>(representations.cols()) == sbn_support_.TaxonCount() - 1,
+         "UnrootedIndexerRepresentationsOf: representations of the wrong length.");
+  const auto sample_count = static_cast<size_t>(representations.rows());
+  std::vector<UnrootedIndexerRepresentation> unrooted_representations(sample_count);
+  auto represent = [this, &representations, &unrooted_representations](size_t begin,
+                                                                      size_t end) {
+    for (size_t sample_idx = begin; sample_idx < end; sample_idx++) {
+      unrooted_representations[sample_idx] = UnrootedIndexerRepresentationOfRooted(
+          representations.row(static_cast<Eigen::Index>(sample_idx)).data());
+    }
+  };
+  if (thread_count < 2) {
+    represent(0, sample_count);
+  } else {
+    ThreadPool::Shared(thread_count)
+        .ParallelFor(
+            sample_count, [](size_t) { return 1.; },
+            [&represent](size_t, size_t begin, size_t end) { represent(begin, end); });
+  }
+  return unrooted_representations;
+}
+
+// A rooting of an unrooted topology puts each internal vertex below one of its three
+// edges, and picks its PCSP by the clades on its other two edges and the sister clade
+// across that edge. Moving the root from the edge above a vertex to the edge above one
+// of its children only changes the PCSPs of the four internal vertices around those two
+// edges. So rather than traverse the topology once per rooting, as
+// UnrootedSBNMaps::IndexerRepresentationOf does, we derive each rooting from the one
+// above it, and look up each PCSP of an internal vertex at most once.
+UnrootedIndexerRepresentation
+UnrootedSBNInstance::UnrootedIndexerRepresentationOfRooted(
+    const size_t *rooted_representation) const {
+  const size_t taxon_count = sbn_support_.TaxonCount();
+  const size_t default_index = sbn_support_.GPCSPCount();
+  const auto &indexer = sbn_support_.Indexer();
+  // As in RootedTopologyOf, we find the PCSP below a subsplit by binary search.
+  SizeVector pcsps(rooted_representation + 1, rooted_representation + taxon_count - 1);
+  std::sort(pcsps.begin(), pcsps.end());
+
+  // The vertices of the unrooted topology are the nodes of the rooted one other than
+  // the root, and we join the two children of the root by an edge. Each vertex has the
+  // clade below it in the rooted topology, and its neighbors: first its parent (or the
+  // other child of the root), then its children. So the clade across the edge to
+  // neighbor k of a vertex is the complement of its clade for k = 0, and the clade of
+  // that neighbor otherwise.
+  const size_t vertex_count = 2 * taxon_count - 2;
+  BitsetVector clades;
+  std::vector<SizeVector> neighbors;
+  clades.reserve(vertex_count);
+  neighbors.reserve(vertex_count);
+  // The PCSP of an internal vertex that is below its neighbor up, with its sister clade
+  // across the edge to neighbor sister of up, is at (3 * vertex + up) * 4 + sister. We
+  // write sister = root_sister for a vertex next to the root, whose sister is across
+  // the root edge. The PCSPs of the sampled rooting are those with up = 0, which we
+  // fill in as we go.
+  const size_t root_sister = 3;
+  SizeVector pcsp_cache(vertex_count * 3 * 4, default_index + 1);
+  // Each rooting has its rootsplit first, and then the PCSP of each internal vertex at
+  // 1 + the position of that vertex among the internal vertices. We start with the
+  // sampled rooting, on the edge joining vertices 0 and 1.
+  UnrootedIndexerRepresentation unrooted_representation;
+  unrooted_representation.reserve(vertex_count - 1);
+  auto &sampled_rooting = unrooted_representation.emplace_back(taxon_count - 1);
+  sampled_rooting[0] = rooted_representation[0];
+  SizeVector positions(vertex_count, 0);
+  size_t internal_count = 0;
+  // Vertices to add the children of, with their sister as above and their subsplit
+  // turned so that their clade is on the right.
+  std::vector<std::tuple<size_t, size_t, Bitset>> to_expand;
+  auto add_vertex = [&clades, &neighbors, &to_expand](
+                        const Bitset &subsplit, const size_t neighbor,
+                        const size_t sister) {
+    const size_t vertex = clades.size();
+    clades.push_back(subsplit.SubsplitGetClade(SubsplitClade::Right));
+    neighbors.push_back({neighbor});
+    if (!clades.back().SingletonOption()) {
+      to_expand.emplace_back(vertex, sister, subsplit);
+    }
+    return vertex;
+  };
+  const Bitset &rootsplit = sbn_support_.RootsplitsAt(rooted_representation[0]);
+  add_vertex(rootsplit, 1, root_sister);
+  add_vertex(rootsplit.SubsplitRotate(), 0, root_sister);
+  while (!to_expand.empty()) {
+    const auto [vertex, sister, parent_subsplit] = std::move(to_expand.back());
+    to_expand.pop_back();
+    const auto [start, end] = sbn_support_.ParentToRangeAt(parent_subsplit);
+    const auto pcsp = std::lower_bound(pcsps.begin(), pcsps.end(), start);
+    Assert(pcsp != pcsps.end() && *pcsp < end,
+           "UnrootedIndexerRepresentationsOf given a representation missing a PCSP.");
+    positions[vertex] = 1 + internal_count++;
+    sampled_rooting[positions[vertex]] = *pcsp;
+    pcsp_cache[(3 * vertex) * 4 + sister] = *pcsp;
+    const Bitset &child_subsplit = sbn_support_.IndexToChildAt(*pcsp);
+    // Children 1 and 2 are each other's sisters.
+    for (const auto &subsplit : {child_subsplit, child_subsplit.SubsplitRotate()}) {
+      const size_t child = add_vertex(subsplit, vertex, 3 - neighbors[vertex].size());
+      neighbors[vertex].push_back(child);
+    }
+  }
+  Assert(clades.size() == vertex_count && internal_count == taxon_count - 2,
+         "UnrootedIndexerRepresentationsOf given a representation of the wrong size.");
+  BitsetVector complements;
+  complements.reserve(vertex_count);
+  for (const auto &clade : clades) {
+    complements.push_back(~clade);
+  }
+  auto clade_across = [&clades, &neighbors, &complements](
+                          const size_t vertex, const size_t k) -> const Bitset & {
+    return (k == 0) ? complements[vertex] : clades[neighbors[vertex][k]];
+  };
+  // The PCSP bitset as in SBNMaps::PCSPBitsetOf, which we fill in place.
+  Bitset pcsp_bitset(3 * taxon_count);
+  auto pcsp_of = [&](const size_t vertex, const size_t up, const size_t sister) {
+    size_t &pcsp_index = pcsp_cache[(3 * vertex + up) * 4 + sister];
+    if (pcsp_index == default_index + 1) {
+      const Bitset &sister_clade = (sister == root_sister)
+                                       ? clade_across(vertex, up)
+                                       : clade_across(neighbors[vertex][up], sister);
+      const Bitset &child0 = clade_across(vertex, (up + 1) % 3);
+      const Bitset &child1 = clade_across(vertex, (up + 2) % 3);
+      pcsp_bitset.CopyFrom(sister_clade, 0, false);
+      pcsp_bitset.CopyFrom(clade_across(vertex, up), taxon_count, true);
+      pcsp_bitset.CopyFrom(std::min(child0, child1), 2 * taxon_count, false);
+      pcsp_index = AtWithDefault(indexer, pcsp_bitset, default_index);
+    }
+    return pcsp_index;
+  };
+  // The rootsplit of the edge above a vertex, as Bitset::PCSPFromUCAToRootsplit of
+  // Bitset::RootsplitSubsplitOfClade of its clade: no sister, every taxon in the focal
+  // clade, and the side without taxon 0 as the child.
+  const Bitset no_taxa(taxon_count);
+  auto rootsplit_of = [&](const size_t vertex) {
+    pcsp_bitset.CopyFrom(no_taxa, 0, false);
+    pcsp_bitset.CopyFrom(no_taxa, taxon_count, true);
+    pcsp_bitset.CopyFrom(clades[vertex][0] ? complements[vertex] : clades[vertex],
+                         2 * taxon_count, false);
+    return AtWithDefault(indexer, pcsp_bitset, default_index);
+  };
+
+  // Each edge but the root edge is above its vertex, and a vertex comes after its
+  // parent, so we can take the rootings in the order of their vertices. The rooting of
+  // each of vertices 0 and 1 is the sampled one.
+  SizeVector rooting_of_vertex(vertex_count, 0);
+  // The position of child among the neighbors of a vertex other than the first.
+  auto child_position = [&neighbors](const size_t vertex, const size_t child) {
+    const auto &vertex_neighbors = neighbors[vertex];
+    return static_cast<size_t>(
+        std::find(vertex_neighbors.begin() + 1, vertex_neighbors.end(), child) -
+        vertex_neighbors.begin());
+  };
+  for (size_t vertex = 2; vertex < vertex_count; vertex++) {
+    // We move the root down to the edge above vertex from the edge above its parent,
+    // which is neighbor up of the parent. The other child of the parent is across the
+    // edge to its neighbor down.
+    const size_t parent = neighbors[vertex][0];
+    const size_t up = child_position(parent, vertex);
+    const size_t down = 3 - up;
+    const size_t grandparent = neighbors[parent][0];
+    const size_t sibling = neighbors[parent][down];
+    rooting_of_vertex[vertex] = unrooted_representation.size();
+    auto &rooting = unrooted_representation.emplace_back(
+        unrooted_representation[rooting_of_vertex[parent]]);
+    rooting[0] = rootsplit_of(vertex);
+    if (positions[vertex] != 0) {
+      rooting[positions[vertex]] = pcsp_of(vertex, 0, root_sister);
+    }
+    rooting[positions[parent]] = pcsp_of(parent, up, root_sister);
+    if (positions[sibling] != 0) {
+      rooting[positions[sibling]] = pcsp_of(sibling, 0, 0);
+    }
+    // The grandparent is now below the parent, with the sibling as its sister. The
+    // parent is neighbor 0 of the grandparent if they are the two vertices next to the
+    // root, and one of its children otherwise.
+    if (positions[grandparent] != 0) {
+      const size_t parent_up = (parent < 2) ? 0 : child_position(grandparent, parent);
+      rooting[positions[grandparent]] = pcsp_of(grandparent, parent_up, down);
+    }
+  }
+  return unrooted_representation;
+}
+
 std::vector<SizeVectorVector> UnrootedSBNInstance::MakePSPIndexerRepresentations()
     const {
   std::vector<SizeVectorVector> representations;
@@ -77,14 +297,17 @@ std::pair<StringSizeMap, StringPCSPMap> UnrootedSBNInstance::SplitCounters() con
 
 // ** I/O
 
-void UnrootedSBNInstance::ReadNewickFile(const std::string &fname) {
+void UnrootedSBNInstance::ReadNewickFile(const std::string &fname,
+                                         size_t thread_count) {
   Driver driver;
+  driver.SetThreadCount(thread_count);
   tree_collection_ =
       UnrootedTreeCollection::OfTreeCollection(driver.ParseNewickFile(fname));
 }
 
-void UnrootedSBNInstance::ReadNexusFile(const std::string &fname) {
+void UnrootedSBNInstance::ReadNexusFile(const std::string &fname, size_t thread_count) {
   Driver driver;
+  driver.SetThreadCount(thread_count);
   tree_collection_ =
       UnrootedTreeCollection::OfTreeCollection(driver.ParseNexusFile(fname));
 }
@@ -212,25 +435,23 @@ EigenVectorXd UnrootedSBNInstance::GradientOfLogQ(
 }
 
 EigenVectorXd UnrootedSBNInstance::TopologyGradients(const EigenVectorXdRef log_f,
-                                                     bool use_vimco) {
-  size_t tree_count = tree_collection_.TreeCount();
-  EigenVectorXd gradient_vector = EigenVectorXd::Zero(sbn_parameters_.size());
-  EigenVectorXd multiplicative_factors =
+                                                     bool use_vimco,
+                                                     size_t thread_count) {
+  return TopologyGradients(MakeIndexerRepresentations(thread_count), log_f, use_vimco,
+                           thread_count);
+}
+
+EigenVectorXd UnrootedSBNInstance::TopologyGradients(
+    const std::vector<UnrootedIndexerRepresentation> &indexer_representations,
+    const EigenVectorXdRef log_f, bool use_vimco, size_t thread_count) const {
+  Assert(static_cast<size_t>(log_f.size()) == indexer_representations.size(),
+         "TopologyGradients needs a log_f entry for each topology.");
+  const EigenVectorXd multiplicative_factors =
       use_vimco ? CalculateVIMCOMultiplicativeFactors(log_f)
                 : CalculateMultiplicativeFactors(log_f);
-  // This variable acts as a cache to store normalized SBN parameters in log.
-  // Initialization to DOUBLE_NAN indicates that all entries are empty.
-  // It is mutated by GradientOfLogQ.
-  EigenVectorXd normalized_sbn_parameters_in_log =
-      EigenVectorXd::Constant(sbn_parameters_.size(), DOUBLE_NAN);
-  for (size_t i = 0; i < tree_count; i++) {
-    const auto indexer_representation =
-        sbn_support_.IndexerRepresentationOf(tree_collection_.GetTree(i).Topology());
-    // PROFILE: does it matter that we are allocating another sbn_vector_ sized object?
-    EigenVectorXd log_grad_q =
-        GradientOfLogQ(normalized_sbn_parameters_in_log, indexer_representation);
-    log_grad_q.array() *= multiplicative_factors(i);
-    gradient_vector += log_grad_q;
-  }
-  return gradient_vector;
+  EigenVectorXd normalized_sbn_parameters_in_log = sbn_parameters_;
+  ProbabilityNormalizeSBNParametersInLog(normalized_sbn_parameters_in_log);
+  return GetSBNGradientEngine().Gradient(normalized_sbn_parameters_in_log,
+                                         indexer_representations,
+                                         multiplicative_factors, thread_count);
 }
@@ -18,10 +18,18 @@ class UnrootedSBNInstance : public PreUnrootedSBNInstance {
 
   // ** SBN-related items
 
-  // max_iter is the maximum number of EM iterations to do, while score_epsilon
-  // is the cutoff for score improvement.
-  EigenVectorXd TrainExpectationMaximization(double alpha, size_t max_iter,
-                                             double score_epsilon = 0.);
+  // max_iter is the maximum number of EM steps to take, while score_epsilon
+  // is the cutoff for score improvement. If packed, we run EM over a
+  // PackedIndexerRepresentationCounter on thread_count threads, which is much faster
+  // for large collections of trees. See SBNProbability::EMAcceleration for the
+  // accelerations, whose iterations take several EM steps each. The run is recorded
+  // in the EM trace.
+  EigenVectorXd TrainExpectationMaximization(
+      double alpha, size_t max_iter, double score_epsilon = 0., bool packed = false,
+      size_t thread_count = 1,
+      SBNProbability::EMAcceleration acceleration =
+          SBNProbability::EMAcceleration::None);
+  const SBNProbability::EMTrace &GetEMTrace() const { return em_trace_; }
 
   // Sample a topology from the SBN.
   using PreUnrootedSBNInstance::SampleTopology;
@@ -29,6 +37,18 @@ class UnrootedSBNInstance : public PreUnrootedSBNInstance {
 
   // Sample trees and store them internally
   void SampleTrees(size_t count);
+  // Replace the stored trees with the derooted topologies of a batch of rooted indexer
+  // representations (see SampleIndexerRepresentations), with zero branch lengths.
+  void LoadTreesFromIndexerRepresentations(
+      const IndexerRepresentationMatrix &representations);
+  // The unrooted indexer representations of a batch of rooted indexer representations,
+  // i.e. those of every rooting of each sample, as MakeIndexerRepresentations gives
+  // for the loaded trees. We derive them from the rows without building any trees.
+  // The rootings of a sample come in an order of our own, with the sampled rooting
+  // first.
+  std::vector<UnrootedIndexerRepresentation> UnrootedIndexerRepresentationsOf(
+      const IndexerRepresentationMatrix &representations,
+      size_t thread_count = 1) const;
 
   // Get PSP indexer representations of the trees in tree_collection_.
   std::vector<SizeVectorVector> MakePSPIndexerRepresentations() const;
@@ -70,7 +90,14 @@ class UnrootedSBNInstance : public PreUnrootedSBNInstance {
   // Topology gradient for unrooted trees.
   // Assumption: This function is called from Python side
   // after the trees (both the topology and the branch lengths) are sampled.
-  EigenVectorXd TopologyGradients(EigenVectorXdRef log_f, bool use_vimco = true);
+  // The trees are split over thread_count threads; see SBNGradientEngine.
+  EigenVectorXd TopologyGradients(EigenVectorXdRef log_f, bool use_vimco = true,
+                                  size_t thread_count = 1);
+  // The same for a batch of topologies given by their indexer representations, e.g.
+  // from MakeIndexerRepresentations, with log_f holding an entry for each.
+  EigenVectorXd TopologyGradients(
+      const std::vector<UnrootedIndexerRepresentation> &indexer_representations,
+      EigenVectorXdRef log_f, bool use_vimco = true, size_t thread_count = 1) const;
   // Computes gradient WRT \phi of log q_{\phi}(\tau).
   // IndexerRepresentation contains all rootings of \tau.
   // normalized_sbn_parameters_in_log is a cache; see implementation of
@@ -82,14 +109,21 @@ class UnrootedSBNInstance : public PreUnrootedSBNInstance {
 
   // ** I/O
 
-  void ReadNewickFile(const std::string &fname);
-  void ReadNexusFile(const std::string &fname);
+  void ReadNewickFile(const std::string &fname, size_t thread_count = 1);
+  void ReadNexusFile(const std::string &fname, size_t thread_count = 1);
 
  protected:
   void PushBackRangeForParentIfAvailable(
       const Bitset &parent, UnrootedSBNInstance::RangeVector &range_vector);
   RangeVector GetSubsplitRanges(
       const RootedIndexerRepresentation &rooted_representation);
+
+ private:
+  SBNProbability::EMTrace em_trace_;
+
+  // See UnrootedIndexerRepresentationsOf.
+  UnrootedIndexerRepresentation UnrootedIndexerRepresentationOfRooted(
+      const size_t *rooted_representation) const;
 };
 
 #ifdef DOCTEST_LIBRARY_INCLUDED
@@ -307,6 +341,19 @@ TEST_CASE("UnrootedSBNInstance: likelihood and gradient") {
       for (size_t i = 0; i < branch_lengths_gradient.size(); i++) {
         CHECK_LT(fabs(branch_lengths_gradient[i] - physher_gradients[i]), 0.0001);
       }
+      // Batched likelihoods.
+      inst.PrepareForPhyloLikelihood(simple_specification, 2, {vector_flag},
+                                     tip_state_option, std::nullopt, 4);
+      // Trees are only batched together when they share parameters.
+      inst.GetPhyloModelParams().setOnes();
+      for (const bool rescaling : {false, true}) {
+        inst.SetRescaling(rescaling);
+        auto batched_likelihoods = inst.LogLikelihoods();
+        CHECK_EQ(batched_likelihoods.size(), pybeagle_likelihoods.size());
+        for (size_t i = 0; i < batched_likelihoods.size(); i++) {
+          CHECK_LT(fabs(batched_likelihoods[i] - pybeagle_likelihoods[i]), 0.00011);
+        }
+      }
     }
   }
 }
@@ -364,6 +411,63 @@ TEST_CASE("UnrootedSBNInstance: likelihood and gradient with Weibull") {
   }
 }
 
+TEST_CASE("UnrootedSBNInstance: incremental likelihood") {
+  UnrootedSBNInstance inst("charlie");
+  inst.ReadNexusFile("data/DS1.subsampled_10.t");
+  inst.ReadFastaFile("data/DS1.fasta");
+  PhyloModelSpecification simple_specification{"JC69", "constant", "strict"};
+  SitePattern site_pattern(Alignment::ReadFasta("data/DS1.fasta"), inst.TagTaxonMap());
+  const auto &trees = inst.tree_collection_.Trees();
+  const auto &tree0 = trees[1];
+  const auto &tree1 = trees[2];
+  // Lengthen a pendant branch, which only changes the partials above that leaf.
+  auto branch_lengths = tree0.BranchLengths();
+  branch_lengths[0] += 0.01;
+  const UnrootedTree perturbed_tree0(tree0.Topology(), branch_lengths);
+  const size_t internal_count = site_pattern.SequenceCount() - 1;
+  for (const auto tip_state_option : {false, true}) {
+    for (const auto rescaling : {false, true}) {
+      FatBeagle fat_beagle(simple_specification, site_pattern, BEAGLE_FLAG_VECTOR_NONE,
+                           tip_state_option);
+      fat_beagle.SetRescaling(rescaling);
+      const double log_like0 = fat_beagle.LogLikelihood(tree0);
+      const double perturbed_log_like0 = fat_beagle.LogLikelihood(perturbed_tree0);
+      const double log_like1 = fat_beagle.LogLikelihood(tree1);
+      CHECK_LT(fabs(log_like0 - -6911.294207416366), 0.00011);
+      // The first proposal computes everything.
+      CHECK_LT(fabs(fat_beagle.IncrementalLogLikelihood(tree0) - log_like0), 1e-8);
+      CHECK_EQ(fat_beagle.IncrementalPartialUpdateCount(), internal_count);
+      fat_beagle.CommitIncrementalState();
+      CHECK_LT(fabs(fat_beagle.IncrementalLogLikelihood(perturbed_tree0) -
+                    perturbed_log_like0),
+               1e-8);
+      CHECK_GT(fat_beagle.IncrementalPartialUpdateCount(), 0);
+      CHECK_LT(fat_beagle.IncrementalPartialUpdateCount(), internal_count);
+      fat_beagle.RevertIncrementalState();
+      // After reverting, the committed tree is unchanged and nothing is recomputed.
+      CHECK_LT(fabs(fat_beagle.IncrementalLogLikelihood(tree0) - log_like0), 1e-8);
+      CHECK_EQ(fat_beagle.IncrementalPartialUpdateCount(), 0);
+      fat_beagle.CommitIncrementalState();
+      // Changing the topology.
+      CHECK_LT(fabs(fat_beagle.IncrementalLogLikelihood(tree1) - log_like1), 1e-8);
+      fat_beagle.CommitIncrementalState();
+      CHECK_LT(fabs(fat_beagle.IncrementalLogLikelihood(perturbed_tree0) -
+                    perturbed_log_like0),
+               1e-8);
+      CHECK_THROWS(fat_beagle.IncrementalLogLikelihood(tree0));
+      fat_beagle.CommitIncrementalState();
+      CHECK_LT(fabs(fat_beagle.IncrementalLogLikelihood(tree0) - log_like0), 1e-8);
+      fat_beagle.RevertIncrementalState();
+      // A full calculation overwrites the resident buffers.
+      CHECK_LT(fabs(fat_beagle.LogLikelihood(tree1) - log_like1), 1e-8);
+      CHECK_LT(fabs(fat_beagle.IncrementalLogLikelihood(tree0) - log_like0), 1e-8);
+      CHECK_EQ(fat_beagle.IncrementalPartialUpdateCount(), internal_count);
+      fat_beagle.RevertIncrementalState();
+      CHECK_THROWS(fat_beagle.CommitIncrementalState());
+    }
+  }
+}
+
 TEST_CASE("UnrootedSBNInstance: SBN training") {
   UnrootedSBNInstance inst("charlie");
   inst.ReadNewickFile("data/DS1.100_topologies.nwk");
@@ -384,6 +488,75 @@ TEST_CASE("UnrootedSBNInstance: SBN training") {
   const auto expected_EM_05_100 = ExpectedEMVectorAlpha05();
   inst.TrainExpectationMaximization(0.5, 100);
   CheckVectorXdEquality(inst.CalculateSBNProbabilities(), expected_EM_05_100, 1e-5);
+  // Packed EM matches, on any number of threads.
+  for (const size_t thread_count : {1, 3}) {
+    inst.TrainExpectationMaximization(0., 23, 0., true, thread_count);
+    CheckVectorXdEquality(inst.CalculateSBNProbabilities(), expected_EM_0_23, 1e-12);
+    inst.TrainExpectationMaximization(0.5, 100, 0., true, thread_count);
+    CheckVectorXdEquality(inst.CalculateSBNProbabilities(), expected_EM_05_100, 1e-5);
+  }
+  // As do the score histories.
+  const EigenVectorXd serial_scores = inst.TrainExpectationMaximization(0.5, 10);
+  const EigenVectorXd packed_scores =
+      inst.TrainExpectationMaximization(0.5, 10, 0., true, 4);
+  CheckVectorXdEquality(packed_scores, serial_scores, 1e-12);
+  // Even once EM with alpha = 0 has driven some parameters far below the smallest
+  // double, whose q-weighted counts underflow.
+  const EigenVectorXd serial_long_scores = inst.TrainExpectationMaximization(0., 200);
+  CHECK_LT(inst.SBNParameters().minCoeff(), -1000.);
+  const EigenVectorXd packed_long_scores =
+      inst.TrainExpectationMaximization(0., 200, 0., true, 3);
+  CheckVectorXdEquality(packed_long_scores, serial_long_scores, 1e-10);
+  // Accelerated EM converges to the same parameters in fewer EM steps than plain EM,
+  // whether packed or not, and traces what it did.
+  const size_t em_step_count =
+      inst.TrainExpectationMaximization(0.5, 1000, 1e-10, true).size();
+  const EigenVectorXd em_probabilities = inst.CalculateSBNProbabilities();
+  using SBNProbability::EMAcceleration;
+  for (const auto acceleration : {EMAcceleration::SQUAREM, EMAcceleration::Anderson}) {
+    for (const bool packed : {false, true}) {
+      const EigenVectorXd scores =
+          inst.TrainExpectationMaximization(0.5, 1000, 1e-10, packed, 2, acceleration);
+      CheckVectorXdEquality(inst.CalculateSBNProbabilities(), em_probabilities, 1e-3);
+      const auto& trace = inst.GetEMTrace();
+      CheckVectorXdEquality(trace.score_history_, scores, 1e-12);
+      CHECK_EQ(trace.seconds_.size(), scores.size());
+      CHECK_EQ(trace.em_step_counts_.size(), static_cast<size_t>(scores.size()));
+      CHECK_LT(trace.em_step_counts_.back(), em_step_count / 2);
+      CHECK_GE(scores[scores.size() - 1], scores[0]);
+      // max_iter bounds the number of EM steps rather than iterations.
+      const EigenVectorXd short_scores =
+          inst.TrainExpectationMaximization(0.5, 10, 0., packed, 2, acceleration);
+      CHECK_GT(short_scores.size(), 0);
+      CHECK_LT(short_scores.size(), 10);
+      CHECK_LE(inst.GetEMTrace().em_step_counts_.back(), 10);
+    }
+  }
+}
+
+TEST_CASE("UnrootedSBNInstance: streaming a tree file") {
+  // Streaming counts the same topologies as loading the trees, with burn-in dropping
+  // the first trees.
+  UnrootedSBNInstance loaded_inst("loaded");
+  loaded_inst.ReadNexusFile("data/DS1.subsampled_10.t");
+  loaded_inst.tree_collection_.Erase(0, 4);
+  loaded_inst.ProcessLoadedTrees();
+  loaded_inst.TrainExpectationMaximization(0.5, 10);
+  UnrootedSBNInstance streamed_inst("streamed");
+  streamed_inst.StreamNexusFile("data/DS1.subsampled_10.t", 4);
+  CHECK_EQ(streamed_inst.TreeCount(), 0);
+  CHECK_EQ(streamed_inst.TagTaxonMap(), loaded_inst.TagTaxonMap());
+  CHECK_EQ(streamed_inst.PrettyIndexer(), loaded_inst.PrettyIndexer());
+  CHECK_EQ(streamed_inst.TopologyCounter(), loaded_inst.TopologyCounter());
+  // There are no loaded trees to process, and processing them must not clobber the
+  // streamed topologies.
+  CHECK_THROWS(streamed_inst.ProcessLoadedTrees());
+  CHECK_EQ(streamed_inst.PrettyIndexer(), loaded_inst.PrettyIndexer());
+  streamed_inst.TrainExpectationMaximization(0.5, 10);
+  CheckVectorXdEquality(streamed_inst.SBNParameters(), loaded_inst.SBNParameters(),
+                        1e-12);
+  // Rooted trees aren't unrooted trees.
+  CHECK_THROWS(streamed_inst.StreamNewickFile("data/five_taxon_rooted.nwk"));
 }
 
 TEST_CASE("UnrootedSBNInstance: tree sampling") {
@@ -427,6 +600,124 @@ TEST_CASE("UnrootedSBNInstance: tree sampling") {
   progress_bar.done();
 }
 
+TEST_CASE("UnrootedSBNInstance: alias-table tree sampling") {
+  UnrootedSBNInstance inst("charlie");
+  inst.ReadNewickFile("data/five_taxon_unrooted.nwk");
+  inst.ProcessLoadedTrees();
+  inst.TrainSimpleAverage();
+  // As in the previous test, sampled rooted trees have the frequencies of the rooted
+  // trees in the file.
+  size_t rooted_tree_count_from_file = 0;
+  RootedIndexerRepresentationSizeDict counter_from_file(0);
+  for (const auto &indexer_representation : inst.MakeIndexerRepresentations()) {
+    RootedSBNMaps::IncrementRootedIndexerRepresentationSizeDict(counter_from_file,
+                                                                indexer_representation);
+    rooted_tree_count_from_file += indexer_representation.size();
+  }
+  const SBNSampler &sampler = inst.GetSBNSampler();
+  const size_t length = sampler.RepresentationLength();
+  CHECK_EQ(length, inst.MakeIndexerRepresentations()[0][0].size());
+  const size_t sampled_tree_count = 1'000'000;
+  SizeVector representations(sampled_tree_count * length);
+  inst.SampleRootedIndexerRepresentations(representations.data(), sampled_tree_count,
+                                          2);
+  RootedIndexerRepresentationSizeDict counter_from_sampling(0);
+  for (size_t sample_idx = 0; sample_idx < sampled_tree_count; ++sample_idx) {
+    const auto begin = representations.begin() + sample_idx * length;
+    RootedSBNMaps::IncrementRootedIndexerRepresentationSizeDict(
+        counter_from_sampling, SizeVector(begin, begin + length));
+  }
+  CHECK_EQ(counter_from_sampling.size(), counter_from_file.size());
+  for (const auto &[key, _] : counter_from_file) {
+    std::ignore = _;
+    double observed =
+        static_cast<double>(counter_from_sampling.at(key)) / sampled_tree_count;
+    double expected =
+        static_cast<double>(counter_from_file.at(key)) / rooted_tree_count_from_file;
+    CHECK_LT(fabs(observed - expected), 5e-3);
+  }
+  // The samples only depend on the seed, not on the number of threads.
+  const size_t sample_count = 3 * SBNSampler::stream_block_size_ + 5;
+  SizeVector serial(sample_count * length), parallel(sample_count * length);
+  sampler.Sample(serial.data(), sample_count, 42, 1);
+  sampler.Sample(parallel.data(), sample_count, 42, 3);
+  CHECK(serial == parallel);
+  // The sampler is rebuilt when the parameters change: here we make the first
+  // rootsplit certain.
+  inst.sbn_parameters_.head(inst.SBNSupport().RootsplitCount()).setConstant(
+      DOUBLE_MINIMUM);
+  inst.sbn_parameters_[0] = 0.;
+  inst.SampleRootedIndexerRepresentations(serial.data(), sample_count);
+  for (size_t sample_idx = 0; sample_idx < sample_count; ++sample_idx) {
+    CHECK_EQ(serial[sample_idx * length], 0);
+  }
+}
+
+TEST_CASE("UnrootedSBNInstance: sampling indexer representations") {
+  UnrootedSBNInstance inst("charlie");
+  inst.ReadNewickFile("data/five_taxon_unrooted.nwk");
+  inst.ProcessLoadedTrees();
+  inst.TrainSimpleAverage();
+  const size_t sample_count = 1000;
+  const auto representations = inst.SampleIndexerRepresentations(sample_count);
+  CHECK_EQ(representations.rows(), sample_count);
+  CHECK_EQ(representations.cols(), 4);
+  // Each sample is one of the rootings of the tree we load for it.
+  inst.LoadTreesFromIndexerRepresentations(representations);
+  CHECK_EQ(inst.TreeCount(), sample_count);
+  const auto loaded_representations = inst.MakeIndexerRepresentations();
+  for (size_t sample_idx = 0; sample_idx < sample_count; sample_idx++) {
+    const size_t *row = representations.row(sample_idx).data();
+    SizeVector sampled(row, row + representations.cols());
+    std::sort(sampled.begin() + 1, sampled.end());
+    bool found = false;
+    for (auto rooted_representation : loaded_representations[sample_idx]) {
+      std::sort(rooted_representation.begin() + 1, rooted_representation.end());
+      found |= (rooted_representation == sampled);
+    }
+    CHECK(found);
+  }
+}
+
+TEST_CASE("UnrootedSBNInstance: unrooted indexer representations of samples") {
+  // Each rooting of a rooted indexer representation, with its PCSPs sorted, and the
+  // rootings sorted, so that we can compare them whatever their order.
+  auto sorted = [](UnrootedIndexerRepresentation unrooted_representation) {
+    for (auto &rooted_representation : unrooted_representation) {
+      std::sort(rooted_representation.begin() + 1, rooted_representation.end());
+    }
+    std::sort(unrooted_representation.begin(), unrooted_representation.end());
+    return unrooted_representation;
+  };
+  for (const auto &path :
+       {"data/five_taxon_unrooted.nwk", "data/DS1.100_topologies.nwk"}) {
+    UnrootedSBNInstance inst("charlie");
+    inst.ReadNewickFile(path);
+    inst.ProcessLoadedTrees();
+    inst.TrainSimpleAverage();
+    const size_t sample_count = 200;
+    const auto representations = inst.SampleIndexerRepresentations(sample_count);
+    const auto unrooted_representations =
+        inst.UnrootedIndexerRepresentationsOf(representations);
+    CHECK(inst.UnrootedIndexerRepresentationsOf(representations, 3) ==
+          unrooted_representations);
+    // They are those of the trees that we build from the samples, and the first
+    // rooting is the sampled one.
+    inst.LoadTreesFromIndexerRepresentations(representations);
+    const auto loaded_representations = inst.MakeIndexerRepresentations();
+    REQUIRE_EQ(unrooted_representations.size(), sample_count);
+    for (size_t sample_idx = 0; sample_idx < sample_count; sample_idx++) {
+      const auto &unrooted_representation = unrooted_representations[sample_idx];
+      CHECK_EQ(unrooted_representation.size(), 2 * inst.TaxonCount() - 3);
+      CHECK(sorted(unrooted_representation) ==
+            sorted(loaded_representations[sample_idx]));
+      const size_t *row = representations.row(sample_idx).data();
+      CHECK(sorted({RootedIndexerRepresentation(row, row + representations.cols())}) ==
+            sorted({unrooted_representation.front()}));
+    }
+  }
+}
+
 TEST_CASE("UnrootedSBNInstance: gradient of log q_{phi}(tau) WRT phi") {
   UnrootedSBNInstance inst("charlie");
   // File gradient_test.t contains two trees:
@@ -610,4 +901,54 @@ TEST_CASE("UnrootedSBNInstance: gradient of log q_{phi}(tau) WRT phi") {
   realized_nabla = inst.TopologyGradients(log_f, use_vimco);
   CheckVectorXdEquality(realized_nabla, expected_nabla, 1e-8);
 }
+
+TEST_CASE("UnrootedSBNInstance: batched topology gradients") {
+  UnrootedSBNInstance inst("charlie");
+  inst.ReadNewickFile("data/DS1.100_topologies.nwk");
+  inst.ProcessLoadedTrees();
+  inst.TrainSimpleAverage();
+  // Perturb the parameters so that the gradient isn't the same in every range.
+  for (Eigen::Index idx = 0; idx < inst.sbn_parameters_.size(); idx++) {
+    inst.sbn_parameters_[idx] += 0.1 * static_cast<double>(idx % 7);
+  }
+  const size_t tree_count = 50;
+  inst.SampleTrees(tree_count);
+  EigenVectorXd log_f(tree_count);
+  for (size_t tree_idx = 0; tree_idx < tree_count; tree_idx++) {
+    log_f[tree_idx] = -7000. - static_cast<double>((tree_idx * 37) % 11);
+  }
+  const auto indexer_representations = inst.MakeIndexerRepresentations();
+  CHECK(inst.MakeIndexerRepresentations(3) == indexer_representations);
+  for (const bool use_vimco : {false, true}) {
+    // The batched gradient is what GradientOfLogQ gives tree by tree.
+    const EigenVectorXd multiplicative_factors =
+        use_vimco ? inst.CalculateVIMCOMultiplicativeFactors(log_f)
+                  : inst.CalculateMultiplicativeFactors(log_f);
+    EigenVectorXd normalized_sbn_parameters_in_log =
+        EigenVectorXd::Constant(inst.sbn_parameters_.size(), DOUBLE_NAN);
+    EigenVectorXd expected_nabla = EigenVectorXd::Zero(inst.sbn_parameters_.size());
+    for (size_t tree_idx = 0; tree_idx < tree_count; tree_idx++) {
+      expected_nabla += multiplicative_factors[tree_idx] *
+                        inst.GradientOfLogQ(normalized_sbn_parameters_in_log,
+                                            indexer_representations[tree_idx]);
+    }
+    CheckVectorXdEquality(inst.TopologyGradients(log_f, use_vimco), expected_nabla,
+                          1e-8);
+    // Results don't depend on the number of threads.
+    CheckVectorXdEquality(
+        inst.TopologyGradients(indexer_representations, log_f, use_vimco, 3),
+        expected_nabla, 1e-8);
+  }
+  // The VIMCO factors match those of the quadratic-time definition.
+  const EigenVectorXd vimco_factors = inst.CalculateVIMCOMultiplicativeFactors(log_f);
+  const double log_geometric_mean_numerator = log_f.sum();
+  const EigenVectorXd rws_factors = inst.CalculateMultiplicativeFactors(log_f);
+  for (size_t j = 0; j < tree_count; j++) {
+    EigenVectorXd log_f_perturbed = log_f;
+    log_f_perturbed[j] = (log_geometric_mean_numerator - log_f[j]) / (tree_count - 1);
+    const double per_sample_signal =
+        NumericalUtils::LogSum(log_f_perturbed) - log(tree_count);
+    CHECK_LT(fabs(vimco_factors[j] - (rws_factors[j] - per_sample_signal)), 1e-10);
+  }
+}
 #endif  // DOCTEST_LIBRARY_INCLUDED
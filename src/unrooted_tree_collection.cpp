@@ -20,3 +20,10 @@ UnrootedTreeCollection UnrootedTreeCollection::OfTreeCollection(
   }
   return UnrootedTreeCollection(std::move(unrooted_trees), trees.TagTaxonMap());
 }
+
+UnrootedTreeCollection UnrootedTreeCollection::Load(const std::string& path,
+                                                    size_t thread_count) {
+  auto pre_collection = PreUnrootedTreeCollection::Load(path, thread_count);
+  return UnrootedTreeCollection(std::move(pre_collection.trees_),
+                                pre_collection.TagTaxonMap());
+}
@@ -15,6 +15,8 @@ class UnrootedTreeCollection : public PreUnrootedTreeCollection {
   UnrootedTreeCollection(const PreUnrootedTreeCollection& pre_collection);
 
   static UnrootedTreeCollection OfTreeCollection(const TreeCollection& trees);
+  // Load a collection written by Export.
+  static UnrootedTreeCollection Load(const std::string& path, size_t thread_count = 1);
 };
 
 #ifdef DOCTEST_LIBRARY_INCLUDED
@@ -3,6 +3,11 @@
 
 #include "zlib_stream.hpp"
 
+#include <algorithm>
+#include <cstring>
+
+#include "thread_pool.hpp"
+
 namespace zlib {
 
 namespace detail {
@@ -45,6 +50,13 @@ void ZStream::Close() {
   }
 }
 
+void ZStream::Reset() {
+  auto ret = detail::call_zlib(::inflateReset(&impl_), impl_);
+  if (ret != Result::Code::ok) {
+    throw std::logic_error("Unexpected result from zlib");
+  }
+}
+
 Result ZStream::Inflate(Flush mode, const unsigned char* in, size_t in_size,
                         unsigned char* out, size_t out_size) {
   impl_.next_in = const_cast<unsigned char*>(in);
@@ -56,66 +68,278 @@ Result ZStream::Inflate(Flush mode, const unsigned char* in, size_t in_size,
   return {ret, in_size - impl_.avail_in, out_size - impl_.avail_out};
 }
 
-ZStringBuf::ZStringBuf(const std::istream& in, size_t in_buf_size, size_t out_buf_size)
-    : base{},
-      in_{*in.rdbuf()},
-      in_buf_{std::make_unique<char[]>(in_buf_size)},
-      in_buf_size_{static_cast<std::streamsize>(in_buf_size)},
-      out_buf_{std::make_unique<char[]>(out_buf_size)},
-      out_buf_size_{static_cast<std::streamsize>(out_buf_size)},
-      inflate_{} {}
+namespace {
 
-ZStringBuf::~ZStringBuf() {}
+// The size of a BGZF member header, which is a gzip header with a BC extra field.
+constexpr size_t bgzf_header_size = 18;
+// The gzip footer holds the CRC32 and the uncompressed size.
+constexpr size_t gzip_footer_size = 8;
+
+uint32_t ReadLittleEndian(const unsigned char* bytes, size_t byte_count) {
+  uint32_t value = 0;
+  for (size_t idx = byte_count; idx > 0; idx--) {
+    value = (value << 8) | bytes[idx - 1];
+  }
+  return value;
+}
+
+bool StartsGzipMember(const char* data, size_t count) {
+  return count >= 2 && static_cast<unsigned char>(data[0]) == 0x1f &&
+         static_cast<unsigned char>(data[1]) == 0x8b;
+}
+
+// The total size of the BGZF member starting at data, or 0 if it doesn't start with a
+// BGZF header. See the SAM/BAM specification for the format.
+size_t BGZFMemberSize(const char* data, size_t count) {
+  const auto* bytes = reinterpret_cast<const unsigned char*>(data);
+  // A deflated gzip member with a 6 byte extra field holding the BC subfield.
+  const bool is_bgzf = count >= bgzf_header_size && StartsGzipMember(data, count) &&
+                       bytes[2] == 8 && (bytes[3] & 4) &&
+                       ReadLittleEndian(bytes + 10, 2) == 6 && bytes[12] == 'B' &&
+                       bytes[13] == 'C' && ReadLittleEndian(bytes + 14, 2) == 2;
+  return is_bgzf ? ReadLittleEndian(bytes + 16, 2) + 1 : 0;
+}
+
+}  // namespace
+
+ZStringBuf::ZStringBuf(const std::istream& in, size_t in_buf_size, size_t out_buf_size,
+                       size_t thread_count)
+    : in_{*in.rdbuf()},
+      // A batch of BGZF members needs room for at least one whole member.
+      in_buf_size_{std::max(in_buf_size, bgzf_max_member_size_)},
+      out_buf_size_{std::max(out_buf_size, bgzf_max_member_size_)},
+      thread_count_{std::max(thread_count, size_t(1))},
+      out_counts_(ring_size_, 0) {
+  in_buf_ = std::make_unique<char[]>(in_buf_size_);
+  for (size_t buf_idx = 0; buf_idx < ring_size_; buf_idx++) {
+    out_bufs_.push_back(std::make_unique<char[]>(out_buf_size_));
+  }
+  producer_ = std::thread(&ZStringBuf::Produce, this);
+}
+
+ZStringBuf::~ZStringBuf() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  condition_.notify_all();
+  producer_.join();
+}
 
 ZStringBuf::int_type ZStringBuf::underflow() {
-  ensure_avail(1);
-  return base::underflow();
-}
-
-ZStringBuf::int_type ZStringBuf::uflow() {
-  ensure_avail(1);
-  return base::uflow();
-}
-
-std::streamsize ZStringBuf::xsgetn(char_type* s, std::streamsize count) {
-  ensure_avail(count);
-  return base::xsgetn(s, count);
-}
-
-void ZStringBuf::ensure_avail(std::streamsize count) {
-  while (count > in_avail()) {
-    // Reads from the compressed stream
-    const size_t in_count =
-        in_.sgetn(in_buf_.get(), std::min(in_buf_size_, count - in_avail()));
-
-    size_t consumed = 0;
-    while (consumed < in_count) {
-      // Performs zlib decompression
-      auto ret = inflate_.Inflate(
-          Flush::partial, reinterpret_cast<unsigned char*>(in_buf_.get() + consumed),
-          static_cast<size_t>(in_count - consumed),
-          reinterpret_cast<unsigned char*>(out_buf_.get()),
-          static_cast<size_t>(out_buf_size_));
-      if (ret.code != Result::Code::ok) {
-        if (ret.code == Result::Code::need_dict) {
-          throw std::runtime_error("Preset dictionary is needed");
-        }
-        if (ret.code == Result::Code::stream_end) {
-          break;
-        }
-        throw std::logic_error("Unexpected result from zlib");
+  if (gptr() < egptr()) {
+    return traits_type::to_int_type(*gptr());
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (consuming_) {
+    // We are done with the current buffer, so the producer can have it back.
+    released_count_++;
+    consuming_ = false;
+    condition_.notify_all();
+  }
+  condition_.wait(lock, [this] {
+    return published_count_ > released_count_ || producer_finished_;
+  });
+  if (published_count_ == released_count_) {
+    if (producer_exception_ != nullptr) {
+      std::rethrow_exception(producer_exception_);
+    }
+    return traits_type::eof();
+  }
+  consuming_ = true;
+  const size_t ring_idx = released_count_ % ring_size_;
+  char* buffer = out_bufs_[ring_idx].get();
+  setg(buffer, buffer, buffer + out_counts_[ring_idx]);
+  return traits_type::to_int_type(*gptr());
+}
+
+void ZStringBuf::Produce() {
+  try {
+    RefillInput();
+    if (BGZFMemberSize(in_buf_.get(), in_end_) > 0) {
+      ProduceBGZF();
+    } else {
+      ProduceGzip();
+    }
+  } catch (...) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    producer_exception_ = std::current_exception();
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    producer_finished_ = true;
+  }
+  condition_.notify_all();
+}
+
+bool ZStringBuf::RefillInput() {
+  std::memmove(in_buf_.get(), in_buf_.get() + in_begin_, in_end_ - in_begin_);
+  in_end_ -= in_begin_;
+  in_begin_ = 0;
+  bool read_any = false;
+  while (in_end_ < in_buf_size_) {
+    const auto read_count = in_.sgetn(
+        in_buf_.get() + in_end_, static_cast<std::streamsize>(in_buf_size_ - in_end_));
+    if (read_count <= 0) {
+      break;
+    }
+    in_end_ += static_cast<size_t>(read_count);
+    read_any = true;
+  }
+  return read_any;
+}
+
+char* ZStringBuf::AcquireBuffer() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  condition_.wait(lock, [this] {
+    return published_count_ - released_count_ < ring_size_ || stop_;
+  });
+  return stop_ ? nullptr : out_bufs_[published_count_ % ring_size_].get();
+}
+
+void ZStringBuf::PublishBuffer(size_t count) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    out_counts_[published_count_ % ring_size_] = count;
+    published_count_++;
+  }
+  condition_.notify_all();
+}
+
+void ZStringBuf::ProduceGzip() {
+  ZStream inflate;
+  char* out = AcquireBuffer();
+  size_t out_count = 0;
+  // Are we part way through a member?
+  bool in_member = in_end_ > 0;
+  while (out != nullptr && in_member) {
+    if (in_begin_ == in_end_ && !RefillInput()) {
+      throw std::runtime_error("Unexpected end of gzip data");
+    }
+    const auto ret = inflate.Inflate(
+        Flush::no, reinterpret_cast<unsigned char*>(in_buf_.get() + in_begin_),
+        in_end_ - in_begin_, reinterpret_cast<unsigned char*>(out + out_count),
+        out_buf_size_ - out_count);
+    in_begin_ += ret.in_count;
+    out_count += ret.out_count;
+    if (out_count == out_buf_size_) {
+      PublishBuffer(out_count);
+      out = AcquireBuffer();
+      out_count = 0;
+    }
+    if (ret.code == Result::Code::need_dict) {
+      throw std::runtime_error("Preset dictionary is needed");
+    }
+    if (ret.code == Result::Code::stream_end) {
+      // Another member may follow. Anything else after the end is ignored, as gzip
+      // does.
+      if (in_end_ - in_begin_ < 2) {
+        RefillInput();
+      }
+      in_member = StartsGzipMember(in_buf_.get() + in_begin_, in_end_ - in_begin_);
+      if (in_member) {
+        inflate.Reset();
+      }
+    }
+  }
+  if (out != nullptr && out_count > 0) {
+    PublishBuffer(out_count);
+  }
+}
+
+void ZStringBuf::ProduceBGZF() {
+  // A member in in_buf_, along with where its output goes.
+  struct Member {
+    size_t in_offset;
+    size_t in_size;
+    size_t out_offset;
+    size_t out_size;
+  };
+  std::vector<Member> members;
+  // We don't use the shared pools: the reader of this stream may be a worker of one,
+  // and if all of its workers are waiting on us for output then nothing would be left
+  // to run our inflation.
+  std::unique_ptr<ThreadPool> pool;
+  if (thread_count_ > 1) {
+    pool = std::make_unique<ThreadPool>(thread_count_);
+  }
+  while (true) {
+    // Gather as many whole members as fit in the input and output buffers.
+    members.clear();
+    size_t in_offset = in_begin_;
+    size_t out_offset = 0;
+    while (in_offset < in_end_) {
+      const size_t in_size =
+          BGZFMemberSize(in_buf_.get() + in_offset, in_end_ - in_offset);
+      if (in_size == 0 && in_end_ - in_offset < bgzf_header_size) {
+        break;  // We need more input to see the header.
+      }
+      if (in_size < bgzf_header_size + gzip_footer_size) {
+        throw std::runtime_error("Malformed BGZF member");
+      }
+      if (in_offset + in_size > in_end_) {
+        break;  // We need more input for the whole member.
+      }
+      // The uncompressed size is at the very end of the member.
+      const auto* member_end =
+          reinterpret_cast<const unsigned char*>(in_buf_.get() + in_offset + in_size);
+      const size_t out_size = ReadLittleEndian(member_end - 4, 4);
+      if (out_size > bgzf_max_member_size_) {
+        throw std::runtime_error("Malformed BGZF member");
+      }
+      if (out_offset + out_size > out_buf_size_) {
+        break;
       }
-      consumed += ret.in_count;
-
-      // Stores the decompressed data
-      std::streamsize produced = 0;
-      while (produced < static_cast<std::streamsize>(ret.out_count)) {
-        const auto prod = sputn(out_buf_.get() + produced, ret.out_count - produced);
-        if (prod < 1) break;
-        produced += prod;
+      members.push_back({in_offset, in_size, out_offset, out_size});
+      in_offset += in_size;
+      out_offset += out_size;
+    }
+    if (members.empty()) {
+      if (RefillInput()) {
+        continue;
+      }
+      if (in_begin_ < in_end_) {
+        throw std::runtime_error("Unexpected end of BGZF data");
+      }
+      return;
+    }
+    char* out = AcquireBuffer();
+    if (out == nullptr) {
+      return;
+    }
+    auto inflate_member = [this, &members, out](size_t member_idx) {
+      const auto& member = members[member_idx];
+      ZStream inflate;
+      const auto ret = inflate.Inflate(
+          Flush::finish,
+          reinterpret_cast<unsigned char*>(in_buf_.get() + member.in_offset),
+          member.in_size, reinterpret_cast<unsigned char*>(out + member.out_offset),
+          member.out_size);
+      if (ret.code != Result::Code::stream_end || ret.out_count != member.out_size) {
+        throw std::runtime_error("Malformed BGZF member");
+      }
+    };
+    if (thread_count_ == 1) {
+      for (size_t member_idx = 0; member_idx < members.size(); member_idx++) {
+        inflate_member(member_idx);
       }
+    } else {
+      pool->ParallelFor(
+          members.size(),
+          [&members](size_t member_idx) {
+            return static_cast<double>(members[member_idx].in_size);
+          },
+          [&inflate_member](size_t, size_t begin, size_t end) {
+            for (size_t member_idx = begin; member_idx < end; member_idx++) {
+              inflate_member(member_idx);
+            }
+          });
+    }
+    in_begin_ = in_offset;
+    // The empty member marking the end of a BGZF file gives us nothing to publish.
+    if (out_offset > 0) {
+      PublishBuffer(out_offset);
     }
-    if (consumed < 1) break;
   }
 }
 
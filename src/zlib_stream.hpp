@@ -8,10 +8,14 @@
 #include <zlib.h>
 
 #include <atomic>
+#include <condition_variable>
+#include <exception>
 #include <memory>
-#include <sstream>
+#include <mutex>
 #include <stdexcept>
 #include <streambuf>
+#include <thread>
+#include <vector>
 
 namespace zlib {
 
@@ -76,6 +80,9 @@ class ZStream {
   // will be performed automatically by the destructor, with exceptions
   void Close();
 
+  // Get ready to inflate a new gzip member.
+  void Reset();
+
   // Performs a round of decompression. The result object contains
   // status code, count of consumed bytes and count of produced bytes
   Result Inflate(Flush mode, const unsigned char* in, size_t in_size,
@@ -86,32 +93,76 @@ class ZStream {
   std::atomic_flag closed_ = ATOMIC_FLAG_INIT;
 };
 
-// IO streams interface for zlib. Performs buffering on both compressed and
-// decompressed sides. Takes input from a std::istream.
-class ZStringBuf : public std::stringbuf {
-  using base = std::stringbuf;
-
+// IO streams interface for zlib, reading gzip data from a std::istream.
+//
+// A background thread reads the compressed input and inflates it into a ring of
+// large buffers, which the reader of this streambuf consumes in turn, so that
+// decompression overlaps with whatever is done with the output. Concatenated gzip
+// members are read one after another. BGZF input (as written by bgzip) records the
+// compressed size of each member in its header, so we can find the members without
+// inflating them. We inflate batches of BGZF members in parallel on a pool of
+// thread_count threads belonging to this streambuf.
+//
+// Errors are thrown from underflow. An istream turns these into badbit, and only
+// rethrows them if badbit is set in its exceptions mask.
+class ZStringBuf : public std::streambuf {
  public:
-  // Takes an input stream for compressed side, and buffer sizes for the
-  // compressed and decompressed sides.
-  ZStringBuf(const std::istream& in, size_t in_buf_size, size_t out_buf_size);
+  // Takes an input stream for compressed side, and buffer sizes for the compressed
+  // and decompressed sides.
+  ZStringBuf(const std::istream& in, size_t in_buf_size = default_buf_size_,
+             size_t out_buf_size = default_buf_size_, size_t thread_count = 1);
 
   virtual ~ZStringBuf() override;
 
+  static inline const size_t default_buf_size_ = 1 << 20;
+  // The number of decompressed buffers that can be in flight.
+  static inline const size_t ring_size_ = 4;
+  // BGZF members hold at most this many bytes, before and after compression.
+  static inline const size_t bgzf_max_member_size_ = 1 << 16;
+
  protected:
   virtual int_type underflow() override;
-  virtual int_type uflow() override;
-  virtual std::streamsize xsgetn(char_type* s, std::streamsize count) override;
 
  private:
-  void ensure_avail(std::streamsize count);
+  // The body of the producer thread.
+  void Produce();
+  // Inflate a stream of gzip members on this thread.
+  void ProduceGzip();
+  // Inflate a stream of BGZF members in batches.
+  void ProduceBGZF();
+  // Top up in_buf_ from in_, after moving the unread bytes to the front. Returns false
+  // if there is nothing left to read.
+  bool RefillInput();
+  // Wait for a free buffer in the ring, returning nullptr if we are asked to stop.
+  char* AcquireBuffer();
+  // Hand the acquired buffer, holding count bytes, to the consumer.
+  void PublishBuffer(size_t count);
 
   std::streambuf& in_;
   std::unique_ptr<char[]> in_buf_;
-  const std::streamsize in_buf_size_;
-  std::unique_ptr<char[]> out_buf_;
-  const std::streamsize out_buf_size_;
-  ZStream inflate_;
+  const size_t in_buf_size_;
+  // The bytes of in_buf_ in [in_begin_, in_end_) are read but not yet inflated.
+  size_t in_begin_ = 0;
+  size_t in_end_ = 0;
+  const size_t out_buf_size_;
+  const size_t thread_count_;
+  std::vector<std::unique_ptr<char[]>> out_bufs_;
+  std::vector<size_t> out_counts_;
+
+  // State shared with the producer thread, guarded by mutex_. Buffer i of the sequence
+  // lives in out_bufs_[i % ring_size_].
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  // The number of buffers handed over by the producer.
+  size_t published_count_ = 0;
+  // The number of buffers that the consumer has finished with.
+  size_t released_count_ = 0;
+  // Is the consumer reading from buffer released_count_?
+  bool consuming_ = false;
+  bool producer_finished_ = false;
+  bool stop_ = false;
+  std::exception_ptr producer_exception_;
+  std::thread producer_;
 };
 
 }  // namespace zlib
@@ -56,6 +56,11 @@ def sampling_and_indexers_demo():
     # Showing off tree sampling.
     inst.process_loaded_trees()
     inst.train_expectation_maximization(0.0001, 1)
+    # Sampling indexer representations doesn't make any trees until we load them.
+    representations = inst.sample_indexer_representations(3)
+    assert representations.shape == (3, len(inst.taxon_names()) - 1)
+    inst.load_trees_from_indexer_representations(representations)
+    assert inst.tree_count() == 3
     # Note that this puts the trees into the unrooted_instance object, replacing the
     # trees loaded from the file.
     inst.sample_trees(2)